@@ -0,0 +1,61 @@
+#include <sys/time.h>
+#include <freertos/FreeRTOS.h>
+#include "alarm_table.h"
+
+/* Filled by the publish task, read and emptied by the Zigbee task. Not kept across reboots,
+ * the active alarms are raised again from the measurements */
+static portMUX_TYPE s_alarm_mux = portMUX_INITIALIZER_UNLOCKED;
+static alarm_entry_t s_entries[ALARM_TABLE_SIZE];
+static uint16_t s_first;
+static uint16_t s_count;
+
+void alarm_table_add(uint8_t code, uint16_t cluster_id)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	alarm_entry_t entry = {
+			.code = code,
+			.cluster_id = cluster_id,
+			.timestamp = (uint32_t) tv.tv_sec,
+	};
+
+	portENTER_CRITICAL(&s_alarm_mux);
+	if (s_count == ALARM_TABLE_SIZE)
+	{
+		s_first = (s_first + 1) % ALARM_TABLE_SIZE;
+		s_count--;
+	}
+	s_entries[(s_first + s_count) % ALARM_TABLE_SIZE] = entry;
+	s_count++;
+	portEXIT_CRITICAL(&s_alarm_mux);
+}
+
+bool alarm_table_pop(alarm_entry_t *entry)
+{
+	portENTER_CRITICAL(&s_alarm_mux);
+	bool found = s_count > 0;
+	if (found)
+	{
+		*entry = s_entries[s_first];
+		s_first = (s_first + 1) % ALARM_TABLE_SIZE;
+		s_count--;
+	}
+	portEXIT_CRITICAL(&s_alarm_mux);
+	return found;
+}
+
+void alarm_table_clear(void)
+{
+	portENTER_CRITICAL(&s_alarm_mux);
+	s_first = 0;
+	s_count = 0;
+	portEXIT_CRITICAL(&s_alarm_mux);
+}
+
+uint16_t alarm_table_count(void)
+{
+	portENTER_CRITICAL(&s_alarm_mux);
+	uint16_t count = s_count;
+	portEXIT_CRITICAL(&s_alarm_mux);
+	return count;
+}
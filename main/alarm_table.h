@@ -0,0 +1,47 @@
+#ifndef DEPTH_SENSOR_ALARM_TABLE_H
+#define DEPTH_SENSOR_ALARM_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ALARM_TABLE_SIZE    8   /* the oldest entry is dropped when a new alarm does not fit */
+
+/* One raised alarm, as the Alarms cluster returns it in the Get Alarm response */
+typedef struct
+{
+	uint8_t code;
+	uint16_t cluster_id;
+	uint32_t timestamp;         /* RTC time of the alarm (second) */
+} alarm_entry_t;
+
+/**
+ * @brief Log a raised alarm
+ */
+void alarm_table_add(uint8_t code, uint16_t cluster_id);
+
+/**
+ * @brief Take the oldest entry out of the log, for Get Alarm
+ *
+ * @return false when the log is empty
+ */
+bool alarm_table_pop(alarm_entry_t *entry);
+
+/**
+ * @brief Empty the log, for Reset Alarm Log
+ */
+void alarm_table_clear(void);
+
+/**
+ * @brief Entries in the log, the AlarmCount attribute
+ */
+uint16_t alarm_table_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_ALARM_TABLE_H
@@ -0,0 +1,137 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include "app_tasks.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#if CONFIG_DEPTH_SENSOR_STATIC_ALLOCATION
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_sys.h"
+#endif
+
+typedef struct
+{
+	const char *name;
+	uint32_t stack_size;
+	UBaseType_t priority;
+	bool heap_guard;            /* the task is not expected to allocate after init */
+#if CONFIG_DEPTH_SENSOR_STATIC_ALLOCATION
+	StackType_t *stack;
+	StaticTask_t *tcb;
+#endif
+} app_task_config_t;
+
+#if CONFIG_DEPTH_SENSOR_STATIC_ALLOCATION
+static StackType_t s_zigbee_stack[APP_TASK_ZIGBEE_STACK];
+static StaticTask_t s_zigbee_tcb;
+static StackType_t s_ultrasonic_stack[APP_TASK_ULTRASONIC_STACK];
+static StaticTask_t s_ultrasonic_tcb;
+static StackType_t s_publish_stack[APP_TASK_PUBLISH_STACK];
+static StaticTask_t s_publish_tcb;
+static StackType_t s_identify_stack[APP_TASK_IDENTIFY_STACK];
+static StaticTask_t s_identify_tcb;
+static StackType_t s_trace_stack[APP_TASK_TRACE_STACK];
+static StaticTask_t s_trace_tcb;
+#define APP_TASK_BUFFERS(name) .stack = s_##name##_stack, .tcb = &s_##name##_tcb,
+#else
+#define APP_TASK_BUFFERS(name)
+#endif
+
+/* The Zigbee task runs the stack, which keeps allocating by design. So does the publish task,
+ * it carries the attribute updates, commands and NVS writes of the ultrasonic task */
+static const app_task_config_t s_task_config[APP_TASK_COUNT] = {
+		[APP_TASK_ZIGBEE] = {
+				.name = "Zigbee_main", .stack_size = APP_TASK_ZIGBEE_STACK, .priority = 5, .heap_guard = false,
+				APP_TASK_BUFFERS(zigbee)
+		},
+		[APP_TASK_ULTRASONIC] = {
+				.name = "ultrasonic_task", .stack_size = APP_TASK_ULTRASONIC_STACK, .priority = 5, .heap_guard = true,
+				APP_TASK_BUFFERS(ultrasonic)
+		},
+		[APP_TASK_PUBLISH] = {
+				.name = "zb_publish", .stack_size = APP_TASK_PUBLISH_STACK, .priority = 6, .heap_guard = false,
+				APP_TASK_BUFFERS(publish)
+		},
+		[APP_TASK_IDENTIFY] = {
+				.name = "Identify", .stack_size = APP_TASK_IDENTIFY_STACK, .priority = 5, .heap_guard = true,
+				APP_TASK_BUFFERS(identify)
+		},
+		/* Lowest priority, formatting log output must never delay the sensor or the stack */
+		[APP_TASK_TRACE] = {
+				.name = "trace_drain", .stack_size = APP_TASK_TRACE_STACK, .priority = 1, .heap_guard = true,
+				APP_TASK_BUFFERS(trace)
+		},
+		/* Same for the console stream, a host that stops reading must not stall the measurements.
+		 * Console only, which the zero-heap build leaves out, so it has no static buffers */
+		[APP_TASK_DIAG_STREAM] = {
+				.name = "diag_stream", .stack_size = APP_TASK_DIAG_STREAM_STACK, .priority = 1, .heap_guard = true,
+		},
+};
+
+static TaskHandle_t s_task_handle[APP_TASK_COUNT];
+static bool s_init_done = false;
+
+static const char *TAG = "APP_TASKS";
+
+esp_err_t app_task_create(app_task_id_t id, TaskFunction_t fn, void *arg)
+{
+	if (id >= APP_TASK_COUNT || s_task_handle[id])
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	const app_task_config_t *config = &s_task_config[id];
+#if CONFIG_DEPTH_SENSOR_STATIC_ALLOCATION
+	s_task_handle[id] = xTaskCreateStatic(fn, config->name, config->stack_size, arg, config->priority,
+										  config->stack, config->tcb);
+#else
+	xTaskCreate(fn, config->name, config->stack_size, arg, config->priority, &s_task_handle[id]);
+#endif
+	return s_task_handle[id] ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+TaskHandle_t app_task_handle(app_task_id_t id)
+{
+	return id < APP_TASK_COUNT ? s_task_handle[id] : NULL;
+}
+
+void app_tasks_init_done(void)
+{
+	s_init_done = true;
+}
+
+void app_tasks_report(void)
+{
+	for (int i = 0; i < APP_TASK_COUNT; i++)
+	{
+		if (!s_task_handle[i])
+		{
+			continue;
+		}
+		/* ESP-IDF reports the high-water mark in bytes */
+		UBaseType_t free_bytes = uxTaskGetStackHighWaterMark(s_task_handle[i]);
+		ESP_LOGI(TAG, "%-16s stack %5lu B, peak use %5lu B", s_task_config[i].name,
+				 (unsigned long) s_task_config[i].stack_size,
+				 (unsigned long) (s_task_config[i].stack_size - free_bytes));
+	}
+}
+
+#if CONFIG_DEPTH_SENSOR_STATIC_ALLOCATION
+/* Called by the heap for every allocation (CONFIG_HEAP_USE_HOOKS) */
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+	if (!s_init_done || xPortInIsrContext())
+	{
+		return;
+	}
+	TaskHandle_t current = xTaskGetCurrentTaskHandle();
+	for (int i = 0; i < APP_TASK_COUNT; i++)
+	{
+		if (s_task_config[i].heap_guard && s_task_handle[i] == current)
+		{
+			esp_rom_printf("%s: %u B heap allocation from %s after init\n", TAG, (unsigned) size,
+						   s_task_config[i].name);
+			abort();
+		}
+	}
+}
+#endif
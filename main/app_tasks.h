@@ -0,0 +1,75 @@
+#ifndef DEPTH_SENSOR_APP_TASKS_H
+#define DEPTH_SENSOR_APP_TASKS_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Task stack sizes (bytes): the peak use of every scenario in the zero-heap simulator build
+ * (depth_sensor_sim_static -v summary) plus a ~25% margin, rounded up to 256 B. Host frames are
+ * larger than RISC-V ones, check app_tasks_report() on the device after changes. Tasks that
+ * spend their time in drivers the simulator stubs get twice the FreeRTOS minimum instead, the
+ * publish task gets 3 KB on top for the NVS and ZCL code behind the stubbed calls.
+ * In the static build, which has no console and so no stream task, they are 16.8 KB of the
+ * static RAM budget. */
+#define APP_TASK_ZIGBEE_STACK       4864                            /* 3720 B measured, scene and alarm commands */
+#define APP_TASK_ULTRASONIC_STACK   3328                            /* 2552 B measured */
+#define APP_TASK_PUBLISH_STACK      3584                            /* 600 B measured, NVS and ZCL stubbed */
+#define APP_TASK_IDENTIFY_STACK     (configMINIMAL_STACK_SIZE * 2)  /* 128 B measured, LED strip driver */
+#define APP_TASK_TRACE_STACK        3840                            /* 3032 B measured */
+#define APP_TASK_DIAG_STREAM_STACK  (configMINIMAL_STACK_SIZE * 2)  /* 200 B measured, USB-Serial-JTAG driver */
+
+#define APP_TASKS_REPORT_INTERVAL   (60 * 60)   /* Stack usage report interval (second) */
+
+typedef enum
+{
+	APP_TASK_ZIGBEE,
+	APP_TASK_ULTRASONIC,
+	APP_TASK_PUBLISH,
+	APP_TASK_IDENTIFY,
+	APP_TASK_TRACE,
+	APP_TASK_DIAG_STREAM,
+	APP_TASK_COUNT,
+} app_task_id_t;
+
+/**
+ * @brief Create one of the application tasks
+ *
+ * Stack size and priority come from the task table. With CONFIG_DEPTH_SENSOR_STATIC_ALLOCATION
+ * the stack and control block are static buffers, otherwise they are taken from the heap.
+ *
+ * @param id  Task to create, each one can be created only once
+ * @param fn  Task function
+ * @param arg Task argument
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the task already exists, ESP_ERR_NO_MEM otherwise
+ */
+esp_err_t app_task_create(app_task_id_t id, TaskFunction_t fn, void *arg);
+
+/**
+ * @brief Handle of a created application task, NULL if it was not created
+ */
+TaskHandle_t app_task_handle(app_task_id_t id);
+
+/**
+ * @brief Mark the end of initialization
+ *
+ * With CONFIG_DEPTH_SENSOR_STATIC_ALLOCATION any later heap allocation from an
+ * application task aborts.
+ */
+void app_tasks_init_done(void);
+
+/**
+ * @brief Log stack usage of all application tasks
+ */
+void app_tasks_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_APP_TASKS_H
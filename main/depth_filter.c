@@ -0,0 +1,28 @@
+#include <string.h>
+#include "depth_filter.h"
+
+void depth_filter_reset(depth_filter_t *filter)
+{
+	memset(filter, 0, sizeof(*filter));
+}
+
+float depth_filter_average(const depth_filter_t *filter)
+{
+	float sum = 0.0f;
+	for (int i = 0; i < filter->count; i++)
+	{
+		sum += filter->values[i];
+	}
+	return sum / filter->count;
+}
+
+float depth_filter_push(depth_filter_t *filter, float value)
+{
+	filter->values[filter->index] = value;
+	filter->index = (filter->index + 1) % DEPTH_FILTER_WINDOW;
+	if (filter->count < DEPTH_FILTER_WINDOW)
+	{
+		filter->count++;
+	}
+	return depth_filter_average(filter);
+}
@@ -0,0 +1,51 @@
+#ifndef DEPTH_SENSOR_DEPTH_FILTER_H
+#define DEPTH_SENSOR_DEPTH_FILTER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEPTH_FILTER_WINDOW 10
+
+/**
+ * Moving average over the last DEPTH_FILTER_WINDOW distance samples.
+ * Plain data so it can be checkpointed and restored as a blob.
+ */
+typedef struct
+{
+	float values[DEPTH_FILTER_WINDOW];
+	uint8_t index;
+	uint8_t count;
+} depth_filter_t;
+
+/**
+ * @brief Drop all samples from the window
+ *
+ * @param filter Filter state
+ */
+void depth_filter_reset(depth_filter_t *filter);
+
+/**
+ * @brief Add a sample to the window
+ *
+ * @param filter Filter state
+ * @param value  New sample (cm)
+ *
+ * @return Average over the window including the new sample
+ */
+float depth_filter_push(depth_filter_t *filter, float value);
+
+/**
+ * @brief Average over the current window
+ *
+ * @param filter Filter state, must hold at least one sample
+ */
+float depth_filter_average(const depth_filter_t *filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_DEPTH_FILTER_H
@@ -1,15 +1,33 @@
 #include <sys/cdefs.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <ultrasonic.h>
 #include <esp_err.h>
 #include "depth_sensor.h"
+#include "diag_console.h"
+#include "diag_stream.h"
+#include "echo_tracker.h"
+#include "join_policy.h"
+#include "alarm_table.h"
+#include "app_tasks.h"
+#include "esp_timer.h"
 #include "esp_check.h"
 #include "esp_log.h"
+#include "esp_random.h"
+#include "light_scenes.h"
 #include "nvs_flash.h"
+#include "sensor_bus.h"
+#include "tank_profile.h"
+#include "led_rules.h"
+#include "pump_control.h"
+#include "trend_detector.h"
+#include "trace.h"
 #include "temp_sensor_driver.h"
+#include "warm_start.h"
+#include "sdkconfig.h"
 #include "ha/esp_zigbee_ha_standard.h"
 
 //TODO: https://github.com/Koenkk/zigbee2mqtt/issues/18321
@@ -17,8 +35,6 @@
 #define TRIGGER_GPIO 7
 #define ECHO_GPIO 14
 
-#define MAX_VALUES 10
-
 static ultrasonic_sensor_t sensor = {
 		.trigger_pin = TRIGGER_GPIO,
 		.echo_pin = ECHO_GPIO
@@ -26,68 +42,712 @@ static ultrasonic_sensor_t sensor = {
 
 static const char *TAG = "ESP_ZB_DIST_SENSOR";
 
+/* Sensors run from boot; values are cached here until the Zigbee stack is up */
+static portMUX_TYPE s_cache_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool s_zb_ready = false;
+static float s_cached_distance;
+static bool s_cached_distance_valid = false;
+static int16_t s_cached_temperature;
+static bool s_cached_temperature_valid = false;
+static int64_t s_first_valid_reading_us = -1;
+
+/* Filter window and last published values, restored from NVS at boot */
+static warm_start_state_t s_warm_state;
+static bool s_warm_state_restored = false;
+
+/* Expected echo window from the last accepted echo to the filtered level */
+static echo_tracker_t s_echo_tracker;
+
+/* Work the ultrasonic task leaves for the publish task, under s_cache_mux. The Zigbee stack
+ * and NVS allocate, which the ultrasonic task must not do in the zero-heap build */
+#define PUBLISH_DISTANCE    (1 << 0)
+#define PUBLISH_TEMPERATURE (1 << 1)
+#define PUBLISH_PUMP        (1 << 2)
+#define PUBLISH_ALARMS      (1 << 3)
+#define PUBLISH_CHECKPOINT  (1 << 4)
+static uint32_t s_publish_pending;
+static pump_command_t s_pending_pump;
+static float s_pending_pump_distance;
+static int64_t s_pending_pump_timestamp_us;
+static uint8_t s_pending_alarms;
+static uint8_t s_pending_raised;
+static warm_start_state_t s_pending_checkpoint;
+
+/* Alarm bits last written to the tank cluster, under the Zigbee lock */
+static uint8_t s_published_alarms;
+
+/* Measurement counters, filter and tracker for the console, written by the ultrasonic task
+ * under s_diag_mux so a snapshot is never half updated */
+static portMUX_TYPE s_diag_mux = portMUX_INITIALIZER_UNLOCKED;
+static depth_sensor_diag_t s_diag = {
+		.interval_ms = ESP_DIST_SENSOR_UPDATE_INTERVAL * 1000,
+};
+
 static int16_t zb_temperature_to_s16(float temp)
 {
 	return (int16_t) (temp * 100);
 }
 
-float calculate_average(float values[], int count)
+static void zb_update_distance(float distance)
+{
+	esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+								 ESP_ZB_ZCL_CLUSTER_ID_ANALOG_OUTPUT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+								 ESP_ZB_ZCL_ATTR_ANALOG_OUTPUT_PRESENT_VALUE_ID, &distance, false);
+
+	float volume;
+	uint8_t percent;
+	if (tank_profile_evaluate(distance, &volume, &percent))
+	{
+		esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+									 ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+									 ESP_ZB_ZCL_ATTR_TANK_VOLUME_ID, &volume, false);
+		esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+									 ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+									 ESP_ZB_ZCL_ATTR_TANK_PERCENT_FULL_ID, &percent, false);
+	}
+}
+
+static void zb_update_temperature(int16_t measured_value)
+{
+	esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+								 ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+								 ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID, &measured_value, false);
+}
+
+/* Through the binding table, so the relays switch without the coordinator. Zigbee lock held */
+static void zb_send_pump_command(pump_command_t command)
+{
+	esp_zb_zcl_on_off_cmd_t cmd_req = {
+			.zcl_basic_cmd.src_endpoint = HA_ESP_SENSOR_ENDPOINT,
+			.address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT,
+			.on_off_cmd_id = command == PUMP_COMMAND_ON ? ESP_ZB_ZCL_CMD_ON_OFF_ON_ID : ESP_ZB_ZCL_CMD_ON_OFF_OFF_ID,
+	};
+	esp_zb_zcl_on_off_cmd_req(&cmd_req);
+}
+
+static void zb_update_alarm_count(void)
+{
+	uint16_t count = alarm_table_count();
+	esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+								 ESP_ZB_ZCL_CLUSTER_ID_ALARMS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+								 ALARMS_ATTR_ALARM_COUNT_ID, &count, false);
+}
+
+/* Alarm command of the Alarms cluster through the binding table, logged for Get Alarm. Zigbee lock held */
+static void zb_send_alarm(uint8_t alarm_code)
+{
+	uint8_t payload[3] = {alarm_code, ESP_ZB_ZCL_CLUSTER_ID_TANK & 0xff, ESP_ZB_ZCL_CLUSTER_ID_TANK >> 8};
+	esp_zb_zcl_custom_cluster_cmd_t cmd_req = {
+			.zcl_basic_cmd.src_endpoint = HA_ESP_SENSOR_ENDPOINT,
+			.address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT,
+			.profile_id = ESP_ZB_AF_HA_PROFILE_ID,
+			.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_ALARMS,
+			.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI,
+			.custom_cmd_id = ESP_ZB_ZCL_CMD_ALARMS_ALARM_ID,
+			/* raw payload: alarm code, cluster ID */
+			.data = {.type = ESP_ZB_ZCL_ATTR_TYPE_SET, .size = sizeof(payload), .value = payload},
+	};
+	esp_zb_zcl_custom_cluster_cmd_req(&cmd_req);
+	alarm_table_add(alarm_code, ESP_ZB_ZCL_CLUSTER_ID_TANK);
+}
+
+/* Active alarms attribute and an Alarm command for every raised bit, Zigbee lock held */
+static void zb_update_alarms(uint8_t alarms, uint8_t raised)
+{
+	if (raised && !esp_zb_bdb_dev_joined())
+	{
+		/* nobody to send them to yet, zb_publish_kept_alarms() does once joined */
+		portENTER_CRITICAL(&s_cache_mux);
+		s_pending_raised |= raised;
+		portEXIT_CRITICAL(&s_cache_mux);
+		raised = 0;
+	}
+	if (!raised && alarms == s_published_alarms)
+	{
+		return;
+	}
+
+	esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+								 ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+								 ESP_ZB_ZCL_ATTR_TANK_ALARMS_ID, &alarms, false);
+	for (int i = 0; i < TREND_ALARM_COUNT; i++)
+	{
+		if (raised & (1 << i))
+		{
+			zb_send_alarm(TANK_ALARM_CODE_LEAK + i);
+		}
+	}
+	if (raised)
+	{
+		zb_update_alarm_count();
+	}
+	s_published_alarms = alarms;
+}
+
+/* Zigbee task, lock held. Alarms raised before the stack was up or joined were kept */
+static void zb_publish_kept_alarms(void)
+{
+	portENTER_CRITICAL(&s_cache_mux);
+	uint8_t alarms = s_pending_alarms;
+	uint8_t raised = s_pending_raised;
+	s_pending_raised = 0;
+	portEXIT_CRITICAL(&s_cache_mux);
+	zb_update_alarms(alarms, raised);
+}
+
+/* Called from the Zigbee task once the stack is initialized, the lock is already held there */
+static void zb_publish_cached_state(void)
+{
+	portENTER_CRITICAL(&s_cache_mux);
+	s_zb_ready = true;
+	bool distance_valid = s_cached_distance_valid;
+	float distance = s_cached_distance;
+	bool temperature_valid = s_cached_temperature_valid;
+	int16_t temperature = s_cached_temperature;
+	portEXIT_CRITICAL(&s_cache_mux);
+
+	if (distance_valid)
+	{
+		zb_update_distance(distance);
+	}
+	if (temperature_valid)
+	{
+		zb_update_temperature(temperature);
+	}
+	zb_publish_kept_alarms();
+	/* Commands decided before the stack was up were not sent */
+	pump_command_t pump = pump_control_state();
+	if (pump != PUMP_COMMAND_NONE)
+	{
+		zb_send_pump_command(pump);
+	}
+	ESP_LOGI(TAG, "Zigbee stack up after %lld ms, published cached state (distance %s, temperature %s)",
+			 esp_timer_get_time() / 1000, distance_valid ? "valid" : "pending",
+			 temperature_valid ? "valid" : "pending");
+}
+
+static void zb_distance_subscriber(const sensor_sample_t *sample, void *ctx)
+{
+	portENTER_CRITICAL(&s_cache_mux);
+	s_cached_distance = sample->distance.filtered;
+	s_cached_distance_valid = true;
+	if (s_zb_ready)
+	{
+		s_publish_pending |= PUBLISH_DISTANCE;
+	}
+	portEXIT_CRITICAL(&s_cache_mux);
+}
+
+/* Runs in the ultrasonic task, ahead of the other consumers and wakes the publish task right
+ * away, so nothing delays the command */
+static void pump_subscriber(const sensor_sample_t *sample, void *ctx)
+{
+	pump_command_t command = pump_control_update(sample->distance.filtered, sample->timestamp_us);
+	if (command == PUMP_COMMAND_NONE)
+	{
+		return;
+	}
+
+	portENTER_CRITICAL(&s_cache_mux);
+	bool zb_ready = s_zb_ready;
+	if (zb_ready)
+	{
+		s_pending_pump = command;
+		s_pending_pump_distance = sample->distance.filtered;
+		s_pending_pump_timestamp_us = sample->timestamp_us;
+		s_publish_pending |= PUBLISH_PUMP;
+	}
+	portEXIT_CRITICAL(&s_cache_mux);
+	if (!zb_ready)
+	{
+		trace_record(TRACE_PUMP_DEFERRED, command);
+		return;
+	}
+	xTaskNotifyGive(app_task_handle(APP_TASK_PUBLISH));
+}
+
+/* Publish task context, Zigbee lock held */
+static void zb_publish_pump_command(pump_command_t command, float distance, int64_t timestamp_us)
+{
+	zb_send_pump_command(command);
+
+	int64_t latency_us = esp_timer_get_time() - timestamp_us;
+	portENTER_CRITICAL(&s_diag_mux);
+	s_diag.pump_commands++;
+	if (latency_us > s_diag.pump_latency_max_us)
+	{
+		s_diag.pump_latency_max_us = latency_us;
+	}
+	int64_t latency_max_us = s_diag.pump_latency_max_us;
+	portEXIT_CRITICAL(&s_diag_mux);
+	/* formatted by the trace drain, not on this task; the command count is in the console stats */
+	trace_record(TRACE_PUMP_COMMAND, command, trace_float(distance), (uint32_t) latency_us,
+				 (uint32_t) latency_max_us);
+}
+
+/* Runs in the ultrasonic task, the detector keeps minute averages of the unfiltered distance */
+static void trend_subscriber(const sensor_sample_t *sample, void *ctx)
+{
+	uint8_t raised = trend_detector_update(sample->distance.raw, sample->timestamp_us);
+	uint8_t alarms = trend_detector_alarms();
+
+	/* Raised alarms are kept until the stack is up and joined, see zb_publish_kept_alarms() */
+	portENTER_CRITICAL(&s_cache_mux);
+	s_pending_alarms = alarms;
+	s_pending_raised |= raised;
+	if (s_zb_ready)
+	{
+		s_publish_pending |= PUBLISH_ALARMS;
+	}
+	portEXIT_CRITICAL(&s_cache_mux);
+}
+
+/* Zigbee task context, a write changes one field of the trend detector sensitivity */
+static void zb_trend_config_handler(const esp_zb_zcl_attribute_t *attribute)
+{
+	trend_config_t config;
+	trend_detector_get_config(&config);
+	uint16_t value = *(uint16_t *) attribute->data.value;
+	switch (attribute->id)
+	{
+		case ESP_ZB_ZCL_ATTR_TANK_LEAK_RATE_ID:
+			config.leak_rate = value;
+			break;
+		case ESP_ZB_ZCL_ATTR_TANK_DRAIN_RATE_ID:
+			config.drain_rate = value;
+			break;
+		default:
+			config.overflow_mark = value;
+			break;
+	}
+	esp_err_t err = trend_detector_set_config(&config);
+	if (err != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Alarm sensitivity not stored: %s", esp_err_to_name(err));
+	}
+}
+
+/* Zigbee task context, a write changes one field of the pump configuration */
+static void zb_pump_config_handler(const esp_zb_zcl_attribute_t *attribute)
+{
+	pump_config_t config;
+	pump_control_get_config(&config);
+	switch (attribute->id)
+	{
+		case ESP_ZB_ZCL_ATTR_TANK_PUMP_MODE_ID:
+			config.mode = *(uint8_t *) attribute->data.value;
+			break;
+		case ESP_ZB_ZCL_ATTR_TANK_PUMP_HIGH_MARK_ID:
+			config.high_mark = *(uint16_t *) attribute->data.value;
+			break;
+		default:
+			config.low_mark = *(uint16_t *) attribute->data.value;
+			break;
+	}
+	esp_err_t err = pump_control_set_config(&config);
+	if (err != ESP_OK)
+	{
+		/* The stack already stored the rejected value, put the active one back */
+		ESP_LOGW(TAG, "Pump configuration rejected: %s", esp_err_to_name(err));
+		pump_control_get_config(&config);
+		esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+									 ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+									 ESP_ZB_ZCL_ATTR_TANK_PUMP_MODE_ID, &config.mode, false);
+		esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+									 ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+									 ESP_ZB_ZCL_ATTR_TANK_PUMP_HIGH_MARK_ID, &config.high_mark, false);
+		esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+									 ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+									 ESP_ZB_ZCL_ATTR_TANK_PUMP_LOW_MARK_ID, &config.low_mark, false);
+	}
+}
+
+/* The attribute is created at the largest profile size, it holds the active one at its own length */
+static void zb_tank_profile_sync(void)
 {
-	float sum = 0.0;
-	for (int i = 0; i < count; i++)
+	uint8_t profile[TANK_PROFILE_WIRE_MAX_SIZE + 1];
+	tank_profile_encode(profile);
+	esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+								 ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+								 ESP_ZB_ZCL_ATTR_TANK_PROFILE_ID, profile, false);
+}
+
+/* Zigbee task context, a new profile takes effect on the attributes right away */
+static void zb_tank_profile_handler(const esp_zb_zcl_attribute_t *attribute)
+{
+	uint8_t *value = attribute->data.value;
+	esp_err_t err = value ? tank_profile_set(value + 1, value[0]) : ESP_ERR_INVALID_ARG;
+	if (err != ESP_OK)
+	{
+		/* The stack already stored the rejected value, put the active profile back */
+		ESP_LOGW(TAG, "Tank profile rejected: %s", esp_err_to_name(err));
+		zb_tank_profile_sync();
+		return;
+	}
+
+	portENTER_CRITICAL(&s_cache_mux);
+	bool distance_valid = s_cached_distance_valid;
+	float distance = s_cached_distance;
+	portEXIT_CRITICAL(&s_cache_mux);
+	if (distance_valid)
+	{
+		zb_update_distance(distance);
+	}
+}
+
+/* Zigbee task context, the rules are evaluated against the last samples right away */
+static void zb_led_rules_handler(const esp_zb_zcl_attribute_t *attribute)
+{
+	uint8_t *value = attribute->data.value;
+	esp_err_t err = value ? led_rules_set(value + 1, value[0]) : ESP_ERR_INVALID_ARG;
+	if (err != ESP_OK)
+	{
+		/* The stack already stored the rejected value, put the active rules back */
+		ESP_LOGW(TAG, "LED rules rejected: %s", esp_err_to_name(err));
+		uint8_t rules[LED_RULES_WIRE_SIZE + 1];
+		led_rules_encode(rules);
+		esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+									 ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+									 ESP_ZB_ZCL_ATTR_TANK_LED_RULES_ID, rules, false);
+	}
+}
+
+/* ZCL octet string of the trace level of each module */
+static void zb_trace_levels_encode(uint8_t *levels)
+{
+	levels[0] = TRACE_MODULE_COUNT;
+	for (int i = 0; i < TRACE_MODULE_COUNT; i++)
+	{
+		levels[i + 1] = trace_get_level(i);
+	}
+}
+
+/* Zigbee task context, levels apply right away and are not stored */
+static void zb_trace_levels_handler(const esp_zb_zcl_attribute_t *attribute)
+{
+	uint8_t *value = attribute->data.value;
+	bool valid = value && value[0] == TRACE_MODULE_COUNT;
+	for (int i = 0; valid && i < TRACE_MODULE_COUNT; i++)
+	{
+		valid = value[i + 1] <= ESP_LOG_VERBOSE;
+	}
+	if (!valid)
+	{
+		/* The stack already stored the rejected value, put the active levels back */
+		ESP_LOGW(TAG, "Trace levels rejected");
+		uint8_t levels[TRACE_MODULE_COUNT + 1];
+		zb_trace_levels_encode(levels);
+		esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+									 ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+									 ESP_ZB_ZCL_ATTR_TANK_TRACE_LEVELS_ID, levels, false);
+		return;
+	}
+	for (int i = 0; i < TRACE_MODULE_COUNT; i++)
+	{
+		trace_set_level(i, value[i + 1]);
+	}
+}
+
+void depth_sensor_publish_config(void)
+{
+	portENTER_CRITICAL(&s_cache_mux);
+	bool zb_ready = s_zb_ready;
+	portEXIT_CRITICAL(&s_cache_mux);
+	if (!zb_ready)
+	{
+		return;
+	}
+
+	pump_config_t pump;
+	pump_control_get_config(&pump);
+	trend_config_t trend;
+	trend_detector_get_config(&trend);
+	uint8_t levels[TRACE_MODULE_COUNT + 1];
+	zb_trace_levels_encode(levels);
+	const struct
+	{
+		uint16_t id;
+		void *value;
+	} attributes[] = {
+			{ESP_ZB_ZCL_ATTR_TANK_PUMP_MODE_ID,      &pump.mode},
+			{ESP_ZB_ZCL_ATTR_TANK_PUMP_HIGH_MARK_ID, &pump.high_mark},
+			{ESP_ZB_ZCL_ATTR_TANK_PUMP_LOW_MARK_ID,  &pump.low_mark},
+			{ESP_ZB_ZCL_ATTR_TANK_LEAK_RATE_ID,      &trend.leak_rate},
+			{ESP_ZB_ZCL_ATTR_TANK_DRAIN_RATE_ID,     &trend.drain_rate},
+			{ESP_ZB_ZCL_ATTR_TANK_OVERFLOW_MARK_ID,  &trend.overflow_mark},
+			{ESP_ZB_ZCL_ATTR_TANK_TRACE_LEVELS_ID,   levels},
+	};
+
+	esp_zb_lock_acquire(portMAX_DELAY);
+	for (size_t i = 0; i < sizeof(attributes) / sizeof(attributes[0]); i++)
+	{
+		esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
+									 ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+									 attributes[i].id, attributes[i].value, false);
+	}
+	esp_zb_lock_release();
+}
+
+static void zb_temperature_subscriber(const sensor_sample_t *sample, void *ctx)
+{
+	portENTER_CRITICAL(&s_cache_mux);
+	s_cached_temperature = zb_temperature_to_s16(sample->temperature.celsius);
+	s_cached_temperature_valid = true;
+	if (s_zb_ready)
+	{
+		s_publish_pending |= PUBLISH_TEMPERATURE;
+	}
+	portEXIT_CRITICAL(&s_cache_mux);
+}
+
+static void log_distance_subscriber(const sensor_sample_t *sample, void *ctx)
+{
+	trace_record(TRACE_DISTANCE, trace_float(sample->distance.raw), sample->distance.echo_us,
+				 trace_float(sample->distance.filtered));
+}
+
+/* Runs in the ultrasonic task, which owns the filter window inside s_warm_state. The publish
+ * task decides on and does the flash write from a copy */
+static void warm_start_subscriber(const sensor_sample_t *sample, void *ctx)
+{
+	portENTER_CRITICAL(&s_cache_mux);
+	s_warm_state.distance = sample->distance.filtered;
+	s_warm_state.temperature = s_cached_temperature;
+	s_warm_state.temperature_valid = s_cached_temperature_valid;
+	s_pending_checkpoint = s_warm_state;
+	s_publish_pending |= PUBLISH_CHECKPOINT;
+	portEXIT_CRITICAL(&s_cache_mux);
+}
+
+/* Ultrasonic task, once per measurement, hands what the subscribers left to the publish task */
+static void zb_publish_kick(void)
+{
+	portENTER_CRITICAL(&s_cache_mux);
+	bool pending = s_publish_pending != 0;
+	portEXIT_CRITICAL(&s_cache_mux);
+	if (pending)
 	{
-		sum += values[i];
+		xTaskNotifyGive(app_task_handle(APP_TASK_PUBLISH));
+	}
+}
+
+/* Attribute updates, bound commands, alarms and checkpoints of the ultrasonic task, the pump
+ * command first. Above the ultrasonic task, so it runs as soon as it is woken */
+_Noreturn static void zb_publish_task(void *pvParameters)
+{
+	while (true)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		portENTER_CRITICAL(&s_cache_mux);
+		uint32_t pending = s_publish_pending;
+		s_publish_pending = 0;
+		pump_command_t pump = s_pending_pump;
+		float pump_distance = s_pending_pump_distance;
+		int64_t pump_timestamp_us = s_pending_pump_timestamp_us;
+		float distance = s_cached_distance;
+		int16_t temperature = s_cached_temperature;
+		uint8_t alarms = s_pending_alarms;
+		uint8_t raised = s_pending_raised;
+		s_pending_raised = 0;
+		warm_start_state_t checkpoint = s_pending_checkpoint;
+		portEXIT_CRITICAL(&s_cache_mux);
+
+		if (pending & (PUBLISH_PUMP | PUBLISH_DISTANCE | PUBLISH_TEMPERATURE | PUBLISH_ALARMS))
+		{
+			esp_zb_lock_acquire(portMAX_DELAY);
+			if (pending & PUBLISH_PUMP)
+			{
+				zb_publish_pump_command(pump, pump_distance, pump_timestamp_us);
+			}
+			if (pending & PUBLISH_DISTANCE)
+			{
+				zb_update_distance(distance);
+			}
+			if (pending & PUBLISH_TEMPERATURE)
+			{
+				zb_update_temperature(temperature);
+			}
+			if (pending & PUBLISH_ALARMS)
+			{
+				zb_update_alarms(alarms, raised);
+			}
+			esp_zb_lock_release();
+		}
+		if (pending & PUBLISH_CHECKPOINT)
+		{
+			warm_start_checkpoint(&checkpoint);
+		}
+	}
+}
+
+/* Speed of sound from the latest temperature, read on demand through the bus */
+static float current_speed_of_sound(void)
+{
+	sensor_sample_t temperature;
+	if (sensor_bus_get(SENSOR_TOPIC_TEMPERATURE, ESP_TEMP_SENSOR_MAX_AGE * 1000000LL, &temperature) == ESP_OK)
+	{
+		return ultrasonic_speed_of_sound(temperature.temperature.celsius);
+	}
+	return ultrasonic_speed_of_sound(ESP_TEMP_SENSOR_FALLBACK_VALUE);
+}
+
+/* Ultrasonic task, after every measurement, returns the interval to the next one */
+static uint32_t diag_update(diag_stream_status_t status, uint32_t window_min_us, uint32_t window_max_us)
+{
+	portENTER_CRITICAL(&s_diag_mux);
+	s_diag.measurements++;
+	switch (status)
+	{
+		case DIAG_STREAM_SAMPLE:
+			s_diag.samples++;
+			break;
+		case DIAG_STREAM_WINDOW_MISS:
+		case DIAG_STREAM_TARGET_LOST:
+			s_diag.window_misses++;
+			break;
+		case DIAG_STREAM_PING_ERROR:
+			s_diag.ping_errors++;
+			break;
+		case DIAG_STREAM_ECHO_TIMEOUT:
+			s_diag.echo_timeouts++;
+			break;
+		case DIAG_STREAM_ECHO_EARLY:
+			s_diag.echo_early++;
+			break;
+		default:
+			s_diag.other_errors++;
+			break;
+	}
+	s_diag.window_min_us = window_min_us;
+	s_diag.window_max_us = window_max_us;
+	s_diag.tracker = s_echo_tracker;
+	s_diag.filter = s_warm_state.filter;
+	uint32_t interval_ms = s_diag.interval_ms;
+	portEXIT_CRITICAL(&s_diag_mux);
+	return interval_ms;
+}
+
+void depth_sensor_diag(depth_sensor_diag_t *diag)
+{
+	portENTER_CRITICAL(&s_diag_mux);
+	*diag = s_diag;
+	portEXIT_CRITICAL(&s_diag_mux);
+}
+
+esp_err_t depth_sensor_set_interval(uint32_t interval_ms)
+{
+	ESP_RETURN_ON_FALSE(interval_ms >= ESP_DIST_SENSOR_MIN_INTERVAL_MS && interval_ms <= ESP_DIST_SENSOR_MAX_INTERVAL_MS,
+						ESP_ERR_INVALID_ARG, TAG, "Interval out of range");
+	portENTER_CRITICAL(&s_diag_mux);
+	s_diag.interval_ms = interval_ms;
+	portEXIT_CRITICAL(&s_diag_mux);
+	/* Start the new interval right away */
+	depth_sensor_measure();
+	return ESP_OK;
+}
+
+void depth_sensor_measure(void)
+{
+	TaskHandle_t task = app_task_handle(APP_TASK_ULTRASONIC);
+	if (task)
+	{
+		xTaskNotifyGive(task);
 	}
-	return sum / count;
 }
 
 _Noreturn void ultrasonic_task(void *pvParameters)
 {
-	float values[MAX_VALUES] = {0.0};
-	int currentIndex = 0;
-	int count = 0;
+	depth_filter_t *filter = &s_warm_state.filter;
+	bool check_restored = s_warm_state_restored;
+	int64_t next_report_us = APP_TASKS_REPORT_INTERVAL * 1000000LL;
 
 	while (true)
 	{
-		int32_t distance;
-		esp_err_t res = ultrasonic_measure_cm(&sensor, ESP_DIST_SENSOR_MAX_VALUE, &distance);
-		if (res != ESP_OK)
+		float speed_of_sound = current_speed_of_sound();
+		uint32_t min_time_us;
+		uint32_t max_time_us;
+		echo_tracker_window(&s_echo_tracker, ESP_DIST_SENSOR_MAX_VALUE, 20000.0f / speed_of_sound,
+							&min_time_us, &max_time_us);
+		int64_t timestamp_us = esp_timer_get_time();
+		uint32_t echo_us = 0;
+		esp_err_t res = ultrasonic_measure_raw_window(&sensor, min_time_us, max_time_us, &echo_us);
+		diag_stream_sample_t frame = {
+				.timestamp_us = timestamp_us,
+				.status = DIAG_STREAM_SAMPLE,
+				.window_min_us = min_time_us,
+				.window_max_us = max_time_us,
+		};
+		if (s_echo_tracker.locked && (res == ESP_ERR_ULTRASONIC_ECHO_EARLY || res == ESP_ERR_ULTRASONIC_ECHO_TIMEOUT))
+		{
+			echo_tracker_miss(&s_echo_tracker);
+			frame.status = s_echo_tracker.locked ? DIAG_STREAM_WINDOW_MISS : DIAG_STREAM_TARGET_LOST;
+			trace_record(s_echo_tracker.locked ? TRACE_ECHO_MISSED : TRACE_TARGET_LOST, min_time_us, max_time_us);
+		} else if (res != ESP_OK)
 		{
-			printf("Error %d: ", res);
 			switch (res)
 			{
 				case ESP_ERR_ULTRASONIC_PING:
-					ESP_LOGW(TAG, "Cannot ping (device is in invalid state)\n");
+					frame.status = DIAG_STREAM_PING_ERROR;
+					trace_record(TRACE_PING_INVALID);
 					break;
 				case ESP_ERR_ULTRASONIC_PING_TIMEOUT:
-					ESP_LOGW(TAG, "Ping timeout (echo timeout)\n");
+					frame.status = DIAG_STREAM_PING_ERROR;
+					trace_record(TRACE_PING_TIMEOUT);
 					break;
 				case ESP_ERR_ULTRASONIC_ECHO_TIMEOUT:
-					ESP_LOGW(TAG, "Echo timeout (i.e. distance too big)\n");
+					frame.status = DIAG_STREAM_ECHO_TIMEOUT;
+					trace_record(TRACE_ECHO_TIMEOUT);
+					break;
+				case ESP_ERR_ULTRASONIC_ECHO_EARLY:
+					frame.status = DIAG_STREAM_ECHO_EARLY;
+					trace_record(TRACE_ECHO_EARLY);
 					break;
 				default:
-					ESP_LOGE(TAG, "%s\n", esp_err_to_name(res));
+					frame.status = DIAG_STREAM_OTHER_ERROR;
+					trace_record(TRACE_MEASURE_FAILED, (uint32_t) res);
 			}
 		} else
 		{
-			ESP_LOGI(TAG, "Distance: %ld cm", distance);
-			values[currentIndex] = (float) distance;
-			currentIndex = (currentIndex + 1) % MAX_VALUES;
-			if (count < MAX_VALUES)
+			float distance = ultrasonic_time_to_cm(echo_us, speed_of_sound);
+			if (check_restored)
+			{
+				check_restored = false;
+				if (!warm_start_is_consistent(&s_warm_state, distance))
+				{
+					ESP_LOGW(TAG, "Restored filter state does not match the tank, starting cold");
+					depth_filter_reset(filter);
+				}
+			}
+			if (s_first_valid_reading_us < 0)
 			{
-				count++;
+				s_first_valid_reading_us = esp_timer_get_time();
+				ESP_LOGI(TAG, "First valid reading %lld ms after boot", s_first_valid_reading_us / 1000);
 			}
-			float fdistance = roundf(calculate_average(values, count));
-			ESP_LOGI(TAG, "Distance Average: %f cm", fdistance);
-			esp_zb_lock_acquire(portMAX_DELAY);
-			esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
-										 ESP_ZB_ZCL_CLUSTER_ID_ANALOG_OUTPUT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
-										 ESP_ZB_ZCL_ATTR_ANALOG_OUTPUT_PRESENT_VALUE_ID, &fdistance, false);
-			esp_zb_lock_release();
+
+			sensor_sample_t *sample = sensor_bus_claim(SENSOR_TOPIC_DISTANCE);
+			sample->timestamp_us = timestamp_us;
+			sample->distance.raw = distance;
+			sample->distance.echo_us = echo_us;
+			sample->distance.filtered = roundf(depth_filter_push(filter, distance));
+			echo_tracker_hit(&s_echo_tracker, distance, sample->distance.filtered);
+			sensor_bus_commit(SENSOR_TOPIC_DISTANCE);
+			frame.echo_us = echo_us;
+			frame.raw = distance;
+			frame.filtered = sample->distance.filtered;
 		}
+		uint32_t interval_ms = diag_update(frame.status, min_time_us, max_time_us);
+		diag_stream_record(&frame);
+		zb_publish_kick();
 
+		if (esp_timer_get_time() >= next_report_us)
+		{
+			app_tasks_report();
+			next_report_us += APP_TASKS_REPORT_INTERVAL * 1000000LL;
+		}
 
-		vTaskDelay(pdMS_TO_TICKS(ESP_DIST_SENSOR_UPDATE_INTERVAL * 1000));
+		/* depth_sensor_measure() cuts the wait short */
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(interval_ms));
 	}
 }
 
@@ -98,28 +758,119 @@ static void bdb_start_top_level_commissioning_cb(uint8_t mode_mask)
 						TAG, "Failed to start Zigbee bdb commissioning");
 }
 
-static void esp_app_temp_sensor_handler(float temperature)
+/* Steering on the channels and network the join policy picks, the cached ones first */
+static void zb_steering_start(uint8_t param)
 {
-	int16_t measured_value = zb_temperature_to_s16(temperature);
-	/* Update temperature sensor measured value */
-	esp_zb_lock_acquire(portMAX_DELAY);
-	esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT,
-								 ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
-								 ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID, &measured_value, false);
-	esp_zb_lock_release();
+	uint32_t primary_mask;
+	uint32_t secondary_mask;
+	esp_zb_ieee_addr_t extended_pan_id;
+	join_policy_channels(&primary_mask, &secondary_mask, extended_pan_id);
+	esp_zb_set_extended_pan_id(extended_pan_id);
+	esp_zb_set_primary_network_channel_set(primary_mask);
+	esp_zb_set_secondary_network_channel_set(secondary_mask);
+	bdb_start_top_level_commissioning_cb(ESP_ZB_BDB_MODE_NETWORK_STEERING);
 }
 
-static esp_err_t deferred_driver_init(void)
+static void zb_log_joined(void)
 {
-	ultrasonic_init(&sensor);
+	join_stats_t stats;
+	join_policy_stats(&stats);
+	ESP_LOGI(TAG, "Joined after %.1f s, %lu steering attempts, %lu retries since boot",
+			 stats.last_join_us / 1e6, (unsigned long) stats.last_attempts, (unsigned long) stats.total_retries);
+}
+
+/* Runs for the whole uptime and blinks whenever notified, so identify requests do not create tasks */
+_Noreturn static void esp_zb_identify(void *pvParameters)
+{
+	while (true)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		bool light_state = false;
+		for (int i = 0; i < 50; ++i)
+		{
+			light_state = !light_state;
+			light_driver_set_identify(true, light_state);
+
+			vTaskDelay(pdMS_TO_TICKS(1000));
+		};
+		/* back to what On/Off, level and color say */
+		light_driver_set_identify(false, false);
+		vTaskDelay(pdMS_TO_TICKS(1000));
+	}
+}
+
+static esp_err_t sensor_pipeline_init(void)
+{
+	esp_err_t err = warm_start_restore(&s_warm_state);
+	if (err == ESP_OK)
+	{
+		/* The distance is only published once the first live reading confirms the restored
+		 * window, the tank may have changed while the device was off */
+		s_warm_state_restored = true;
+		s_cached_temperature = s_warm_state.temperature;
+		s_cached_temperature_valid = s_warm_state.temperature_valid;
+	} else
+	{
+		ESP_LOGI(TAG, "Cold start (%s)", esp_err_to_name(err));
+		depth_filter_reset(&s_warm_state.filter);
+	}
+
+	if (trace_init() != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Trace drain not started, events stay in the ring");
+	}
+#if CONFIG_DEPTH_SENSOR_CONSOLE
+	if (diag_console_init() != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Diagnostics console not started");
+	}
+#endif
+
+	/* Consumers first, the bus does not support subscribing once samples flow */
+	ESP_ERROR_CHECK(sensor_bus_subscribe(SENSOR_TOPIC_DISTANCE, pump_subscriber, NULL));
+	ESP_ERROR_CHECK(sensor_bus_subscribe(SENSOR_TOPIC_DISTANCE, log_distance_subscriber, NULL));
+	ESP_ERROR_CHECK(sensor_bus_subscribe(SENSOR_TOPIC_DISTANCE, zb_distance_subscriber, NULL));
+	ESP_ERROR_CHECK(sensor_bus_subscribe(SENSOR_TOPIC_DISTANCE, warm_start_subscriber, NULL));
+	ESP_ERROR_CHECK(sensor_bus_subscribe(SENSOR_TOPIC_DISTANCE, trend_subscriber, NULL));
+	ESP_ERROR_CHECK(sensor_bus_subscribe(SENSOR_TOPIC_TEMPERATURE, zb_temperature_subscriber, NULL));
+
+	/* Before the rules, their timer may fire right away */
 	light_driver_init(LIGHT_DEFAULT_OFF);
-	xTaskCreate(ultrasonic_task, "ultrasonic_task", configMINIMAL_STACK_SIZE * 3, NULL, 5, NULL);
+	if (led_rules_init() != ESP_OK)
+	{
+		ESP_LOGW(TAG, "LED rules not loaded, the light follows Zigbee only");
+	}
+	if (pump_control_init() != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Pump configuration not loaded, pump control is disabled");
+	}
+	if (trend_detector_init() != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Alarm sensitivity not loaded, using defaults");
+	}
+	if (tank_profile_init() != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Tank profile not loaded, volume is not reported");
+	}
+	if (light_scenes_init() != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Scene table not loaded, starting empty");
+	}
+	echo_tracker_reset(&s_echo_tracker);
+	ultrasonic_init(&sensor);
 	temperature_sensor_config_t temp_sensor_config =
 			TEMPERATURE_SENSOR_CONFIG_DEFAULT(ESP_TEMP_SENSOR_MIN_VALUE, ESP_TEMP_SENSOR_MAX_VALUE);
-	ESP_RETURN_ON_ERROR(
-			temp_sensor_driver_init(&temp_sensor_config, ESP_TEMP_SENSOR_UPDATE_INTERVAL, esp_app_temp_sensor_handler),
-			TAG,
-			"Failed to initialize temperature sensor");
+	if (temp_sensor_driver_init(&temp_sensor_config) != ESP_OK)
+	{
+		/* Not fatal, distance falls back to ESP_TEMP_SENSOR_FALLBACK_VALUE */
+		ESP_LOGW(TAG, "Failed to initialize temperature sensor");
+	}
+	ESP_RETURN_ON_ERROR(app_task_create(APP_TASK_PUBLISH, zb_publish_task, NULL), TAG,
+						"Failed to create publish task");
+	ESP_RETURN_ON_ERROR(app_task_create(APP_TASK_ULTRASONIC, ultrasonic_task, NULL), TAG,
+						"Failed to create ultrasonic task");
+	ESP_RETURN_ON_ERROR(app_task_create(APP_TASK_IDENTIFY, esp_zb_identify, NULL), TAG,
+						"Failed to create identify task");
 	return ESP_OK;
 }
 
@@ -128,6 +879,7 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct)
 	uint32_t *p_sg_p = signal_struct->p_app_signal;
 	esp_err_t err_status = signal_struct->esp_err_status;
 	esp_zb_app_signal_type_t sig_type = *p_sg_p;
+	esp_zb_ieee_addr_t extended_pan_id;
 	switch (sig_type)
 	{
 		case ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP:
@@ -138,44 +890,59 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct)
 		case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT:
 			if (err_status == ESP_OK)
 			{
-				ESP_LOGI(TAG, "Deferred driver initialization %s", deferred_driver_init() ? "failed" : "successful");
+				zb_publish_cached_state();
 				ESP_LOGI(TAG, "Device started up in %s factory-reset mode", esp_zb_bdb_is_factory_new() ? "" : "non");
 				if (esp_zb_bdb_is_factory_new())
 				{
 					ESP_LOGI(TAG, "Start network steering");
-					esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_NETWORK_STEERING);
+					zb_steering_start(0);
 				} else
 				{
+					/* the stack rejoined the network it kept in NVRAM, no scan needed */
 					ESP_LOGI(TAG, "Device rebooted");
+					esp_zb_get_extended_pan_id(extended_pan_id);
+					join_policy_joined(esp_zb_get_current_channel(), extended_pan_id, esp_timer_get_time());
+					zb_log_joined();
 				}
 			} else
 			{
-				/* commissioning failed */
-				ESP_LOGW(TAG, "Failed to initialize Zigbee stack (status: %s)", esp_err_to_name(err_status));
+				/* commissioning failed, sensors keep running and caching meanwhile */
+				uint32_t delay_ms = join_policy_failed();
+				ESP_LOGW(TAG, "Failed to initialize Zigbee stack (status: %s), retry in %lu ms",
+						 esp_err_to_name(err_status), (unsigned long) delay_ms);
+				esp_zb_scheduler_alarm((esp_zb_callback_t) bdb_start_top_level_commissioning_cb,
+									   ESP_ZB_BDB_MODE_INITIALIZATION, delay_ms);
 			}
 			break;
 		case ESP_ZB_BDB_SIGNAL_STEERING:
 			if (err_status == ESP_OK)
 			{
-				esp_zb_ieee_addr_t extended_pan_id;
 				esp_zb_get_extended_pan_id(extended_pan_id);
 				ESP_LOGI(TAG,
 						 "Joined network successfully (Extended PAN ID: %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x, PAN ID: 0x%04hx, Channel:%d, Short Address: 0x%04hx)",
 						 extended_pan_id[7], extended_pan_id[6], extended_pan_id[5], extended_pan_id[4],
 						 extended_pan_id[3], extended_pan_id[2], extended_pan_id[1], extended_pan_id[0],
 						 esp_zb_get_pan_id(), esp_zb_get_current_channel(), esp_zb_get_short_address());
+				if (join_policy_joined(esp_zb_get_current_channel(), extended_pan_id, esp_timer_get_time()) != ESP_OK)
+				{
+					ESP_LOGW(TAG, "Network not cached, the next join scans all channels");
+				}
+				zb_log_joined();
+				zb_publish_kept_alarms();
 			} else
 			{
-				ESP_LOGI(TAG, "Network steering was not successful (status: %s)", esp_err_to_name(err_status));
-				esp_zb_scheduler_alarm((esp_zb_callback_t) bdb_start_top_level_commissioning_cb,
-									   ESP_ZB_BDB_MODE_NETWORK_STEERING, 1000);
+				uint32_t delay_ms = join_policy_failed();
+				ESP_LOGI(TAG, "Network steering was not successful (status: %s), retry in %lu ms",
+						 esp_err_to_name(err_status), (unsigned long) delay_ms);
+				esp_zb_scheduler_alarm((esp_zb_callback_t) zb_steering_start, 0, delay_ms);
 			}
 			break;
 		case ESP_ZB_ZDO_SIGNAL_LEAVE:
 			ESP_LOGI(TAG, "Leaving old network");
 			esp_zb_nvram_erase_at_start(true);
 			ESP_LOGI(TAG, "Start network steering");
-			esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_NETWORK_STEERING);
+			join_policy_start(esp_timer_get_time());
+			zb_steering_start(0);
 			break;
 		default:
 			ESP_LOGI(TAG, "ZDO signal: %s (0x%x), status: %s", esp_zb_zdo_signal_to_string(sig_type), sig_type,
@@ -184,19 +951,59 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct)
 	}
 }
 
-static void esp_zb_identify(void *pvParameters)
+/* One attribute per call, the light driver keeps the rest, so the stack is never asked for them */
+static void zb_color_control_handler(const esp_zb_zcl_attribute_t *attribute)
 {
-	bool light_state = false;
-	for (int i = 0; i < 50; ++i)
+	uint16_t value;
+	if (attribute->data.type == ESP_ZB_ZCL_ATTR_TYPE_U8 || attribute->data.type == ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM)
 	{
-		light_state = !light_state;
-		light_driver_set_power(light_state);
+		value = *(uint8_t *) attribute->data.value;
+	} else if (attribute->data.type == ESP_ZB_ZCL_ATTR_TYPE_U16)
+	{
+		value = *(uint16_t *) attribute->data.value;
+	} else
+	{
+		trace_record(TRACE_ZB_UNEXPECTED, ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, attribute->id, attribute->data.type);
+		return;
+	}
 
-		vTaskDelay(pdMS_TO_TICKS(1000));
-	};
-	light_driver_set_power(false);
-	vTaskDelay(pdMS_TO_TICKS(1000));
-	vTaskDelete(NULL);
+	light_shadow_t shadow;
+	switch (attribute->id)
+	{
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID:
+			light_driver_set_color_x(value);
+			break;
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID:
+			light_driver_set_color_y(value);
+			break;
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_HUE_ID:
+			light_driver_set_hue((uint8_t) value);
+			break;
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID:
+			light_driver_set_saturation((uint8_t) value);
+			break;
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_CURRENT_HUE_ID:
+			light_driver_set_enhanced_hue(value);
+			break;
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMPERATURE_ID:
+			light_driver_set_color_temperature(value);
+			break;
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_MODE_ID:
+			/* Color Mode says hue/saturation for the enhanced hue as well, Enhanced Color Mode tells them apart */
+			light_driver_get_shadow(&shadow);
+			if (value != LIGHT_COLOR_MODE_HUE_SAT || shadow.color_mode != LIGHT_COLOR_MODE_ENHANCED_HUE_SAT)
+			{
+				light_driver_set_color_mode((uint8_t) value);
+			}
+			break;
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_COLOR_MODE_ID:
+			light_driver_set_color_mode((uint8_t) value);
+			break;
+		default:
+			trace_record(TRACE_ZB_UNEXPECTED, ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, attribute->id, attribute->data.type);
+			return;
+	}
+	trace_record(TRACE_LIGHT_COLOR, attribute->id, value);
 }
 
 static esp_err_t zb_attribute_handler(const esp_zb_zcl_set_attr_value_message_t *message)
@@ -204,15 +1011,12 @@ static esp_err_t zb_attribute_handler(const esp_zb_zcl_set_attr_value_message_t
 	esp_err_t ret = ESP_OK;
 	bool light_state = 0;
 	uint8_t light_level = 0;
-	uint16_t light_color_x = 0;
-	uint16_t light_color_y = 0;
 	ESP_RETURN_ON_FALSE(message, ESP_FAIL, TAG, "Empty message");
 	ESP_RETURN_ON_FALSE(message->info.status == ESP_ZB_ZCL_STATUS_SUCCESS, ESP_ERR_INVALID_ARG, TAG,
 						"Received message: error status(%d)",
 						message->info.status);
-	ESP_LOGI(TAG, "Received message: endpoint(%d), cluster(0x%x), attribute(0x%x), data size(%d)",
-			 message->info.dst_endpoint, message->info.cluster,
-			 message->attribute.id, message->attribute.data.size);
+	trace_record(TRACE_ZB_MESSAGE, message->info.dst_endpoint, message->info.cluster, message->attribute.id,
+				 message->attribute.data.size);
 	if (message->info.dst_endpoint == HA_ESP_SENSOR_ENDPOINT)
 	{
 		switch (message->info.cluster)
@@ -222,43 +1026,19 @@ static esp_err_t zb_attribute_handler(const esp_zb_zcl_set_attr_value_message_t
 					message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_BOOL)
 				{
 					light_state = message->attribute.data.value ? *(bool *) message->attribute.data.value : light_state;
-					ESP_LOGI(TAG, "Light sets to %s", light_state ? "On" : "Off");
+					trace_record(TRACE_LIGHT_POWER, light_state);
 					light_driver_set_power(light_state);
 				} else
 				{
-					ESP_LOGW(TAG, "On/Off cluster data: attribute(0x%x), type(0x%x)", message->attribute.id,
-							 message->attribute.data.type);
+					trace_record(TRACE_ZB_UNEXPECTED, message->info.cluster, message->attribute.id,
+								 message->attribute.data.type);
 				}
 				break;
 			case ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL:
-				if (message->attribute.id == ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID &&
-					message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_U16)
-				{
-					light_color_x = message->attribute.data.value ? *(uint16_t *) message->attribute.data.value
-																  : light_color_x;
-					light_color_y = *(uint16_t *) esp_zb_zcl_get_attribute(message->info.dst_endpoint,
-																		   message->info.cluster,
-																		   ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
-																		   ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID)
-							->data_p;
-					ESP_LOGI(TAG, "Light color x changes to 0x%x", light_color_x);
-				} else if (message->attribute.id == ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID &&
-						   message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_U16)
+				if (message->attribute.data.value)
 				{
-					light_color_y = message->attribute.data.value ? *(uint16_t *) message->attribute.data.value
-																  : light_color_y;
-					light_color_x = *(uint16_t *) esp_zb_zcl_get_attribute(message->info.dst_endpoint,
-																		   message->info.cluster,
-																		   ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
-																		   ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID)
-							->data_p;
-					ESP_LOGI(TAG, "Light color y changes to 0x%x", light_color_y);
-				} else
-				{
-					ESP_LOGW(TAG, "Color control cluster data: attribute(0x%x), type(0x%x)", message->attribute.id,
-							 message->attribute.data.type);
+					zb_color_control_handler(&message->attribute);
 				}
-				light_driver_set_color_xy(light_color_x, light_color_y);
 				break;
 			case ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL:
 				if (message->attribute.id == ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID &&
@@ -267,24 +1047,317 @@ static esp_err_t zb_attribute_handler(const esp_zb_zcl_set_attr_value_message_t
 					light_level = message->attribute.data.value ? *(uint8_t *) message->attribute.data.value
 																: light_level;
 					light_driver_set_level((uint8_t) light_level);
-					ESP_LOGI(TAG, "Light level changes to %d", light_level);
+					trace_record(TRACE_LIGHT_LEVEL, light_level);
 				} else
 				{
-					ESP_LOGW(TAG, "Level Control cluster data: attribute(0x%x), type(0x%x)", message->attribute.id,
-							 message->attribute.data.type);
+					trace_record(TRACE_ZB_UNEXPECTED, message->info.cluster, message->attribute.id,
+								 message->attribute.data.type);
+				}
+				break;
+			case ESP_ZB_ZCL_CLUSTER_ID_TANK:
+				if (message->attribute.id == ESP_ZB_ZCL_ATTR_TANK_PROFILE_ID &&
+					message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING)
+				{
+					zb_tank_profile_handler(&message->attribute);
+				} else if (message->attribute.id == ESP_ZB_ZCL_ATTR_TANK_LED_RULES_ID &&
+						   message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING)
+				{
+					zb_led_rules_handler(&message->attribute);
+				} else if ((message->attribute.id == ESP_ZB_ZCL_ATTR_TANK_PUMP_MODE_ID &&
+							message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM) ||
+						   ((message->attribute.id == ESP_ZB_ZCL_ATTR_TANK_PUMP_HIGH_MARK_ID ||
+							 message->attribute.id == ESP_ZB_ZCL_ATTR_TANK_PUMP_LOW_MARK_ID) &&
+							message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_U16))
+				{
+					zb_pump_config_handler(&message->attribute);
+				} else if ((message->attribute.id == ESP_ZB_ZCL_ATTR_TANK_LEAK_RATE_ID ||
+							message->attribute.id == ESP_ZB_ZCL_ATTR_TANK_DRAIN_RATE_ID ||
+							message->attribute.id == ESP_ZB_ZCL_ATTR_TANK_OVERFLOW_MARK_ID) &&
+						   message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_U16)
+				{
+					zb_trend_config_handler(&message->attribute);
+				} else if (message->attribute.id == ESP_ZB_ZCL_ATTR_TANK_TRACE_LEVELS_ID &&
+						   message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING)
+				{
+					zb_trace_levels_handler(&message->attribute);
+				} else
+				{
+					trace_record(TRACE_ZB_UNEXPECTED, message->info.cluster, message->attribute.id,
+								 message->attribute.data.type);
 				}
 				break;
 			case ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY:
-				xTaskCreate(esp_zb_identify, "Identify", 4096, NULL, 5, NULL);
+				xTaskNotifyGive(app_task_handle(APP_TASK_IDENTIFY));
 			default:
-				ESP_LOGI(TAG, "Message data: cluster(0x%x), attribute(0x%x)  ", message->info.cluster,
-						 message->attribute.id);
+				break;
 		}
 	}
 	return ret;
 }
 
 
+static void zb_set_light_attribute(uint16_t cluster_id, uint16_t attr_id, void *value)
+{
+	esp_zb_zcl_set_attribute_val(HA_ESP_SENSOR_ENDPOINT, cluster_id, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, attr_id, value,
+								 false);
+}
+
+/* Attributes back in line with a restored light */
+static void zb_set_light_attributes(light_shadow_t *shadow)
+{
+	uint8_t color_mode = shadow->color_mode == LIGHT_COLOR_MODE_ENHANCED_HUE_SAT ? LIGHT_COLOR_MODE_HUE_SAT
+																				  : shadow->color_mode;
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID, &shadow->on);
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID,
+						   &shadow->level);
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_MODE_ID,
+						   &color_mode);
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_COLOR_MODE_ID,
+						   &shadow->color_mode);
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID,
+						   &shadow->color_x);
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID,
+						   &shadow->color_y);
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_HUE_ID,
+						   &shadow->hue);
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID,
+						   &shadow->saturation);
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_CURRENT_HUE_ID,
+						   &shadow->enhanced_hue);
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMPERATURE_ID,
+						   &shadow->color_temperature);
+}
+
+static esp_err_t zb_scene_store_handler(const esp_zb_zcl_store_scene_message_t *message)
+{
+	ESP_RETURN_ON_FALSE(message->info.status == ESP_ZB_ZCL_STATUS_SUCCESS, ESP_ERR_INVALID_ARG, TAG,
+						"Store scene: error status(%d)", message->info.status);
+	/* The shadow holds the attributes and the frame is what the strip shows now,
+	 * recall does not need to redo the color maths */
+	light_scene_t scene = {
+			.group_id = message->group_id,
+			.scene_id = message->scene_id,
+	};
+	light_driver_get_state(&scene.light);
+	esp_err_t err = light_scenes_store(&scene);
+	ESP_LOGI(TAG, "Stored scene %d of group 0x%04x", message->scene_id, message->group_id);
+	return err;
+}
+
+/*
+ * Color Control extension field set: x(2), y(2), enhanced hue(2), saturation(1), loop active(1),
+ * loop direction(1), loop time(2), color temperature(2). Senders may cut it short after any field.
+ * It carries no color mode, the light takes the first mode with a non-zero value in that order;
+ * the color loop is not supported and its fields are skipped.
+ */
+static void zb_scene_apply_color(const uint8_t *value, uint8_t length)
+{
+	if (length < 4)
+	{
+		return;
+	}
+	light_shadow_t shadow;
+	light_driver_get_shadow(&shadow);
+	shadow.color_x = (uint16_t) (value[0] | value[1] << 8);
+	shadow.color_y = (uint16_t) (value[2] | value[3] << 8);
+	bool xy = shadow.color_x || shadow.color_y;
+	bool hue_sat = false, temperature = false;
+	if (length >= 7)
+	{
+		shadow.enhanced_hue = (uint16_t) (value[4] | value[5] << 8);
+		shadow.hue = (uint8_t) (shadow.enhanced_hue >> 8);
+		shadow.saturation = value[6];
+		hue_sat = shadow.enhanced_hue || shadow.saturation;
+	}
+	if (length >= 13)
+	{
+		shadow.color_temperature = (uint16_t) (value[11] | value[12] << 8);
+		temperature = shadow.color_temperature != 0;
+	}
+	shadow.color_mode = xy ? LIGHT_COLOR_MODE_XY
+						   : hue_sat ? LIGHT_COLOR_MODE_ENHANCED_HUE_SAT
+									 : temperature ? LIGHT_COLOR_MODE_TEMPERATURE : LIGHT_COLOR_MODE_XY;
+	light_driver_set_color(&shadow);
+	/* the driver clamps the temperature */
+	light_driver_get_shadow(&shadow);
+	zb_set_light_attributes(&shadow);
+}
+
+/* Scenes added with explicit field sets were never stored here, convert them the slow way */
+static void zb_scene_apply_field_set(const esp_zb_zcl_scenes_extension_field_t *field)
+{
+	for (; field; field = field->next)
+	{
+		const uint8_t *value = field->extension_field_attribute_value_list;
+		switch (field->cluster_id)
+		{
+			case ESP_ZB_ZCL_CLUSTER_ID_ON_OFF:
+				if (field->length >= 1)
+				{
+					bool on_off = value[0];
+					zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID, &on_off);
+					light_driver_set_power(on_off);
+				}
+				break;
+			case ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL:
+				if (field->length >= 1)
+				{
+					uint8_t level = value[0];
+					zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+										   ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID, &level);
+					light_driver_set_level(level);
+				}
+				break;
+			case ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL:
+				zb_scene_apply_color(value, field->length);
+				break;
+			default:
+				ESP_LOGW(TAG, "Scene field set for cluster(0x%x) ignored", field->cluster_id);
+				break;
+		}
+	}
+}
+
+static esp_err_t zb_scene_recall_handler(const esp_zb_zcl_recall_scene_message_t *message)
+{
+	ESP_RETURN_ON_FALSE(message->info.status == ESP_ZB_ZCL_STATUS_SUCCESS, ESP_ERR_INVALID_ARG, TAG,
+						"Recall scene: error status(%d)", message->info.status);
+	const light_scene_t *scene = light_scenes_find(message->group_id, message->scene_id);
+	if (scene)
+	{
+		light_scene_t values = *scene;
+		light_driver_set_state(&values.light);
+		zb_set_light_attributes(&values.light.shadow);
+	} else
+	{
+		zb_scene_apply_field_set(message->field_set);
+	}
+
+	uint8_t scene_id = message->scene_id;
+	uint16_t group_id = message->group_id;
+	bool scene_valid = true;
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_SCENES, ESP_ZB_ZCL_ATTR_SCENES_CURRENT_SCENE_ID, &scene_id);
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_SCENES, ESP_ZB_ZCL_ATTR_SCENES_CURRENT_GROUP_ID, &group_id);
+	zb_set_light_attribute(ESP_ZB_ZCL_CLUSTER_ID_SCENES, ESP_ZB_ZCL_ATTR_SCENES_SCENE_VALID_ID, &scene_valid);
+	ESP_LOGI(TAG, "Recalled scene %d of group 0x%04x%s", message->scene_id, message->group_id,
+			 scene ? "" : " from field sets");
+	return ESP_OK;
+}
+
+/* A stored frame must not outlive the stack's scene. The stack still runs the command and answers it */
+static void zb_scenes_raw_command(uint8_t cmd_id, const uint8_t *payload, zb_uint_t length)
+{
+	uint16_t group_id = length >= 2 ? (uint16_t) (payload[0] | payload[1] << 8) : 0;
+	switch (cmd_id)
+	{
+		case ESP_ZB_ZCL_CMD_SCENES_ADD_SCENE:
+		case ESP_ZB_ZCL_CMD_SCENES_REMOVE_SCENE:
+			/* an added scene brings its own field sets, recall uses those from now on */
+			if (length >= 3)
+			{
+				light_scenes_remove(group_id, payload[2]);
+			}
+			break;
+		case ESP_ZB_ZCL_CMD_SCENES_REMOVE_ALL_SCENES:
+			if (length >= 2)
+			{
+				light_scenes_remove_group(group_id);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/* Oldest logged alarm back to the requester, NOT_FOUND alone when the log is empty */
+static void zb_send_get_alarm_response(const zb_zcl_parsed_hdr_t *cmd_info)
+{
+	alarm_entry_t entry;
+	uint8_t payload[8] = {ESP_ZB_ZCL_STATUS_NOT_FOUND};
+	uint16_t size = 1;
+	if (alarm_table_pop(&entry))
+	{
+		payload[0] = ESP_ZB_ZCL_STATUS_SUCCESS;
+		payload[1] = entry.code;
+		payload[2] = entry.cluster_id & 0xff;
+		payload[3] = entry.cluster_id >> 8;
+		for (int i = 0; i < 4; i++)
+		{
+			payload[4 + i] = (uint8_t) (entry.timestamp >> (8 * i));
+		}
+		size = sizeof(payload);
+	}
+	esp_zb_zcl_custom_cluster_cmd_t cmd_req = {
+			.zcl_basic_cmd = {
+					.dst_addr_u.addr_short = ZB_ZCL_PARSED_HDR_SHORT_DATA(cmd_info).source,
+					.dst_endpoint = ZB_ZCL_PARSED_HDR_SHORT_DATA(cmd_info).src_endpoint,
+					.src_endpoint = HA_ESP_SENSOR_ENDPOINT,
+			},
+			.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT,
+			.profile_id = ESP_ZB_AF_HA_PROFILE_ID,
+			.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_ALARMS,
+			.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI,
+			.custom_cmd_id = ALARMS_CMD_GET_ALARM_RESPONSE_ID,
+			.data = {.type = ESP_ZB_ZCL_ATTR_TYPE_SET, .size = size, .value = payload},
+	};
+	esp_zb_zcl_custom_cluster_cmd_req(&cmd_req);
+	zb_update_alarm_count();
+}
+
+/* The Alarms cluster is only a cluster ID to the stack, the commands are run here. A reset alarm
+ * whose condition is still present is raised again with the next measurements */
+static bool zb_alarms_raw_command(const zb_zcl_parsed_hdr_t *cmd_info, const uint8_t *payload, zb_uint_t length)
+{
+	switch (cmd_info->cmd_id)
+	{
+		case ALARMS_CMD_RESET_ALARM_ID:
+		{
+			uint16_t cluster_id = length >= 3 ? (uint16_t) (payload[1] | payload[2] << 8) : 0;
+			if (cluster_id == ESP_ZB_ZCL_CLUSTER_ID_TANK && payload[0] >= TANK_ALARM_CODE_LEAK &&
+				payload[0] < TANK_ALARM_CODE_LEAK + TREND_ALARM_COUNT)
+			{
+				trend_detector_reset(1 << (payload[0] - TANK_ALARM_CODE_LEAK));
+			}
+			return true;
+		}
+		case ALARMS_CMD_RESET_ALL_ALARMS_ID:
+			trend_detector_reset((1 << TREND_ALARM_COUNT) - 1);
+			return true;
+		case ALARMS_CMD_GET_ALARM_ID:
+			zb_send_get_alarm_response(cmd_info);
+			return true;
+		case ALARMS_CMD_RESET_ALARM_LOG_ID:
+			alarm_table_clear();
+			zb_update_alarm_count();
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Commands the stack has no callback for, looked at before it runs them */
+static bool zb_raw_command_handler(uint8_t bufid)
+{
+	zb_zcl_parsed_hdr_t *cmd_info = ZB_BUF_GET_PARAM(bufid, zb_zcl_parsed_hdr_t);
+	if (cmd_info->is_common_command || cmd_info->cmd_direction != ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV ||
+		ZB_ZCL_PARSED_HDR_SHORT_DATA(cmd_info).dst_endpoint != HA_ESP_SENSOR_ENDPOINT)
+	{
+		return false;
+	}
+	const uint8_t *payload = zb_buf_begin(bufid);
+	zb_uint_t length = zb_buf_len(bufid);
+	switch (cmd_info->cluster_id)
+	{
+		case ESP_ZB_ZCL_CLUSTER_ID_SCENES:
+			zb_scenes_raw_command(cmd_info->cmd_id, payload, length);
+			return false;
+		case ESP_ZB_ZCL_CLUSTER_ID_ALARMS:
+			return zb_alarms_raw_command(cmd_info, payload, length);
+		default:
+			return false;
+	}
+}
+
 static esp_err_t zb_action_handler(esp_zb_core_action_callback_id_t callback_id, const void *message)
 {
 	esp_err_t ret = ESP_OK;
@@ -292,33 +1365,150 @@ static esp_err_t zb_action_handler(esp_zb_core_action_callback_id_t callback_id,
 	{
 		case ESP_ZB_CORE_REPORT_ATTR_CB_ID:
 //			ret = zb_attribute_reporting_handler((esp_zb_zcl_report_attr_message_t *)message);
-			ESP_LOGI(TAG, "Report attribute callback");
+			trace_record(TRACE_ZB_ACTION, callback_id);
 			break;
 		case ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID:
 //			ret = zb_read_attr_resp_handler((esp_zb_zcl_cmd_read_attr_resp_message_t *)message);
-			ESP_LOGI(TAG, "Read attribute response callback");
+			trace_record(TRACE_ZB_ACTION, callback_id);
 			break;
 		case ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID:
-			ESP_LOGI(TAG, "Configure report response callback");
+			trace_record(TRACE_ZB_ACTION, callback_id);
 //			ret = zb_configure_report_resp_handler((esp_zb_zcl_cmd_config_report_resp_message_t *)message);
 			break;
 		case ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID:
-			ESP_LOGI(TAG, "Set attribute value callback");
+			trace_record(TRACE_ZB_ACTION, callback_id);
 			ret = zb_attribute_handler((esp_zb_zcl_set_attr_value_message_t *) message);
 			break;
+		case ESP_ZB_CORE_SCENES_STORE_SCENE_CB_ID:
+			ret = zb_scene_store_handler((esp_zb_zcl_store_scene_message_t *) message);
+			break;
+		case ESP_ZB_CORE_SCENES_RECALL_SCENE_CB_ID:
+			ret = zb_scene_recall_handler((esp_zb_zcl_recall_scene_message_t *) message);
+			break;
 		case ESP_ZB_CORE_IDENTIFY_EFFECT_CB_ID:
-			ESP_LOGI(TAG, "Identify effect callback");
+			trace_record(TRACE_ZB_ACTION, callback_id);
 			break;
 		case ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID:
-			ESP_LOGI(TAG, "Default response callback");
+			trace_record(TRACE_ZB_ACTION, callback_id);
 			break;
 		default:
-			ESP_LOGW(TAG, "Receive Zigbee action(0x%x) callback", callback_id);
+			trace_record(TRACE_ZB_ACTION_UNKNOWN, callback_id);
 			break;
 	}
 	return ret;
 }
 
+static esp_zb_attribute_list_t *alarms_cluster_create(void)
+{
+	uint16_t alarm_count = 0;
+	esp_zb_attribute_list_t *alarms_cluster = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_ALARMS);
+	ESP_ERROR_CHECK(esp_zb_custom_cluster_add_custom_attr(alarms_cluster, ALARMS_ATTR_ALARM_COUNT_ID,
+														  ESP_ZB_ZCL_ATTR_TYPE_U16, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY,
+														  &alarm_count));
+	return alarms_cluster;
+}
+
+static esp_zb_attribute_list_t *tank_cluster_create(void)
+{
+	float volume = 0;
+	uint8_t percent = 0;
+	/* The stack keeps an octet string at the size it was created with, the real profile is set
+	 * once the device is registered */
+	uint8_t profile[TANK_PROFILE_WIRE_MAX_SIZE + 1] = {TANK_PROFILE_WIRE_MAX_SIZE};
+	uint8_t rules[LED_RULES_WIRE_SIZE + 1];
+	led_rules_encode(rules);
+	pump_config_t pump;
+	pump_control_get_config(&pump);
+	trend_config_t trend;
+	trend_detector_get_config(&trend);
+	uint8_t alarms = 0;
+	uint8_t trace_levels[TRACE_MODULE_COUNT + 1];
+	zb_trace_levels_encode(trace_levels);
+
+	esp_zb_attribute_list_t *tank_cluster = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_TANK);
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_VOLUME_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_SINGLE,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY |
+														 ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &volume));
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_PERCENT_FULL_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_U8,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY |
+														 ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &percent));
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_PROFILE_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, profile));
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_LED_RULES_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, rules));
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_PUMP_MODE_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &pump.mode));
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_PUMP_HIGH_MARK_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_U16,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &pump.high_mark));
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_PUMP_LOW_MARK_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_U16,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &pump.low_mark));
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_LEAK_RATE_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_U16,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &trend.leak_rate));
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_DRAIN_RATE_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_U16,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &trend.drain_rate));
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_OVERFLOW_MARK_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_U16,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &trend.overflow_mark));
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_ALARMS_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_8BITMAP,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY |
+														 ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &alarms));
+	ESP_ERROR_CHECK(esp_zb_cluster_add_manufacturer_attr(tank_cluster, ESP_ZB_ZCL_CLUSTER_ID_TANK,
+														 ESP_ZB_ZCL_ATTR_TANK_TRACE_LEVELS_ID, ESP_ZB_MANUFACTURER_CODE,
+														 ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING,
+														 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, trace_levels));
+	return tank_cluster;
+}
+
+/* The attributes of every mode in ESP_ZB_LIGHT_COLOR_CAPABILITIES, the stack runs the move and step commands on them */
+static esp_zb_attribute_list_t *color_control_cluster_create(esp_zb_color_cluster_cfg_t *color_cfg)
+{
+	light_shadow_t shadow;
+	light_driver_get_shadow(&shadow);
+	uint16_t temperature_min = LIGHT_COLOR_TEMPERATURE_MIN;
+	uint16_t temperature_max = LIGHT_COLOR_TEMPERATURE_MAX;
+
+	esp_zb_attribute_list_t *color_cluster = esp_zb_color_control_cluster_create(color_cfg);
+	ESP_ERROR_CHECK(esp_zb_color_control_cluster_add_attr(color_cluster, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_HUE_ID,
+														  &shadow.hue));
+	ESP_ERROR_CHECK(esp_zb_color_control_cluster_add_attr(color_cluster,
+														  ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID,
+														  &shadow.saturation));
+	ESP_ERROR_CHECK(esp_zb_color_control_cluster_add_attr(color_cluster,
+														  ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_CURRENT_HUE_ID,
+														  &shadow.enhanced_hue));
+	ESP_ERROR_CHECK(esp_zb_color_control_cluster_add_attr(color_cluster,
+														  ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMPERATURE_ID,
+														  &shadow.color_temperature));
+	ESP_ERROR_CHECK(esp_zb_color_control_cluster_add_attr(color_cluster,
+														  ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMP_PHYSICAL_MIN_MIREDS_ID,
+														  &temperature_min));
+	ESP_ERROR_CHECK(esp_zb_color_control_cluster_add_attr(color_cluster,
+														  ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMP_PHYSICAL_MAX_MIREDS_ID,
+														  &temperature_max));
+	return color_cluster;
+}
+
 static esp_zb_cluster_list_t *
 custom_distance_sensor_clusters_create(esp_zb_analog_output_cluster_cfg_t *distance_sensor,
 									   esp_zb_temperature_meas_cluster_cfg_t *temperature_sensor,
@@ -351,9 +1541,11 @@ custom_distance_sensor_clusters_create(esp_zb_analog_output_cluster_cfg_t *dista
 														   esp_zb_on_off_cluster_create(
 																   &light->on_off_cfg),
 														   ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
+	/* Client side for the pump relays, bound on the coordinator */
+	ESP_ERROR_CHECK(esp_zb_cluster_list_add_on_off_cluster(cluster_list, esp_zb_zcl_attr_list_create(
+			ESP_ZB_ZCL_CLUSTER_ID_ON_OFF), ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE));
 	ESP_ERROR_CHECK(esp_zb_cluster_list_add_color_control_cluster(cluster_list,
-																  esp_zb_color_control_cluster_create(
-																		  &light->color_cfg),
+																  color_control_cluster_create(&light->color_cfg),
 																  ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
 	ESP_ERROR_CHECK(esp_zb_cluster_list_add_scenes_cluster(cluster_list,
 														   esp_zb_scenes_cluster_create(
@@ -367,6 +1559,10 @@ custom_distance_sensor_clusters_create(esp_zb_analog_output_cluster_cfg_t *dista
 														  esp_zb_groups_cluster_create(
 																  &light->groups_cfg),
 														  ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
+	ESP_ERROR_CHECK(esp_zb_cluster_list_add_custom_cluster(cluster_list, alarms_cluster_create(),
+														   ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
+	ESP_ERROR_CHECK(esp_zb_cluster_list_add_custom_cluster(cluster_list, tank_cluster_create(),
+														   ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
 	return cluster_list;
 }
 
@@ -387,6 +1583,35 @@ custom_distance_sensor_ep_create(esp_zb_analog_output_cluster_cfg_t *distance_se
 	return ep_list;
 }
 
+/* Singles carry their delta as the raw float in the delta buffer */
+static esp_zb_zcl_attr_var_t zb_float_delta(float delta)
+{
+	esp_zb_zcl_attr_var_t var = {0};
+	memcpy(var.data_buf, &delta, sizeof(delta));
+	return var;
+}
+
+static void zb_configure_reporting(uint16_t cluster_id, uint16_t attr_id, uint16_t manuf_code,
+								   esp_zb_zcl_attr_var_t delta)
+{
+	esp_zb_zcl_reporting_info_t reporting_info = {
+			.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV,
+			.ep = HA_ESP_SENSOR_ENDPOINT,
+			.cluster_id = cluster_id,
+			.cluster_role = ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+			.dst.profile_id = ESP_ZB_AF_HA_PROFILE_ID,
+			.u.send_info.min_interval = 1,
+			.u.send_info.max_interval = 0,
+			.u.send_info.def_min_interval = 1,
+			.u.send_info.def_max_interval = 0,
+			.u.send_info.delta = delta,
+			.attr_id = attr_id,
+			.manuf_code = manuf_code,
+	};
+
+	esp_zb_zcl_update_reporting_info(&reporting_info);
+}
+
 static void esp_zb_task(void *pvParameters)
 {
 	/* Initialize Zigbee stack */
@@ -411,7 +1636,7 @@ static void esp_zb_task(void *pvParameters)
 					.color_mode = ESP_ZB_ZCL_COLOR_CONTROL_COLOR_MODE_DEFAULT_VALUE,
 					.options = ESP_ZB_ZCL_COLOR_CONTROL_OPTIONS_DEFAULT_VALUE,
 					.enhanced_color_mode = ESP_ZB_ZCL_COLOR_CONTROL_ENHANCED_COLOR_MODE_DEFAULT_VALUE,
-					.color_capabilities = 0x0008,
+					.color_capabilities = ESP_ZB_LIGHT_COLOR_CAPABILITIES,
 			},
 			.level_cfg =
 					{
@@ -419,7 +1644,7 @@ static void esp_zb_task(void *pvParameters)
 					},
 			.scenes_cfg =
 					{
-							.scenes_count = ESP_ZB_ZCL_SCENES_SCENE_COUNT_DEFAULT_VALUE,
+							.scenes_count = light_scenes_count(),
 							.current_scene = ESP_ZB_ZCL_SCENES_CURRENT_SCENE_DEFAULT_VALUE,
 							.current_group = ESP_ZB_ZCL_SCENES_CURRENT_GROUP_DEFAULT_VALUE,
 							.scene_valid = ESP_ZB_ZCL_SCENES_SCENE_VALID_DEFAULT_VALUE,
@@ -439,26 +1664,25 @@ static void esp_zb_task(void *pvParameters)
 
 	/* Register the device */
 	esp_zb_device_register(esp_zb_sensor_ep);
+	zb_tank_profile_sync();
 
 	/* Config the reporting info  */
-	esp_zb_zcl_reporting_info_t reporting_info = {
-			.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV,
-			.ep = HA_ESP_SENSOR_ENDPOINT,
-			.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_ANALOG_OUTPUT,
-			.cluster_role = ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
-			.dst.profile_id = ESP_ZB_AF_HA_PROFILE_ID,
-			.u.send_info.min_interval = 1,
-			.u.send_info.max_interval = 0,
-			.u.send_info.def_min_interval = 1,
-			.u.send_info.def_max_interval = 0,
-			.u.send_info.delta.u16 = 100,
-			.attr_id = ESP_ZB_ZCL_ATTR_ANALOG_OUTPUT_PRESENT_VALUE_ID,
-			.manuf_code = ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC,
-	};
-
-	esp_zb_zcl_update_reporting_info(&reporting_info);
+	zb_configure_reporting(ESP_ZB_ZCL_CLUSTER_ID_ANALOG_OUTPUT, ESP_ZB_ZCL_ATTR_ANALOG_OUTPUT_PRESENT_VALUE_ID,
+						   ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC, zb_float_delta(ESP_DIST_SENSOR_REPORT_DELTA));
+	zb_configure_reporting(ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_ATTR_TANK_VOLUME_ID, ESP_ZB_MANUFACTURER_CODE,
+						   zb_float_delta(ESP_ZB_TANK_VOLUME_REPORT_DELTA));
+	zb_configure_reporting(ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_ATTR_TANK_PERCENT_FULL_ID, ESP_ZB_MANUFACTURER_CODE,
+						   (esp_zb_zcl_attr_var_t) {.u8 = ESP_ZB_TANK_PERCENT_REPORT_DELTA});
+	/* a bitmap, every change is reported */
+	zb_configure_reporting(ESP_ZB_ZCL_CLUSTER_ID_TANK, ESP_ZB_ZCL_ATTR_TANK_ALARMS_ID, ESP_ZB_MANUFACTURER_CODE,
+						   (esp_zb_zcl_attr_var_t) {0});
 
 	esp_zb_core_action_handler_register(zb_action_handler);
+	esp_zb_raw_command_handler_register(zb_raw_command_handler);
+	if (join_policy_init(ESP_ZB_PRIMARY_CHANNEL_MASK, esp_random()) != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Cached network not loaded, joining scans all channels");
+	}
 	esp_zb_set_primary_network_channel_set(ESP_ZB_PRIMARY_CHANNEL_MASK);
 	ESP_ERROR_CHECK(esp_zb_start(false));
 
@@ -472,6 +1696,9 @@ void app_main(void)
 			.host_config = ESP_ZB_DEFAULT_HOST_CONFIG(),
 	};
 	ESP_ERROR_CHECK(nvs_flash_init());
+	/* Start sensing right away, the Zigbee stack picks up the cached values once it is up */
+	ESP_LOGI(TAG, "Sensor pipeline initialization %s", sensor_pipeline_init() ? "failed" : "successful");
 	ESP_ERROR_CHECK(esp_zb_platform_config(&config));
-	xTaskCreate(esp_zb_task, "Zigbee_main", 4096, NULL, 5, NULL);
+	ESP_ERROR_CHECK(app_task_create(APP_TASK_ZIGBEE, esp_zb_task, NULL));
+	app_tasks_init_done();
 }
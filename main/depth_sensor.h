@@ -6,6 +6,8 @@
 #define DEPTH_SENSOR_DEPTH_SENSOR_H
 
 #include "esp_zigbee_core.h"
+#include "depth_filter.h"
+#include "echo_tracker.h"
 #include "light_driver.h"
 
 /* Zigbee configuration */
@@ -13,23 +15,104 @@
 #define INSTALLCODE_POLICY_ENABLE       false   /* enable the install code policy for security */
 #define HA_ESP_SENSOR_ENDPOINT          1
 #define ESP_ZB_PRIMARY_CHANNEL_MASK     ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK    /* Zigbee primary channel mask use in the example */
+#define ESP_ZB_LIGHT_COLOR_CAPABILITIES 0x001B  /* hue/saturation, enhanced hue, XY and color temperature */
 
 /* Distance sendor configuration */
 #define ESP_DIST_SENSOR_UPDATE_INTERVAL (1)     /* Local sensor update interval (second) */
 #define ESP_DIST_SENSOR_MAX_VALUE       (600)    /* Local sensor max measured value (cm) */
+#define ESP_DIST_SENSOR_MIN_INTERVAL_MS (100)   /* Shortest interval the console can set (ms) */
+#define ESP_DIST_SENSOR_MAX_INTERVAL_MS (60000) /* Longest interval the console can set (ms) */
+#define ESP_DIST_SENSOR_REPORT_DELTA    (0.1f)  /* Smallest reported distance change (cm) */
 
 
 /* Temperature sensor configuration */
-#define ESP_TEMP_SENSOR_UPDATE_INTERVAL (1)     /* Local sensor update interval (second) */
+#define ESP_TEMP_SENSOR_MAX_AGE         (10)    /* Local sensor is re-read when its value is older (second) */
+#define ESP_TEMP_SENSOR_FALLBACK_VALUE  (20.0f) /* Speed of sound compensation without a reading (degree Celsius) */
 #define ESP_TEMP_SENSOR_MIN_VALUE       (-10)   /* Local sensor min measured value (degree Celsius) */
 #define ESP_TEMP_SENSOR_MAX_VALUE       (80)    /* Local sensor max measured value (degree Celsius) */
 
+/* Manufacturer specific tank cluster */
+#define ESP_ZB_MANUFACTURER_CODE                0x131B
+#define ESP_ZB_ZCL_CLUSTER_ID_TANK              0xFC00
+#define ESP_ZB_ZCL_ATTR_TANK_VOLUME_ID          0x0000  /* single, volume at the current level (l) */
+#define ESP_ZB_ZCL_ATTR_TANK_PERCENT_FULL_ID    0x0001  /* u8, volume relative to the full tank (%) */
+#define ESP_ZB_ZCL_ATTR_TANK_PROFILE_ID         0x0002  /* octet string, distance to volume table, see tank_profile.h */
+#define ESP_ZB_ZCL_ATTR_TANK_LED_RULES_ID       0x0003  /* octet string, threshold rules driving the light, see led_rules.h */
+#define ESP_ZB_ZCL_ATTR_TANK_PUMP_MODE_ID       0x0004  /* enum8, pump_mode_t, On/Off commands to bound relays */
+#define ESP_ZB_ZCL_ATTR_TANK_PUMP_HIGH_MARK_ID  0x0005  /* u16, distance of the high water mark (mm) */
+#define ESP_ZB_ZCL_ATTR_TANK_PUMP_LOW_MARK_ID   0x0006  /* u16, distance of the low water mark (mm) */
+#define ESP_ZB_ZCL_ATTR_TANK_LEAK_RATE_ID       0x0007  /* u16, smallest leak raising an alarm (0.1 mm/h), 0 disables */
+#define ESP_ZB_ZCL_ATTR_TANK_DRAIN_RATE_ID      0x0008  /* u16, rapid drain alarm rate (mm/min), 0 disables */
+#define ESP_ZB_ZCL_ATTR_TANK_OVERFLOW_MARK_ID   0x0009  /* u16, distance of the overflow (mm), 0 disables */
+#define ESP_ZB_ZCL_ATTR_TANK_ALARMS_ID          0x000A  /* bitmap8, active TREND_ALARM_* bits */
+#define ESP_ZB_ZCL_ATTR_TANK_TRACE_LEVELS_ID    0x000B  /* octet string, esp_log_level_t of each trace_module_t */
+#define ESP_ZB_TANK_VOLUME_REPORT_DELTA         (1.0f)  /* Smallest reported volume change (l) */
+#define ESP_ZB_TANK_PERCENT_REPORT_DELTA        (1)     /* Smallest reported fill change (%) */
+
+/* Alarms cluster codes, sent with the tank cluster ID */
+#define ESP_ZB_ZCL_CMD_ALARMS_ALARM_ID          0x00
+#define TANK_ALARM_CODE_LEAK                    0x01
+#define TANK_ALARM_CODE_RAPID_DRAIN             0x02
+#define TANK_ALARM_CODE_OVERFLOW                0x03
+
+/* Rest of the Alarms cluster, handled by the application on top of the stack's cluster ID */
+#define ALARMS_ATTR_ALARM_COUNT_ID              0x0000  /* u16, entries in the alarm table */
+#define ALARMS_CMD_RESET_ALARM_ID               0x00    /* client to server: code, cluster ID */
+#define ALARMS_CMD_RESET_ALL_ALARMS_ID          0x01
+#define ALARMS_CMD_GET_ALARM_ID                 0x02
+#define ALARMS_CMD_RESET_ALARM_LOG_ID           0x03
+#define ALARMS_CMD_GET_ALARM_RESPONSE_ID        0x01    /* server to client: status, code, cluster ID, time */
+
 /* Attribute values in ZCL string format
  * The string should be started with the length of its own.
  */
 #define MANUFACTURER_NAME               "\x06""Acheta"
 #define MODEL_IDENTIFIER                "\x0C""Depth.Sensor"
 
+/* Measurement pipeline state for the diagnostics console */
+typedef struct
+{
+	uint32_t interval_ms;           /* current measurement interval */
+	uint32_t measurements;          /* pings since boot */
+	uint32_t samples;               /* distance samples published */
+	uint32_t window_misses;         /* no echo inside the tracking window */
+	uint32_t ping_errors;
+	uint32_t echo_timeouts;
+	uint32_t echo_early;
+	uint32_t other_errors;
+	uint32_t window_min_us;         /* echo window of the last measurement */
+	uint32_t window_max_us;
+	uint32_t pump_commands;
+	int64_t pump_latency_max_us;    /* echo to On/Off command */
+	echo_tracker_t tracker;
+	depth_filter_t filter;
+} depth_sensor_diag_t;
+
+/**
+ * @brief Snapshot of the measurement pipeline counters and filter state
+ */
+void depth_sensor_diag(depth_sensor_diag_t *diag);
+
+/**
+ * @brief Change the measurement interval until the next reboot
+ *
+ * @return ESP_ERR_INVALID_ARG outside ESP_DIST_SENSOR_MIN_INTERVAL_MS..ESP_DIST_SENSOR_MAX_INTERVAL_MS
+ */
+esp_err_t depth_sensor_set_interval(uint32_t interval_ms);
+
+/**
+ * @brief Start a measurement now instead of at the end of the interval
+ */
+void depth_sensor_measure(void);
+
+/**
+ * @brief Write the pump, alarm and trace configuration to the tank cluster attributes
+ *
+ * For changes made outside Zigbee, takes the Zigbee lock. Does nothing before the stack is up,
+ * the cluster is created from the current configuration.
+ */
+void depth_sensor_publish_config(void);
+
 #define ESP_ZB_ZR_CONFIG()                                                              \
     {                                                                                   \
         .esp_zb_role = ESP_ZB_DEVICE_TYPE_ROUTER,                                       \
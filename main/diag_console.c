@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "diag_console.h"
+#include "diag_stream.h"
+#include "depth_sensor.h"
+#include "app_tasks.h"
+#include "join_policy.h"
+#include "pump_control.h"
+#include "sensor_bus.h"
+#include "trace.h"
+#include "trend_detector.h"
+#include "esp_check.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "DIAG_CONSOLE";
+
+static const char *const s_status_names[] = {
+		[DIAG_STREAM_SAMPLE] = "sample",
+		[DIAG_STREAM_WINDOW_MISS] = "window miss",
+		[DIAG_STREAM_TARGET_LOST] = "target lost",
+		[DIAG_STREAM_PING_ERROR] = "ping error",
+		[DIAG_STREAM_ECHO_TIMEOUT] = "echo timeout",
+		[DIAG_STREAM_ECHO_EARLY] = "echo early",
+		[DIAG_STREAM_OTHER_ERROR] = "error",
+};
+static const char *const s_pump_modes[PUMP_MODE_COUNT] = {"disabled", "drain", "fill"};
+static const char *const s_trace_modules[TRACE_MODULE_COUNT] = {"sensor", "zigbee", "light"};
+static const char *const s_log_levels[] = {"none", "error", "warn", "info", "debug", "verbose"};
+
+static int lookup(const char *const *names, int count, const char *name)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (!strcmp(names[i], name))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Number scaled to an integer unit, e.g. cm to mm */
+static bool parse_scaled(const char *text, float scale, uint32_t max, uint16_t *out)
+{
+	char *end;
+	float value = strtof(text, &end) * scale;
+	if (end == text || *end || value < 0 || value > (float) max)
+	{
+		return false;
+	}
+	*out = (uint16_t) (value + 0.5f);
+	return true;
+}
+
+static int cmd_stats(int argc, char **argv)
+{
+	depth_sensor_diag_t diag;
+	depth_sensor_diag(&diag);
+	uint32_t sent;
+	uint32_t dropped;
+	diag_stream_counters(&sent, &dropped);
+	join_stats_t join;
+	join_policy_stats(&join);
+
+	printf("measurements  %lu, every %lu ms\n", (unsigned long) diag.measurements, (unsigned long) diag.interval_ms);
+	printf("samples       %lu\n", (unsigned long) diag.samples);
+	printf("window misses %lu, target lost %lu times\n", (unsigned long) diag.window_misses,
+		   (unsigned long) diag.tracker.lost);
+	printf("errors        ping %lu, echo timeout %lu, echo early %lu, other %lu\n",
+		   (unsigned long) diag.ping_errors, (unsigned long) diag.echo_timeouts, (unsigned long) diag.echo_early,
+		   (unsigned long) diag.other_errors);
+	printf("tracker       %lu hits, %lu rejects\n", (unsigned long) diag.tracker.hits,
+		   (unsigned long) diag.tracker.rejects);
+	printf("pump          %lu commands, echo to command max %lld us\n", (unsigned long) diag.pump_commands,
+		   diag.pump_latency_max_us);
+	printf("alarms        0x%02x\n", trend_detector_alarms());
+	printf("stream        %s, %lu frames sent, %lu dropped\n", diag_stream_enabled() ? "on" : "off",
+		   (unsigned long) sent, (unsigned long) dropped);
+	printf("zigbee        %lu joins, last took %.1f s and %lu attempts, %lu retries, channel %u\n",
+		   (unsigned long) join.joins, join.last_join_us / 1e6, (unsigned long) join.last_attempts,
+		   (unsigned long) join.total_retries, join.channel);
+	app_tasks_report();
+	return 0;
+}
+
+static int cmd_filter(int argc, char **argv)
+{
+	depth_sensor_diag_t diag;
+	depth_sensor_diag(&diag);
+
+	printf("window        %u of %d samples:", diag.filter.count, DEPTH_FILTER_WINDOW);
+	for (int i = 0; i < diag.filter.count; i++)
+	{
+		/* oldest first */
+		int slot = (diag.filter.index + DEPTH_FILTER_WINDOW - diag.filter.count + i) % DEPTH_FILTER_WINDOW;
+		printf(" %.1f", diag.filter.values[slot]);
+	}
+	printf(" cm\n");
+	printf("average       %.1f cm\n", depth_filter_average(&diag.filter));
+	printf("tracker       %s, echo %.1f cm, center %.1f cm, filtered %.1f cm, half width %.1f cm, %u misses\n",
+		   diag.tracker.locked ? "locked" : "searching", diag.tracker.echo, diag.tracker.center,
+		   diag.tracker.filtered, diag.tracker.half_width, diag.tracker.misses);
+	printf("echo window   %lu..%lu us\n", (unsigned long) diag.window_min_us, (unsigned long) diag.window_max_us);
+	return 0;
+}
+
+static esp_err_t set_pump(const char *param, const char *value)
+{
+	pump_config_t config;
+	pump_control_get_config(&config);
+	if (!strcmp(param, "pump_mode"))
+	{
+		int mode = lookup(s_pump_modes, PUMP_MODE_COUNT, value);
+		ESP_RETURN_ON_FALSE(mode >= 0, ESP_ERR_INVALID_ARG, TAG, "Mode is disabled, drain or fill");
+		config.mode = (uint8_t) mode;
+	} else
+	{
+		uint16_t mark;
+		ESP_RETURN_ON_FALSE(parse_scaled(value, 10, ESP_DIST_SENSOR_MAX_VALUE * 10, &mark), ESP_ERR_INVALID_ARG,
+							TAG, "Mark is a distance in cm");
+		if (!strcmp(param, "pump_high"))
+		{
+			config.high_mark = mark;
+		} else
+		{
+			config.low_mark = mark;
+		}
+	}
+	return pump_control_set_config(&config);
+}
+
+static esp_err_t set_trend(const char *param, const char *value)
+{
+	trend_config_t config;
+	trend_detector_get_config(&config);
+	bool valid;
+	if (!strcmp(param, "leak_rate"))
+	{
+		valid = parse_scaled(value, 10, UINT16_MAX, &config.leak_rate);
+	} else if (!strcmp(param, "drain_rate"))
+	{
+		valid = parse_scaled(value, 1, UINT16_MAX, &config.drain_rate);
+	} else
+	{
+		valid = parse_scaled(value, 10, ESP_DIST_SENSOR_MAX_VALUE * 10, &config.overflow_mark);
+	}
+	ESP_RETURN_ON_FALSE(valid, ESP_ERR_INVALID_ARG, TAG, "Not a valid %s", param);
+	return trend_detector_set_config(&config);
+}
+
+static int cmd_set(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		printf("usage: set interval <ms>\n"
+			   "       set pump_mode disabled|drain|fill\n"
+			   "       set pump_high|pump_low|overflow <cm>\n"
+			   "       set leak_rate <mm/h> | drain_rate <mm/min>\n"
+			   "       set trace sensor|zigbee|light none|error|warn|info|debug|verbose\n");
+		return 1;
+	}
+	const char *param = argv[1];
+	esp_err_t err;
+	if (!strcmp(param, "interval"))
+	{
+		char *end;
+		unsigned long interval_ms = strtoul(argv[2], &end, 10);
+		err = *end ? ESP_ERR_INVALID_ARG : depth_sensor_set_interval(interval_ms);
+	} else if (!strcmp(param, "pump_mode") || !strcmp(param, "pump_high") || !strcmp(param, "pump_low"))
+	{
+		err = set_pump(param, argv[2]);
+	} else if (!strcmp(param, "leak_rate") || !strcmp(param, "drain_rate") || !strcmp(param, "overflow"))
+	{
+		err = set_trend(param, argv[2]);
+	} else if (!strcmp(param, "trace") && argc >= 4)
+	{
+		int module = lookup(s_trace_modules, TRACE_MODULE_COUNT, argv[2]);
+		int level = lookup(s_log_levels, sizeof(s_log_levels) / sizeof(s_log_levels[0]), argv[3]);
+		err = module < 0 || level < 0 ? ESP_ERR_INVALID_ARG : trace_set_level(module, level);
+	} else
+	{
+		printf("unknown parameter %s\n", param);
+		return 1;
+	}
+
+	if (err != ESP_OK)
+	{
+		printf("%s not set: %s\n", param, esp_err_to_name(err));
+		return 1;
+	}
+	/* Keep the Zigbee view in line with the change */
+	depth_sensor_publish_config();
+	return 0;
+}
+
+static int cmd_measure(int argc, char **argv)
+{
+	depth_sensor_diag_t before;
+	depth_sensor_diag(&before);
+	depth_sensor_measure();
+
+	depth_sensor_diag_t after;
+	TickType_t start = xTaskGetTickCount();
+	do
+	{
+		vTaskDelay(pdMS_TO_TICKS(10));
+		depth_sensor_diag(&after);
+	} while (after.measurements == before.measurements &&
+			 xTaskGetTickCount() - start < pdMS_TO_TICKS(DIAG_CONSOLE_MEASURE_TIMEOUT_MS));
+
+	if (after.measurements == before.measurements)
+	{
+		printf("no measurement within %d ms\n", DIAG_CONSOLE_MEASURE_TIMEOUT_MS);
+		return 1;
+	}
+	sensor_sample_t sample;
+	if (after.samples == before.samples || sensor_bus_get(SENSOR_TOPIC_DISTANCE, INT64_MAX, &sample) != ESP_OK)
+	{
+		diag_stream_status_t status = after.window_misses != before.window_misses ? DIAG_STREAM_WINDOW_MISS
+									: after.ping_errors != before.ping_errors ? DIAG_STREAM_PING_ERROR
+									: after.echo_timeouts != before.echo_timeouts ? DIAG_STREAM_ECHO_TIMEOUT
+									: after.echo_early != before.echo_early ? DIAG_STREAM_ECHO_EARLY
+									: DIAG_STREAM_OTHER_ERROR;
+		printf("%s, echo window %lu..%lu us\n", s_status_names[status], (unsigned long) after.window_min_us,
+			   (unsigned long) after.window_max_us);
+		return 1;
+	}
+	printf("distance %.1f cm (%lu us), filtered %.1f cm, echo window %lu..%lu us\n", sample.distance.raw,
+		   (unsigned long) sample.distance.echo_us, sample.distance.filtered, (unsigned long) after.window_min_us,
+		   (unsigned long) after.window_max_us);
+	return 0;
+}
+
+static int cmd_stream(int argc, char **argv)
+{
+	if (argc < 2 || (strcmp(argv[1], "on") && strcmp(argv[1], "off")))
+	{
+		printf("usage: stream on|off\n");
+		return 1;
+	}
+	diag_stream_enable(!strcmp(argv[1], "on"));
+	return 0;
+}
+
+esp_err_t diag_console_init(void)
+{
+	esp_console_repl_t *repl = NULL;
+	esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+	repl_config.prompt = DIAG_CONSOLE_PROMPT;
+	/* Below the measurement and Zigbee tasks, typing never delays them */
+	repl_config.task_priority = 1;
+#if CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG || CONFIG_ESP_CONSOLE_SECONDARY_USB_SERIAL_JTAG
+	esp_console_dev_usb_serial_jtag_config_t hw_config = ESP_CONSOLE_DEV_USB_SERIAL_JTAG_CONFIG_DEFAULT();
+	ESP_RETURN_ON_ERROR(esp_console_new_repl_usb_serial_jtag(&hw_config, &repl_config, &repl), TAG,
+						"Failed to create the USB-Serial-JTAG REPL");
+#else
+	esp_console_dev_uart_config_t hw_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+	ESP_RETURN_ON_ERROR(esp_console_new_repl_uart(&hw_config, &repl_config, &repl), TAG,
+						"Failed to create the UART REPL");
+#endif
+
+	const esp_console_cmd_t commands[] = {
+			{.command = "stats", .help = "Measurement pipeline counters", .func = cmd_stats},
+			{.command = "filter", .help = "Filter window and echo tracker state", .func = cmd_filter},
+			{.command = "set", .help = "Change a parameter, without arguments lists them",
+			 .hint = "<param> <value>", .func = cmd_set},
+			{.command = "measure", .help = "Measure now and print the result", .func = cmd_measure},
+			{.command = "stream", .help = "Binary frame per measurement, decode with tools/diag_stream.py",
+			 .hint = "on|off", .func = cmd_stream},
+	};
+	for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+	{
+		ESP_RETURN_ON_ERROR(esp_console_cmd_register(&commands[i]), TAG, "Failed to register %s",
+							commands[i].command);
+	}
+	ESP_RETURN_ON_ERROR(esp_console_register_help_command(), TAG, "Failed to register help");
+	ESP_RETURN_ON_ERROR(diag_stream_init(), TAG, "Failed to create the stream task");
+	return esp_console_start_repl(repl);
+}
@@ -0,0 +1,30 @@
+#ifndef DEPTH_SENSOR_DIAG_CONSOLE_H
+#define DEPTH_SENSOR_DIAG_CONSOLE_H
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAG_CONSOLE_PROMPT             "depth> "
+#define DIAG_CONSOLE_MEASURE_TIMEOUT_MS 500     /* measure gives up on a new sample after this long */
+
+/**
+ * @brief Start the diagnostics REPL and the sample stream writer
+ *
+ * The REPL runs on USB-Serial-JTAG when it is the primary or secondary console,
+ * on the console UART otherwise. Commands:
+ *   stats                  pipeline counters
+ *   filter                 filter window and echo tracker state
+ *   set <param> <value>    measurement interval, pump, alarm and trace settings
+ *   measure                measure now and print the result
+ *   stream on|off          binary frame per measurement, see diag_stream.h
+ */
+esp_err_t diag_console_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_DIAG_CONSOLE_H
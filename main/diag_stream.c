@@ -0,0 +1,185 @@
+#include <math.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "diag_stream.h"
+#include "app_tasks.h"
+#include "sdkconfig.h"
+#if CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG || CONFIG_ESP_CONSOLE_SECONDARY_USB_SERIAL_JTAG
+#include "driver/usb_serial_jtag.h"
+#else
+#include "driver/uart.h"
+#endif
+
+typedef struct
+{
+	diag_stream_sample_t sample;
+	uint16_t seq;
+} diag_stream_entry_t;
+
+static volatile bool s_enabled;
+
+/* The measurement task is the only producer, the writer task the only consumer */
+static portMUX_TYPE s_ring_mux = portMUX_INITIALIZER_UNLOCKED;
+static diag_stream_entry_t s_ring[DIAG_STREAM_RING_SIZE];
+static uint32_t s_head;
+static uint32_t s_tail;
+static uint16_t s_seq;
+static uint32_t s_sent;
+static uint32_t s_dropped;
+
+void diag_stream_enable(bool enable)
+{
+	s_enabled = enable;
+}
+
+bool diag_stream_enabled(void)
+{
+	return s_enabled;
+}
+
+void diag_stream_record(const diag_stream_sample_t *sample)
+{
+	if (!s_enabled)
+	{
+		return;
+	}
+
+	bool was_empty = false;
+	portENTER_CRITICAL(&s_ring_mux);
+	uint16_t seq = s_seq++;
+	if (s_head - s_tail == DIAG_STREAM_RING_SIZE)
+	{
+		s_dropped++;
+	} else
+	{
+		was_empty = s_head == s_tail;
+		s_ring[s_head % DIAG_STREAM_RING_SIZE] = (diag_stream_entry_t) {.sample = *sample, .seq = seq};
+		s_head++;
+	}
+	portEXIT_CRITICAL(&s_ring_mux);
+
+	TaskHandle_t writer = app_task_handle(APP_TASK_DIAG_STREAM);
+	if (was_empty && writer)
+	{
+		xTaskNotifyGive(writer);
+	}
+}
+
+static uint8_t diag_stream_crc8(const uint8_t *data, size_t len)
+{
+	uint8_t crc = 0;
+	for (size_t i = 0; i < len; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = crc & 0x80 ? (uint8_t) ((crc << 1) ^ 0x07) : (uint8_t) (crc << 1);
+		}
+	}
+	return crc;
+}
+
+static uint8_t *put_u16(uint8_t *out, uint32_t value)
+{
+	value = value > UINT16_MAX ? UINT16_MAX : value;
+	out[0] = (uint8_t) value;
+	out[1] = (uint8_t) (value >> 8);
+	return out + 2;
+}
+
+static uint16_t cm_to_mm(float cm)
+{
+	if (isnan(cm) || cm < 0)
+	{
+		return UINT16_MAX;
+	}
+	float mm = roundf(cm * 10);
+	return mm >= UINT16_MAX ? UINT16_MAX - 1 : (uint16_t) mm;
+}
+
+size_t diag_stream_encode(const diag_stream_sample_t *sample, uint16_t seq, uint8_t *frame)
+{
+	bool valid = sample->status == DIAG_STREAM_SAMPLE;
+	uint32_t timestamp_ms = (uint32_t) (sample->timestamp_us / 1000);
+
+	frame[0] = DIAG_STREAM_SYNC_0;
+	frame[1] = DIAG_STREAM_SYNC_1;
+	frame[2] = DIAG_STREAM_PAYLOAD_SIZE;
+	uint8_t *out = put_u16(frame + 3, seq);
+	out = put_u16(out, timestamp_ms & 0xFFFF);
+	out = put_u16(out, timestamp_ms >> 16);
+	*out++ = (uint8_t) sample->status;
+	out = put_u16(out, valid ? sample->echo_us : 0);
+	out = put_u16(out, valid ? cm_to_mm(sample->raw) : UINT16_MAX);
+	out = put_u16(out, valid ? cm_to_mm(sample->filtered) : UINT16_MAX);
+	out = put_u16(out, sample->window_min_us);
+	out = put_u16(out, sample->window_max_us);
+	*out = diag_stream_crc8(frame + 2, DIAG_STREAM_PAYLOAD_SIZE + 1);
+	return DIAG_STREAM_FRAME_SIZE;
+}
+
+static int diag_stream_write(const uint8_t *frame, size_t len)
+{
+#if CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG || CONFIG_ESP_CONSOLE_SECONDARY_USB_SERIAL_JTAG
+	return usb_serial_jtag_write_bytes(frame, len, pdMS_TO_TICKS(DIAG_STREAM_WRITE_TIMEOUT));
+#else
+	/* uart_write_bytes() blocks until the frame is queued, wait for the previous one with a bound instead.
+	 * Once it is out, a frame fits the hardware FIFO and the write returns at once. */
+	if (uart_wait_tx_done(CONFIG_ESP_CONSOLE_UART_NUM, pdMS_TO_TICKS(DIAG_STREAM_WRITE_TIMEOUT)) != ESP_OK)
+	{
+		return -1;
+	}
+	return uart_write_bytes(CONFIG_ESP_CONSOLE_UART_NUM, frame, len);
+#endif
+}
+
+/* Lowest priority, a slow or absent host only ever delays this task */
+static void diag_stream_task(void *pvParameters)
+{
+	uint8_t frame[DIAG_STREAM_FRAME_SIZE];
+	while (true)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		while (true)
+		{
+			diag_stream_entry_t entry;
+			portENTER_CRITICAL(&s_ring_mux);
+			bool empty = s_head == s_tail;
+			if (!empty)
+			{
+				entry = s_ring[s_tail % DIAG_STREAM_RING_SIZE];
+				s_tail++;
+			}
+			portEXIT_CRITICAL(&s_ring_mux);
+			if (empty)
+			{
+				break;
+			}
+
+			size_t len = diag_stream_encode(&entry.sample, entry.seq, frame);
+			bool written = diag_stream_write(frame, len) == (int) len;
+			portENTER_CRITICAL(&s_ring_mux);
+			if (written)
+			{
+				s_sent++;
+			} else
+			{
+				s_dropped++;
+			}
+			portEXIT_CRITICAL(&s_ring_mux);
+		}
+	}
+}
+
+esp_err_t diag_stream_init(void)
+{
+	return app_task_create(APP_TASK_DIAG_STREAM, diag_stream_task, NULL);
+}
+
+void diag_stream_counters(uint32_t *sent, uint32_t *dropped)
+{
+	portENTER_CRITICAL(&s_ring_mux);
+	*sent = s_sent;
+	*dropped = s_dropped;
+	portEXIT_CRITICAL(&s_ring_mux);
+}
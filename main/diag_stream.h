@@ -0,0 +1,94 @@
+#ifndef DEPTH_SENSOR_DIAG_STREAM_H
+#define DEPTH_SENSOR_DIAG_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAG_STREAM_RING_SIZE       16      /* frames, power of two */
+#define DIAG_STREAM_WRITE_TIMEOUT   10      /* ms the writer waits for the host to take a frame */
+
+/* Frame on the wire, little endian, decoded by tools/diag_stream.py:
+ *   0xA5 0x5A, u8 payload length, payload, u8 CRC-8 (poly 0x07) of length and payload
+ * Payload:
+ *   u16 sequence, gaps are frames dropped on the device
+ *   u32 measurement time (ms since boot)
+ *   u8  diag_stream_status_t
+ *   u16 echo pulse length (us), 0 without an echo
+ *   u16 raw distance (mm), 0xFFFF without an echo
+ *   u16 filtered distance (mm), 0xFFFF without an echo
+ *   u16 echo window start (us)
+ *   u16 echo window end (us) */
+#define DIAG_STREAM_SYNC_0          0xA5
+#define DIAG_STREAM_SYNC_1          0x5A
+#define DIAG_STREAM_PAYLOAD_SIZE    17
+#define DIAG_STREAM_FRAME_SIZE      (DIAG_STREAM_PAYLOAD_SIZE + 4)
+
+typedef enum
+{
+	DIAG_STREAM_SAMPLE,         /* echo inside the window */
+	DIAG_STREAM_WINDOW_MISS,    /* no echo inside the tracking window */
+	DIAG_STREAM_TARGET_LOST,    /* window miss that unlocked the tracker */
+	DIAG_STREAM_PING_ERROR,     /* ping could not be sent */
+	DIAG_STREAM_ECHO_TIMEOUT,
+	DIAG_STREAM_ECHO_EARLY,
+	DIAG_STREAM_OTHER_ERROR,
+} diag_stream_status_t;
+
+typedef struct
+{
+	int64_t timestamp_us;
+	diag_stream_status_t status;
+	uint32_t echo_us;
+	float raw;                  /* cm, ignored unless status is DIAG_STREAM_SAMPLE */
+	float filtered;             /* cm */
+	uint32_t window_min_us;
+	uint32_t window_max_us;
+} diag_stream_sample_t;
+
+/**
+ * @brief Create the writer task, the stream starts disabled
+ */
+esp_err_t diag_stream_init(void);
+
+/**
+ * @brief Start or stop streaming a frame for every measurement
+ */
+void diag_stream_enable(bool enable);
+
+/**
+ * @brief Whether frames are being streamed
+ */
+bool diag_stream_enabled(void);
+
+/**
+ * @brief Queue the frame of one measurement
+ *
+ * Meant for the measurement task: costs a flag check while disabled and a copy
+ * into the ring otherwise. The frame is dropped when the ring is full.
+ */
+void diag_stream_record(const diag_stream_sample_t *sample);
+
+/**
+ * @brief Encode a measurement as a frame
+ *
+ * @param frame DIAG_STREAM_FRAME_SIZE bytes
+ * @return Frame length
+ */
+size_t diag_stream_encode(const diag_stream_sample_t *sample, uint16_t seq, uint8_t *frame);
+
+/**
+ * @brief Frames written to the host and dropped since boot
+ */
+void diag_stream_counters(uint32_t *sent, uint32_t *dropped);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_DIAG_STREAM_H
@@ -0,0 +1,71 @@
+#include <math.h>
+#include <string.h>
+#include "echo_tracker.h"
+
+void echo_tracker_reset(echo_tracker_t *tracker)
+{
+	tracker->locked = false;
+	tracker->misses = 0;
+	tracker->half_width = ECHO_TRACKER_MAX_HALF_WIDTH;
+}
+
+void echo_tracker_window(const echo_tracker_t *tracker, float max_distance, float us_per_cm,
+						 uint32_t *min_us, uint32_t *max_us)
+{
+	float low = 0.0f;
+	float high = max_distance;
+	if (tracker->locked)
+	{
+		/* A step or a ramp shows in the echo before the filtered level follows */
+		low = (tracker->center < tracker->filtered ? tracker->center : tracker->filtered) - tracker->half_width;
+		high = (tracker->center > tracker->filtered ? tracker->center : tracker->filtered) + tracker->half_width;
+		low = low < 0.0f ? 0.0f : low;
+		high = high > max_distance ? max_distance : high;
+	}
+	*min_us = (uint32_t) (low * us_per_cm);
+	*max_us = (uint32_t) (high * us_per_cm);
+}
+
+void echo_tracker_hit(echo_tracker_t *tracker, float distance, float filtered)
+{
+	/* An echo near the previous one is the surface, a lone one may be a spurious reflection. The
+	 * previous echo survives losing the target, so reacquiring compares against it too */
+	bool confirmed = tracker->echo > 0.0f && fabsf(distance - tracker->echo) <= tracker->half_width;
+	if (tracker->locked)
+	{
+		tracker->hits++;
+		tracker->half_width *= 0.75f;
+		if (tracker->half_width < ECHO_TRACKER_MIN_HALF_WIDTH)
+		{
+			tracker->half_width = ECHO_TRACKER_MIN_HALF_WIDTH;
+		}
+	} else
+	{
+		/* Acquired from a full range search, start with a wide window */
+		tracker->locked = true;
+		tracker->half_width = ECHO_TRACKER_MAX_HALF_WIDTH;
+	}
+	tracker->echo = distance;
+	tracker->center = confirmed ? distance : filtered;
+	tracker->filtered = filtered;
+	tracker->misses = 0;
+}
+
+void echo_tracker_miss(echo_tracker_t *tracker)
+{
+	if (!tracker->locked)
+	{
+		return;
+	}
+	tracker->rejects++;
+	tracker->half_width *= 2.0f;
+	if (tracker->half_width > ECHO_TRACKER_MAX_HALF_WIDTH)
+	{
+		tracker->half_width = ECHO_TRACKER_MAX_HALF_WIDTH;
+	}
+	if (++tracker->misses >= ECHO_TRACKER_MAX_MISSES)
+	{
+		tracker->lost++;
+		echo_tracker_reset(tracker);
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef DEPTH_SENSOR_ECHO_TRACKER_H
+#define DEPTH_SENSOR_ECHO_TRACKER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Tracking window configuration */
+#define ECHO_TRACKER_MIN_HALF_WIDTH     (3.0f)  /* Narrowest window around the prediction (cm) */
+#define ECHO_TRACKER_MAX_HALF_WIDTH     (30.0f) /* Widest window before falling back to full range (cm) */
+#define ECHO_TRACKER_MAX_MISSES         (3)     /* Consecutive misses until the target counts as lost */
+
+/**
+ * Expected echo window from the last accepted echo to the filtered level
+ */
+typedef struct
+{
+	bool locked;
+	float echo;                 /* last accepted echo (cm) */
+	float center;               /* that echo once confirmed, the filtered level until then (cm) */
+	float filtered;             /* filtered level after the last accepted echo (cm) */
+	float half_width;           /* current window half width (cm) */
+	uint8_t misses;             /* consecutive samples without an echo in the window */
+	uint32_t hits;              /* statistics since boot */
+	uint32_t rejects;
+	uint32_t lost;
+} echo_tracker_t;
+
+/**
+ * @brief Forget the target, the next measurement searches the full range
+ */
+void echo_tracker_reset(echo_tracker_t *tracker);
+
+/**
+ * @brief Echo time window for the next measurement
+ *
+ * @param tracker        Tracker state
+ * @param max_distance   Full measurement range (cm)
+ * @param us_per_cm      Round trip time per centimetre at the current speed of sound
+ * @param[out] min_us    Shortest echo to accept
+ * @param[out] max_us    Longest echo to wait for
+ */
+void echo_tracker_window(const echo_tracker_t *tracker, float max_distance, float us_per_cm,
+						 uint32_t *min_us, uint32_t *max_us);
+
+/**
+ * @brief Report an accepted echo
+ *
+ * Narrows the window and moves it to span the echo and the new filtered level,
+ * so a step or a ramp stays inside it while the filter catches up. An echo counts
+ * only once the next one lands within the window of it, a lone spurious echo
+ * leaves the window on the filtered level.
+ *
+ * @param tracker    Tracker state
+ * @param distance   Distance of the accepted echo (cm)
+ * @param filtered   Filtered distance after the sample (cm)
+ */
+void echo_tracker_hit(echo_tracker_t *tracker, float distance, float filtered);
+
+/**
+ * @brief Report a measurement without an echo inside the window
+ *
+ * Widens the window; after ECHO_TRACKER_MAX_MISSES in a row the target is lost.
+ */
+void echo_tracker_miss(echo_tracker_t *tracker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_ECHO_TRACKER_H
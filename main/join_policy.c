@@ -0,0 +1,189 @@
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include "join_policy.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#define JOIN_POLICY_NAMESPACE "join"
+#define JOIN_POLICY_KEY       "network"
+#define JOIN_POLICY_VERSION   2     /* 1 kept the PAN ID, which a conflict can change */
+
+typedef struct
+{
+	uint16_t version;
+	uint16_t size;
+	uint8_t channel;
+	uint8_t extended_pan_id[JOIN_EXTENDED_PAN_ID_SIZE];
+} join_policy_record_t;
+
+static const char *TAG = "JOIN_POLICY";
+
+/* Driven by the Zigbee task, read by the console */
+static portMUX_TYPE s_join_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_channel_mask;
+static uint32_t s_rand;
+static int64_t s_start_us;
+static join_stats_t s_stats;
+
+/* xorshift32, the jitter only has to differ between devices */
+static uint32_t join_policy_rand(void)
+{
+	s_rand ^= s_rand << 13;
+	s_rand ^= s_rand >> 17;
+	s_rand ^= s_rand << 5;
+	return s_rand;
+}
+
+esp_err_t join_policy_init(uint32_t channel_mask, uint32_t seed)
+{
+	portENTER_CRITICAL(&s_join_mux);
+	s_channel_mask = channel_mask;
+	s_rand = seed ? seed : 0x2545f491;
+	portEXIT_CRITICAL(&s_join_mux);
+
+	join_policy_record_t record;
+	nvs_handle_t handle;
+	size_t size = sizeof(record);
+	esp_err_t err = nvs_open(JOIN_POLICY_NAMESPACE, NVS_READONLY, &handle);
+	if (err == ESP_OK)
+	{
+		err = nvs_get_blob(handle, JOIN_POLICY_KEY, &record, &size);
+		nvs_close(handle);
+	}
+	if (err == ESP_OK && (size != sizeof(record) || record.version != JOIN_POLICY_VERSION ||
+						  record.size != sizeof(record) || record.channel >= 32 ||
+						  !(channel_mask & (1U << record.channel))))
+	{
+		err = ESP_ERR_INVALID_VERSION;
+	}
+	if (err != ESP_OK)
+	{
+		/* never joined before, or not on an allowed channel any more */
+		return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+	}
+	portENTER_CRITICAL(&s_join_mux);
+	s_stats.channel = record.channel;
+	memcpy(s_stats.extended_pan_id, record.extended_pan_id, sizeof(s_stats.extended_pan_id));
+	portEXIT_CRITICAL(&s_join_mux);
+	ESP_LOGI(TAG, "Cached network on channel %u", record.channel);
+	return ESP_OK;
+}
+
+void join_policy_start(int64_t now_us)
+{
+	portENTER_CRITICAL(&s_join_mux);
+	s_start_us = now_us;
+	s_stats.attempts = 0;
+	s_stats.retries = 0;
+	s_stats.next_delay_ms = 0;
+	portEXIT_CRITICAL(&s_join_mux);
+}
+
+void join_policy_channels(uint32_t *primary_mask, uint32_t *secondary_mask,
+						  uint8_t extended_pan_id[JOIN_EXTENDED_PAN_ID_SIZE])
+{
+	portENTER_CRITICAL(&s_join_mux);
+	s_stats.attempts++;
+	s_stats.total_attempts++;
+	if (s_stats.channel)
+	{
+		uint32_t cached = 1U << s_stats.channel;
+		*primary_mask = cached;
+		/* the network may have moved, or the device to another one, look everywhere now and then */
+		bool full_scan = s_stats.attempts % JOIN_FULL_SCAN_INTERVAL == 0;
+		*secondary_mask = full_scan ? s_channel_mask & ~cached : 0;
+		if (full_scan)
+		{
+			memset(extended_pan_id, 0, JOIN_EXTENDED_PAN_ID_SIZE);
+		} else
+		{
+			memcpy(extended_pan_id, s_stats.extended_pan_id, JOIN_EXTENDED_PAN_ID_SIZE);
+		}
+	} else
+	{
+		*primary_mask = s_channel_mask;
+		*secondary_mask = 0;
+		memset(extended_pan_id, 0, JOIN_EXTENDED_PAN_ID_SIZE);
+	}
+	portEXIT_CRITICAL(&s_join_mux);
+}
+
+uint32_t join_policy_failed(void)
+{
+	portENTER_CRITICAL(&s_join_mux);
+	uint32_t shift = s_stats.retries < 16 ? s_stats.retries : 16;
+	uint32_t cap = (uint32_t) JOIN_BACKOFF_BASE_MS << shift;
+	cap = cap < JOIN_BACKOFF_MAX_MS ? cap : JOIN_BACKOFF_MAX_MS;
+	uint32_t delay_ms = cap / 2 + join_policy_rand() % (cap / 2 + 1);
+	s_stats.retries++;
+	s_stats.total_retries++;
+	s_stats.next_delay_ms = delay_ms;
+	portEXIT_CRITICAL(&s_join_mux);
+	return delay_ms;
+}
+
+static esp_err_t join_policy_store(uint8_t channel, const uint8_t extended_pan_id[JOIN_EXTENDED_PAN_ID_SIZE])
+{
+	join_policy_record_t record = {
+			.version = JOIN_POLICY_VERSION,
+			.size = sizeof(record),
+			.channel = channel,
+	};
+	memcpy(record.extended_pan_id, extended_pan_id, sizeof(record.extended_pan_id));
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(JOIN_POLICY_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+	err = nvs_set_blob(handle, JOIN_POLICY_KEY, &record, sizeof(record));
+	if (err == ESP_OK)
+	{
+		err = nvs_commit(handle);
+	}
+	nvs_close(handle);
+	return err;
+}
+
+esp_err_t join_policy_joined(uint8_t channel, const uint8_t extended_pan_id[JOIN_EXTENDED_PAN_ID_SIZE],
+							 int64_t now_us)
+{
+	portENTER_CRITICAL(&s_join_mux);
+	bool changed = channel != s_stats.channel ||
+				   memcmp(extended_pan_id, s_stats.extended_pan_id, sizeof(s_stats.extended_pan_id)) != 0;
+	uint8_t old_channel = s_stats.channel;
+	s_stats.joins++;
+	s_stats.last_attempts = s_stats.attempts;
+	s_stats.last_join_us = now_us - s_start_us;
+	s_stats.attempts = 0;
+	s_stats.retries = 0;
+	s_stats.next_delay_ms = 0;
+	portEXIT_CRITICAL(&s_join_mux);
+
+	if (!changed || channel >= 32 || !(s_channel_mask & (1U << channel)))
+	{
+		return ESP_OK;
+	}
+	/* only a different network costs a flash write */
+	esp_err_t err = join_policy_store(channel, extended_pan_id);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+	portENTER_CRITICAL(&s_join_mux);
+	s_stats.channel = channel;
+	memcpy(s_stats.extended_pan_id, extended_pan_id, sizeof(s_stats.extended_pan_id));
+	portEXIT_CRITICAL(&s_join_mux);
+	if (old_channel)
+	{
+		ESP_LOGI(TAG, "Network changed from channel %u to %u", old_channel, channel);
+	}
+	return ESP_OK;
+}
+
+void join_policy_stats(join_stats_t *stats)
+{
+	portENTER_CRITICAL(&s_join_mux);
+	*stats = s_stats;
+	portEXIT_CRITICAL(&s_join_mux);
+}
@@ -0,0 +1,86 @@
+#ifndef DEPTH_SENSOR_JOIN_POLICY_H
+#define DEPTH_SENSOR_JOIN_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JOIN_BACKOFF_BASE_MS        1000                /* delay after the first failure */
+#define JOIN_BACKOFF_MAX_MS         (5 * 60 * 1000)     /* the doubling stops here */
+#define JOIN_FULL_SCAN_INTERVAL     4                   /* with a cached channel, every 4th attempt scans all */
+#define JOIN_EXTENDED_PAN_ID_SIZE   8
+
+/* Statistics since boot, for the console and the log */
+typedef struct
+{
+	uint32_t joins;             /* successful joins and rejoins */
+	uint32_t attempts;          /* steering attempts since commissioning last started */
+	uint32_t retries;           /* failed initializations and steerings since then */
+	uint32_t total_attempts;
+	uint32_t total_retries;
+	uint32_t last_attempts;     /* steering attempts the last join took, 0 for a rejoin on reboot */
+	int64_t last_join_us;       /* time the last join took, from boot or from leaving */
+	uint32_t next_delay_ms;     /* backoff of the last retry */
+	uint8_t channel;            /* cached channel, 0 for none */
+	uint8_t extended_pan_id[JOIN_EXTENDED_PAN_ID_SIZE];     /* cached network, least significant byte first */
+} join_stats_t;
+
+/**
+ * @brief Load the cached network from NVS
+ *
+ * NVS has to be initialized already.
+ *
+ * @param channel_mask Channels the device may join on, the cache is ignored outside of them
+ * @param seed         Random seed of the backoff jitter, different for every device
+ */
+esp_err_t join_policy_init(uint32_t channel_mask, uint32_t seed);
+
+/**
+ * @brief Start counting a new commissioning, after boot or after leaving the network
+ */
+void join_policy_start(int64_t now_us);
+
+/**
+ * @brief Channels and network for the next steering attempt, counts the attempt
+ *
+ * The cached channel alone, limited to the cached extended PAN ID so a
+ * neighbouring network open for joining on that channel is not taken. Every
+ * JOIN_FULL_SCAN_INTERVAL-th attempt adds all channels as secondary set and
+ * accepts any network, the device may have been moved to a new coordinator.
+ * All channels and any network when nothing is cached.
+ *
+ * @param extended_pan_id Network to join, all zeros for any
+ */
+void join_policy_channels(uint32_t *primary_mask, uint32_t *secondary_mask,
+						  uint8_t extended_pan_id[JOIN_EXTENDED_PAN_ID_SIZE]);
+
+/**
+ * @brief Delay before retrying after a failed initialization or steering
+ *
+ * Doubles from JOIN_BACKOFF_BASE_MS up to JOIN_BACKOFF_MAX_MS and is drawn from
+ * the upper half of that, so devices that failed together spread out.
+ */
+uint32_t join_policy_failed(void);
+
+/**
+ * @brief Record a successful join or rejoin and cache its network
+ *
+ * @return ESP_OK, or the NVS error when the new network could not be stored
+ */
+esp_err_t join_policy_joined(uint8_t channel, const uint8_t extended_pan_id[JOIN_EXTENDED_PAN_ID_SIZE],
+							 int64_t now_us);
+
+/**
+ * @brief Join statistics and the cached network
+ */
+void join_policy_stats(join_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_JOIN_POLICY_H
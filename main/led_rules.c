@@ -0,0 +1,306 @@
+#include <math.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include "led_rules.h"
+#include "light_driver.h"
+#include "sensor_bus.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#define LED_RULES_NAMESPACE     "led_rules"
+#define LED_RULES_KEY           "rules"
+#define LED_RULES_BLINK_UNIT_MS 100
+#define LED_RULES_NONE          (-1)
+
+typedef struct
+{
+	uint8_t source;
+	uint8_t op;
+	int16_t threshold;          /* 0.1 cm or 0.1 degC */
+	uint16_t hysteresis;        /* 0.1 cm or 0.1 degC */
+	uint8_t red;
+	uint8_t green;
+	uint8_t blue;
+	uint8_t level;
+	uint8_t blink;              /* half period in LED_RULES_BLINK_UNIT_MS, 0 steady */
+} led_rule_t;
+
+typedef struct
+{
+	uint8_t count;
+	led_rule_t rules[LED_RULES_MAX];
+} led_rules_table_t;
+
+static const char *TAG = "LED_RULES";
+
+/* Written by the Zigbee task, evaluated by whichever task publishes samples */
+static portMUX_TYPE s_rules_mux = portMUX_INITIALIZER_UNLOCKED;
+static led_rules_table_t s_table;
+static bool s_active[LED_RULES_MAX];
+static int32_t s_last_value[LED_RULE_SOURCE_COUNT];
+static bool s_last_valid[LED_RULE_SOURCE_COUNT];
+static int s_winner = LED_RULES_NONE;
+static uint32_t s_generation;
+
+/* Only the timer callback touches the light, so blinking and rule changes never race */
+static StaticTimer_t s_timer_buffer;
+static TimerHandle_t s_timer;
+static uint32_t s_shown_generation;
+static bool s_blink_on;
+
+static esp_err_t led_rules_decode(const uint8_t *data, size_t len, led_rules_table_t *table)
+{
+	if (len < 1 || data[0] > LED_RULES_MAX || len < (size_t) (1 + data[0] * LED_RULES_RULE_SIZE))
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+	memset(table, 0, sizeof(*table));
+	table->count = data[0];
+	const uint8_t *p = data + 1;
+	for (int i = 0; i < table->count; i++, p += LED_RULES_RULE_SIZE)
+	{
+		led_rule_t *rule = &table->rules[i];
+		rule->source = p[0];
+		rule->op = p[1];
+		rule->threshold = (int16_t) (p[2] | p[3] << 8);
+		rule->hysteresis = (uint16_t) (p[4] | p[5] << 8);
+		rule->red = p[6];
+		rule->green = p[7];
+		rule->blue = p[8];
+		rule->level = p[9];
+		rule->blink = p[10];
+		if (rule->source >= LED_RULE_SOURCE_COUNT || rule->op >= LED_RULE_OP_COUNT)
+		{
+			return ESP_ERR_INVALID_ARG;
+		}
+	}
+	return ESP_OK;
+}
+
+static bool led_rule_update(const led_rule_t *rule, bool active, int32_t value)
+{
+	if (rule->op == LED_RULE_OP_ABOVE)
+	{
+		return active ? value >= rule->threshold - rule->hysteresis : value > rule->threshold;
+	}
+	return active ? value <= rule->threshold + rule->hysteresis : value < rule->threshold;
+}
+
+/* Called with s_rules_mux held, returns true when another rule took over the light */
+static bool led_rules_evaluate_locked(led_rule_source_t source, int32_t value)
+{
+	s_last_value[source] = value;
+	s_last_valid[source] = true;
+
+	int winner = LED_RULES_NONE;
+	for (int i = 0; i < s_table.count; i++)
+	{
+		const led_rule_t *rule = &s_table.rules[i];
+		if (rule->source == source)
+		{
+			s_active[i] = led_rule_update(rule, s_active[i], value);
+		}
+		if (s_active[i] && winner == LED_RULES_NONE)
+		{
+			winner = i;
+		}
+	}
+	if (winner == s_winner)
+	{
+		return false;
+	}
+	s_winner = winner;
+	s_generation++;
+	return true;
+}
+
+static void led_rules_kick(void)
+{
+	/* Shortest period, the callback applies the new winner on the next tick */
+	xTimerChangePeriod(s_timer, 1, 0);
+}
+
+static void led_rules_update(led_rule_source_t source, float value)
+{
+	int32_t tenths = (int32_t) lroundf(value * 10.0f);
+	portENTER_CRITICAL(&s_rules_mux);
+	bool changed = led_rules_evaluate_locked(source, tenths);
+	portEXIT_CRITICAL(&s_rules_mux);
+	if (changed)
+	{
+		led_rules_kick();
+	}
+}
+
+static void led_rules_timer_cb(TimerHandle_t timer)
+{
+	portENTER_CRITICAL(&s_rules_mux);
+	int winner = s_winner;
+	uint32_t generation = s_generation;
+	led_rule_t rule = winner != LED_RULES_NONE ? s_table.rules[winner] : (led_rule_t) {0};
+	portEXIT_CRITICAL(&s_rules_mux);
+
+	if (winner == LED_RULES_NONE)
+	{
+		s_shown_generation = generation;
+		light_driver_set_override(false, 0, 0, 0);
+		ESP_LOGI(TAG, "No rule active, light released");
+		return;
+	}
+	if (generation != s_shown_generation)
+	{
+		s_shown_generation = generation;
+		s_blink_on = true;
+		ESP_LOGI(TAG, "Rule %d active", winner);
+	} else
+	{
+		s_blink_on = !s_blink_on;
+	}
+	if (s_blink_on)
+	{
+		light_driver_set_override(true, (uint8_t) (rule.red * rule.level / 255),
+								  (uint8_t) (rule.green * rule.level / 255), (uint8_t) (rule.blue * rule.level / 255));
+	} else
+	{
+		light_driver_set_override(true, 0, 0, 0);
+	}
+	if (rule.blink)
+	{
+		xTimerChangePeriod(timer, pdMS_TO_TICKS(rule.blink * LED_RULES_BLINK_UNIT_MS), 0);
+	}
+}
+
+static void led_rules_distance_subscriber(const sensor_sample_t *sample, void *ctx)
+{
+	led_rules_update(LED_RULE_SOURCE_DISTANCE, sample->distance.filtered);
+}
+
+static void led_rules_temperature_subscriber(const sensor_sample_t *sample, void *ctx)
+{
+	led_rules_update(LED_RULE_SOURCE_TEMPERATURE, sample->temperature.celsius);
+}
+
+/* Start over from the new table, using the last sample of every source */
+static void led_rules_apply(const led_rules_table_t *table)
+{
+	portENTER_CRITICAL(&s_rules_mux);
+	s_table = *table;
+	memset(s_active, 0, sizeof(s_active));
+	bool changed = s_winner != LED_RULES_NONE;
+	s_winner = LED_RULES_NONE;
+	for (int source = 0; source < LED_RULE_SOURCE_COUNT; source++)
+	{
+		if (s_last_valid[source])
+		{
+			led_rules_evaluate_locked(source, s_last_value[source]);
+		}
+	}
+	changed |= s_winner != LED_RULES_NONE;
+	s_generation++;
+	portEXIT_CRITICAL(&s_rules_mux);
+	if (changed)
+	{
+		led_rules_kick();
+	}
+}
+
+esp_err_t led_rules_init(void)
+{
+	s_timer = xTimerCreateStatic("led_rules", 1, pdFALSE, NULL, led_rules_timer_cb, &s_timer_buffer);
+	ESP_RETURN_ON_FALSE(s_timer, ESP_ERR_NO_MEM, TAG, "Failed to create blink timer");
+	ESP_RETURN_ON_ERROR(sensor_bus_subscribe(SENSOR_TOPIC_DISTANCE, led_rules_distance_subscriber, NULL), TAG,
+						"Failed to subscribe to distance");
+	ESP_RETURN_ON_ERROR(sensor_bus_subscribe(SENSOR_TOPIC_TEMPERATURE, led_rules_temperature_subscriber, NULL), TAG,
+						"Failed to subscribe to temperature");
+
+	nvs_handle_t handle;
+	uint8_t data[LED_RULES_WIRE_SIZE];
+	size_t size = sizeof(data);
+	esp_err_t err = nvs_open(LED_RULES_NAMESPACE, NVS_READONLY, &handle);
+	if (err != ESP_OK)
+	{
+		return ESP_OK;
+	}
+	err = nvs_get_blob(handle, LED_RULES_KEY, data, &size);
+	nvs_close(handle);
+	if (err == ESP_ERR_NVS_NOT_FOUND)
+	{
+		return ESP_OK;
+	}
+	led_rules_table_t table;
+	if (err == ESP_OK)
+	{
+		err = led_rules_decode(data, size, &table);
+	}
+	if (err != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Stored rules are unusable: %s", esp_err_to_name(err));
+		return err;
+	}
+	led_rules_apply(&table);
+	ESP_LOGI(TAG, "Loaded %d rules", table.count);
+	return ESP_OK;
+}
+
+esp_err_t led_rules_set(const uint8_t *data, size_t len)
+{
+	led_rules_table_t table;
+	esp_err_t err = led_rules_decode(data, len, &table);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+
+	nvs_handle_t handle;
+	err = nvs_open(LED_RULES_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+	size_t size = 1 + table.count * LED_RULES_RULE_SIZE;
+	err = table.count ? nvs_set_blob(handle, LED_RULES_KEY, data, size) : nvs_erase_key(handle, LED_RULES_KEY);
+	if (err == ESP_ERR_NVS_NOT_FOUND)
+	{
+		err = ESP_OK;
+	}
+	if (err == ESP_OK)
+	{
+		err = nvs_commit(handle);
+	}
+	nvs_close(handle);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+	led_rules_apply(&table);
+	ESP_LOGI(TAG, "New rule table with %d rules", table.count);
+	return ESP_OK;
+}
+
+void led_rules_encode(uint8_t *zcl_str)
+{
+	memset(zcl_str, 0, LED_RULES_WIRE_SIZE + 1);
+	zcl_str[0] = LED_RULES_WIRE_SIZE;
+	portENTER_CRITICAL(&s_rules_mux);
+	led_rules_table_t table = s_table;
+	portEXIT_CRITICAL(&s_rules_mux);
+	zcl_str[1] = table.count;
+	uint8_t *p = zcl_str + 2;
+	for (int i = 0; i < table.count; i++, p += LED_RULES_RULE_SIZE)
+	{
+		const led_rule_t *rule = &table.rules[i];
+		p[0] = rule->source;
+		p[1] = rule->op;
+		p[2] = (uint16_t) rule->threshold & 0xff;
+		p[3] = (uint16_t) rule->threshold >> 8;
+		p[4] = rule->hysteresis & 0xff;
+		p[5] = rule->hysteresis >> 8;
+		p[6] = rule->red;
+		p[7] = rule->green;
+		p[8] = rule->blue;
+		p[9] = rule->level;
+		p[10] = rule->blink;
+	}
+}
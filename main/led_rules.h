@@ -0,0 +1,67 @@
+#ifndef DEPTH_SENSOR_LED_RULES_H
+#define DEPTH_SENSOR_LED_RULES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LED_RULES_MAX           8
+/* u8 source, u8 op, s16 threshold, u16 hysteresis (both 0.1 cm or 0.1 degC),
+ * u8 red, green, blue, level, u8 blink half period (100 ms, 0 steady), little endian */
+#define LED_RULES_RULE_SIZE     11
+/* Wire format: u8 rule count followed by LED_RULES_MAX rules, unused ones zeroed.
+ * Always the full size, so the ZCL octet string attribute never changes length. */
+#define LED_RULES_WIRE_SIZE     (1 + LED_RULES_MAX * LED_RULES_RULE_SIZE)
+
+typedef enum
+{
+	LED_RULE_SOURCE_DISTANCE = 0,
+	LED_RULE_SOURCE_TEMPERATURE,
+	LED_RULE_SOURCE_COUNT,
+} led_rule_source_t;
+
+typedef enum
+{
+	LED_RULE_OP_ABOVE = 0,      /* active above threshold, released below threshold - hysteresis */
+	LED_RULE_OP_BELOW,          /* active below threshold, released above threshold + hysteresis */
+	LED_RULE_OP_COUNT,
+} led_rule_op_t;
+
+/**
+ * @brief Load the stored rules from NVS and subscribe to the sensor bus
+ *
+ * NVS has to be initialized already, the sensor bus must not be publishing yet.
+ * The first active rule in table order drives the light, without an active
+ * rule the light shows whatever Zigbee set.
+ */
+esp_err_t led_rules_init(void);
+
+/**
+ * @brief Replace the rules and store them in NVS
+ *
+ * The new rules are evaluated against the last samples right away.
+ *
+ * @param data Rules in wire format
+ * @param len  Length of data
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE or ESP_ERR_INVALID_ARG for malformed
+ *         rules (the previous ones stay active), or the NVS error
+ */
+esp_err_t led_rules_set(const uint8_t *data, size_t len);
+
+/**
+ * @brief Encode the active rules as a ZCL octet string
+ *
+ * @param[out] zcl_str Buffer of at least LED_RULES_WIRE_SIZE + 1 bytes
+ */
+void led_rules_encode(uint8_t *zcl_str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_LED_RULES_H
@@ -13,65 +13,336 @@
  */
 
 
+#include <math.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include "esp_log.h"
 #include "led_strip.h"
 #include "light_driver.h"
 
+/* The Zigbee task, the LED rule timer, Identify and the sensor pipeline all drive the light */
+#define LIGHT_DRIVER_LOCK()     xSemaphoreTake(s_lock, portMAX_DELAY)
+#define LIGHT_DRIVER_UNLOCK()   xSemaphoreGive(s_lock)
+
+static StaticSemaphore_t s_lock_buffer;
+static SemaphoreHandle_t s_lock;
 static led_strip_handle_t s_led_strip;
-static uint8_t s_red = 255, s_green = 255, s_blue = 255, s_level = 255;
+static uint8_t s_red = 255, s_green = 255, s_blue = 255;
+static light_shadow_t s_shadow = {
+    .level = LIGHT_DEFAULT_LEVEL,
+    .color_mode = LIGHT_COLOR_MODE_XY,
+    .color_x = LIGHT_DEFAULT_COLOR_X,
+    .color_y = LIGHT_DEFAULT_COLOR_Y,
+    .color_temperature = LIGHT_DEFAULT_COLOR_TEMPERATURE,
+};
+static uint8_t s_frame[LIGHT_FRAME_SIZE];
+static bool s_override;
+static uint8_t s_override_rgb[3];
+static bool s_identify;
+static bool s_identify_lit;
 
-void light_driver_set_color_xy(uint16_t color_current_x, uint16_t color_current_y)
+static void light_driver_fill(uint8_t red, uint8_t green, uint8_t blue)
+{
+    for (int i = 0; i < CONFIG_EXAMPLE_STRIP_LED_NUMBER; i++) {
+        ESP_ERROR_CHECK(led_strip_set_pixel(s_led_strip, i, red, green, blue));
+    }
+    ESP_ERROR_CHECK(led_strip_refresh(s_led_strip));
+}
+
+/* Identify blinks over the override, the override covers the frame */
+static void light_driver_refresh(void)
 {
-    float red_f = 0, green_f = 0, blue_f = 0, color_x, color_y;
-    color_x = (float)color_current_x / 65535;
-    color_y = (float)color_current_y / 65535;
+    if (s_identify) {
+        light_driver_fill(s_identify_lit ? s_red : 0, s_identify_lit ? s_green : 0, s_identify_lit ? s_blue : 0);
+        return;
+    }
+    if (s_override) {
+        light_driver_fill(s_override_rgb[0], s_override_rgb[1], s_override_rgb[2]);
+        return;
+    }
+    for (int i = 0; i < CONFIG_EXAMPLE_STRIP_LED_NUMBER; i++) {
+        ESP_ERROR_CHECK(led_strip_set_pixel(s_led_strip, i, s_frame[3 * i], s_frame[3 * i + 1], s_frame[3 * i + 2]));
+    }
+    ESP_ERROR_CHECK(led_strip_refresh(s_led_strip));
+}
+
+static void light_driver_show(uint8_t red, uint8_t green, uint8_t blue)
+{
+    for (int i = 0; i < CONFIG_EXAMPLE_STRIP_LED_NUMBER; i++) {
+        s_frame[3 * i] = red;
+        s_frame[3 * i + 1] = green;
+        s_frame[3 * i + 2] = blue;
+    }
+    light_driver_refresh();
+}
+
+/* Color scaled by level, black while off */
+static void light_driver_show_level(void)
+{
+    float ratio = s_shadow.on ? (float)s_shadow.level / 255 : 0;
+    light_driver_show(s_red * ratio, s_green * ratio, s_blue * ratio);
+}
+
+static uint8_t light_driver_channel(float value)
+{
+    return value <= 0 ? 0 : value >= 1 ? UINT8_MAX : (uint8_t)(value * UINT8_MAX);
+}
+
+static void light_driver_xy_to_rgb(void)
+{
+    float red_f = 0, green_f = 0, blue_f = 0;
+    float color_x = (float)s_shadow.color_x / 65535;
+    float color_y = (float)(s_shadow.color_y ? s_shadow.color_y : 1) / 65535;
     /* assume color_Y is full light level value 1  (0-1.0) */
     float color_X = color_x / color_y;
     float color_Z = (1 - color_x - color_y) / color_y;
     /* change from xy to linear RGB NOT sRGB */
     XYZ_to_RGB(color_X, 1, color_Z, red_f, green_f, blue_f);
-    float ratio = (float)s_level / 255;
-    s_red = (uint8_t)(red_f * (float)255);
-    s_green = (uint8_t)(green_f * (float)255);
-    s_blue = (uint8_t)(blue_f * (float)255);
-    ESP_ERROR_CHECK(led_strip_set_pixel(s_led_strip, 0, s_red * ratio, s_green * ratio, s_blue * ratio));
-    ESP_ERROR_CHECK(led_strip_refresh(s_led_strip));
+    s_red = light_driver_channel(red_f);
+    s_green = light_driver_channel(green_f);
+    s_blue = light_driver_channel(blue_f);
 }
 
-void light_driver_set_color_hue_sat(uint8_t hue, uint8_t sat)
+/* hue in turns, so the 8 and 16 bit hues share one conversion */
+static void light_driver_hsv_to_rgb(float hue, uint8_t saturation)
 {
+    float sat = saturation >= 254 ? 1 : (float)saturation / 254;
+    float sector = (hue - floorf(hue)) * 6;
+    float f = sector - floorf(sector);
+    float p = 1 - sat, q = 1 - sat * f, t = 1 - sat * (1 - f);
     float red_f, green_f, blue_f;
-    HSV_to_RGB(hue, sat, UINT8_MAX, red_f, green_f, blue_f);
-    float ratio = (float)s_level / 255;
-    s_red = (uint8_t)red_f;
-    s_green = (uint8_t)green_f;
-    s_blue = (uint8_t)blue_f;
-    ESP_ERROR_CHECK(led_strip_set_pixel(s_led_strip, 0, s_red * ratio, s_green * ratio, s_blue * ratio));
-    ESP_ERROR_CHECK(led_strip_refresh(s_led_strip));
+    switch ((int)sector) {
+    case 0: red_f = 1; green_f = t; blue_f = p; break;
+    case 1: red_f = q; green_f = 1; blue_f = p; break;
+    case 2: red_f = p; green_f = 1; blue_f = t; break;
+    case 3: red_f = p; green_f = q; blue_f = 1; break;
+    case 4: red_f = t; green_f = p; blue_f = 1; break;
+    default: red_f = 1; green_f = p; blue_f = q; break;
+    }
+    s_red = light_driver_channel(red_f);
+    s_green = light_driver_channel(green_f);
+    s_blue = light_driver_channel(blue_f);
+}
+
+/* Black body approximation, good to a few percent between 1000 and 40000 K */
+static void light_driver_temperature_to_rgb(uint16_t mireds)
+{
+    float t = 10000.0f / mireds;    /* kelvin / 100 */
+    float red_f, green_f, blue_f;
+    if (t <= 66) {
+        red_f = 255;
+        green_f = 99.4708025861f * logf(t) - 161.1195681661f;
+        blue_f = t <= 19 ? 0 : 138.5177312231f * logf(t - 10) - 305.0447927307f;
+    } else {
+        red_f = 329.698727446f * powf(t - 60, -0.1332047592f);
+        green_f = 288.1221695283f * powf(t - 60, -0.0755148492f);
+        blue_f = 255;
+    }
+    s_red = light_driver_channel(red_f / 255);
+    s_green = light_driver_channel(green_f / 255);
+    s_blue = light_driver_channel(blue_f / 255);
+}
+
+static void light_driver_update_color(void)
+{
+    switch (s_shadow.color_mode) {
+    case LIGHT_COLOR_MODE_HUE_SAT:
+        light_driver_hsv_to_rgb((float)s_shadow.hue / 254, s_shadow.saturation);
+        break;
+    case LIGHT_COLOR_MODE_ENHANCED_HUE_SAT:
+        light_driver_hsv_to_rgb((float)s_shadow.enhanced_hue / 65536, s_shadow.saturation);
+        break;
+    case LIGHT_COLOR_MODE_TEMPERATURE:
+        light_driver_temperature_to_rgb(s_shadow.color_temperature);
+        break;
+    default:
+        light_driver_xy_to_rgb();
+        break;
+    }
+}
+
+/* A changed attribute only costs a conversion when the current mode shows it */
+static void light_driver_color_changed(bool shown)
+{
+    if (shown) {
+        light_driver_update_color();
+        light_driver_show_level();
+    }
+}
+
+void light_driver_set_color_xy(uint16_t color_current_x, uint16_t color_current_y)
+{
+    LIGHT_DRIVER_LOCK();
+    s_shadow.color_x = color_current_x;
+    s_shadow.color_y = color_current_y;
+    s_shadow.color_mode = LIGHT_COLOR_MODE_XY;
+    light_driver_color_changed(true);
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_color_hue_sat(uint8_t hue, uint8_t sat)
+{
+    LIGHT_DRIVER_LOCK();
+    s_shadow.hue = hue;
+    s_shadow.saturation = sat;
+    s_shadow.color_mode = LIGHT_COLOR_MODE_HUE_SAT;
+    light_driver_color_changed(true);
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_color_mode(uint8_t mode)
+{
+    LIGHT_DRIVER_LOCK();
+    if (mode <= LIGHT_COLOR_MODE_ENHANCED_HUE_SAT && mode != s_shadow.color_mode) {
+        s_shadow.color_mode = mode;
+        light_driver_color_changed(true);
+    }
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_color_x(uint16_t color_x)
+{
+    LIGHT_DRIVER_LOCK();
+    s_shadow.color_x = color_x;
+    light_driver_color_changed(s_shadow.color_mode == LIGHT_COLOR_MODE_XY);
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_color_y(uint16_t color_y)
+{
+    LIGHT_DRIVER_LOCK();
+    s_shadow.color_y = color_y;
+    light_driver_color_changed(s_shadow.color_mode == LIGHT_COLOR_MODE_XY);
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_hue(uint8_t hue)
+{
+    LIGHT_DRIVER_LOCK();
+    s_shadow.hue = hue;
+    light_driver_color_changed(s_shadow.color_mode == LIGHT_COLOR_MODE_HUE_SAT);
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_enhanced_hue(uint16_t enhanced_hue)
+{
+    LIGHT_DRIVER_LOCK();
+    s_shadow.enhanced_hue = enhanced_hue;
+    light_driver_color_changed(s_shadow.color_mode == LIGHT_COLOR_MODE_ENHANCED_HUE_SAT);
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_saturation(uint8_t saturation)
+{
+    LIGHT_DRIVER_LOCK();
+    s_shadow.saturation = saturation;
+    light_driver_color_changed(s_shadow.color_mode == LIGHT_COLOR_MODE_HUE_SAT ||
+                               s_shadow.color_mode == LIGHT_COLOR_MODE_ENHANCED_HUE_SAT);
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_color_temperature(uint16_t mireds)
+{
+    LIGHT_DRIVER_LOCK();
+    mireds = mireds < LIGHT_COLOR_TEMPERATURE_MIN ? LIGHT_COLOR_TEMPERATURE_MIN : mireds;
+    mireds = mireds > LIGHT_COLOR_TEMPERATURE_MAX ? LIGHT_COLOR_TEMPERATURE_MAX : mireds;
+    s_shadow.color_temperature = mireds;
+    light_driver_color_changed(s_shadow.color_mode == LIGHT_COLOR_MODE_TEMPERATURE);
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_color(const light_shadow_t *color)
+{
+    LIGHT_DRIVER_LOCK();
+    uint16_t mireds = color->color_temperature;
+    mireds = mireds < LIGHT_COLOR_TEMPERATURE_MIN ? LIGHT_COLOR_TEMPERATURE_MIN : mireds;
+    mireds = mireds > LIGHT_COLOR_TEMPERATURE_MAX ? LIGHT_COLOR_TEMPERATURE_MAX : mireds;
+    s_shadow.color_mode = color->color_mode <= LIGHT_COLOR_MODE_ENHANCED_HUE_SAT ? color->color_mode : LIGHT_COLOR_MODE_XY;
+    s_shadow.hue = color->hue;
+    s_shadow.saturation = color->saturation;
+    s_shadow.enhanced_hue = color->enhanced_hue;
+    s_shadow.color_x = color->color_x;
+    s_shadow.color_y = color->color_y;
+    s_shadow.color_temperature = mireds;
+    light_driver_color_changed(true);
+    LIGHT_DRIVER_UNLOCK();
 }
 
 void light_driver_set_color_RGB(uint8_t red, uint8_t green, uint8_t blue)
 {
-    float ratio = (float)s_level / 255;
+    LIGHT_DRIVER_LOCK();
     s_red = red;
     s_green = green;
     s_blue = blue;
-    ESP_ERROR_CHECK(led_strip_set_pixel(s_led_strip, 0, red * ratio, green * ratio, blue * ratio));
-    ESP_ERROR_CHECK(led_strip_refresh(s_led_strip));
+    light_driver_show_level();
+    LIGHT_DRIVER_UNLOCK();
 }
 
 void light_driver_set_power(bool power)
 {
-    ESP_ERROR_CHECK(led_strip_set_pixel(s_led_strip, 0, s_red * power, s_green * power, s_blue * power));
-    ESP_ERROR_CHECK(led_strip_refresh(s_led_strip));
+    LIGHT_DRIVER_LOCK();
+    s_shadow.on = power;
+    light_driver_show_level();
+    LIGHT_DRIVER_UNLOCK();
 }
 
 void light_driver_set_level(uint8_t level)
 {
-    s_level = level;
-    float ratio = (float)s_level / 255;
-    ESP_ERROR_CHECK(led_strip_set_pixel(s_led_strip, 0, s_red * ratio, s_green * ratio, s_blue * ratio));
-    ESP_ERROR_CHECK(led_strip_refresh(s_led_strip));
+    LIGHT_DRIVER_LOCK();
+    s_shadow.level = level;
+    light_driver_show_level();
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_get_shadow(light_shadow_t *shadow)
+{
+    LIGHT_DRIVER_LOCK();
+    *shadow = s_shadow;
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_get_state(light_driver_state_t *state)
+{
+    LIGHT_DRIVER_LOCK();
+    state->red = s_red;
+    state->green = s_green;
+    state->blue = s_blue;
+    state->shadow = s_shadow;
+    memcpy(state->frame, s_frame, sizeof(s_frame));
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_state(const light_driver_state_t *state)
+{
+    LIGHT_DRIVER_LOCK();
+    s_red = state->red;
+    s_green = state->green;
+    s_blue = state->blue;
+    s_shadow = state->shadow;
+    memcpy(s_frame, state->frame, sizeof(s_frame));
+    light_driver_refresh();
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_override(bool enable, uint8_t red, uint8_t green, uint8_t blue)
+{
+    LIGHT_DRIVER_LOCK();
+    s_override = enable;
+    s_override_rgb[0] = red;
+    s_override_rgb[1] = green;
+    s_override_rgb[2] = blue;
+    light_driver_refresh();
+    LIGHT_DRIVER_UNLOCK();
+}
+
+void light_driver_set_identify(bool enable, bool lit)
+{
+    LIGHT_DRIVER_LOCK();
+    s_identify = enable;
+    s_identify_lit = lit;
+    light_driver_refresh();
+    LIGHT_DRIVER_UNLOCK();
 }
 
 void light_driver_init(bool power)
@@ -83,7 +354,9 @@ void light_driver_init(bool power)
     led_strip_rmt_config_t rmt_conf = {
         .resolution_hz = 10 * 1000 * 1000, // 10MHz
     };
+    s_lock = xSemaphoreCreateMutexStatic(&s_lock_buffer);
     ESP_ERROR_CHECK(led_strip_new_rmt_device(&led_strip_conf, &rmt_conf, &s_led_strip));
 
+    light_driver_update_color();
     light_driver_set_power(power);
 }
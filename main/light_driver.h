@@ -16,6 +16,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <math.h>
 
 #ifdef __cplusplus
@@ -29,6 +30,55 @@ extern "C" {
 /* LED strip configuration */
 #define CONFIG_EXAMPLE_STRIP_LED_GPIO   8
 #define CONFIG_EXAMPLE_STRIP_LED_NUMBER 1
+#define LIGHT_FRAME_SIZE                (CONFIG_EXAMPLE_STRIP_LED_NUMBER * 3)
+
+/* Shadow defaults, the same as the Color Control cluster is created with */
+#define LIGHT_DEFAULT_LEVEL             255
+#define LIGHT_DEFAULT_COLOR_X           0x616b
+#define LIGHT_DEFAULT_COLOR_Y           0x607d
+#define LIGHT_DEFAULT_COLOR_TEMPERATURE 250     /* mireds, 4000 K */
+
+/* Color temperature range the strip can mix, in mireds */
+#define LIGHT_COLOR_TEMPERATURE_MIN     153     /* 6500 K */
+#define LIGHT_COLOR_TEMPERATURE_MAX     500     /* 2000 K */
+
+/**
+ * @brief Color modes, the values of the ZCL Enhanced Color Mode attribute
+ */
+typedef enum {
+    LIGHT_COLOR_MODE_HUE_SAT = 0,
+    LIGHT_COLOR_MODE_XY = 1,
+    LIGHT_COLOR_MODE_TEMPERATURE = 2,
+    LIGHT_COLOR_MODE_ENHANCED_HUE_SAT = 3,
+} light_color_mode_t;
+
+/**
+ * @brief On/Off, Level Control and Color Control attributes as the light shows them
+ *
+ * Kept by the driver so a change of one attribute never needs the others from the stack.
+ */
+typedef struct {
+    bool on;
+    uint8_t level;
+    uint8_t color_mode;                 /*!< light_color_mode_t */
+    uint8_t hue;                        /*!< 0..254 is the full circle */
+    uint8_t saturation;                 /*!< 0..254 */
+    uint16_t enhanced_hue;              /*!< 0..65535 is the full circle */
+    uint16_t color_x;
+    uint16_t color_y;
+    uint16_t color_temperature;         /*!< mireds */
+} light_shadow_t;
+
+/**
+ * @brief Light state, enough to restore the strip without any color conversion
+ */
+typedef struct {
+    uint8_t red;                        /*!< color before level scaling */
+    uint8_t green;
+    uint8_t blue;
+    light_shadow_t shadow;
+    uint8_t frame[LIGHT_FRAME_SIZE];    /*!< RGB pixels as last sent to the strip */
+} light_driver_state_t;
 
 
 /** Convert Hue,Saturation,V to RGB
@@ -105,7 +155,7 @@ void light_driver_set_level(uint8_t level);
 void light_driver_set_color_RGB(uint8_t red, uint8_t green, uint8_t blue);
 
 /**
-* @brief Set light color from color xy
+* @brief Set light color from color xy and switch to LIGHT_COLOR_MODE_XY
 *
 * @param  color_currentx  The color x to be set
 * @param  color_currenty  The color y to be set
@@ -113,13 +163,114 @@ void light_driver_set_color_RGB(uint8_t red, uint8_t green, uint8_t blue);
 void light_driver_set_color_xy(uint16_t color_current_x, uint16_t color_current_y);
 
 /**
-* @brief Set light color from hue saturation
+* @brief Set light color from hue saturation and switch to LIGHT_COLOR_MODE_HUE_SAT
 *
 * @param  hue  The hue to be set
 * @param  sat  The sat to be set
 */
 void light_driver_set_color_hue_sat(uint8_t hue, uint8_t sat);
 
+/**
+* @brief Set the color mode, the light switches to the color stored for it
+*
+* @param  mode  light_color_mode_t
+*/
+void light_driver_set_color_mode(uint8_t mode);
+
+/**
+* @brief Set color x, shown when the light is in LIGHT_COLOR_MODE_XY
+*
+* @param  color_x  The color x to be set
+*/
+void light_driver_set_color_x(uint16_t color_x);
+
+/**
+* @brief Set color y, shown when the light is in LIGHT_COLOR_MODE_XY
+*
+* @param  color_y  The color y to be set
+*/
+void light_driver_set_color_y(uint16_t color_y);
+
+/**
+* @brief Set hue, shown when the light is in LIGHT_COLOR_MODE_HUE_SAT
+*
+* @param  hue  The hue to be set, 0..254
+*/
+void light_driver_set_hue(uint8_t hue);
+
+/**
+* @brief Set enhanced hue, shown when the light is in LIGHT_COLOR_MODE_ENHANCED_HUE_SAT
+*
+* @param  enhanced_hue  The hue to be set, 0..65535
+*/
+void light_driver_set_enhanced_hue(uint16_t enhanced_hue);
+
+/**
+* @brief Set saturation of both hue modes
+*
+* @param  saturation  The saturation to be set, 0..254
+*/
+void light_driver_set_saturation(uint8_t saturation);
+
+/**
+* @brief Set color temperature, shown when the light is in LIGHT_COLOR_MODE_TEMPERATURE
+*
+* @param  mireds  The color temperature to be set, clamped to the strip's range
+*/
+void light_driver_set_color_temperature(uint16_t mireds);
+
+/**
+* @brief Set every color attribute and the mode at once, converted once
+*
+* @param  color  Shadow to take the color attributes from, on and level are ignored
+*/
+void light_driver_set_color(const light_shadow_t *color);
+
+/**
+* @brief Get the attribute shadow
+*
+* @param[out]  shadow  Current attributes
+*/
+void light_driver_get_shadow(light_shadow_t *shadow);
+
+/**
+* @brief Get the current light state including the pixel frame
+*
+* @param[out]  state  Current state
+*/
+void light_driver_get_state(light_driver_state_t *state);
+
+/**
+* @brief Restore a light state, the frame is copied to the strip as is
+*
+* @param  state  State from light_driver_get_state()
+*/
+void light_driver_set_state(const light_driver_state_t *state);
+
+/**
+* @brief Show a color on top of the light state
+*
+* While the override is on, the other setters only update the light state;
+* the strip shows it again once the override is released.
+*
+* @param  enable  Show the override color, false releases the override
+* @param  red     The red color to be shown
+* @param  green   The green color to be shown
+* @param  blue    The blue color to be shown
+*/
+void light_driver_set_override(bool enable, uint8_t red, uint8_t green, uint8_t blue);
+
+/**
+* @brief Blink for Identify on top of everything else
+*
+* The shadow is left alone, so On/Off, level and color changes during the
+* blink are shown once identify is released.
+*
+* @param  enable  Identify is running, false releases it
+* @param  lit     Show the current color at full level, false shows black
+*/
+void light_driver_set_identify(bool enable, bool lit);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,160 @@
+#include <string.h>
+#include "light_scenes.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#define LIGHT_SCENES_NAMESPACE "scenes"
+#define LIGHT_SCENES_KEY       "table"
+#define LIGHT_SCENES_VERSION   2
+
+typedef struct
+{
+	uint32_t seq;               /* store order, 0 marks a free slot */
+	light_scene_t scene;
+} light_scenes_entry_t;
+
+typedef struct
+{
+	uint16_t version;
+	uint16_t size;
+	uint32_t seq;
+	light_scenes_entry_t entries[LIGHT_SCENES_MAX];
+} light_scenes_table_t;
+
+static const char *TAG = "LIGHT_SCENES";
+
+static light_scenes_table_t s_table;
+
+esp_err_t light_scenes_init(void)
+{
+	nvs_handle_t handle;
+	size_t size = sizeof(s_table);
+	esp_err_t err = nvs_open(LIGHT_SCENES_NAMESPACE, NVS_READONLY, &handle);
+	if (err == ESP_OK)
+	{
+		err = nvs_get_blob(handle, LIGHT_SCENES_KEY, &s_table, &size);
+		nvs_close(handle);
+	}
+	if (err == ESP_OK && (size != sizeof(s_table) || s_table.version != LIGHT_SCENES_VERSION ||
+						  s_table.size != sizeof(s_table)))
+	{
+		err = ESP_ERR_INVALID_VERSION;
+	}
+	if (err != ESP_OK)
+	{
+		memset(&s_table, 0, sizeof(s_table));
+		/* a missing table is the normal first boot */
+		return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+	}
+	ESP_LOGI(TAG, "Loaded %d scenes", light_scenes_count());
+	return ESP_OK;
+}
+
+static light_scenes_entry_t *light_scenes_entry(uint16_t group_id, uint8_t scene_id)
+{
+	for (int i = 0; i < LIGHT_SCENES_MAX; i++)
+	{
+		light_scenes_entry_t *entry = &s_table.entries[i];
+		if (entry->seq && entry->scene.group_id == group_id && entry->scene.scene_id == scene_id)
+		{
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static esp_err_t light_scenes_save(void)
+{
+	s_table.version = LIGHT_SCENES_VERSION;
+	s_table.size = sizeof(s_table);
+
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(LIGHT_SCENES_NAMESPACE, NVS_READWRITE, &handle);
+	if (err == ESP_OK)
+	{
+		err = nvs_set_blob(handle, LIGHT_SCENES_KEY, &s_table, sizeof(s_table));
+		if (err == ESP_OK)
+		{
+			err = nvs_commit(handle);
+		}
+		nvs_close(handle);
+	}
+	if (err != ESP_OK)
+	{
+		/* the table in RAM stays in use until reboot */
+		ESP_LOGW(TAG, "Failed to save scene table: %s", esp_err_to_name(err));
+	}
+	return err;
+}
+
+esp_err_t light_scenes_store(const light_scene_t *scene)
+{
+	light_scenes_entry_t *entry = light_scenes_entry(scene->group_id, scene->scene_id);
+	for (int i = 0; i < LIGHT_SCENES_MAX && !entry; i++)
+	{
+		light_scenes_entry_t *candidate = &s_table.entries[i];
+		if (!candidate->seq)
+		{
+			entry = candidate;
+		}
+	}
+	if (!entry)
+	{
+		/* full, the stack holds more scenes than we do, the oldest goes */
+		entry = &s_table.entries[0];
+		for (int i = 1; i < LIGHT_SCENES_MAX; i++)
+		{
+			if (s_table.entries[i].seq < entry->seq)
+			{
+				entry = &s_table.entries[i];
+			}
+		}
+		ESP_LOGW(TAG, "Table full, replacing scene %d of group 0x%04x", entry->scene.scene_id,
+				 entry->scene.group_id);
+	}
+	entry->seq = ++s_table.seq;
+	entry->scene = *scene;
+	return light_scenes_save();
+}
+
+esp_err_t light_scenes_remove(uint16_t group_id, uint8_t scene_id)
+{
+	light_scenes_entry_t *entry = light_scenes_entry(group_id, scene_id);
+	if (!entry)
+	{
+		return ESP_OK;
+	}
+	entry->seq = 0;
+	return light_scenes_save();
+}
+
+esp_err_t light_scenes_remove_group(uint16_t group_id)
+{
+	bool removed = false;
+	for (int i = 0; i < LIGHT_SCENES_MAX; i++)
+	{
+		light_scenes_entry_t *entry = &s_table.entries[i];
+		if (entry->seq && entry->scene.group_id == group_id)
+		{
+			entry->seq = 0;
+			removed = true;
+		}
+	}
+	return removed ? light_scenes_save() : ESP_OK;
+}
+
+const light_scene_t *light_scenes_find(uint16_t group_id, uint8_t scene_id)
+{
+	light_scenes_entry_t *entry = light_scenes_entry(group_id, scene_id);
+	return entry ? &entry->scene : NULL;
+}
+
+uint8_t light_scenes_count(void)
+{
+	uint8_t count = 0;
+	for (int i = 0; i < LIGHT_SCENES_MAX; i++)
+	{
+		count += s_table.entries[i].seq != 0;
+	}
+	return count;
+}
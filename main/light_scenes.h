@@ -0,0 +1,63 @@
+#ifndef DEPTH_SENSOR_LIGHT_SCENES_H
+#define DEPTH_SENSOR_LIGHT_SCENES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "light_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIGHT_SCENES_MAX 16     /* oldest scene is replaced when the table is full */
+
+/**
+ * @brief Stored scene, the attribute shadow of the light plus the frame it produced
+ */
+typedef struct
+{
+	uint16_t group_id;
+	uint8_t scene_id;
+	light_driver_state_t light;
+} light_scene_t;
+
+/**
+ * @brief Load the scene table from NVS
+ *
+ * NVS has to be initialized already. A missing or outdated table starts empty.
+ */
+esp_err_t light_scenes_init(void);
+
+/**
+ * @brief Add or replace a scene and write the table to NVS
+ */
+esp_err_t light_scenes_store(const light_scene_t *scene);
+
+/**
+ * @brief Drop a scene, after Add Scene replaced it or Remove Scene removed it
+ */
+esp_err_t light_scenes_remove(uint16_t group_id, uint8_t scene_id);
+
+/**
+ * @brief Drop every scene of a group, after Remove All Scenes
+ */
+esp_err_t light_scenes_remove_group(uint16_t group_id);
+
+/**
+ * @brief Scene by group and scene id
+ *
+ * @return the scene, or NULL if it was never stored
+ */
+const light_scene_t *light_scenes_find(uint16_t group_id, uint8_t scene_id);
+
+/**
+ * @brief Number of stored scenes
+ */
+uint8_t light_scenes_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_LIGHT_SCENES_H
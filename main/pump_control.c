@@ -0,0 +1,174 @@
+#include <math.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include "pump_control.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#define PUMP_CONTROL_NAMESPACE "pump"
+#define PUMP_CONTROL_KEY       "config"
+#define PUMP_CONTROL_VERSION   1
+
+typedef struct
+{
+	uint16_t version;
+	uint16_t size;
+	pump_config_t config;
+} pump_control_record_t;
+
+static const char *TAG = "PUMP_CONTROL";
+
+/* Configured by the Zigbee task, evaluated by the ultrasonic task */
+static portMUX_TYPE s_pump_mux = portMUX_INITIALIZER_UNLOCKED;
+static pump_config_t s_config;
+static pump_command_t s_state;
+static pump_command_t s_pending;
+static uint8_t s_pending_count;
+static int64_t s_on_since_us;
+
+static bool pump_control_valid(const pump_config_t *config)
+{
+	if (config->mode >= PUMP_MODE_COUNT)
+	{
+		return false;
+	}
+	return config->mode == PUMP_MODE_DISABLED || (config->high_mark && config->high_mark < config->low_mark);
+}
+
+esp_err_t pump_control_init(void)
+{
+	pump_control_record_t record;
+	nvs_handle_t handle;
+	size_t size = sizeof(record);
+	esp_err_t err = nvs_open(PUMP_CONTROL_NAMESPACE, NVS_READONLY, &handle);
+	if (err == ESP_OK)
+	{
+		err = nvs_get_blob(handle, PUMP_CONTROL_KEY, &record, &size);
+		nvs_close(handle);
+	}
+	if (err == ESP_OK && (size != sizeof(record) || record.version != PUMP_CONTROL_VERSION ||
+						  record.size != sizeof(record) || !pump_control_valid(&record.config)))
+	{
+		err = ESP_ERR_INVALID_VERSION;
+	}
+	if (err != ESP_OK)
+	{
+		/* a missing configuration is the normal first boot */
+		return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+	}
+	s_config = record.config;
+	ESP_LOGI(TAG, "Loaded mode %d, marks %u/%u mm", s_config.mode, s_config.high_mark, s_config.low_mark);
+	return ESP_OK;
+}
+
+esp_err_t pump_control_set_config(const pump_config_t *config)
+{
+	if (!pump_control_valid(config))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	pump_control_record_t record = {
+			.version = PUMP_CONTROL_VERSION,
+			.size = sizeof(record),
+			.config = *config,
+	};
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(PUMP_CONTROL_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+	err = nvs_set_blob(handle, PUMP_CONTROL_KEY, &record, sizeof(record));
+	if (err == ESP_OK)
+	{
+		err = nvs_commit(handle);
+	}
+	nvs_close(handle);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+
+	portENTER_CRITICAL(&s_pump_mux);
+	s_config = *config;
+	s_pending = PUMP_COMMAND_NONE;
+	s_pending_count = 0;
+	portEXIT_CRITICAL(&s_pump_mux);
+	ESP_LOGI(TAG, "New mode %d, marks %u/%u mm", config->mode, config->high_mark, config->low_mark);
+	return ESP_OK;
+}
+
+void pump_control_get_config(pump_config_t *config)
+{
+	portENTER_CRITICAL(&s_pump_mux);
+	*config = s_config;
+	portEXIT_CRITICAL(&s_pump_mux);
+}
+
+/* Called with s_pump_mux held */
+static pump_command_t pump_control_wanted_locked(int32_t distance_mm)
+{
+	bool high = distance_mm <= s_config.high_mark;
+	bool low = distance_mm >= s_config.low_mark;
+	switch (s_config.mode)
+	{
+		case PUMP_MODE_DRAIN:
+			return high ? PUMP_COMMAND_ON : low ? PUMP_COMMAND_OFF : s_state;
+		case PUMP_MODE_FILL:
+			return low ? PUMP_COMMAND_ON : high ? PUMP_COMMAND_OFF : s_state;
+		default:
+			/* Switch a running pump off once when control gets disabled */
+			return s_state == PUMP_COMMAND_ON ? PUMP_COMMAND_OFF : s_state;
+	}
+}
+
+pump_command_t pump_control_update(float distance, int64_t timestamp_us)
+{
+	int32_t distance_mm = (int32_t) lroundf(distance * 10.0f);
+	pump_command_t command = PUMP_COMMAND_NONE;
+
+	portENTER_CRITICAL(&s_pump_mux);
+	pump_command_t wanted = pump_control_wanted_locked(distance_mm);
+	if (wanted == s_state)
+	{
+		s_pending = PUMP_COMMAND_NONE;
+		s_pending_count = 0;
+	} else
+	{
+		if (wanted != s_pending)
+		{
+			s_pending = wanted;
+			s_pending_count = 0;
+		}
+		if (s_pending_count < CONFIG_DEPTH_SENSOR_PUMP_DEBOUNCE_SAMPLES)
+		{
+			s_pending_count++;
+		}
+		bool debounced = s_pending_count >= CONFIG_DEPTH_SENSOR_PUMP_DEBOUNCE_SAMPLES;
+		bool held = wanted == PUMP_COMMAND_OFF && s_state == PUMP_COMMAND_ON && s_config.mode != PUMP_MODE_DISABLED &&
+					timestamp_us - s_on_since_us < CONFIG_DEPTH_SENSOR_PUMP_MIN_ON_TIME * 1000000LL;
+		if (debounced && !held)
+		{
+			s_state = wanted;
+			s_pending = PUMP_COMMAND_NONE;
+			s_pending_count = 0;
+			if (wanted == PUMP_COMMAND_ON)
+			{
+				s_on_since_us = timestamp_us;
+			}
+			command = wanted;
+		}
+	}
+	portEXIT_CRITICAL(&s_pump_mux);
+	return command;
+}
+
+pump_command_t pump_control_state(void)
+{
+	portENTER_CRITICAL(&s_pump_mux);
+	pump_command_t state = s_state;
+	portEXIT_CRITICAL(&s_pump_mux);
+	return state;
+}
@@ -0,0 +1,80 @@
+#ifndef DEPTH_SENSOR_PUMP_CONTROL_H
+#define DEPTH_SENSOR_PUMP_CONTROL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+	PUMP_MODE_DISABLED = 0,
+	PUMP_MODE_DRAIN,            /* on at the high water mark, off at the low one */
+	PUMP_MODE_FILL,             /* on at the low water mark, off at the high one */
+	PUMP_MODE_COUNT,
+} pump_mode_t;
+
+typedef enum
+{
+	PUMP_COMMAND_NONE = 0,
+	PUMP_COMMAND_ON,
+	PUMP_COMMAND_OFF,
+} pump_command_t;
+
+/* Marks are distances from the sensor, so the high water mark is the shorter one */
+typedef struct
+{
+	uint8_t mode;               /* pump_mode_t */
+	uint16_t high_mark;         /* mm */
+	uint16_t low_mark;          /* mm */
+} pump_config_t;
+
+/**
+ * @brief Load the stored configuration from NVS
+ *
+ * NVS has to be initialized already. Without a stored configuration the pump is disabled.
+ */
+esp_err_t pump_control_init(void);
+
+/**
+ * @brief Replace the configuration and store it in NVS
+ *
+ * An enabled pump needs a high water mark above the low one, with both set.
+ * Disabling the control switches a running pump off.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an unusable configuration
+ *         (the previous one stays active), or the NVS error
+ */
+esp_err_t pump_control_set_config(const pump_config_t *config);
+
+/**
+ * @brief Active configuration
+ */
+void pump_control_get_config(pump_config_t *config);
+
+/**
+ * @brief Feed a filtered level, called for every sample
+ *
+ * A crossing has to hold for CONFIG_DEPTH_SENSOR_PUMP_DEBOUNCE_SAMPLES samples,
+ * and the pump stays on for at least CONFIG_DEPTH_SENSOR_PUMP_MIN_ON_TIME seconds.
+ *
+ * @param distance     Filtered distance from the sensor (cm)
+ * @param timestamp_us When the sample was measured
+ *
+ * @return The command to send, PUMP_COMMAND_NONE when the pump state does not change
+ */
+pump_command_t pump_control_update(float distance, int64_t timestamp_us);
+
+/**
+ * @brief Last command sent, PUMP_COMMAND_NONE before the first one
+ */
+pump_command_t pump_control_state(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_PUMP_CONTROL_H
@@ -0,0 +1,122 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "sensor_bus.h"
+#include "esp_timer.h"
+
+typedef struct
+{
+	sensor_bus_subscriber_t cb;
+	void *ctx;
+} sensor_subscriber_t;
+
+/* Double buffered slots: the producer fills one while readers see the other */
+typedef struct
+{
+	sensor_sample_t slots[2];
+	uint8_t latest;
+	bool valid;
+	uint32_t seq;
+	sensor_bus_provider_t provider;
+	sensor_subscriber_t subscribers[SENSOR_BUS_MAX_SUBSCRIBERS];
+	uint8_t subscriber_count;
+} sensor_topic_state_t;
+
+static sensor_topic_state_t s_topics[SENSOR_TOPIC_COUNT];
+static portMUX_TYPE s_bus_mux = portMUX_INITIALIZER_UNLOCKED;
+/* Serializes providers so a topic never has two producers at once */
+static StaticSemaphore_t s_provider_lock_buffer;
+static SemaphoreHandle_t s_provider_lock;
+
+esp_err_t sensor_bus_subscribe(sensor_topic_t topic, sensor_bus_subscriber_t cb, void *ctx)
+{
+	if (topic >= SENSOR_TOPIC_COUNT || !cb)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	sensor_topic_state_t *state = &s_topics[topic];
+	if (state->subscriber_count >= SENSOR_BUS_MAX_SUBSCRIBERS)
+	{
+		return ESP_ERR_NO_MEM;
+	}
+	state->subscribers[state->subscriber_count++] = (sensor_subscriber_t) {.cb = cb, .ctx = ctx};
+	return ESP_OK;
+}
+
+esp_err_t sensor_bus_register_provider(sensor_topic_t topic, sensor_bus_provider_t provider)
+{
+	if (topic >= SENSOR_TOPIC_COUNT)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (!s_provider_lock)
+	{
+		s_provider_lock = xSemaphoreCreateMutexStatic(&s_provider_lock_buffer);
+	}
+	s_topics[topic].provider = provider;
+	return ESP_OK;
+}
+
+sensor_sample_t *sensor_bus_claim(sensor_topic_t topic)
+{
+	sensor_topic_state_t *state = &s_topics[topic];
+	return &state->slots[state->latest ^ 1];
+}
+
+void sensor_bus_commit(sensor_topic_t topic)
+{
+	sensor_topic_state_t *state = &s_topics[topic];
+	sensor_sample_t *sample = &state->slots[state->latest ^ 1];
+	sample->topic = topic;
+	sample->seq = ++state->seq;
+
+	portENTER_CRITICAL(&s_bus_mux);
+	state->latest ^= 1;
+	state->valid = true;
+	portEXIT_CRITICAL(&s_bus_mux);
+
+	for (int i = 0; i < state->subscriber_count; i++)
+	{
+		state->subscribers[i].cb(sample, state->subscribers[i].ctx);
+	}
+}
+
+static bool sensor_bus_copy_latest(sensor_topic_state_t *state, int64_t max_age_us, sensor_sample_t *out)
+{
+	bool fresh = false;
+	portENTER_CRITICAL(&s_bus_mux);
+	if (state->valid)
+	{
+		*out = state->slots[state->latest];
+		fresh = esp_timer_get_time() - out->timestamp_us <= max_age_us;
+	}
+	portEXIT_CRITICAL(&s_bus_mux);
+	return fresh;
+}
+
+esp_err_t sensor_bus_get(sensor_topic_t topic, int64_t max_age_us, sensor_sample_t *out)
+{
+	if (topic >= SENSOR_TOPIC_COUNT || !out)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	sensor_topic_state_t *state = &s_topics[topic];
+	if (sensor_bus_copy_latest(state, max_age_us, out) || !state->provider)
+	{
+		return state->valid ? ESP_OK : ESP_ERR_NOT_FOUND;
+	}
+
+	xSemaphoreTake(s_provider_lock, portMAX_DELAY);
+	/* Another reader may have refreshed the topic while we waited */
+	esp_err_t err = ESP_OK;
+	if (!sensor_bus_copy_latest(state, max_age_us, out))
+	{
+		err = state->provider();
+		sensor_bus_copy_latest(state, max_age_us, out);
+	}
+	xSemaphoreGive(s_provider_lock);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+	return state->valid ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,105 @@
+#ifndef DEPTH_SENSOR_SENSOR_BUS_H
+#define DEPTH_SENSOR_SENSOR_BUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SENSOR_BUS_MAX_SUBSCRIBERS 6   /* per topic */
+
+typedef enum
+{
+	SENSOR_TOPIC_DISTANCE,      /* ultrasonic distance, published by the measurement task */
+	SENSOR_TOPIC_TEMPERATURE,   /* on-chip temperature, read on demand */
+	SENSOR_TOPIC_COUNT,
+} sensor_topic_t;
+
+/**
+ * Timestamped sample, one fixed-size slot per topic
+ */
+typedef struct
+{
+	sensor_topic_t topic;
+	uint32_t seq;               /* incremented with every publish on the topic */
+	int64_t timestamp_us;       /* esp_timer time of the measurement */
+	union
+	{
+		struct
+		{
+			float filtered;     /* moving average (cm) */
+			float raw;          /* this sample (cm) */
+			uint32_t echo_us;   /* echo pulse length */
+		} distance;
+		struct
+		{
+			float celsius;
+		} temperature;
+	};
+} sensor_sample_t;
+
+/**
+ * Subscriber callback, runs in the publisher context
+ *
+ * @param sample Published sample, valid until the callback returns
+ * @param ctx    Context given to sensor_bus_subscribe()
+ */
+typedef void (*sensor_bus_subscriber_t)(const sensor_sample_t *sample, void *ctx);
+
+/**
+ * On-demand producer, expected to fill and commit a sample of its topic
+ */
+typedef esp_err_t (*sensor_bus_provider_t)(void);
+
+/**
+ * @brief Add a subscriber to a topic
+ *
+ * Subscribe during initialization, before the publishers start.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the topic has SENSOR_BUS_MAX_SUBSCRIBERS already
+ */
+esp_err_t sensor_bus_subscribe(sensor_topic_t topic, sensor_bus_subscriber_t cb, void *ctx);
+
+/**
+ * @brief Register the on-demand producer of a topic
+ *
+ * The provider is called by sensor_bus_get() when the last sample is missing or too old.
+ */
+esp_err_t sensor_bus_register_provider(sensor_topic_t topic, sensor_bus_provider_t provider);
+
+/**
+ * @brief Get the slot to fill with the next sample of a topic
+ *
+ * Only one producer may fill a topic at a time; the slot is not visible to readers
+ * until sensor_bus_commit().
+ */
+sensor_sample_t *sensor_bus_claim(sensor_topic_t topic);
+
+/**
+ * @brief Publish the claimed slot of a topic
+ *
+ * Stamps the topic and sequence number, makes the slot the latest sample and
+ * hands it to every subscriber in registration order.
+ */
+void sensor_bus_commit(sensor_topic_t topic);
+
+/**
+ * @brief Copy the latest sample of a topic
+ *
+ * @param topic      Topic to read
+ * @param max_age_us Call the provider first when the latest sample is older than this
+ * @param[out] out   Latest sample
+ *
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if there is no sample yet,
+ *         or the provider error
+ */
+esp_err_t sensor_bus_get(sensor_topic_t topic, int64_t max_age_us, sensor_sample_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_SENSOR_BUS_H
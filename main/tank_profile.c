@@ -0,0 +1,184 @@
+#include <math.h>
+#include <string.h>
+#include "tank_profile.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#define TANK_PROFILE_NAMESPACE "tank"
+#define TANK_PROFILE_KEY       "profile"
+
+typedef struct
+{
+	uint16_t distance;          /* mm */
+	uint32_t volume;            /* dl */
+} tank_profile_point_t;
+
+typedef struct
+{
+	uint8_t count;
+	uint32_t max_volume;        /* dl */
+	tank_profile_point_t points[TANK_PROFILE_MAX_POINTS];
+} tank_profile_t;
+
+static const char *TAG = "TANK_PROFILE";
+
+static tank_profile_t s_profile;
+
+static esp_err_t tank_profile_decode(const uint8_t *data, size_t len, tank_profile_t *profile)
+{
+	if (len < 1 || data[0] > TANK_PROFILE_MAX_POINTS || len != (size_t) (1 + data[0] * TANK_PROFILE_POINT_SIZE))
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+	memset(profile, 0, sizeof(*profile));
+	profile->count = data[0];
+	if (profile->count == 1)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	const uint8_t *p = data + 1;
+	for (int i = 0; i < profile->count; i++, p += TANK_PROFILE_POINT_SIZE)
+	{
+		tank_profile_point_t *point = &profile->points[i];
+		point->distance = (uint16_t) (p[0] | p[1] << 8);
+		point->volume = (uint32_t) p[2] | (uint32_t) p[3] << 8 | (uint32_t) p[4] << 16 | (uint32_t) p[5] << 24;
+		if (i > 0 && point->distance <= profile->points[i - 1].distance)
+		{
+			return ESP_ERR_INVALID_ARG;
+		}
+		if (point->volume > profile->max_volume)
+		{
+			profile->max_volume = point->volume;
+		}
+	}
+	return ESP_OK;
+}
+
+esp_err_t tank_profile_init(void)
+{
+	nvs_handle_t handle;
+	uint8_t data[TANK_PROFILE_WIRE_MAX_SIZE];
+	size_t size = sizeof(data);
+	esp_err_t err = nvs_open(TANK_PROFILE_NAMESPACE, NVS_READONLY, &handle);
+	if (err != ESP_OK)
+	{
+		return ESP_OK;
+	}
+	err = nvs_get_blob(handle, TANK_PROFILE_KEY, data, &size);
+	nvs_close(handle);
+	if (err == ESP_ERR_NVS_NOT_FOUND)
+	{
+		return ESP_OK;
+	}
+	if (err == ESP_OK)
+	{
+		err = tank_profile_decode(data, size, &s_profile);
+	}
+	if (err != ESP_OK)
+	{
+		memset(&s_profile, 0, sizeof(s_profile));
+		ESP_LOGW(TAG, "Stored profile is unusable: %s", esp_err_to_name(err));
+		return err;
+	}
+	ESP_LOGI(TAG, "Loaded %d point profile, %lu dl max", s_profile.count, (unsigned long) s_profile.max_volume);
+	return ESP_OK;
+}
+
+esp_err_t tank_profile_set(const uint8_t *data, size_t len)
+{
+	tank_profile_t profile;
+	esp_err_t err = tank_profile_decode(data, len, &profile);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+
+	nvs_handle_t handle;
+	err = nvs_open(TANK_PROFILE_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+	err = profile.count ? nvs_set_blob(handle, TANK_PROFILE_KEY, data, len) : nvs_erase_key(handle, TANK_PROFILE_KEY);
+	if (err == ESP_ERR_NVS_NOT_FOUND)
+	{
+		err = ESP_OK;
+	}
+	if (err == ESP_OK)
+	{
+		err = nvs_commit(handle);
+	}
+	nvs_close(handle);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+	s_profile = profile;
+	ESP_LOGI(TAG, "New %d point profile, %lu dl max", s_profile.count, (unsigned long) s_profile.max_volume);
+	return ESP_OK;
+}
+
+void tank_profile_encode(uint8_t *zcl_str)
+{
+	zcl_str[0] = (uint8_t) (1 + s_profile.count * TANK_PROFILE_POINT_SIZE);
+	zcl_str[1] = s_profile.count;
+	uint8_t *p = zcl_str + 2;
+	for (int i = 0; i < s_profile.count; i++, p += TANK_PROFILE_POINT_SIZE)
+	{
+		const tank_profile_point_t *point = &s_profile.points[i];
+		p[0] = point->distance & 0xff;
+		p[1] = point->distance >> 8;
+		p[2] = point->volume & 0xff;
+		p[3] = (point->volume >> 8) & 0xff;
+		p[4] = (point->volume >> 16) & 0xff;
+		p[5] = point->volume >> 24;
+	}
+}
+
+bool tank_profile_evaluate(float distance, float *volume, uint8_t *percent)
+{
+	const tank_profile_t *profile = &s_profile;
+	if (profile->count < 2 || profile->max_volume == 0)
+	{
+		return false;
+	}
+
+	/* Work in 1/16 mm so sub-millimetre interpolation stays in integers */
+	int32_t d = (int32_t) lroundf(distance * 160.0f);
+	int32_t first = profile->points[0].distance * 16;
+	int32_t last = profile->points[profile->count - 1].distance * 16;
+	uint32_t dl;
+	if (d <= first)
+	{
+		dl = profile->points[0].volume;
+	} else if (d >= last)
+	{
+		dl = profile->points[profile->count - 1].volume;
+	} else
+	{
+		/* Largest point with distance <= d */
+		int lo = 0;
+		int hi = profile->count - 1;
+		while (hi - lo > 1)
+		{
+			int mid = (lo + hi) / 2;
+			if (profile->points[mid].distance * 16 <= d)
+			{
+				lo = mid;
+			} else
+			{
+				hi = mid;
+			}
+		}
+		const tank_profile_point_t *a = &profile->points[lo];
+		const tank_profile_point_t *b = &profile->points[hi];
+		int64_t span = (int64_t) (b->distance - a->distance) * 16;
+		int64_t offset = d - a->distance * 16;
+		int64_t delta = (int64_t) b->volume - (int64_t) a->volume;
+		dl = (uint32_t) ((int64_t) a->volume + (delta * offset + (delta >= 0 ? span / 2 : -span / 2)) / span);
+	}
+
+	*volume = (float) dl / 10.0f;
+	*percent = (uint8_t) (((uint64_t) dl * 100 + profile->max_volume / 2) / profile->max_volume);
+	return true;
+}
@@ -0,0 +1,66 @@
+#ifndef DEPTH_SENSOR_TANK_PROFILE_H
+#define DEPTH_SENSOR_TANK_PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TANK_PROFILE_MAX_POINTS 32
+#define TANK_PROFILE_POINT_SIZE 6      /* u16 distance (mm) + u32 volume (dl), little endian */
+/* Wire format: u8 point count followed by that many points, 1 + count * TANK_PROFILE_POINT_SIZE bytes */
+#define TANK_PROFILE_WIRE_MAX_SIZE  (1 + TANK_PROFILE_MAX_POINTS * TANK_PROFILE_POINT_SIZE)
+
+/**
+ * @brief Load the stored profile from NVS
+ *
+ * NVS has to be initialized already. Without a stored profile the tank
+ * is unconfigured and tank_profile_evaluate() returns false.
+ */
+esp_err_t tank_profile_init(void);
+
+/**
+ * @brief Replace the profile and store it in NVS
+ *
+ * Points are distances from the sensor with the tank volume at that level.
+ * At least two points with strictly increasing distances are required;
+ * a count of zero clears the profile.
+ *
+ * @param data Profile in wire format
+ * @param len  Length of data, exactly 1 + count * TANK_PROFILE_POINT_SIZE
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE or ESP_ERR_INVALID_ARG for a malformed
+ *         profile (the previous one stays active), or the NVS error
+ */
+esp_err_t tank_profile_set(const uint8_t *data, size_t len);
+
+/**
+ * @brief Encode the active profile as a ZCL octet string of its wire length
+ *
+ * @param[out] zcl_str Buffer of at least TANK_PROFILE_WIRE_MAX_SIZE + 1 bytes
+ */
+void tank_profile_encode(uint8_t *zcl_str);
+
+/**
+ * @brief Volume at a given distance
+ *
+ * Binary search for the segment, then fixed-point linear interpolation.
+ * Distances outside the profile are clamped to its ends.
+ *
+ * @param distance     Distance from the sensor (cm)
+ * @param[out] volume  Volume (l)
+ * @param[out] percent Volume relative to the largest one in the profile (%)
+ *
+ * @return false if no profile is configured
+ */
+bool tank_profile_evaluate(float distance, float *volume, uint8_t *percent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_TANK_PROFILE_H
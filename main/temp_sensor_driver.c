@@ -13,45 +13,42 @@
  */
 
 #include "temp_sensor_driver.h"
+#include "sensor_bus.h"
 
 #include "esp_err.h"
 #include "esp_check.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include "esp_timer.h"
 
 /**
  * @brief:
  * This example code shows how to configure temperature sensor.
  *
  * @note:
- * The callback will be called with updated temperature sensor value every $interval seconds.
+ * The sensor is not polled, it is read and published whenever a sensor bus
+ * reader asks for a temperature newer than the last one.
  *
  */
 
 /* temperatuer sensor instance handle */
 static temperature_sensor_handle_t temp_sensor;
-/* call back function pointer */
-static esp_temp_sensor_callback_t func_ptr;
-/* update interval in seconds */
-static uint16_t interval = 1;
 
 static const char *TAG = "ESP_TEMP_SENSOR_DRIVER";
 
 /**
- * @brief Tasks for updating the sensor value
- *
- * @param arg      Unused value.
+ * @brief Sensor bus provider, publishes a fresh sample
  */
-static void temp_sensor_driver_value_update(void *arg)
+static esp_err_t temp_sensor_driver_publish(void)
 {
-    for (;;) {
-        float tsens_value;
-        temperature_sensor_get_celsius(temp_sensor, &tsens_value);
-        if (func_ptr) {
-            func_ptr(tsens_value);
-        }
-        vTaskDelay(pdMS_TO_TICKS(interval * 1000));
-    }
+    sensor_sample_t *sample = sensor_bus_claim(SENSOR_TOPIC_TEMPERATURE);
+    ESP_RETURN_ON_ERROR(temp_sensor_driver_read(&sample->temperature.celsius), TAG, "Fail to read temperature");
+    sample->timestamp_us = esp_timer_get_time();
+    sensor_bus_commit(SENSOR_TOPIC_TEMPERATURE);
+    return ESP_OK;
+}
+
+esp_err_t temp_sensor_driver_read(float *celsius)
+{
+    return temperature_sensor_get_celsius(temp_sensor, celsius);
 }
 
 /**
@@ -65,16 +62,13 @@ static esp_err_t temp_sensor_driver_sensor_init(temperature_sensor_config_t *con
                         TAG, "Fail to install on-chip temperature sensor");
     ESP_RETURN_ON_ERROR(temperature_sensor_enable(temp_sensor),
                         TAG, "Fail to enable on-chip temperature sensor");
-    return (xTaskCreate(temp_sensor_driver_value_update, "sensor_update", 2048, NULL, 10, NULL) == pdTRUE) ? ESP_OK : ESP_FAIL;
+    return ESP_OK;
 }
 
-esp_err_t temp_sensor_driver_init(temperature_sensor_config_t *config, uint16_t update_interval,
-                             esp_temp_sensor_callback_t cb)
+esp_err_t temp_sensor_driver_init(temperature_sensor_config_t *config)
 {
     if (ESP_OK != temp_sensor_driver_sensor_init(config)) {
         return ESP_FAIL;
     }
-    func_ptr = cb;
-    interval = update_interval;
-    return ESP_OK;
+    return sensor_bus_register_provider(SENSOR_TOPIC_TEMPERATURE, temp_sensor_driver_publish);
 }
@@ -20,23 +20,26 @@
 extern "C" {
 #endif
 
-/** Temperature sensor callback
+/**
+ * @brief init function for temp sensor
+ *
+ * Registers the sensor as the on-demand provider of SENSOR_TOPIC_TEMPERATURE,
+ * it is only read when a sensor bus reader needs a fresh value.
  *
- * @param[in] temperature temperature value in degrees Celsius from sensor
+ * @param config                pointer of temperature sensor config.
  *
+ * @return ESP_OK if the driver initialization succeed, otherwise ESP_FAIL.
  */
-typedef void (*esp_temp_sensor_callback_t)(float temperature);
+esp_err_t temp_sensor_driver_init(temperature_sensor_config_t *config);
 
 /**
- * @brief init function for temp sensor and callback setup
+ * @brief read the sensor once
  *
- * @param config                pointer of temperature sensor config.
- * @param update_interval       sensor value update interval in seconds.
- * @param cb                    callback pointer.
+ * @param[out] celsius          temperature value in degrees Celsius.
  *
- * @return ESP_OK if the driver initialization succeed, otherwise ESP_FAIL.
+ * @return ESP_OK on success, otherwise the driver error.
  */
-esp_err_t temp_sensor_driver_init(temperature_sensor_config_t *config, uint16_t update_interval, esp_temp_sensor_callback_t cb);
+esp_err_t temp_sensor_driver_read(float *celsius);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -0,0 +1,207 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "trace.h"
+#include "app_tasks.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+typedef struct
+{
+	trace_module_t module;
+	esp_log_level_t level;
+	uint8_t argc;
+	const char *format;
+} trace_event_desc_t;
+
+typedef struct
+{
+	uint32_t timestamp_ms;
+	uint16_t id;
+	uint32_t args[TRACE_MAX_ARGS];
+} trace_entry_t;
+
+static const char *TAG = "TRACE";
+
+static const trace_event_desc_t s_events[TRACE_EVENT_COUNT] = {
+#define TRACE_EVENT_DESC(id, module, level, argc, format) \
+		[id] = {TRACE_MODULE_##module, ESP_LOG_##level, argc, format},
+		TRACE_EVENTS(TRACE_EVENT_DESC)
+#undef TRACE_EVENT_DESC
+};
+
+static const char *const s_module_tags[TRACE_MODULE_COUNT] = {
+		[TRACE_MODULE_SENSOR] = "SENSOR",
+		[TRACE_MODULE_ZIGBEE] = "ZIGBEE",
+		[TRACE_MODULE_LIGHT] = "LIGHT",
+};
+
+static volatile uint8_t s_levels[TRACE_MODULE_COUNT] = {
+		[0 ... TRACE_MODULE_COUNT - 1] = CONFIG_LOG_DEFAULT_LEVEL,
+};
+
+/* Producers are any task, the drain task is the only consumer */
+static portMUX_TYPE s_ring_mux = portMUX_INITIALIZER_UNLOCKED;
+static trace_entry_t s_ring[TRACE_RING_SIZE];
+static uint32_t s_head;
+static uint32_t s_tail;
+static uint32_t s_dropped;
+
+void trace_record(trace_event_t id, ...)
+{
+	const trace_event_desc_t *desc = &s_events[id];
+	if (desc->level > s_levels[desc->module])
+	{
+		return;
+	}
+
+	trace_entry_t entry = {.timestamp_ms = (uint32_t) (esp_timer_get_time() / 1000), .id = id};
+	va_list args;
+	va_start(args, id);
+	for (int i = 0; i < desc->argc; i++)
+	{
+		entry.args[i] = va_arg(args, uint32_t);
+	}
+	va_end(args);
+
+	bool was_empty = false;
+	portENTER_CRITICAL(&s_ring_mux);
+	if (s_head - s_tail == TRACE_RING_SIZE)
+	{
+		s_dropped++;
+	} else
+	{
+		was_empty = s_head == s_tail;
+		s_ring[s_head % TRACE_RING_SIZE] = entry;
+		s_head++;
+	}
+	portEXIT_CRITICAL(&s_ring_mux);
+
+	/* One wakeup per batch, the drain empties the ring before it waits again */
+	TaskHandle_t drain = app_task_handle(APP_TASK_TRACE);
+	if (was_empty && drain)
+	{
+		xTaskNotifyGive(drain);
+	}
+}
+
+/* printf of one argument at a time, with its type taken from the conversion */
+static void trace_format(char *out, size_t size, const char *format, const uint32_t *args)
+{
+	size_t len = 0;
+	int arg = 0;
+	while (*format && len + 1 < size)
+	{
+		if (*format != '%' || format[1] == '%')
+		{
+			out[len++] = *format;
+			format += *format == '%' ? 2 : 1;
+			continue;
+		}
+		char spec[16];
+		size_t spec_len = 0;
+		do
+		{
+			spec[spec_len++] = *format++;
+		} while (*format && !strchr("diuxXcfeEgG", *format) && spec_len < sizeof(spec) - 2);
+		char conversion = *format ? *format++ : 'x';
+		spec[spec_len++] = conversion;
+		spec[spec_len] = '\0';
+
+		uint32_t value = arg < TRACE_MAX_ARGS ? args[arg++] : 0;
+		int written;
+		if (strchr("feEgG", conversion))
+		{
+			union
+			{
+				uint32_t u;
+				float f;
+			} bits = {.u = value};
+			written = snprintf(out + len, size - len, spec, (double) bits.f);
+		} else if (conversion == 'd' || conversion == 'i')
+		{
+			written = snprintf(out + len, size - len, spec, (int) value);
+		} else
+		{
+			written = snprintf(out + len, size - len, spec, (unsigned int) value);
+		}
+		if (written < 0)
+		{
+			break;
+		}
+		len += (size_t) written < size - len ? (size_t) written : size - len - 1;
+	}
+	out[len] = '\0';
+}
+
+static void trace_drain_task(void *pvParameters)
+{
+	static const char letters[] = "NEWIDV";
+	char text[160];
+	while (true)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		vTaskDelay(pdMS_TO_TICKS(TRACE_DRAIN_BATCH_MS));
+		while (true)
+		{
+			trace_entry_t entry;
+			uint32_t dropped;
+			portENTER_CRITICAL(&s_ring_mux);
+			bool empty = s_head == s_tail;
+			if (!empty)
+			{
+				entry = s_ring[s_tail % TRACE_RING_SIZE];
+				s_tail++;
+			}
+			dropped = s_dropped;
+			s_dropped = 0;
+			portEXIT_CRITICAL(&s_ring_mux);
+
+			if (dropped)
+			{
+				ESP_LOGW(TAG, "%lu events dropped, ring full", (unsigned long) dropped);
+			}
+			if (empty)
+			{
+				break;
+			}
+			const trace_event_desc_t *desc = &s_events[entry.id];
+			const char *tag = s_module_tags[desc->module];
+			trace_format(text, sizeof(text), desc->format, entry.args);
+			esp_log_write(desc->level, tag, "%c (%lu) %s: %s\n", letters[desc->level],
+						  (unsigned long) entry.timestamp_ms, tag, text);
+		}
+	}
+}
+
+esp_err_t trace_init(void)
+{
+	/* Filtering happens when recording, let everything recorded through */
+	for (int i = 0; i < TRACE_MODULE_COUNT; i++)
+	{
+		esp_log_level_set(s_module_tags[i], ESP_LOG_VERBOSE);
+	}
+	esp_err_t err = app_task_create(APP_TASK_TRACE, trace_drain_task, NULL);
+	if (err == ESP_OK && s_head != s_tail)
+	{
+		xTaskNotifyGive(app_task_handle(APP_TASK_TRACE));
+	}
+	return err;
+}
+
+esp_err_t trace_set_level(trace_module_t module, esp_log_level_t level)
+{
+	if (module >= TRACE_MODULE_COUNT || level > ESP_LOG_VERBOSE)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	s_levels[module] = level;
+	return ESP_OK;
+}
+
+esp_log_level_t trace_get_level(trace_module_t module)
+{
+	return module < TRACE_MODULE_COUNT ? (esp_log_level_t) s_levels[module] : ESP_LOG_NONE;
+}
@@ -0,0 +1,99 @@
+#ifndef DEPTH_SENSOR_TRACE_H
+#define DEPTH_SENSOR_TRACE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_RING_SIZE         64      /* events, power of two */
+#define TRACE_MAX_ARGS          4
+#define TRACE_DRAIN_BATCH_MS    100     /* the drain collects events this long before formatting */
+
+typedef enum
+{
+	TRACE_MODULE_SENSOR,
+	TRACE_MODULE_ZIGBEE,
+	TRACE_MODULE_LIGHT,
+	TRACE_MODULE_COUNT,
+} trace_module_t;
+
+/* X(id, module, level, argument count, format)
+ * Arguments are 32 bit words: %d and %i signed, %u, %x, %X and %c unsigned,
+ * %f, %e and %g floats passed through trace_float(). No length modifiers. */
+#define TRACE_EVENTS(X) \
+	X(TRACE_DISTANCE,           SENSOR, INFO,  3, "Distance: %.1f cm (%u us), average: %.0f cm") \
+	X(TRACE_ECHO_MISSED,        SENSOR, WARN,  2, "No echo between %u and %u us, widening window") \
+	X(TRACE_TARGET_LOST,        SENSOR, WARN,  2, "No echo between %u and %u us, target lost") \
+	X(TRACE_PING_INVALID,       SENSOR, WARN,  0, "Cannot ping (device is in invalid state)") \
+	X(TRACE_PING_TIMEOUT,       SENSOR, WARN,  0, "Ping timeout (echo timeout)") \
+	X(TRACE_ECHO_TIMEOUT,       SENSOR, WARN,  0, "Echo timeout (i.e. distance too big)") \
+	X(TRACE_ECHO_EARLY,         SENSOR, WARN,  0, "Echo too early (i.e. distance too small)") \
+	X(TRACE_MEASURE_FAILED,     SENSOR, ERROR, 1, "Measurement failed: 0x%x") \
+	X(TRACE_PUMP_DEFERRED,      SENSOR, WARN,  1, "Pump command(%u) deferred until the Zigbee stack is up") \
+	X(TRACE_PUMP_COMMAND,       SENSOR, INFO,  4, "Pump command(%u) sent to bindings at %.1f cm, %u us after the echo (max %u us)") \
+	X(TRACE_TREND_ALARM,        SENSOR, WARN,  4, "Alarms 0x%02x at %.1f cm, slope %.3f cm/min, cusum %.2f cm") \
+	X(TRACE_ZB_ACTION,          ZIGBEE, INFO,  1, "Zigbee action(0x%x) callback") \
+	X(TRACE_ZB_ACTION_UNKNOWN,  ZIGBEE, WARN,  1, "Receive Zigbee action(0x%x) callback") \
+	X(TRACE_ZB_MESSAGE,         ZIGBEE, INFO,  4, "Received message: endpoint(%u), cluster(0x%x), attribute(0x%x), data size(%u)") \
+	X(TRACE_ZB_UNEXPECTED,      ZIGBEE, WARN,  3, "Cluster(0x%x) data: attribute(0x%x), type(0x%x)") \
+	X(TRACE_LIGHT_POWER,        LIGHT,  INFO,  1, "Light sets to %u") \
+	X(TRACE_LIGHT_COLOR,        LIGHT,  INFO,  2, "Light color attribute(0x%x) changes to %u") \
+	X(TRACE_LIGHT_LEVEL,        LIGHT,  INFO,  1, "Light level changes to %u")
+
+typedef enum
+{
+#define TRACE_EVENT_ID(id, module, level, argc, format) id,
+	TRACE_EVENTS(TRACE_EVENT_ID)
+#undef TRACE_EVENT_ID
+	TRACE_EVENT_COUNT,
+} trace_event_t;
+
+/**
+ * @brief Record an event, the arguments are formatted later by the drain task
+ *
+ * Safe from any task. Costs a level check and a copy into the ring, when the
+ * ring is full the event is dropped and counted.
+ *
+ * @param id  Event, followed by its arguments as 32 bit words
+ */
+void trace_record(trace_event_t id, ...);
+
+/**
+ * @brief Pass a float argument to trace_record() without converting it
+ */
+static inline uint32_t trace_float(float value)
+{
+	union
+	{
+		float f;
+		uint32_t u;
+	} bits = {.f = value};
+	return bits.u;
+}
+
+/**
+ * @brief Start the drain task that formats recorded events to the log
+ *
+ * Events can be recorded before, they wait in the ring.
+ */
+esp_err_t trace_init(void);
+
+/**
+ * @brief Set the level of a module, events above it are not recorded
+ */
+esp_err_t trace_set_level(trace_module_t module, esp_log_level_t level);
+
+/**
+ * @brief Current level of a module
+ */
+esp_log_level_t trace_get_level(trace_module_t module);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_TRACE_H
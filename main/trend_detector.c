@@ -0,0 +1,286 @@
+#include <math.h>
+#include <freertos/FreeRTOS.h>
+#include "trend_detector.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "trace.h"
+
+#define TREND_NAMESPACE             "trend"
+#define TREND_KEY                   "config"
+#define TREND_VERSION               1
+#define TREND_DEFAULT_LEAK_RATE     30          /* 3 mm/h */
+#define TREND_DEFAULT_DRAIN_RATE    10          /* 1 cm/min */
+#define TREND_SLOPE_ALPHA           0.25f       /* about four minutes of slope memory */
+#define TREND_LEAK_BLOCKS           10          /* blocks per leak step, long enough for a draw to stand out of the noise */
+#define TREND_LEAK_DRAW_FACTOR      4           /* falls faster than this many leak rates are draws, not leaks */
+#define TREND_LEAK_FALL_ALPHA       0.5f        /* smoothing of the step falls for the draw test */
+#define TREND_LEAK_LIMIT_HOURS      2.0f        /* CUSUM limit as hours of fall at the leak rate, a leak at the rate takes twice that */
+#define TREND_LEAK_MIN_LIMIT_CM     0.3f        /* floor of the limit, well above the noise of the step means */
+#define TREND_OUTLIER_CM            10.0f       /* samples this far from the last block are outliers */
+
+typedef struct
+{
+	uint16_t version;
+	uint16_t size;
+	trend_config_t config;
+} trend_record_t;
+
+/* Everything the detector remembers, no samples are kept */
+typedef struct
+{
+	int64_t block_start_us;
+	float block_sum;
+	uint16_t block_count;
+	float outlier_sum;
+	uint16_t outlier_count;
+	bool have_mean;
+	float last_mean;            /* cm */
+	float slope;                /* cm/min, positive while the level falls */
+	float leak_mean;            /* cm, block mean at the start of the leak step */
+	float leak_fall;            /* cm per leak step, smoothed */
+	uint8_t leak_blocks;
+	float cusum;                /* cm of fall beyond the leak allowance */
+	uint8_t alarms;
+} trend_state_t;
+
+static const char *TAG = "TREND_DETECTOR";
+
+/* Configured and reset by the Zigbee task, the state belongs to the ultrasonic task */
+static portMUX_TYPE s_trend_mux = portMUX_INITIALIZER_UNLOCKED;
+static trend_config_t s_config = {
+		.leak_rate = TREND_DEFAULT_LEAK_RATE,
+		.drain_rate = TREND_DEFAULT_DRAIN_RATE,
+};
+static trend_state_t s_state;
+static uint8_t s_reset;
+
+esp_err_t trend_detector_init(void)
+{
+	trend_record_t record;
+	nvs_handle_t handle;
+	size_t size = sizeof(record);
+	esp_err_t err = nvs_open(TREND_NAMESPACE, NVS_READONLY, &handle);
+	if (err == ESP_OK)
+	{
+		err = nvs_get_blob(handle, TREND_KEY, &record, &size);
+		nvs_close(handle);
+	}
+	if (err == ESP_OK && (size != sizeof(record) || record.version != TREND_VERSION || record.size != sizeof(record)))
+	{
+		err = ESP_ERR_INVALID_VERSION;
+	}
+	if (err != ESP_OK)
+	{
+		/* a missing configuration is the normal first boot */
+		return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+	}
+	s_config = record.config;
+	ESP_LOGI(TAG, "Loaded leak %u, drain %u, overflow %u", s_config.leak_rate, s_config.drain_rate,
+			 s_config.overflow_mark);
+	return ESP_OK;
+}
+
+esp_err_t trend_detector_set_config(const trend_config_t *config)
+{
+	trend_record_t record = {
+			.version = TREND_VERSION,
+			.size = sizeof(record),
+			.config = *config,
+	};
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(TREND_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+	err = nvs_set_blob(handle, TREND_KEY, &record, sizeof(record));
+	if (err == ESP_OK)
+	{
+		err = nvs_commit(handle);
+	}
+	nvs_close(handle);
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+
+	portENTER_CRITICAL(&s_trend_mux);
+	s_config = *config;
+	portEXIT_CRITICAL(&s_trend_mux);
+	ESP_LOGI(TAG, "New leak %u, drain %u, overflow %u", config->leak_rate, config->drain_rate,
+			 config->overflow_mark);
+	return ESP_OK;
+}
+
+void trend_detector_get_config(trend_config_t *config)
+{
+	portENTER_CRITICAL(&s_trend_mux);
+	*config = s_config;
+	portEXIT_CRITICAL(&s_trend_mux);
+}
+
+/* One minute block finished, returns the alarm bits that should be active now */
+static uint8_t trend_detector_block(trend_state_t *state, const trend_config_t *config, float mean)
+{
+	uint8_t alarms = state->alarms;
+	if (!state->have_mean)
+	{
+		state->have_mean = true;
+		state->last_mean = mean;
+		state->leak_mean = mean;
+		state->leak_blocks = 0;
+		return alarms;
+	}
+	float change = mean - state->last_mean;
+	state->last_mean = mean;
+	state->slope += TREND_SLOPE_ALPHA * (change - state->slope);
+
+	/* Rapid drain, cleared at half the rate so it does not flap */
+	float drain_cm_min = config->drain_rate / 10.0f;
+	if (config->drain_rate && state->slope > drain_cm_min)
+	{
+		alarms |= TREND_ALARM_RAPID_DRAIN;
+	} else if (!config->drain_rate || state->slope < drain_cm_min / 2)
+	{
+		alarms &= ~TREND_ALARM_RAPID_DRAIN;
+	}
+
+	/* Leak: CUSUM of the fall beyond half the leak rate, one step every TREND_LEAK_BLOCKS blocks.
+	 * The changes telescope, so noise does not accumulate while a steady fall does. Steps whose
+	 * smoothed fall exceeds TREND_LEAK_DRAW_FACTOR leak rates are draws and drains, not leaks,
+	 * they start the sum over unless a leak is already raised; a slow draw would otherwise add up
+	 * to a leak over the hours it lasts. A single step adds at most the draw threshold, so the
+	 * first steps of a draw cannot raise the alarm before the smoothed fall catches up. */
+	float leak_cm_h = config->leak_rate / 100.0f;
+	float leak_limit = fmaxf(leak_cm_h * TREND_LEAK_LIMIT_HOURS, TREND_LEAK_MIN_LIMIT_CM);
+	if (++state->leak_blocks >= TREND_LEAK_BLOCKS)
+	{
+		float fall = mean - state->leak_mean;
+		float leak_cm_step = leak_cm_h / 60.0f * TREND_LEAK_BLOCKS;
+		float draw_cm_step = TREND_LEAK_DRAW_FACTOR * leak_cm_step;
+		state->leak_mean = mean;
+		state->leak_blocks = 0;
+		state->leak_fall += TREND_LEAK_FALL_ALPHA * (fall - state->leak_fall);
+		if (!config->leak_rate)
+		{
+			state->cusum = 0;
+		} else if (state->leak_fall > draw_cm_step || (alarms & TREND_ALARM_RAPID_DRAIN))
+		{
+			if (!(alarms & TREND_ALARM_LEAK))
+			{
+				state->cusum = 0;
+			}
+		} else
+		{
+			state->cusum += fminf(fall, draw_cm_step) - leak_cm_step / 2;
+			if (state->cusum < 0)
+			{
+				state->cusum = 0;
+			} else if (state->cusum > 2 * leak_limit)
+			{
+				state->cusum = 2 * leak_limit;
+			}
+		}
+	}
+	if (config->leak_rate && state->cusum >= leak_limit)
+	{
+		alarms |= TREND_ALARM_LEAK;
+	} else if (state->cusum == 0)
+	{
+		alarms &= ~TREND_ALARM_LEAK;
+	}
+
+	/* Overflow: at the mark already, or reaching it within the horizon at the current rise */
+	float headroom = mean - config->overflow_mark / 10.0f;
+	float rise = -state->slope;
+	if (config->overflow_mark && (headroom <= 0 || (rise > 0 && headroom < rise * TREND_OVERFLOW_HORIZON_MIN)))
+	{
+		alarms |= TREND_ALARM_OVERFLOW;
+	} else if (!config->overflow_mark || rise <= 0 || headroom > rise * 2 * TREND_OVERFLOW_HORIZON_MIN)
+	{
+		alarms &= ~TREND_ALARM_OVERFLOW;
+	}
+	return alarms;
+}
+
+uint8_t trend_detector_update(float distance, int64_t timestamp_us)
+{
+	trend_state_t *state = &s_state;
+	portENTER_CRITICAL(&s_trend_mux);
+	uint8_t reset = s_reset;
+	s_reset = 0;
+	state->alarms &= ~reset;
+	portEXIT_CRITICAL(&s_trend_mux);
+	if (reset & TREND_ALARM_LEAK)
+	{
+		state->cusum = 0;
+	}
+
+	if (state->block_count + state->outlier_count == 0)
+	{
+		state->block_start_us = timestamp_us;
+	}
+	if (state->have_mean && fabsf(distance - state->last_mean) > TREND_OUTLIER_CM)
+	{
+		state->outlier_sum += distance;
+		state->outlier_count++;
+	} else
+	{
+		state->block_sum += distance;
+		state->block_count++;
+	}
+	if (timestamp_us - state->block_start_us < TREND_BLOCK_US)
+	{
+		return 0;
+	}
+
+	float mean;
+	if (state->block_count >= state->outlier_count)
+	{
+		mean = state->block_sum / state->block_count;
+	} else
+	{
+		/* Mostly far off, the level stepped rather than a few stray echoes */
+		mean = state->outlier_sum / state->outlier_count;
+		state->have_mean = false;
+	}
+	/* After a long gap the change would look like a single step */
+	if (timestamp_us - state->block_start_us > 2 * TREND_BLOCK_US)
+	{
+		state->have_mean = false;
+	}
+	state->block_sum = 0;
+	state->block_count = 0;
+	state->outlier_sum = 0;
+	state->outlier_count = 0;
+
+	trend_config_t config;
+	trend_detector_get_config(&config);
+	uint8_t alarms = trend_detector_block(state, &config, mean);
+	uint8_t raised = alarms & ~state->alarms;
+
+	portENTER_CRITICAL(&s_trend_mux);
+	state->alarms = alarms;
+	portEXIT_CRITICAL(&s_trend_mux);
+	if (raised)
+	{
+		trace_record(TRACE_TREND_ALARM, alarms, trace_float(mean), trace_float(state->slope),
+					 trace_float(state->cusum));
+	}
+	return raised;
+}
+
+uint8_t trend_detector_alarms(void)
+{
+	portENTER_CRITICAL(&s_trend_mux);
+	uint8_t alarms = s_state.alarms;
+	portEXIT_CRITICAL(&s_trend_mux);
+	return alarms;
+}
+
+void trend_detector_reset(uint8_t alarms)
+{
+	portENTER_CRITICAL(&s_trend_mux);
+	s_reset |= alarms;
+	portEXIT_CRITICAL(&s_trend_mux);
+}
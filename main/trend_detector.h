@@ -0,0 +1,81 @@
+#ifndef DEPTH_SENSOR_TREND_DETECTOR_H
+#define DEPTH_SENSOR_TREND_DETECTOR_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Alarm bits, also the ZCL alarm codes minus one */
+#define TREND_ALARM_LEAK            (1 << 0)    /* level keeps falling by at least the leak rate */
+#define TREND_ALARM_RAPID_DRAIN     (1 << 1)    /* level falling faster than the drain rate */
+#define TREND_ALARM_OVERFLOW        (1 << 2)    /* level reaches the overflow mark within the horizon */
+#define TREND_ALARM_COUNT           3
+
+#define TREND_BLOCK_US              (60 * 1000000LL)    /* samples are averaged per minute */
+#define TREND_OVERFLOW_HORIZON_MIN  10
+
+/* Marks are distances from the sensor, like everywhere else */
+typedef struct
+{
+	uint16_t leak_rate;         /* smallest leak to detect (0.1 mm/h), falls 4 times faster are draws, 0 disables */
+	uint16_t drain_rate;        /* rapid drain (mm/min), 0 disables */
+	uint16_t overflow_mark;     /* distance of the overflow (mm), 0 disables */
+} trend_config_t;
+
+/**
+ * @brief Load the stored sensitivity from NVS
+ *
+ * NVS has to be initialized already. Without a stored configuration the defaults apply.
+ */
+esp_err_t trend_detector_init(void);
+
+/**
+ * @brief Replace the sensitivity and store it in NVS
+ *
+ * Active alarms are kept, each clears once its condition is gone under the new configuration.
+ */
+esp_err_t trend_detector_set_config(const trend_config_t *config);
+
+/**
+ * @brief Active sensitivity
+ */
+void trend_detector_get_config(trend_config_t *config);
+
+/**
+ * @brief Feed a distance sample
+ *
+ * Samples are averaged into one minute blocks. Every block updates a CUSUM of
+ * the level change for leaks and an exponentially weighted slope for rapid
+ * drains and overflow, all in a fixed state without sample history.
+ *
+ * @param distance     Unfiltered distance from the sensor (cm)
+ * @param timestamp_us When the sample was measured
+ *
+ * @return TREND_ALARM_* bits raised by this sample
+ */
+uint8_t trend_detector_update(float distance, int64_t timestamp_us);
+
+/**
+ * @brief TREND_ALARM_* bits currently active
+ */
+uint8_t trend_detector_alarms(void);
+
+/**
+ * @brief Clear active alarms, for Reset Alarm and Reset All Alarms
+ *
+ * Applied with the next sample. An alarm whose condition is still present is
+ * raised again, the leak alarm only after a new fall of the leak limit, two hours
+ * at the leak rate.
+ *
+ * @param alarms TREND_ALARM_* bits to clear
+ */
+void trend_detector_reset(uint8_t alarms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_TREND_DETECTOR_H
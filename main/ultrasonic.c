@@ -10,7 +10,7 @@
 #include "ultrasonic.h"
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <sys/time.h>
+#include <esp_timer.h>
 #include <esp_log.h>
 
 #define TRIGGER_LOW_DELAY 4
@@ -20,11 +20,10 @@
 
 static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
 
+// tv_usec alone wraps every second, use the monotonic microsecond timer
 static inline uint32_t get_time_us()
 {
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return tv.tv_usec;
+	return (uint32_t) esp_timer_get_time();
 }
 
 #define timeout_expired(start, len) ((uint32_t)(get_time_us() - (start)) >= (len))
@@ -41,9 +40,10 @@ void ultrasonic_init(const ultrasonic_sensor_t *dev)
 	gpio_set_level(dev->trigger_pin, 0);
 }
 
-esp_err_t ultrasonic_measure_cm(const ultrasonic_sensor_t *dev, uint32_t max_distance, int32_t *distance)
+esp_err_t ultrasonic_measure_raw_window(const ultrasonic_sensor_t *dev, uint32_t min_time_us, uint32_t max_time_us,
+										uint32_t *time_us)
 {
-	if (!distance)
+	if (!time_us)
 		return ESP_ERR_INVALID_ARG;
 
 	portENTER_CRITICAL(&mux);
@@ -64,10 +64,7 @@ esp_err_t ultrasonic_measure_cm(const ultrasonic_sensor_t *dev, uint32_t max_dis
 	while (!gpio_get_level(dev->echo_pin))
 	{
 		if (timeout_expired(start, PING_TIMEOUT))
-		{
-			portEXIT_CRITICAL(&mux);
-			return ESP_ERR_ULTRASONIC_PING_TIMEOUT;
-		}
+			RETURN_CRTCAL(mux, ESP_ERR_ULTRASONIC_PING_TIMEOUT);
 	}
 
 	// got echo, measuring
@@ -76,18 +73,46 @@ esp_err_t ultrasonic_measure_cm(const ultrasonic_sensor_t *dev, uint32_t max_dis
 	while (gpio_get_level(dev->echo_pin))
 	{
 		time = get_time_us();
+		if (timeout_expired(echo_start, max_time_us))
+			RETURN_CRTCAL(mux, ESP_ERR_ULTRASONIC_ECHO_TIMEOUT);
 	}
 	portEXIT_CRITICAL(&mux);
 
-	uint32_t temp = (time - echo_start) / ROUNDTRIP;
+	*time_us = time - echo_start;
+	if (*time_us < min_time_us)
+		return ESP_ERR_ULTRASONIC_ECHO_EARLY;
 
-	if (temp > max_distance)
-	{
-		portEXIT_CRITICAL(&mux);
-		return ESP_ERR_ULTRASONIC_ECHO_TIMEOUT;
-	}
+	return ESP_OK;
+}
+
+esp_err_t ultrasonic_measure_raw(const ultrasonic_sensor_t *dev, uint32_t max_time_us, uint32_t *time_us)
+{
+	return ultrasonic_measure_raw_window(dev, 0, max_time_us, time_us);
+}
+
+esp_err_t ultrasonic_measure_cm(const ultrasonic_sensor_t *dev, uint32_t max_distance, int32_t *distance)
+{
+	if (!distance)
+		return ESP_ERR_INVALID_ARG;
 
-	*distance = (int32_t) temp;
+	uint32_t time_us;
+	esp_err_t res = ultrasonic_measure_raw(dev, max_distance * ROUNDTRIP, &time_us);
+	if (res != ESP_OK)
+		return res;
+
+	*distance = (int32_t) (time_us / ROUNDTRIP);
 
 	return ESP_OK;
-}
\ No newline at end of file
+}
+
+float ultrasonic_speed_of_sound(float temperature)
+{
+	// Linear approximation, good to 0.1 % between -20 and 50 degrees
+	return 331.3f + 0.606f * temperature;
+}
+
+float ultrasonic_time_to_cm(uint32_t time_us, float speed_of_sound)
+{
+	// Half of the round trip, m/s * us -> cm
+	return (float) time_us * speed_of_sound / 20000.0f;
+}
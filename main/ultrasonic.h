@@ -20,6 +20,7 @@ extern "C" {
 #define ESP_ERR_ULTRASONIC_PING         0x200
 #define ESP_ERR_ULTRASONIC_PING_TIMEOUT 0x201
 #define ESP_ERR_ULTRASONIC_ECHO_TIMEOUT 0x202
+#define ESP_ERR_ULTRASONIC_ECHO_EARLY   0x203
 
 /**
  * Device descriptor
@@ -44,6 +45,45 @@ void ultrasonic_init(const ultrasonic_sensor_t *dev);
  */
 esp_err_t ultrasonic_measure_cm(const ultrasonic_sensor_t *dev, uint32_t max_distance, int32_t *distance);
 
+/**
+ * Measure the echo pulse length
+ * \param dev Pointer to the device descriptor
+ * \param max_time_us Maximal echo pulse length, microseconds
+ * \param time_us Echo pulse length, microseconds
+ * \return ESP_OK or ESP_ERR_ULTRASONIC_xxx if error occured
+ */
+esp_err_t ultrasonic_measure_raw(const ultrasonic_sensor_t *dev, uint32_t max_time_us, uint32_t *time_us);
+
+/**
+ * Measure the echo pulse length, accepting only echoes inside a window
+ *
+ * Gives up as soon as the window is over instead of waiting for the longest
+ * possible echo, which keeps the time spent in the critical section short.
+ * \param dev Pointer to the device descriptor
+ * \param min_time_us Shorter echoes are rejected, microseconds
+ * \param max_time_us Longer echoes are not waited for, microseconds
+ * \param time_us Echo pulse length, microseconds
+ * \return ESP_OK, ESP_ERR_ULTRASONIC_ECHO_EARLY for an echo before the window,
+ *         ESP_ERR_ULTRASONIC_ECHO_TIMEOUT for none inside it, or another ESP_ERR_ULTRASONIC_xxx
+ */
+esp_err_t ultrasonic_measure_raw_window(const ultrasonic_sensor_t *dev, uint32_t min_time_us, uint32_t max_time_us,
+										uint32_t *time_us);
+
+/**
+ * Speed of sound in air
+ * \param temperature Air temperature, degrees Celsius
+ * \return Speed of sound, meters per second
+ */
+float ultrasonic_speed_of_sound(float temperature);
+
+/**
+ * Convert an echo pulse length to distance
+ * \param time_us Echo pulse length, microseconds
+ * \param speed_of_sound Speed of sound, meters per second
+ * \return Distance in centimeters
+ */
+float ultrasonic_time_to_cm(uint32_t time_us, float speed_of_sound);
+
 #ifdef __cplusplus
 }
 #endif
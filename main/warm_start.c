@@ -0,0 +1,126 @@
+#include <math.h>
+#include <string.h>
+#include <sys/time.h>
+#include "warm_start.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#define WARM_START_NAMESPACE "warm_start"
+#define WARM_START_KEY       "state"
+#define WARM_START_VERSION   1
+
+typedef struct
+{
+	uint16_t version;
+	uint16_t size;
+	int64_t saved_at;           /* RTC time of the write (second) */
+	warm_start_state_t state;
+} warm_start_record_t;
+
+static const char *TAG = "WARM_START";
+
+/* Boot counts as a write so a device stuck in a reset loop does not wear the flash */
+static int64_t s_last_write_us = 0;
+static float s_last_written_distance = NAN;
+
+static int64_t rtc_time_s(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec;
+}
+
+esp_err_t warm_start_restore(warm_start_state_t *state)
+{
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(WARM_START_NAMESPACE, NVS_READONLY, &handle);
+	if (err != ESP_OK)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	warm_start_record_t record;
+	size_t size = sizeof(record);
+	err = nvs_get_blob(handle, WARM_START_KEY, &record, &size);
+	nvs_close(handle);
+	if (err == ESP_ERR_NVS_NOT_FOUND)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+	if (err != ESP_OK || size != sizeof(record))
+	{
+		return ESP_ERR_INVALID_VERSION;
+	}
+	if (record.version != WARM_START_VERSION || record.size != sizeof(record))
+	{
+		return ESP_ERR_INVALID_VERSION;
+	}
+	if (record.state.filter.count == 0 || record.state.filter.count > DEPTH_FILTER_WINDOW ||
+		record.state.filter.index >= DEPTH_FILTER_WINDOW)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	/* The RTC survives software resets but restarts from zero on power loss; only a
+	 * checkpoint from the past can be aged, the rest is left to warm_start_is_consistent() */
+	int64_t now = rtc_time_s();
+	if (now >= record.saved_at && now - record.saved_at > WARM_START_MAX_AGE)
+	{
+		ESP_LOGW(TAG, "Checkpoint is %lld s old, discarding", now - record.saved_at);
+		return ESP_ERR_TIMEOUT;
+	}
+
+	*state = record.state;
+	s_last_written_distance = record.state.distance;
+	ESP_LOGI(TAG, "Restored %d samples, distance %.0f cm", record.state.filter.count, record.state.distance);
+	return ESP_OK;
+}
+
+bool warm_start_is_consistent(const warm_start_state_t *state, float distance)
+{
+	return fabsf(depth_filter_average(&state->filter) - distance) <= WARM_START_MAX_DEVIATION;
+}
+
+void warm_start_checkpoint(const warm_start_state_t *state)
+{
+	int64_t now_us = esp_timer_get_time();
+	int64_t since_last_s = (now_us - s_last_write_us) / 1000000;
+	if (since_last_s < WARM_START_MIN_INTERVAL)
+	{
+		return;
+	}
+	bool changed = isnan(s_last_written_distance) ||
+				   fabsf(state->distance - s_last_written_distance) >= WARM_START_MIN_CHANGE;
+	if (!changed && since_last_s < WARM_START_HEARTBEAT_INTERVAL)
+	{
+		return;
+	}
+
+	warm_start_record_t record = {
+			.version = WARM_START_VERSION,
+			.size = sizeof(record),
+			.saved_at = rtc_time_s(),
+			.state = *state,
+	};
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(WARM_START_NAMESPACE, NVS_READWRITE, &handle);
+	if (err == ESP_OK)
+	{
+		err = nvs_set_blob(handle, WARM_START_KEY, &record, sizeof(record));
+		if (err == ESP_OK)
+		{
+			err = nvs_commit(handle);
+		}
+		nvs_close(handle);
+	}
+	/* Count failed writes too, so a broken flash is not retried on every sample */
+	s_last_write_us = now_us;
+	if (err != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Checkpoint failed: %s", esp_err_to_name(err));
+		return;
+	}
+	s_last_written_distance = state->distance;
+	ESP_LOGI(TAG, "Checkpoint written, distance %.0f cm", state->distance);
+}
@@ -0,0 +1,72 @@
+#ifndef DEPTH_SENSOR_WARM_START_H
+#define DEPTH_SENSOR_WARM_START_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "depth_filter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Checkpoint configuration */
+#define WARM_START_MIN_INTERVAL       (10 * 60)         /* Minimum time between two flash writes (second) */
+#define WARM_START_HEARTBEAT_INTERVAL (6 * 60 * 60)     /* Rewrite an unchanged state this often to keep it fresh (second) */
+#define WARM_START_MAX_AGE            (24 * 60 * 60)    /* Older checkpoints are discarded at boot (second) */
+#define WARM_START_MIN_CHANGE         (1.0f)            /* Published distance change worth a write (cm) */
+#define WARM_START_MAX_DEVIATION      (10.0f)           /* First live sample further than this from the restored average discards it (cm) */
+
+/**
+ * Pipeline state carried across reboots
+ */
+typedef struct
+{
+	depth_filter_t filter;
+	float distance;             /* last published distance (cm) */
+	int16_t temperature;        /* last published temperature (0.01 degree Celsius) */
+	bool temperature_valid;
+} warm_start_state_t;
+
+/**
+ * @brief Load the last checkpoint from NVS
+ *
+ * NVS has to be initialized already.
+ *
+ * @param[out] state Restored state, untouched on failure
+ *
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if there is no checkpoint,
+ *         ESP_ERR_INVALID_VERSION if it was written by an incompatible firmware,
+ *         ESP_ERR_INVALID_STATE if it is corrupted, ESP_ERR_TIMEOUT if it is stale.
+ */
+esp_err_t warm_start_restore(warm_start_state_t *state);
+
+/**
+ * @brief Offer the current state for checkpointing
+ *
+ * Cheap to call on every sample. The state is only written when WARM_START_MIN_INTERVAL
+ * has passed since the last write and either the published distance moved by at least
+ * WARM_START_MIN_CHANGE or WARM_START_HEARTBEAT_INTERVAL has passed.
+ *
+ * @param state Current state
+ */
+void warm_start_checkpoint(const warm_start_state_t *state);
+
+/**
+ * @brief Check a restored state against the first live sample
+ *
+ * Covers the case where the restored checkpoint age could not be verified
+ * (RTC reset by a power loss) and the tank changed meanwhile.
+ *
+ * @param state    Restored state
+ * @param distance First live distance sample (cm)
+ *
+ * @return true if the restored filter window can be kept
+ */
+bool warm_start_is_consistent(const warm_start_state_t *state, float distance);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEPTH_SENSOR_WARM_START_H
@@ -0,0 +1,10 @@
+#ifndef SIM_DRIVER_USB_SERIAL_JTAG_H
+#define SIM_DRIVER_USB_SERIAL_JTAG_H
+
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+
+/* Appends to the file given with -o, see console.c */
+int usb_serial_jtag_write_bytes(const void *src, size_t size, TickType_t ticks_to_wait);
+
+#endif
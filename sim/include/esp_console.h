@@ -0,0 +1,54 @@
+#ifndef SIM_ESP_CONSOLE_H
+#define SIM_ESP_CONSOLE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef int (*esp_console_cmd_func_t)(int argc, char **argv);
+
+typedef struct
+{
+	const char *command;
+	const char *help;
+	const char *hint;
+	esp_console_cmd_func_t func;
+	void *argtable;
+} esp_console_cmd_t;
+
+typedef struct esp_console_repl_s esp_console_repl_t;
+
+typedef struct
+{
+	uint32_t max_history_len;
+	const char *history_save_path;
+	uint32_t task_stack_size;
+	uint32_t task_priority;
+	const char *prompt;
+	size_t max_cmdline_length;
+} esp_console_repl_config_t;
+
+#define ESP_CONSOLE_REPL_CONFIG_DEFAULT() \
+    {                                     \
+        .max_history_len = 32,            \
+        .task_stack_size = 4096,          \
+        .task_priority = 2,               \
+    }
+
+typedef struct
+{
+	int unused;
+} esp_console_dev_usb_serial_jtag_config_t;
+
+#define ESP_CONSOLE_DEV_USB_SERIAL_JTAG_CONFIG_DEFAULT() {0}
+
+esp_err_t esp_console_new_repl_usb_serial_jtag(const esp_console_dev_usb_serial_jtag_config_t *dev_config,
+											   const esp_console_repl_config_t *repl_config,
+											   esp_console_repl_t **ret_repl);
+esp_err_t esp_console_start_repl(esp_console_repl_t *repl);
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd);
+esp_err_t esp_console_register_help_command(void);
+
+/* Runs a command line, the scenario's "console" events come through here */
+esp_err_t esp_console_run(const char *cmdline, int *cmd_ret);
+
+#endif
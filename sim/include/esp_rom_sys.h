@@ -0,0 +1,9 @@
+#ifndef SIM_ESP_ROM_SYS_H
+#define SIM_ESP_ROM_SYS_H
+
+#include <stdint.h>
+
+void esp_rom_delay_us(uint32_t us);
+int esp_rom_printf(const char *fmt, ...);
+
+#endif
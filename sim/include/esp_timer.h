@@ -0,0 +1,9 @@
+#ifndef SIM_ESP_TIMER_H
+#define SIM_ESP_TIMER_H
+
+#include <stdint.h>
+
+/* Simulated clock, every read costs SIM_TIMER_READ_COST_US of busy time */
+int64_t esp_timer_get_time(void);
+
+#endif
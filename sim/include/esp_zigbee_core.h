@@ -0,0 +1,126 @@
+/* Zigbee core API subset, backed by the recording stack in sim/src/sim_zigbee.c */
+#ifndef SIM_ESP_ZIGBEE_CORE_H
+#define SIM_ESP_ZIGBEE_CORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_zigbee_zcl.h"
+#include "zboss_api.h"
+
+typedef uint8_t esp_zb_ieee_addr_t[8];
+
+typedef enum
+{
+	ESP_ZB_DEVICE_TYPE_COORDINATOR = 0x0,
+	ESP_ZB_DEVICE_TYPE_ROUTER = 0x1,
+	ESP_ZB_DEVICE_TYPE_ED = 0x2,
+} esp_zb_nwk_device_type_t;
+
+typedef struct
+{
+	uint8_t max_children;
+} esp_zb_zczr_cfg_t;
+
+typedef struct
+{
+	esp_zb_nwk_device_type_t esp_zb_role;
+	bool install_code_policy;
+	union
+	{
+		esp_zb_zczr_cfg_t zczr_cfg;
+	} nwk_cfg;
+} esp_zb_cfg_t;
+
+typedef enum
+{
+	ZB_RADIO_MODE_NATIVE = 0x0,
+} esp_zb_radio_mode_t;
+
+typedef enum
+{
+	ZB_HOST_CONNECTION_MODE_NONE = 0x0,
+} esp_zb_host_connection_mode_t;
+
+typedef struct
+{
+	esp_zb_radio_mode_t radio_mode;
+} esp_zb_radio_config_t;
+
+typedef struct
+{
+	esp_zb_host_connection_mode_t host_connection_mode;
+} esp_zb_host_config_t;
+
+typedef struct
+{
+	esp_zb_radio_config_t radio_config;
+	esp_zb_host_config_t host_config;
+} esp_zb_platform_config_t;
+
+#define ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK    0x07FFF800U
+
+typedef enum
+{
+	ESP_ZB_ZDO_SIGNAL_DEFAULT_START = 0x00,
+	ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP = 0x01,
+	ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE = 0x02,
+	ESP_ZB_ZDO_SIGNAL_LEAVE = 0x03,
+	ESP_ZB_ZDO_SIGNAL_ERROR = 0x04,
+	ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START = 0x05,
+	ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT = 0x06,
+	ESP_ZB_BDB_SIGNAL_STEERING = 0x0a,
+	ESP_ZB_BDB_SIGNAL_FORMATION = 0x0b,
+} esp_zb_app_signal_type_t;
+
+typedef struct
+{
+	uint32_t *p_app_signal;
+	esp_err_t esp_err_status;
+} esp_zb_app_signal_t;
+
+typedef enum
+{
+	ESP_ZB_BDB_MODE_INITIALIZATION = 0,
+	ESP_ZB_BDB_MODE_TOUCHLINK_COMMISSIONING = 1,
+	ESP_ZB_BDB_MODE_NETWORK_STEERING = 2,
+	ESP_ZB_BDB_MODE_NETWORK_FORMATION = 4,
+} esp_zb_bdb_commissioning_mode_mask_t;
+
+typedef void (*esp_zb_callback_t)(uint8_t param);
+
+/* Sees every ZCL command before the stack, true when the application handled it */
+typedef bool (*esp_zb_zcl_raw_command_callback_t)(uint8_t bufid);
+
+void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_s);
+
+esp_err_t esp_zb_platform_config(esp_zb_platform_config_t *config);
+void esp_zb_init(esp_zb_cfg_t *nwk_cfg);
+esp_err_t esp_zb_device_register(esp_zb_ep_list_t *ep_list);
+esp_err_t esp_zb_set_primary_network_channel_set(uint32_t channel_mask);
+esp_err_t esp_zb_set_secondary_network_channel_set(uint32_t channel_mask);
+esp_err_t esp_zb_start(bool autostart);
+void esp_zb_stack_main_loop(void);
+bool esp_zb_is_started(void);
+
+esp_err_t esp_zb_bdb_start_top_level_commissioning(uint8_t mode_mask);
+bool esp_zb_bdb_is_factory_new(void);
+bool esp_zb_bdb_dev_joined(void);
+esp_err_t esp_zb_nvram_erase_at_start(bool erase);
+void esp_zb_get_extended_pan_id(esp_zb_ieee_addr_t ext_pan_id);
+void esp_zb_set_extended_pan_id(const esp_zb_ieee_addr_t ext_pan_id);
+uint16_t esp_zb_get_pan_id(void);
+uint8_t esp_zb_get_current_channel(void);
+uint16_t esp_zb_get_short_address(void);
+const char *esp_zb_zdo_signal_to_string(esp_zb_app_signal_type_t signal);
+
+void esp_zb_raw_command_handler_register(esp_zb_zcl_raw_command_callback_t cb);
+
+void esp_zb_scheduler_alarm(esp_zb_callback_t cb, uint8_t param, uint32_t time);
+void esp_zb_scheduler_alarm_cancel(esp_zb_callback_t cb, uint8_t param);
+
+bool esp_zb_lock_acquire(TickType_t block_ticks);
+void esp_zb_lock_release(void);
+
+#endif
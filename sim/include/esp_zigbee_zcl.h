@@ -0,0 +1,314 @@
+/* ZCL subset of esp-zigbee-lib used by the firmware, see sim/src/sim_zigbee.c */
+#ifndef SIM_ESP_ZIGBEE_ZCL_H
+#define SIM_ESP_ZIGBEE_ZCL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct esp_zb_attribute_list_s esp_zb_attribute_list_t;
+typedef esp_zb_attribute_list_t esp_zb_cluster_list_t;
+typedef struct esp_zb_ep_list_s esp_zb_ep_list_t;
+
+typedef enum
+{
+	ESP_ZB_ZCL_CLUSTER_SERVER_ROLE = 0x01,
+	ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE = 0x02,
+} esp_zb_zcl_cluster_role_t;
+
+enum
+{
+	ESP_ZB_ZCL_CLUSTER_ID_BASIC = 0x0000,
+	ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY = 0x0003,
+	ESP_ZB_ZCL_CLUSTER_ID_GROUPS = 0x0004,
+	ESP_ZB_ZCL_CLUSTER_ID_SCENES = 0x0005,
+	ESP_ZB_ZCL_CLUSTER_ID_ON_OFF = 0x0006,
+	ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL = 0x0008,
+	ESP_ZB_ZCL_CLUSTER_ID_ALARMS = 0x0009,
+	ESP_ZB_ZCL_CLUSTER_ID_ANALOG_OUTPUT = 0x000d,
+	ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL = 0x0300,
+	ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT = 0x0402,
+};
+
+typedef enum
+{
+	ESP_ZB_ZCL_STATUS_SUCCESS = 0x00,
+	ESP_ZB_ZCL_STATUS_FAIL = 0x01,
+	ESP_ZB_ZCL_STATUS_UNSUP_ATTRIB = 0x86,
+	ESP_ZB_ZCL_STATUS_INVALID_VALUE = 0x87,
+	ESP_ZB_ZCL_STATUS_NOT_FOUND = 0x8b,
+	ESP_ZB_ZCL_STATUS_INVALID_TYPE = 0x8d,
+} esp_zb_zcl_status_t;
+
+typedef enum
+{
+	ESP_ZB_ZCL_ATTR_TYPE_NULL = 0x00,
+	ESP_ZB_ZCL_ATTR_TYPE_BOOL = 0x10,
+	ESP_ZB_ZCL_ATTR_TYPE_8BITMAP = 0x18,
+	ESP_ZB_ZCL_ATTR_TYPE_16BITMAP = 0x19,
+	ESP_ZB_ZCL_ATTR_TYPE_U8 = 0x20,
+	ESP_ZB_ZCL_ATTR_TYPE_U16 = 0x21,
+	ESP_ZB_ZCL_ATTR_TYPE_U32 = 0x23,
+	ESP_ZB_ZCL_ATTR_TYPE_S8 = 0x28,
+	ESP_ZB_ZCL_ATTR_TYPE_S16 = 0x29,
+	ESP_ZB_ZCL_ATTR_TYPE_S32 = 0x2b,
+	ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM = 0x30,
+	ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM = 0x31,
+	ESP_ZB_ZCL_ATTR_TYPE_SINGLE = 0x39,
+	ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING = 0x41,
+	ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING = 0x42,
+	ESP_ZB_ZCL_ATTR_TYPE_SET = 0x50,
+} esp_zb_zcl_attr_type_t;
+
+typedef enum
+{
+	ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY = 0x01,
+	ESP_ZB_ZCL_ATTR_ACCESS_WRITE_ONLY = 0x02,
+	ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE = 0x03,
+	ESP_ZB_ZCL_ATTR_ACCESS_REPORTING = 0x04,
+	ESP_ZB_ZCL_ATTR_MANUF_SPEC = 0x08,
+} esp_zb_zcl_attr_access_t;
+
+enum
+{
+	ESP_ZB_ZCL_ATTR_BASIC_ZCL_VERSION_ID = 0x0000,
+	ESP_ZB_ZCL_ATTR_BASIC_MANUFACTURER_NAME_ID = 0x0004,
+	ESP_ZB_ZCL_ATTR_BASIC_MODEL_IDENTIFIER_ID = 0x0005,
+	ESP_ZB_ZCL_ATTR_BASIC_POWER_SOURCE_ID = 0x0007,
+	ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID = 0x0000,
+	ESP_ZB_ZCL_ATTR_GROUPS_NAME_SUPPORT_ID = 0x0000,
+	ESP_ZB_ZCL_ATTR_SCENES_SCENE_COUNT_ID = 0x0000,
+	ESP_ZB_ZCL_ATTR_SCENES_CURRENT_SCENE_ID = 0x0001,
+	ESP_ZB_ZCL_ATTR_SCENES_CURRENT_GROUP_ID = 0x0002,
+	ESP_ZB_ZCL_ATTR_SCENES_SCENE_VALID_ID = 0x0003,
+	ESP_ZB_ZCL_ATTR_SCENES_NAME_SUPPORT_ID = 0x0004,
+	ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID = 0x0000,
+	ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID = 0x0000,
+	ESP_ZB_ZCL_ATTR_ANALOG_OUTPUT_OUT_OF_SERVICE_ID = 0x0051,
+	ESP_ZB_ZCL_ATTR_ANALOG_OUTPUT_PRESENT_VALUE_ID = 0x0055,
+	ESP_ZB_ZCL_ATTR_ANALOG_OUTPUT_STATUS_FLAGS_ID = 0x006f,
+	ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID = 0x0000,
+	ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_MIN_VALUE_ID = 0x0001,
+	ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_MAX_VALUE_ID = 0x0002,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_HUE_ID = 0x0000,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID = 0x0001,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID = 0x0003,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID = 0x0004,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMPERATURE_ID = 0x0007,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_MODE_ID = 0x0008,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_OPTIONS_ID = 0x000f,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_CURRENT_HUE_ID = 0x4000,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_COLOR_MODE_ID = 0x4001,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_CAPABILITIES_ID = 0x400a,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMP_PHYSICAL_MIN_MIREDS_ID = 0x400b,
+	ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMP_PHYSICAL_MAX_MIREDS_ID = 0x400c,
+};
+
+#define ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC   0xFFFF
+#define ESP_ZB_AF_HA_PROFILE_ID                     0x0104
+#define ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID             0xfff0
+
+typedef struct
+{
+	esp_zb_zcl_attr_type_t type;
+	uint16_t size;
+	void *value;
+} esp_zb_zcl_attribute_data_t;
+
+typedef struct
+{
+	uint16_t id;
+	esp_zb_zcl_attribute_data_t data;
+} esp_zb_zcl_attribute_t;
+
+typedef struct
+{
+	esp_zb_zcl_status_t status;
+	uint8_t dst_endpoint;
+	uint16_t cluster;
+} esp_zb_device_cb_common_info_t;
+
+typedef struct
+{
+	esp_zb_device_cb_common_info_t info;
+	esp_zb_zcl_attribute_t attribute;
+} esp_zb_zcl_set_attr_value_message_t;
+
+typedef struct esp_zb_zcl_scenes_extension_field_s
+{
+	uint16_t cluster_id;
+	uint8_t length;
+	uint8_t *extension_field_attribute_value_list;
+	struct esp_zb_zcl_scenes_extension_field_s *next;
+} esp_zb_zcl_scenes_extension_field_t;
+
+typedef struct
+{
+	esp_zb_device_cb_common_info_t info;
+	uint16_t group_id;
+	uint8_t scene_id;
+} esp_zb_zcl_store_scene_message_t;
+
+typedef struct
+{
+	esp_zb_device_cb_common_info_t info;
+	uint16_t group_id;
+	uint8_t scene_id;
+	uint16_t transition_time;
+	esp_zb_zcl_scenes_extension_field_t *field_set;
+} esp_zb_zcl_recall_scene_message_t;
+
+typedef struct
+{
+	uint16_t id;
+	uint8_t type;
+	uint8_t access;
+	uint16_t manuf_code;
+	void *data_p;
+} esp_zb_zcl_attr_t;
+
+typedef enum
+{
+	ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID = 0x0000,
+	ESP_ZB_CORE_SCENES_STORE_SCENE_CB_ID = 0x0001,
+	ESP_ZB_CORE_SCENES_RECALL_SCENE_CB_ID = 0x0002,
+	ESP_ZB_CORE_IDENTIFY_EFFECT_CB_ID = 0x0003,
+	ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID = 0x1000,
+	ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID = 0x1002,
+	ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID = 0x1005,
+	ESP_ZB_CORE_REPORT_ATTR_CB_ID = 0x2000,
+} esp_zb_core_action_callback_id_t;
+
+typedef esp_err_t (*esp_zb_core_action_callback_t)(esp_zb_core_action_callback_id_t callback_id, const void *message);
+
+typedef enum
+{
+	ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV = 0x00,
+	ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI = 0x01,
+} esp_zb_zcl_cmd_direction_t;
+
+/* Reportable change, in the attribute's own type; singles go through data_buf */
+typedef union esp_zb_zcl_attr_var_u
+{
+	uint8_t u8;
+	int8_t s8;
+	uint16_t u16;
+	int16_t s16;
+	uint32_t u32;
+	int32_t s32;
+	uint8_t data_buf[4];
+} esp_zb_zcl_attr_var_t;
+
+typedef struct
+{
+	uint8_t direction;
+	uint8_t ep;
+	uint16_t cluster_id;
+	uint8_t cluster_role;
+	uint16_t attr_id;
+	uint8_t flags;
+	uint64_t run_time;
+	union
+	{
+		struct
+		{
+			uint16_t min_interval;
+			uint16_t max_interval;
+			esp_zb_zcl_attr_var_t delta;
+			union
+			{
+				uint8_t u8;
+				uint16_t u16;
+			} reported_value;
+			uint16_t def_min_interval;
+			uint16_t def_max_interval;
+		} send_info;
+		struct
+		{
+			uint16_t timeout;
+		} recv_info;
+	} u;
+	struct
+	{
+		uint16_t short_addr;
+		uint8_t endpoint;
+		uint16_t profile_id;
+	} dst;
+	uint16_t manuf_code;
+} esp_zb_zcl_reporting_info_t;
+
+typedef enum
+{
+	ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT = 0x00,  /* send to the binding table */
+	ESP_ZB_APS_ADDR_MODE_16_GROUP_ENDP_NOT_PRESENT = 0x01,
+	ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT = 0x02,
+	ESP_ZB_APS_ADDR_MODE_64_ENDP_PRESENT = 0x03,
+} esp_zb_zcl_address_mode_t;
+
+typedef union
+{
+	uint16_t addr_short;
+	uint8_t addr_long[8];
+} esp_zb_addr_u;
+
+typedef struct
+{
+	esp_zb_addr_u dst_addr_u;
+	uint8_t dst_endpoint;
+	uint8_t src_endpoint;
+} esp_zb_zcl_basic_cmd_t;
+
+typedef enum
+{
+	ESP_ZB_ZCL_CMD_ON_OFF_OFF_ID = 0x00,
+	ESP_ZB_ZCL_CMD_ON_OFF_ON_ID = 0x01,
+	ESP_ZB_ZCL_CMD_ON_OFF_TOGGLE_ID = 0x02,
+} esp_zb_zcl_on_off_cmd_id_t;
+
+typedef enum
+{
+	ESP_ZB_ZCL_CMD_SCENES_ADD_SCENE = 0x00,
+	ESP_ZB_ZCL_CMD_SCENES_VIEW_SCENE = 0x01,
+	ESP_ZB_ZCL_CMD_SCENES_REMOVE_SCENE = 0x02,
+	ESP_ZB_ZCL_CMD_SCENES_REMOVE_ALL_SCENES = 0x03,
+	ESP_ZB_ZCL_CMD_SCENES_STORE_SCENE = 0x04,
+	ESP_ZB_ZCL_CMD_SCENES_RECALL_SCENE = 0x05,
+	ESP_ZB_ZCL_CMD_SCENES_GET_SCENE_MEMBERSHIP = 0x06,
+} esp_zb_zcl_scenes_cmd_id_t;
+
+typedef struct
+{
+	esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+	esp_zb_zcl_address_mode_t address_mode;
+	uint8_t on_off_cmd_id;
+} esp_zb_zcl_on_off_cmd_t;
+
+typedef struct
+{
+	esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+	esp_zb_zcl_address_mode_t address_mode;
+	uint16_t profile_id;
+	uint16_t cluster_id;
+	uint16_t manuf_code;
+	uint8_t direction;
+	uint8_t dis_default_resp;
+	uint8_t manuf_specific;
+	uint16_t custom_cmd_id;
+	struct
+	{
+		esp_zb_zcl_attr_type_t type;
+		uint16_t size;
+		void *value;
+	} data;
+} esp_zb_zcl_custom_cluster_cmd_t;
+
+void esp_zb_core_action_handler_register(esp_zb_core_action_callback_t cb);
+esp_zb_zcl_status_t esp_zb_zcl_set_attribute_val(uint8_t endpoint, uint16_t cluster_id, uint8_t cluster_role,
+												 uint16_t attr_id, void *value_p, bool check);
+esp_zb_zcl_attr_t *esp_zb_zcl_get_attribute(uint8_t endpoint, uint16_t cluster_id, uint8_t cluster_role,
+											uint16_t attr_id);
+esp_err_t esp_zb_zcl_update_reporting_info(esp_zb_zcl_reporting_info_t *report_info);
+uint8_t esp_zb_zcl_on_off_cmd_req(esp_zb_zcl_on_off_cmd_t *cmd_req);
+uint8_t esp_zb_zcl_custom_cluster_cmd_req(esp_zb_zcl_custom_cluster_cmd_t *cmd_req);
+
+#endif
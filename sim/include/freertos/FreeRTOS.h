@@ -0,0 +1,44 @@
+/* FreeRTOS API subset for the host simulation, see sim/src/sim_freertos.c */
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;            /* ESP-IDF counts stacks in bytes */
+typedef struct sim_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef struct
+{
+	uint8_t reserved[64];
+} StaticTask_t;
+
+#define pdFALSE                 0
+#define pdTRUE                  1
+#define pdFAIL                  pdFALSE
+#define pdPASS                  pdTRUE
+#define portMAX_DELAY           ((TickType_t) 0xffffffffUL)
+#define configTICK_RATE_HZ      100
+#define configMINIMAL_STACK_SIZE 768
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)       ((TickType_t) (((uint64_t) (ms) * configTICK_RATE_HZ) / 1000))
+
+/* Tasks are cooperative, so critical sections need no locking */
+typedef struct
+{
+	int unused;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux)     ((void) (mux))
+#define portEXIT_CRITICAL(mux)      ((void) (mux))
+#define configASSERT(x)             do { if (!(x)) { sim_assert_failed(#x, __FILE__, __LINE__); } } while (0)
+
+void sim_assert_failed(const char *expr, const char *file, int line);
+BaseType_t xPortInIsrContext(void);
+
+#endif
@@ -0,0 +1,147 @@
+/* Home Automation cluster helpers used by the firmware */
+#ifndef SIM_ESP_ZIGBEE_HA_STANDARD_H
+#define SIM_ESP_ZIGBEE_HA_STANDARD_H
+
+#include "esp_zigbee_core.h"
+
+#define ESP_ZB_ZCL_BASIC_ZCL_VERSION_DEFAULT_VALUE              8
+#define ESP_ZB_ZCL_BASIC_POWER_SOURCE_DEFAULT_VALUE             0
+#define ESP_ZB_ZCL_IDENTIFY_IDENTIFY_TIME_DEFAULT_VALUE         0
+#define ESP_ZB_ZCL_GROUPS_NAME_SUPPORT_DEFAULT_VALUE            0
+#define ESP_ZB_ZCL_SCENES_SCENE_COUNT_DEFAULT_VALUE             0
+#define ESP_ZB_ZCL_SCENES_CURRENT_SCENE_DEFAULT_VALUE           0
+#define ESP_ZB_ZCL_SCENES_CURRENT_GROUP_DEFAULT_VALUE           0
+#define ESP_ZB_ZCL_SCENES_SCENE_VALID_DEFAULT_VALUE             0
+#define ESP_ZB_ZCL_SCENES_NAME_SUPPORT_DEFAULT_VALUE            0
+#define ESP_ZB_ZCL_LEVEL_CONTROL_CURRENT_LEVEL_DEFAULT_VALUE    0xff
+#define ESP_ZB_ZCL_COLOR_CONTROL_CURRENT_X_DEF_VALUE            0x616b
+#define ESP_ZB_ZCL_COLOR_CONTROL_CURRENT_Y_DEF_VALUE            0x607d
+#define ESP_ZB_ZCL_COLOR_CONTROL_COLOR_MODE_DEFAULT_VALUE       0x01
+#define ESP_ZB_ZCL_COLOR_CONTROL_OPTIONS_DEFAULT_VALUE          0x00
+#define ESP_ZB_ZCL_COLOR_CONTROL_ENHANCED_COLOR_MODE_DEFAULT_VALUE 0x01
+#define ESP_ZB_ZCL_TEMP_MEASUREMENT_MEASURED_VALUE_DEFAULT      ((int16_t) 0x8000)
+
+typedef struct
+{
+	uint8_t zcl_version;
+	uint8_t power_source;
+} esp_zb_basic_cluster_cfg_t;
+
+typedef struct
+{
+	uint16_t identify_time;
+} esp_zb_identify_cluster_cfg_t;
+
+typedef struct
+{
+	uint8_t groups_name_support_id;
+} esp_zb_groups_cluster_cfg_t;
+
+typedef struct
+{
+	uint8_t scenes_count;
+	uint8_t current_scene;
+	uint16_t current_group;
+	bool scene_valid;
+	uint8_t name_support;
+} esp_zb_scenes_cluster_cfg_t;
+
+typedef struct
+{
+	bool on_off;
+} esp_zb_on_off_cluster_cfg_t;
+
+typedef struct
+{
+	uint8_t current_level;
+} esp_zb_level_cluster_cfg_t;
+
+typedef struct
+{
+	uint16_t current_x;
+	uint16_t current_y;
+	uint8_t color_mode;
+	uint8_t options;
+	uint8_t enhanced_color_mode;
+	uint16_t color_capabilities;
+} esp_zb_color_cluster_cfg_t;
+
+typedef struct
+{
+	bool out_of_service;
+	float present_value;
+	uint8_t status_flags;
+} esp_zb_analog_output_cluster_cfg_t;
+
+typedef struct
+{
+	int16_t measured_value;
+	int16_t min_value;
+	int16_t max_value;
+} esp_zb_temperature_meas_cluster_cfg_t;
+
+typedef struct
+{
+	esp_zb_basic_cluster_cfg_t basic_cfg;
+	esp_zb_identify_cluster_cfg_t identify_cfg;
+	esp_zb_groups_cluster_cfg_t groups_cfg;
+	esp_zb_scenes_cluster_cfg_t scenes_cfg;
+	esp_zb_on_off_cluster_cfg_t on_off_cfg;
+	esp_zb_level_cluster_cfg_t level_cfg;
+	esp_zb_color_cluster_cfg_t color_cfg;
+} esp_zb_color_dimmable_light_cfg_t;
+
+typedef struct
+{
+	uint8_t endpoint;
+	uint16_t app_profile_id;
+	uint16_t app_device_id;
+	uint32_t app_device_version;
+} esp_zb_endpoint_config_t;
+
+esp_zb_attribute_list_t *esp_zb_zcl_attr_list_create(uint16_t cluster_id);
+esp_zb_cluster_list_t *esp_zb_zcl_cluster_list_create(void);
+esp_zb_ep_list_t *esp_zb_ep_list_create(void);
+esp_err_t esp_zb_ep_list_add_ep(esp_zb_ep_list_t *ep_list, esp_zb_cluster_list_t *cluster_list,
+								esp_zb_endpoint_config_t endpoint_config);
+
+esp_zb_attribute_list_t *esp_zb_basic_cluster_create(esp_zb_basic_cluster_cfg_t *basic_cfg);
+esp_zb_attribute_list_t *esp_zb_identify_cluster_create(esp_zb_identify_cluster_cfg_t *identify_cfg);
+esp_zb_attribute_list_t *esp_zb_groups_cluster_create(esp_zb_groups_cluster_cfg_t *groups_cfg);
+esp_zb_attribute_list_t *esp_zb_scenes_cluster_create(esp_zb_scenes_cluster_cfg_t *scene_cfg);
+esp_zb_attribute_list_t *esp_zb_on_off_cluster_create(esp_zb_on_off_cluster_cfg_t *on_off_cfg);
+esp_zb_attribute_list_t *esp_zb_level_cluster_create(esp_zb_level_cluster_cfg_t *level_cfg);
+esp_zb_attribute_list_t *esp_zb_color_control_cluster_create(esp_zb_color_cluster_cfg_t *color_cfg);
+esp_zb_attribute_list_t *esp_zb_analog_output_cluster_create(esp_zb_analog_output_cluster_cfg_t *analog_output_cfg);
+esp_zb_attribute_list_t *esp_zb_temperature_meas_cluster_create(esp_zb_temperature_meas_cluster_cfg_t *temperature_cfg);
+
+esp_err_t esp_zb_basic_cluster_add_attr(esp_zb_attribute_list_t *attr_list, uint16_t attr_id, void *value_p);
+esp_err_t esp_zb_color_control_cluster_add_attr(esp_zb_attribute_list_t *attr_list, uint16_t attr_id, void *value_p);
+esp_err_t esp_zb_custom_cluster_add_custom_attr(esp_zb_attribute_list_t *attr_list, uint16_t attr_id, uint8_t attr_type,
+												uint8_t attr_access, void *value_p);
+esp_err_t esp_zb_cluster_add_manufacturer_attr(esp_zb_attribute_list_t *attr_list, uint16_t cluster_id,
+											   uint16_t attr_id, uint16_t manuf_code, uint8_t attr_type,
+											   uint8_t attr_access, void *value_p);
+
+esp_err_t esp_zb_cluster_list_add_basic_cluster(esp_zb_cluster_list_t *cluster_list, esp_zb_attribute_list_t *attr_list,
+												uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_identify_cluster(esp_zb_cluster_list_t *cluster_list,
+												   esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_groups_cluster(esp_zb_cluster_list_t *cluster_list,
+												 esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_scenes_cluster(esp_zb_cluster_list_t *cluster_list,
+												 esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_on_off_cluster(esp_zb_cluster_list_t *cluster_list,
+												 esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_level_cluster(esp_zb_cluster_list_t *cluster_list,
+												esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_color_control_cluster(esp_zb_cluster_list_t *cluster_list,
+														esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_analog_output_cluster(esp_zb_cluster_list_t *cluster_list,
+														esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_temperature_meas_cluster(esp_zb_cluster_list_t *cluster_list,
+														   esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_custom_cluster(esp_zb_cluster_list_t *cluster_list,
+												 esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+
+#endif
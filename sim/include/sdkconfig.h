@@ -0,0 +1,16 @@
+/* Host simulation configuration, mirrors the relevant parts of sdkconfig */
+#ifndef SIM_SDKCONFIG_H
+#define SIM_SDKCONFIG_H
+
+#define CONFIG_IDF_TARGET "linux"
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#define CONFIG_DEPTH_SENSOR_RAM_BUDGET 16384
+#define CONFIG_DEPTH_SENSOR_PUMP_DEBOUNCE_SAMPLES 2
+#define CONFIG_DEPTH_SENSOR_PUMP_MIN_ON_TIME 30
+#if !CONFIG_DEPTH_SENSOR_STATIC_ALLOCATION
+#define CONFIG_DEPTH_SENSOR_CONSOLE 1
+#endif
+#define CONFIG_ESP_CONSOLE_SECONDARY_USB_SERIAL_JTAG 1
+
+#endif
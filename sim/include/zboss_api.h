@@ -0,0 +1,43 @@
+/* ZBOSS API subset behind the raw command handler, one parsed command at a time */
+#ifndef SIM_ZBOSS_API_H
+#define SIM_ZBOSS_API_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint8_t zb_bufid_t;
+typedef uint32_t zb_uint_t;
+
+typedef struct
+{
+	uint16_t source;
+	uint16_t dst_addr;
+	uint8_t src_endpoint;
+	uint8_t dst_endpoint;
+} zb_zcl_addr_common_t;
+
+typedef struct
+{
+	union
+	{
+		zb_zcl_addr_common_t common_data;
+	} addr_data;
+	uint16_t cluster_id;
+	uint16_t profile_id;
+	uint8_t cmd_id;
+	uint8_t cmd_direction;
+	uint8_t seq_number;
+	bool is_common_command;
+	bool disable_default_response;
+	bool is_manuf_specific;
+	uint16_t manuf_specific;
+} zb_zcl_parsed_hdr_t;
+
+#define ZB_ZCL_PARSED_HDR_SHORT_DATA(header) ((header)->addr_data.common_data)
+#define ZB_BUF_GET_PARAM(buf, type)          ((type *) zb_buf_get_param(buf))
+
+void *zb_buf_get_param(zb_bufid_t buf);
+void *zb_buf_begin(zb_bufid_t buf);
+zb_uint_t zb_buf_len(zb_bufid_t buf);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Console REPL and USB-Serial-JTAG stand-ins
+ *
+ * There is no terminal: commands come from "console" scenario events and print
+ * to stdout, bytes written to USB-Serial-JTAG go to the file given with -o.
+ */
+#include <string.h>
+#include "esp_console.h"
+#include "driver/usb_serial_jtag.h"
+#include "sim.h"
+
+#define SIM_CONSOLE_MAX_COMMANDS    16
+#define SIM_CONSOLE_MAX_ARGS        8
+
+struct esp_console_repl_s
+{
+	const char *prompt;
+};
+
+static esp_console_cmd_t s_commands[SIM_CONSOLE_MAX_COMMANDS];
+static int s_command_count;
+static esp_console_repl_t s_repl;
+
+esp_err_t esp_console_new_repl_usb_serial_jtag(const esp_console_dev_usb_serial_jtag_config_t *dev_config,
+											   const esp_console_repl_config_t *repl_config,
+											   esp_console_repl_t **ret_repl)
+{
+	s_repl.prompt = repl_config->prompt ? repl_config->prompt : "> ";
+	*ret_repl = &s_repl;
+	return ESP_OK;
+}
+
+esp_err_t esp_console_start_repl(esp_console_repl_t *repl)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd)
+{
+	if (!cmd || !cmd->command || !cmd->func)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (s_command_count == SIM_CONSOLE_MAX_COMMANDS)
+	{
+		return ESP_ERR_NO_MEM;
+	}
+	s_commands[s_command_count++] = *cmd;
+	return ESP_OK;
+}
+
+static int help_command(int argc, char **argv)
+{
+	for (int i = 0; i < s_command_count; i++)
+	{
+		printf("%s %s\n  %s\n", s_commands[i].command, s_commands[i].hint ? s_commands[i].hint : "",
+			   s_commands[i].help ? s_commands[i].help : "");
+	}
+	return 0;
+}
+
+esp_err_t esp_console_register_help_command(void)
+{
+	esp_console_cmd_t cmd = {.command = "help", .help = "List commands", .func = help_command};
+	return esp_console_cmd_register(&cmd);
+}
+
+esp_err_t esp_console_run(const char *cmdline, int *cmd_ret)
+{
+	char line[256];
+	strncpy(line, cmdline, sizeof(line) - 1);
+	line[sizeof(line) - 1] = '\0';
+	char *argv[SIM_CONSOLE_MAX_ARGS + 1] = {0};
+	int argc = 0;
+	for (char *tok = strtok(line, " \t"); tok && argc < SIM_CONSOLE_MAX_ARGS; tok = strtok(NULL, " \t"))
+	{
+		argv[argc++] = tok;
+	}
+	if (argc == 0)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	printf("%s%s\n", s_repl.prompt ? s_repl.prompt : "> ", cmdline);
+	if (!s_command_count)
+	{
+		/* CONFIG_DEPTH_SENSOR_CONSOLE is off in the zero-heap build */
+		printf("Console not in this build\n");
+		return ESP_ERR_INVALID_STATE;
+	}
+	for (int i = 0; i < s_command_count; i++)
+	{
+		if (!strcmp(s_commands[i].command, argv[0]))
+		{
+			*cmd_ret = s_commands[i].func(argc, argv);
+			return ESP_OK;
+		}
+	}
+	printf("Unrecognized command\n");
+	return ESP_ERR_NOT_FOUND;
+}
+
+int usb_serial_jtag_write_bytes(const void *src, size_t size, TickType_t ticks_to_wait)
+{
+	sim_metrics.stream_bytes += size;
+	if (sim_metrics.stream && fwrite(src, 1, size, sim_metrics.stream) != size)
+	{
+		return 0;
+	}
+	return (int) size;
+}
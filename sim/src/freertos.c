@@ -0,0 +1,414 @@
+/*
+ * Cooperative FreeRTOS subset on ucontext
+ *
+ * Tasks only switch when they block, which is where the firmware tasks give up
+ * the CPU on the target as well. The scheduler always resumes the task with the
+ * earliest wake time and moves the virtual clock there, so an idle hour costs
+ * nothing on the host.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "sdkconfig.h"
+#include "sim.h"
+
+#define SIM_HOST_STACK_SIZE     (256 * 1024)
+#define SIM_MAX_TASKS           16
+#define SIM_TICK_US             (SIM_US_PER_S / configTICK_RATE_HZ)
+#define SIM_WAIT_FOREVER        INT64_MAX
+#define SIM_STACK_PAINT         0xa5
+
+struct sim_task
+{
+	ucontext_t context;
+	void *stack;
+	TaskFunction_t fn;
+	void *arg;
+	char name[16];
+	uint32_t stack_size;
+	UBaseType_t priority;
+	int64_t wake_us;
+	uint32_t notify_count;
+	bool notify_wait;
+	bool deleted;
+	bool is_static;
+	uint64_t order;             /* round robin between equal wake times and priorities */
+};
+
+static struct sim_task s_tasks[SIM_MAX_TASKS];
+static int s_task_count;
+static struct sim_task *s_current;
+static ucontext_t s_scheduler_context;
+static int64_t s_now_us;
+static uint64_t s_order;
+
+int64_t sim_now_us(void)
+{
+	return s_now_us;
+}
+
+void sim_busy_us(uint32_t us)
+{
+	s_now_us += us;
+	sim_metrics.busy_us += us;
+}
+
+bool sim_in_task(void)
+{
+	return s_current != NULL;
+}
+
+void sim_assert_failed(const char *expr, const char *file, int line)
+{
+	fprintf(stderr, "assert failed: %s (%s:%d)\n", expr, file, line);
+	abort();
+}
+
+BaseType_t xPortInIsrContext(void)
+{
+	return pdFALSE;
+}
+
+#if CONFIG_DEPTH_SENSOR_STATIC_ALLOCATION
+void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps);
+#endif
+
+void sim_heap_alloc(size_t size)
+{
+#if CONFIG_DEPTH_SENSOR_STATIC_ALLOCATION
+	esp_heap_trace_alloc_hook(NULL, size, 0);
+#endif
+}
+
+static void task_yield(void)
+{
+	struct sim_task *task = s_current;
+	task->order = s_order++;
+	swapcontext(&task->context, &s_scheduler_context);
+}
+
+static void task_entry(void)
+{
+	s_current->fn(s_current->arg);
+	/* FreeRTOS tasks must not return, app_main is the exception */
+	s_current->deleted = true;
+	task_yield();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg, UBaseType_t priority,
+					   TaskHandle_t *handle)
+{
+	if (s_task_count == SIM_MAX_TASKS)
+	{
+		return pdFAIL;
+	}
+	struct sim_task *task = &s_tasks[s_task_count++];
+	memset(task, 0, sizeof(*task));
+	/* Host code paths (printf, libm) need far more stack than the target, size is only recorded.
+	 * Painted, so the peak use can be measured */
+	task->stack = malloc(SIM_HOST_STACK_SIZE);
+	if (!task->stack)
+	{
+		return pdFAIL;
+	}
+	memset(task->stack, SIM_STACK_PAINT, SIM_HOST_STACK_SIZE);
+	snprintf(task->name, sizeof(task->name), "%s", name);
+	task->fn = fn;
+	task->arg = arg;
+	task->stack_size = stack_size;
+	task->priority = priority;
+	task->wake_us = s_now_us;
+	task->order = s_order++;
+	getcontext(&task->context);
+	task->context.uc_stack.ss_sp = task->stack;
+	task->context.uc_stack.ss_size = SIM_HOST_STACK_SIZE;
+	task->context.uc_link = NULL;
+	makecontext(&task->context, task_entry, 0);
+	if (handle)
+	{
+		*handle = task;
+	}
+	return pdPASS;
+}
+
+/* The target-sized buffer cannot hold host frames, the task still runs on a host stack */
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg,
+							   UBaseType_t priority, StackType_t *stack, StaticTask_t *tcb)
+{
+	configASSERT(stack && tcb);
+	TaskHandle_t handle = NULL;
+	if (xTaskCreate(fn, name, stack_size, arg, priority, &handle) == pdPASS)
+	{
+		handle->is_static = true;
+	}
+	return handle;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+	if (!task || task == s_current)
+	{
+		s_current->deleted = true;
+		task_yield();
+		return;
+	}
+	task->deleted = true;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	s_current->wake_us = s_now_us + (int64_t) ticks * SIM_TICK_US;
+	task_yield();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t) (s_now_us / SIM_TICK_US);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return s_current;
+}
+
+char *pcTaskGetName(TaskHandle_t task)
+{
+	return task ? task->name : s_current->name;
+}
+
+static uint32_t task_stack_peak(const struct sim_task *task)
+{
+	/* the stack grows down from the end of the buffer */
+	const uint8_t *stack = task->stack;
+	uint32_t untouched = 0;
+	while (untouched < SIM_HOST_STACK_SIZE && stack[untouched] == SIM_STACK_PAINT)
+	{
+		untouched++;
+	}
+	return SIM_HOST_STACK_SIZE - untouched;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+	/* Host frames are larger than the target's, so the margin left can be negative; report none */
+	task = task ? task : s_current;
+	uint32_t peak = task_stack_peak(task);
+	return peak < task->stack_size ? task->stack_size - peak : 0;
+}
+
+bool sim_task_stack(int index, sim_task_stack_t *stack)
+{
+	if (index >= s_task_count)
+	{
+		return false;
+	}
+	const struct sim_task *task = &s_tasks[index];
+	stack->name = task->name;
+	stack->stack_size = task->stack_size;
+	stack->peak = task_stack_peak(task);
+	stack->is_static = task->is_static;
+	return true;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+	struct sim_task *task = s_current;
+	if (task->notify_count == 0 && ticks > 0)
+	{
+		task->notify_wait = true;
+		task->wake_us = ticks == portMAX_DELAY ? SIM_WAIT_FOREVER : s_now_us + (int64_t) ticks * SIM_TICK_US;
+		task_yield();
+		task->notify_wait = false;
+	}
+	uint32_t count = task->notify_count;
+	if (count)
+	{
+		task->notify_count = clear_on_exit ? 0 : count - 1;
+	}
+	return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	if (!task)
+	{
+		return pdFAIL;
+	}
+	task->notify_count++;
+	if (task->notify_wait)
+	{
+		task->wake_us = s_now_us;
+	}
+	return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+	memset(buffer, 0, sizeof(*buffer));
+	return buffer;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+	int64_t deadline = ticks == portMAX_DELAY ? SIM_WAIT_FOREVER : s_now_us + (int64_t) ticks * SIM_TICK_US;
+	while (semaphore->holder && semaphore->holder != s_current)
+	{
+		if (s_now_us >= deadline)
+		{
+			return pdFALSE;
+		}
+		vTaskDelay(1);
+	}
+	semaphore->holder = s_current;
+	semaphore->count++;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+	if (semaphore->holder != s_current)
+	{
+		return pdFALSE;
+	}
+	if (--semaphore->count == 0)
+	{
+		semaphore->holder = NULL;
+	}
+	return pdTRUE;
+}
+
+/* Timers run from a service task like on the target, callbacks may block briefly */
+static TimerHandle_t s_timers;
+static TaskHandle_t s_timer_task;
+
+static void timer_task(void *arg)
+{
+	while (true)
+	{
+		TimerHandle_t due = NULL;
+		for (TimerHandle_t timer = s_timers; timer; timer = timer->next)
+		{
+			if (timer->active && (!due || timer->expiry_us < due->expiry_us))
+			{
+				due = timer;
+			}
+		}
+		if (!due || due->expiry_us > s_now_us)
+		{
+			TickType_t ticks = due ? (TickType_t) ((due->expiry_us - s_now_us + SIM_TICK_US - 1) / SIM_TICK_US)
+								   : portMAX_DELAY;
+			ulTaskNotifyTake(pdTRUE, ticks);
+			continue;
+		}
+		if (due->auto_reload)
+		{
+			due->expiry_us += (int64_t) due->period * SIM_TICK_US;
+		} else
+		{
+			due->active = false;
+		}
+		due->callback(due);
+	}
+}
+
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period, UBaseType_t auto_reload, void *id,
+								 TimerCallbackFunction_t callback, StaticTimer_t *buffer)
+{
+	if (!s_timer_task && xTaskCreate(timer_task, "Tmr Svc", 2048, NULL, 1, &s_timer_task) != pdPASS)
+	{
+		return NULL;
+	}
+	memset(buffer, 0, sizeof(*buffer));
+	buffer->callback = callback;
+	buffer->id = id;
+	buffer->period = period;
+	buffer->auto_reload = auto_reload;
+	buffer->next = s_timers;
+	s_timers = buffer;
+	return buffer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+	timer->active = true;
+	timer->expiry_us = s_now_us + (int64_t) timer->period * SIM_TICK_US;
+	xTaskNotifyGive(s_timer_task);
+	return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+	timer->active = false;
+	xTaskNotifyGive(s_timer_task);
+	return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks_to_wait)
+{
+	timer->period = period;
+	return xTimerStart(timer, ticks_to_wait);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+	return timer->active;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+	return timer->id;
+}
+
+static struct sim_task *next_task(void)
+{
+	struct sim_task *next = NULL;
+	for (int i = 0; i < s_task_count; i++)
+	{
+		struct sim_task *task = &s_tasks[i];
+		if (task->deleted)
+		{
+			continue;
+		}
+		if (!next || task->wake_us < next->wake_us ||
+			(task->wake_us == next->wake_us &&
+			 (task->priority > next->priority || (task->priority == next->priority && task->order < next->order))))
+		{
+			next = task;
+		}
+	}
+	return next;
+}
+
+void sim_scheduler_start(void (*main_fn)(void *), int64_t end_us)
+{
+	xTaskCreate(main_fn, "main", 3584, NULL, 1, NULL);
+	while (true)
+	{
+		struct sim_task *task = next_task();
+		if (!task || task->wake_us > end_us)
+		{
+			break;
+		}
+		/* a busy-waiting task can push the clock past other tasks' wake times */
+		if (task->wake_us > s_now_us)
+		{
+			s_now_us = task->wake_us;
+		}
+		s_current = task;
+		if (strncmp(task->name, SIM_TASK_PREFIX, strlen(SIM_TASK_PREFIX)) != 0)
+		{
+			sim_metrics.task_switches++;
+		}
+		swapcontext(&s_scheduler_context, &task->context);
+		s_current = NULL;
+	}
+	if (s_now_us < end_us)
+	{
+		s_now_us = end_us;
+	}
+}
@@ -0,0 +1,293 @@
+/*
+ * Chip peripherals: timer, GPIO with an HC-SR04 echo model, temperature sensor,
+ * LED strip, logging
+ */
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "driver/gpio.h"
+#include "driver/temperature_sensor.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "led_strip.h"
+#include "sim.h"
+
+#define GPIO_COUNT              32
+#define ECHO_START_DELAY_US     450     /* 8 cycle burst and processing before the echo pin rises */
+#define ECHO_NO_TARGET_US       38000   /* pulse length the module reports without an echo */
+
+static gpio_mode_t s_gpio_mode[GPIO_COUNT];
+static uint32_t s_gpio_level[GPIO_COUNT];
+static int64_t s_echo_rise_us = -1;
+static int64_t s_echo_fall_us = -1;
+
+static esp_log_level_t s_log_level = ESP_LOG_ERROR;
+
+int64_t esp_timer_get_time(void)
+{
+	if (sim_in_task())
+	{
+		sim_busy_us(SIM_TIMER_READ_COST_US);
+	}
+	return sim_now_us();
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+	sim_busy_us(us);
+}
+
+/* Own xorshift, so asking for it does not shift the echo noise of a scenario */
+uint32_t esp_random(void)
+{
+	static uint32_t state = 0x9e3779b9;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+int esp_rom_printf(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int ret = vfprintf(stderr, fmt, args);
+	va_end(args);
+	return ret;
+}
+
+/* Pulse length for a ping fired now, with the scenario's noise and faults */
+static int64_t echo_pulse_us(int64_t now_us)
+{
+	sim_world_t world;
+	sim_world_at(now_us, &world);
+	if (sim_random_uniform() < world.dropout)
+	{
+		return ECHO_NO_TARGET_US;
+	}
+	float distance = world.distance_cm;
+	if (world.spurious > 0 && sim_random_uniform() < world.spurious)
+	{
+		distance = world.spurious_cm;
+	}
+	distance += world.noise_cm * sim_random_gauss();
+	if (distance < 2.0f)
+	{
+		distance = 2.0f;
+	}
+	float speed = 331.3f * sqrtf(1.0f + world.temperature_c / 273.15f);
+	int64_t pulse = (int64_t) (2.0f * distance / 100.0f / speed * 1e6f);
+	return pulse < ECHO_NO_TARGET_US ? pulse : ECHO_NO_TARGET_US;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+	if (gpio_num < 0 || gpio_num >= GPIO_COUNT)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	s_gpio_mode[gpio_num] = GPIO_MODE_DISABLE;
+	s_gpio_level[gpio_num] = 0;
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+	if (gpio_num < 0 || gpio_num >= GPIO_COUNT)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	s_gpio_mode[gpio_num] = mode;
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+	if (gpio_num < 0 || gpio_num >= GPIO_COUNT)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	int64_t now = sim_now_us();
+	/* Falling edge on the trigger starts a ping, unless the previous one is still running */
+	if (s_gpio_mode[gpio_num] == GPIO_MODE_OUTPUT && s_gpio_level[gpio_num] && !level && now >= s_echo_fall_us)
+	{
+		s_echo_rise_us = now + ECHO_START_DELAY_US;
+		s_echo_fall_us = s_echo_rise_us + echo_pulse_us(now);
+		sim_metrics.pings++;
+	}
+	s_gpio_level[gpio_num] = level != 0;
+	return ESP_OK;
+}
+
+int64_t sim_hw_last_echo_us(void)
+{
+	return s_echo_fall_us;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+	if (gpio_num < 0 || gpio_num >= GPIO_COUNT)
+	{
+		return 0;
+	}
+	if (s_gpio_mode[gpio_num] == GPIO_MODE_INPUT)
+	{
+		int64_t now = sim_now_us();
+		return now >= s_echo_rise_us && now < s_echo_fall_us;
+	}
+	return (int) s_gpio_level[gpio_num];
+}
+
+struct temperature_sensor_obj_t
+{
+	bool enabled;
+};
+
+static struct temperature_sensor_obj_t s_temperature_sensor;
+
+esp_err_t temperature_sensor_install(const temperature_sensor_config_t *tsens_config,
+									 temperature_sensor_handle_t *ret_tsens)
+{
+	*ret_tsens = &s_temperature_sensor;
+	return ESP_OK;
+}
+
+esp_err_t temperature_sensor_enable(temperature_sensor_handle_t tsens)
+{
+	tsens->enabled = true;
+	return ESP_OK;
+}
+
+esp_err_t temperature_sensor_get_celsius(temperature_sensor_handle_t tsens, float *out_celsius)
+{
+	if (!tsens || !tsens->enabled)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	sim_world_t world;
+	sim_world_at(sim_now_us(), &world);
+	*out_celsius = world.temperature_c;
+	return ESP_OK;
+}
+
+struct led_strip_t
+{
+	uint8_t rgb[3];
+};
+
+static struct led_strip_t s_led_strip;
+
+esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const led_strip_rmt_config_t *rmt_config,
+								   led_strip_handle_t *ret_strip)
+{
+	*ret_strip = &s_led_strip;
+	return ESP_OK;
+}
+
+esp_err_t led_strip_set_pixel(led_strip_handle_t strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
+{
+	if (!strip || index != 0 || red > 255 || green > 255 || blue > 255)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	strip->rgb[0] = (uint8_t) red;
+	strip->rgb[1] = (uint8_t) green;
+	strip->rgb[2] = (uint8_t) blue;
+	return ESP_OK;
+}
+
+void sim_hw_led_rgb(uint8_t rgb[3])
+{
+	memcpy(rgb, s_led_strip.rgb, sizeof(s_led_strip.rgb));
+}
+
+esp_err_t led_strip_refresh(led_strip_handle_t strip)
+{
+	sim_metrics.led_refreshes++;
+	return ESP_OK;
+}
+
+esp_err_t led_strip_clear(led_strip_handle_t strip)
+{
+	memset(strip->rgb, 0, sizeof(strip->rgb));
+	return led_strip_refresh(strip);
+}
+
+/* Only the global level is modelled, per tag levels are accepted and ignored */
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+	if (strcmp(tag, "*") == 0)
+	{
+		s_log_level = level;
+	}
+}
+
+/* Preformatted output, used by the trace drain with its own timestamps */
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+	if (level > s_log_level)
+	{
+		return;
+	}
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+void sim_log(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+	static const char letters[] = "NEWIDV";
+	if (level > s_log_level)
+	{
+		return;
+	}
+	int64_t now = sim_now_us();
+	fprintf(stderr, "%c (%lld.%03lld) %s: ", letters[level], (long long) (now / SIM_US_PER_S),
+			(long long) (now / 1000 % 1000), tag);
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+	static const struct
+	{
+		esp_err_t code;
+		const char *name;
+	} names[] = {
+			{ESP_OK, "ESP_OK"},
+			{ESP_FAIL, "ESP_FAIL"},
+			{ESP_ERR_NO_MEM, "ESP_ERR_NO_MEM"},
+			{ESP_ERR_INVALID_ARG, "ESP_ERR_INVALID_ARG"},
+			{ESP_ERR_INVALID_STATE, "ESP_ERR_INVALID_STATE"},
+			{ESP_ERR_INVALID_SIZE, "ESP_ERR_INVALID_SIZE"},
+			{ESP_ERR_NOT_FOUND, "ESP_ERR_NOT_FOUND"},
+			{ESP_ERR_NOT_SUPPORTED, "ESP_ERR_NOT_SUPPORTED"},
+			{ESP_ERR_TIMEOUT, "ESP_ERR_TIMEOUT"},
+			{ESP_ERR_INVALID_RESPONSE, "ESP_ERR_INVALID_RESPONSE"},
+			{ESP_ERR_INVALID_CRC, "ESP_ERR_INVALID_CRC"},
+			{ESP_ERR_INVALID_VERSION, "ESP_ERR_INVALID_VERSION"},
+	};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		if (names[i].code == code)
+		{
+			return names[i].name;
+		}
+	}
+	return "UNKNOWN ERROR";
+}
+
+void sim_error_check_failed(esp_err_t rc, const char *file, int line, const char *expression)
+{
+	fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d\nexpression: %s\n", rc,
+			esp_err_to_name(rc), file, line, expression);
+	abort();
+}
@@ -0,0 +1,449 @@
+/*
+ * Runs the firmware against a scripted tank and a recording Zigbee stack on a
+ * virtual clock, then prints what the coordinator would have seen and checks it
+ * against the scenario's expectations.
+ */
+#include <getopt.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_zigbee_zcl.h"
+#include "sim.h"
+
+#define PROBE_INTERVAL_MS       1000
+#define SETTLE_TOLERANCE_CM     1.0f
+#define TANK_CLUSTER_ID         0xfc00  /* the firmware's manufacturer specific cluster */
+#define TANK_VOLUME_ID          0x0000
+#define TANK_PERCENT_FULL_ID    0x0001
+
+void app_main(void);
+
+sim_metrics_t sim_metrics = {
+		.joined_us = -1,
+};
+
+static int64_t s_step_us = -1;
+
+sim_attr_metrics_t *sim_metrics_attr(uint16_t cluster, uint16_t attr)
+{
+	for (int i = 0; i < sim_metrics.attr_count; i++)
+	{
+		if (sim_metrics.attrs[i].cluster == cluster && sim_metrics.attrs[i].attr == attr)
+		{
+			return &sim_metrics.attrs[i];
+		}
+	}
+	if (sim_metrics.attr_count == SIM_MAX_REPORTED_ATTRS)
+	{
+		fprintf(stderr, "sim: too many reported attributes\n");
+		abort();
+	}
+	sim_attr_metrics_t *metrics = &sim_metrics.attrs[sim_metrics.attr_count++];
+	metrics->cluster = cluster;
+	metrics->attr = attr;
+	return metrics;
+}
+
+void sim_metrics_step(int64_t t_us, float from_cm, float to_cm)
+{
+	sim_metrics.steps++;
+	s_step_us = t_us;
+}
+
+/* Compares what the coordinator last received with the true level, once per second, and feeds
+ * the level to the pump mark crossings */
+static void probe_task(void *arg)
+{
+	while (true)
+	{
+		vTaskDelay(pdMS_TO_TICKS(PROBE_INTERVAL_MS));
+		int64_t now = sim_now_us();
+		sim_world_t world;
+		sim_world_at(now, &world);
+		sim_zigbee_level(now, world.distance_cm);
+		float reported;
+		if (!sim_zigbee_reported_float(ESP_ZB_ZCL_CLUSTER_ID_ANALOG_OUTPUT,
+									   ESP_ZB_ZCL_ATTR_ANALOG_OUTPUT_PRESENT_VALUE_ID, &reported))
+		{
+			continue;
+		}
+		float error = fabsf(reported - world.distance_cm);
+		sim_metrics.lag_samples++;
+		sim_metrics.lag_abs_sum += error;
+		sim_metrics.lag_abs_max = error > sim_metrics.lag_abs_max ? error : sim_metrics.lag_abs_max;
+		int bin = (int) (error * 10);
+		int bins = (int) (sizeof(sim_metrics.lag_histogram) / sizeof(sim_metrics.lag_histogram[0]));
+		sim_metrics.lag_histogram[bin < bins ? bin : bins - 1]++;
+		if (s_step_us >= 0 && error <= SETTLE_TOLERANCE_CM)
+		{
+			int64_t settle = now - s_step_us;
+			sim_metrics.steps_settled++;
+			sim_metrics.settle_sum_us += settle;
+			sim_metrics.settle_max_us = settle > sim_metrics.settle_max_us ? settle : sim_metrics.settle_max_us;
+			s_step_us = -1;
+		}
+		if (sim_metrics.trace)
+		{
+			fprintf(sim_metrics.trace, "%.0f,%.2f,%.1f\n", (double) now / SIM_US_PER_S, world.distance_cm,
+					reported);
+		}
+	}
+}
+
+/* Stands in for the IDF main task, which runs app_main and exits */
+static void main_task(void *arg)
+{
+	xTaskCreate(sim_scenario_task, SIM_TASK_PREFIX "scenario", 4096, NULL, 10, NULL);
+	xTaskCreate(probe_task, SIM_TASK_PREFIX "probe", 4096, NULL, 0, NULL);
+	app_main();
+}
+
+/* Upper edge of the bin, clamped so it never reads above the largest lag seen */
+static float lag_percentile(float fraction)
+{
+	uint32_t target = (uint32_t) ceilf(fraction * (float) sim_metrics.lag_samples);
+	uint32_t seen = 0;
+	int bins = (int) (sizeof(sim_metrics.lag_histogram) / sizeof(sim_metrics.lag_histogram[0]));
+	for (int i = 0; i < bins; i++)
+	{
+		seen += sim_metrics.lag_histogram[i];
+		if (seen >= target)
+		{
+			float edge = (float) (i + 1) / 10.0f;
+			return edge < sim_metrics.lag_abs_max ? edge : sim_metrics.lag_abs_max;
+		}
+	}
+	return sim_metrics.lag_abs_max;
+}
+
+static const char *cluster_name(uint16_t cluster)
+{
+	switch (cluster)
+	{
+		case ESP_ZB_ZCL_CLUSTER_ID_ANALOG_OUTPUT:
+			return "analog_output";
+		case ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT:
+			return "temperature";
+		case ESP_ZB_ZCL_CLUSTER_ID_ON_OFF:
+			return "on_off";
+		case ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL:
+			return "level";
+		case ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL:
+			return "color";
+		default:
+			return "manufacturer";
+	}
+}
+
+static void print_metrics(const char *scenario, int64_t end_us, double host_s)
+{
+	double hours = (double) end_us / SIM_US_PER_HOUR;
+	printf("scenario         %s\n", scenario);
+	printf("simulated        %.1f h in %.2f s (%.0fx)\n", hours, host_s, hours * 3600 / (host_s > 0 ? host_s : 1e-9));
+	printf("host cpu         %.2f ms per simulated hour\n", host_s * 1000 / hours);
+	printf("busy wait        %.1f ms per simulated hour\n", (double) sim_metrics.busy_us / 1000 / hours);
+	printf("task wakeups     %.0f per simulated hour\n", (double) sim_metrics.task_switches / hours);
+	printf("pings            %u\n", sim_metrics.pings);
+	if (sim_metrics.joined_us >= 0)
+	{
+		printf("joined           after %.1f s, %u steering attempts, %u channels scanned\n",
+			   (double) sim_metrics.joined_us / SIM_US_PER_S, sim_metrics.steering_attempts,
+			   sim_metrics.channels_scanned);
+	} else
+	{
+		printf("joined           never, %u steering attempts, %u channels scanned\n", sim_metrics.steering_attempts,
+			   sim_metrics.channels_scanned);
+	}
+	if (sim_metrics.rejoins)
+	{
+		printf("rejoined         %u times after leave, mean %.1f s, max %.1f s\n", sim_metrics.rejoins,
+			   (double) sim_metrics.rejoin_sum_us / sim_metrics.rejoins / SIM_US_PER_S,
+			   (double) sim_metrics.rejoin_max_us / SIM_US_PER_S);
+	}
+	for (int i = 0; i < sim_metrics.attr_count; i++)
+	{
+		const sim_attr_metrics_t *attr = &sim_metrics.attrs[i];
+		printf("reports          %s/0x%04x: %u sent (%.1f/h), %u dropped, %u writes\n", cluster_name(attr->cluster),
+			   attr->attr, attr->reports, attr->reports / hours, attr->dropped, attr->writes);
+	}
+	if (sim_metrics.lag_samples)
+	{
+		printf("reported error   mean %.2f cm, p95 %.1f cm, max %.1f cm\n",
+			   sim_metrics.lag_abs_sum / sim_metrics.lag_samples, lag_percentile(0.95f), sim_metrics.lag_abs_max);
+	}
+	float volume, percent;
+	if (sim_zigbee_reported_float(TANK_CLUSTER_ID, TANK_VOLUME_ID, &volume) &&
+		sim_zigbee_reported_float(TANK_CLUSTER_ID, TANK_PERCENT_FULL_ID, &percent))
+	{
+		printf("tank reported    %.1f l, %.0f %% full\n", volume, percent);
+	}
+	if (sim_metrics.steps)
+	{
+		printf("step settle      %u of %u steps, mean %.1f s, max %.1f s\n", sim_metrics.steps_settled,
+			   sim_metrics.steps,
+			   sim_metrics.steps_settled ? (double) sim_metrics.settle_sum_us / sim_metrics.steps_settled / SIM_US_PER_S
+										 : 0.0,
+			   (double) sim_metrics.settle_max_us / SIM_US_PER_S);
+	}
+	if (sim_metrics.on_off_commands || sim_metrics.on_off_dropped)
+	{
+		printf("on/off commands  %u sent, %u dropped, mark crossing to command mean %.1f s, "
+			   "min %.1f s, max %.1f s (%u timed)\n", sim_metrics.on_off_commands, sim_metrics.on_off_dropped,
+			   sim_metrics.on_off_timed ? (double) sim_metrics.on_off_latency_sum_us / sim_metrics.on_off_timed /
+										  SIM_US_PER_S : 0.0,
+			   (double) sim_metrics.on_off_latency_min_us / SIM_US_PER_S,
+			   (double) sim_metrics.on_off_latency_max_us / SIM_US_PER_S, sim_metrics.on_off_timed);
+	}
+	for (int code = 0; code < 4; code++)
+	{
+		if (sim_metrics.alarms[code])
+		{
+			printf("alarm 0x%02x       %u received, first at %.1f h\n", code, sim_metrics.alarms[code],
+				   (double) sim_metrics.alarm_first_us[code] / SIM_US_PER_HOUR);
+		}
+	}
+	uint32_t logged = 0;
+	for (int code = 0; code < 4; code++)
+	{
+		logged += sim_metrics.alarm_log[code];
+	}
+	if (logged || sim_metrics.alarm_log_empty)
+	{
+		printf("get alarm        %u entries (leak %u, rapid drain %u, overflow %u), %u empty\n", logged,
+			   sim_metrics.alarm_log[1], sim_metrics.alarm_log[2], sim_metrics.alarm_log[3],
+			   sim_metrics.alarm_log_empty);
+	}
+	if (sim_metrics.stream_bytes)
+	{
+		printf("console stream   %llu B (%.1f B/s)\n", (unsigned long long) sim_metrics.stream_bytes,
+			   (double) sim_metrics.stream_bytes / ((double) end_us / SIM_US_PER_S));
+	}
+	printf("nvs writes       %u (%u B)\n", sim_metrics.nvs_writes, sim_metrics.nvs_bytes);
+	uint8_t rgb[3];
+	sim_hw_led_rgb(rgb);
+	printf("led refreshes    %u, %u scene recalls, ends at #%02x%02x%02x\n", sim_metrics.led_refreshes,
+		   sim_metrics.scene_recalls, rgb[0], rgb[1], rgb[2]);
+	/* host frames, an upper bound for the RISC-V target */
+	sim_task_stack_t stack;
+	for (int i = 0; sim_task_stack(i, &stack); i++)
+	{
+		if (strncmp(stack.name, SIM_TASK_PREFIX, strlen(SIM_TASK_PREFIX)) != 0)
+		{
+			printf("stack            %-16s %5u B peak on the host, %5u B configured%s\n", stack.name, stack.peak,
+				   stack.stack_size, stack.is_static ? ", static" : "");
+		}
+	}
+}
+
+typedef struct
+{
+	const char *name;
+	double value;
+} metric_t;
+
+/* Final value of a metric named by an expectation, false for an unknown name */
+static bool metric_value(const char *name, double *value)
+{
+	uint32_t dropped = 0;
+	for (int i = 0; i < sim_metrics.attr_count; i++)
+	{
+		dropped += sim_metrics.attrs[i].dropped;
+	}
+	uint32_t logged = 0;
+	for (int code = 0; code < 4; code++)
+	{
+		logged += sim_metrics.alarm_log[code];
+	}
+	/* smallest margin left by a firmware task, negative when one overran */
+	int64_t headroom = INT32_MAX;
+	sim_task_stack_t stack;
+	for (int i = 0; sim_task_stack(i, &stack); i++)
+	{
+		if (strncmp(stack.name, SIM_TASK_PREFIX, strlen(SIM_TASK_PREFIX)) != 0 &&
+			(int64_t) stack.stack_size - stack.peak < headroom)
+		{
+			headroom = (int64_t) stack.stack_size - stack.peak;
+		}
+	}
+	uint8_t rgb[3];
+	sim_hw_led_rgb(rgb);
+	const metric_t metrics[] = {
+			{"pings",                 sim_metrics.pings},
+			{"joined_s",              sim_metrics.joined_us >= 0 ? (double) sim_metrics.joined_us / SIM_US_PER_S : -1},
+			{"steering_attempts",     sim_metrics.steering_attempts},
+			{"channels_scanned",      sim_metrics.channels_scanned},
+			{"rejoins",               sim_metrics.rejoins},
+			{"rejoin_mean_s",         sim_metrics.rejoins ? (double) sim_metrics.rejoin_sum_us / sim_metrics.rejoins /
+																SIM_US_PER_S : 0},
+			{"rejoin_max_s",          (double) sim_metrics.rejoin_max_us / SIM_US_PER_S},
+			{"reports_dropped",       dropped},
+			{"error_mean_cm",         sim_metrics.lag_samples ? sim_metrics.lag_abs_sum / sim_metrics.lag_samples : 0},
+			{"error_p95_cm",          lag_percentile(0.95f)},
+			{"error_max_cm",          sim_metrics.lag_abs_max},
+			{"steps",                 sim_metrics.steps},
+			{"steps_settled",         sim_metrics.steps_settled},
+			{"settle_max_s",          (double) sim_metrics.settle_max_us / SIM_US_PER_S},
+			{"on_off_commands",       sim_metrics.on_off_commands},
+			{"on_off_dropped",        sim_metrics.on_off_dropped},
+			{"on_off_timed",          sim_metrics.on_off_timed},
+			{"on_off_latency_min_s",  (double) sim_metrics.on_off_latency_min_us / SIM_US_PER_S},
+			{"on_off_latency_max_s",  (double) sim_metrics.on_off_latency_max_us / SIM_US_PER_S},
+			{"leak_alarms",           sim_metrics.alarms[1]},
+			{"drain_alarms",          sim_metrics.alarms[2]},
+			{"overflow_alarms",       sim_metrics.alarms[3]},
+			{"leak_alarm_h",          sim_metrics.alarms[1] ? (double) sim_metrics.alarm_first_us[1] / SIM_US_PER_HOUR
+														   : -1},
+			{"alarm_log_entries",     logged},
+			{"alarm_log_empty",       sim_metrics.alarm_log_empty},
+			{"stream_bytes",          (double) sim_metrics.stream_bytes},
+			{"nvs_writes",            sim_metrics.nvs_writes},
+			{"led_refreshes",         sim_metrics.led_refreshes},
+			{"scene_recalls",         sim_metrics.scene_recalls},
+			{"led_rgb",               (rgb[0] << 16) | (rgb[1] << 8) | rgb[2]},
+			{"stack_headroom",        (double) headroom},
+	};
+	for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++)
+	{
+		if (!strcmp(metrics[i].name, name))
+		{
+			*value = metrics[i].value;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Prints every expectation with the value it saw, false when one is missed */
+static bool check_expectations(void)
+{
+	bool passed = true;
+	sim_expect_t expect;
+	for (int i = 0; sim_scenario_expect(i, &expect); i++)
+	{
+		double value = 0;
+		metric_value(expect.metric, &value);
+		bool met;
+		switch (expect.op)
+		{
+			case SIM_EXPECT_LT:
+				met = value < expect.value;
+				break;
+			case SIM_EXPECT_LE:
+				met = value <= expect.value;
+				break;
+			case SIM_EXPECT_EQ:
+				met = value == expect.value;
+				break;
+			case SIM_EXPECT_NE:
+				met = value != expect.value;
+				break;
+			case SIM_EXPECT_GE:
+				met = value >= expect.value;
+				break;
+			default:
+				met = value > expect.value;
+				break;
+		}
+		printf("expect           %-32s %s (%g)\n", expect.text, met ? "met" : "MISSED", value);
+		passed &= met;
+	}
+	return passed;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s seed] [-v] [-t trace.csv] [-o stream.bin] scenario\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	const char *trace_path = NULL;
+	const char *stream_path = NULL;
+	esp_log_level_t log_level = ESP_LOG_ERROR;
+	/* glibc formats to an unbuffered stream through an 8 KB stack buffer, which would show up as
+	 * the stack peak of whichever task logs an error */
+	setvbuf(stderr, NULL, _IOLBF, BUFSIZ);
+	while ((opt = getopt(argc, argv, "s:t:o:vh")) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				sim_random_seed((uint32_t) strtoul(optarg, NULL, 0));
+				break;
+			case 't':
+				trace_path = optarg;
+				break;
+			case 'o':
+				stream_path = optarg;
+				break;
+			case 'v':
+				log_level = log_level < ESP_LOG_VERBOSE ? log_level + 1 : log_level;
+				break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 2;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return 2;
+	}
+	esp_log_level_set("*", log_level);
+
+	int64_t end_us;
+	esp_err_t err = sim_scenario_load(argv[optind], &end_us);
+	if (err != ESP_OK)
+	{
+		return err == ESP_ERR_NOT_SUPPORTED ? 0 : 1;
+	}
+	sim_expect_t expect;
+	for (int i = 0; sim_scenario_expect(i, &expect); i++)
+	{
+		double value;
+		if (!metric_value(expect.metric, &value))
+		{
+			fprintf(stderr, "%s:%d: unknown metric %s\n", argv[optind], expect.line, expect.metric);
+			return 1;
+		}
+	}
+	if (trace_path)
+	{
+		sim_metrics.trace = fopen(trace_path, "w");
+		if (!sim_metrics.trace)
+		{
+			perror(trace_path);
+			return 1;
+		}
+		fprintf(sim_metrics.trace, "time_s,true_cm,reported_cm\n");
+	}
+	if (stream_path)
+	{
+		sim_metrics.stream = fopen(stream_path, "wb");
+		if (!sim_metrics.stream)
+		{
+			perror(stream_path);
+			return 1;
+		}
+	}
+
+	clock_t start = clock();
+	sim_scheduler_start(main_task, end_us);
+	double host_s = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	if (sim_metrics.trace)
+	{
+		fclose(sim_metrics.trace);
+	}
+	if (sim_metrics.stream)
+	{
+		fclose(sim_metrics.stream);
+	}
+	print_metrics(argv[optind], end_us, host_s);
+	return check_expectations() ? 0 : 1;
+}
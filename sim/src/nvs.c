@@ -0,0 +1,208 @@
+/* In-memory NVS, counts writes so flash wear shows up in the metrics */
+#include <stdlib.h>
+#include <string.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "sim.h"
+
+#define NVS_MAX_NAMESPACES  16
+#define NVS_MAX_ENTRIES     64
+#define NVS_KEY_NAME_SIZE   16
+
+typedef enum
+{
+	NVS_TYPE_U8,
+	NVS_TYPE_U16,
+	NVS_TYPE_U32,
+	NVS_TYPE_BLOB,
+} nvs_type_t;
+
+typedef struct
+{
+	bool used;
+	uint8_t ns;
+	char key[NVS_KEY_NAME_SIZE];
+	nvs_type_t type;
+	uint8_t *data;
+	size_t size;
+} nvs_entry_t;
+
+static char s_namespaces[NVS_MAX_NAMESPACES][NVS_KEY_NAME_SIZE];
+static int s_namespace_count;
+static nvs_entry_t s_entries[NVS_MAX_ENTRIES];
+static bool s_initialized;
+
+esp_err_t nvs_flash_init(void)
+{
+	s_initialized = true;
+	return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+	for (int i = 0; i < NVS_MAX_ENTRIES; i++)
+	{
+		free(s_entries[i].data);
+	}
+	memset(s_entries, 0, sizeof(s_entries));
+	return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+	if (!s_initialized)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (!name || strlen(name) >= NVS_KEY_NAME_SIZE)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	/* the handle entry */
+	sim_heap_alloc(32);
+	for (int i = 0; i < s_namespace_count; i++)
+	{
+		if (!strcmp(s_namespaces[i], name))
+		{
+			*out_handle = (nvs_handle_t) i + 1;
+			return ESP_OK;
+		}
+	}
+	if (open_mode == NVS_READONLY)
+	{
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	if (s_namespace_count == NVS_MAX_NAMESPACES)
+	{
+		return ESP_ERR_NVS_NO_FREE_PAGES;
+	}
+	strcpy(s_namespaces[s_namespace_count], name);
+	*out_handle = (nvs_handle_t) ++s_namespace_count;
+	return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+	return ESP_OK;
+}
+
+static nvs_entry_t *find_entry(nvs_handle_t handle, const char *key)
+{
+	for (int i = 0; i < NVS_MAX_ENTRIES; i++)
+	{
+		if (s_entries[i].used && s_entries[i].ns == handle && !strcmp(s_entries[i].key, key))
+		{
+			return &s_entries[i];
+		}
+	}
+	return NULL;
+}
+
+static esp_err_t get_value(nvs_handle_t handle, const char *key, nvs_type_t type, void *out, size_t *size)
+{
+	if (!handle || handle > (nvs_handle_t) s_namespace_count || !key)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	nvs_entry_t *entry = find_entry(handle, key);
+	if (!entry || entry->type != type)
+	{
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	if (!out)
+	{
+		*size = entry->size;
+		return ESP_OK;
+	}
+	if (*size < entry->size)
+	{
+		return ESP_ERR_NVS_INVALID_LENGTH;
+	}
+	memcpy(out, entry->data, entry->size);
+	*size = entry->size;
+	return ESP_OK;
+}
+
+static esp_err_t set_value(nvs_handle_t handle, const char *key, nvs_type_t type, const void *value, size_t size)
+{
+	if (!handle || handle > (nvs_handle_t) s_namespace_count || !key || strlen(key) >= NVS_KEY_NAME_SIZE)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	nvs_entry_t *entry = find_entry(handle, key);
+	if (entry && entry->type == type && entry->size == size && !memcmp(entry->data, value, size))
+	{
+		/* NVS skips writing identical values, so does the simulation */
+		return ESP_OK;
+	}
+	if (!entry)
+	{
+		for (int i = 0; i < NVS_MAX_ENTRIES && !entry; i++)
+		{
+			entry = s_entries[i].used ? NULL : &s_entries[i];
+		}
+		if (!entry)
+		{
+			return ESP_ERR_NVS_NO_FREE_PAGES;
+		}
+	}
+	/* the page cache entry and blob index */
+	sim_heap_alloc(size);
+	free(entry->data);
+	entry->data = malloc(size ? size : 1);
+	if (!entry->data)
+	{
+		return ESP_ERR_NO_MEM;
+	}
+	memcpy(entry->data, value, size);
+	entry->used = true;
+	entry->ns = (uint8_t) handle;
+	strcpy(entry->key, key);
+	entry->type = type;
+	entry->size = size;
+	sim_metrics.nvs_writes++;
+	sim_metrics.nvs_bytes += (uint32_t) size;
+	return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+	nvs_entry_t *entry = find_entry(handle, key);
+	if (!entry)
+	{
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	free(entry->data);
+	memset(entry, 0, sizeof(*entry));
+	sim_metrics.nvs_writes++;
+	return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+	return get_value(handle, key, NVS_TYPE_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+	return set_value(handle, key, NVS_TYPE_BLOB, value, length);
+}
+
+#define NVS_INT_ACCESSORS(suffix, ctype, type_id)                                   \
+esp_err_t nvs_get_##suffix(nvs_handle_t handle, const char *key, ctype *out_value)  \
+{                                                                                   \
+	size_t size = sizeof(ctype);                                                    \
+	return get_value(handle, key, type_id, out_value, &size);                       \
+}                                                                                   \
+esp_err_t nvs_set_##suffix(nvs_handle_t handle, const char *key, ctype value)       \
+{                                                                                   \
+	return set_value(handle, key, type_id, &value, sizeof(ctype));                  \
+}
+
+NVS_INT_ACCESSORS(u8, uint8_t, NVS_TYPE_U8)
+NVS_INT_ACCESSORS(u16, uint16_t, NVS_TYPE_U16)
+NVS_INT_ACCESSORS(u32, uint32_t, NVS_TYPE_U32)
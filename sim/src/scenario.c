@@ -0,0 +1,577 @@
+/*
+ * Scripted tank scenarios
+ *
+ * One event per line, "<time> <command> [args]", times in s/m/h/d:
+ *
+ *   0     distance 120         surface jumps to 120 cm from the sensor
+ *   1h    ramp 180 6h          moves linearly to 180 cm over 6 hours
+ *   0     temperature 15       air temperature for the speed of sound
+ *   0     noise 0.5            gaussian echo noise (cm)
+ *   0     dropout 0.01         probability of no echo
+ *   0     spurious 0.02 35     probability of an early echo from 35 cm
+ *   2h    coordinator down     coordinator unreachable (join fails, reports drop)
+ *   2h    leave                coordinator removes the device, it steers again
+ *   3h    write 0xfc00 0x0002 <hex>   remote attribute write, ZCL wire bytes
+ *   4h    scene store 0x0001 3          Store Scene command for group 1, scene 3
+ *   5h    scene recall 0x0001 3         Recall Scene command
+ *   5h    scene add 0x0001 4 1 128 0x616b 0x607d   Add Scene: on/off, level, x, y
+ *   5h    scene add 0x0001 5 1 128 0 0 0 0 370     ... and enhanced hue, saturation, mireds
+ *   6h    scene remove 0x0001 3         Remove Scene command
+ *   6h    scene remove_all 0x0001       Remove All Scenes of group 1
+ *   7h    alarm reset 0x03 0xfc00       Reset Alarm of the Alarms cluster: code, cluster ID
+ *   7h    alarm reset_all               Reset All Alarms
+ *   7h    alarm get                     Get Alarm, the oldest entry of the alarm log
+ *   7h    alarm reset_log               Reset Alarm Log
+ *   6h    console set interval 200  diagnostics console command line
+ *   3d    end
+ *
+ * Expectations on the final metrics have no time, a miss makes the run exit 1:
+ *
+ *   expect error_max_cm < 2       one of <, <=, ==, !=, >=, >; metric names are listed in main.c
+ *
+ * Scenarios using the console are skipped by builds without it.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_console.h"
+#include "sdkconfig.h"
+#include "sim.h"
+
+#define SCENARIO_MAX_EVENTS     256
+#define SCENARIO_MAX_WRITE      256
+#define SCENARIO_MAX_ARGS       12
+#define SCENARIO_MAX_EXPECTS    32
+#define SCENARIO_STEP_CM        5.0f    /* smaller jumps are noise, not level steps */
+
+typedef enum
+{
+	EVENT_DISTANCE,
+	EVENT_RAMP,
+	EVENT_TEMPERATURE,
+	EVENT_NOISE,
+	EVENT_DROPOUT,
+	EVENT_SPURIOUS,
+	EVENT_COORDINATOR,
+	EVENT_WRITE,
+	EVENT_SCENE,
+	EVENT_COMMAND,
+	EVENT_CONSOLE,
+	EVENT_LEAVE,
+} event_type_t;
+
+typedef struct
+{
+	int64_t t_us;
+	event_type_t type;
+	float value;
+	float arg;
+	int64_t duration_us;
+	uint16_t cluster;
+	uint16_t attr;
+	uint8_t cmd_id;
+	uint8_t *data;
+	uint16_t size;
+	sim_scene_op_t scene_op;
+	uint16_t group_id;
+	uint8_t scene_id;
+	sim_scene_fields_t scene_fields;
+	char *command;
+} event_t;
+
+static event_t s_events[SCENARIO_MAX_EVENTS];
+static int s_event_count;
+static int s_next_event;
+static sim_expect_t s_expects[SCENARIO_MAX_EXPECTS];
+static int s_expect_count;
+
+/* Current state, distance is a ramp from (t0, d0) to (t1, d1) */
+static sim_world_t s_world = {
+		.distance_cm = 100.0f,
+		.temperature_c = 20.0f,
+		.coordinator_up = true,
+};
+static int64_t s_ramp_t0;
+static int64_t s_ramp_t1;
+static float s_ramp_d0 = 100.0f;
+static float s_ramp_d1 = 100.0f;
+
+static uint32_t s_random_state = 0x2545f491;
+
+void sim_random_seed(uint32_t seed)
+{
+	s_random_state = seed ? seed : 0x2545f491;
+}
+
+float sim_random_uniform(void)
+{
+	s_random_state ^= s_random_state << 13;
+	s_random_state ^= s_random_state >> 17;
+	s_random_state ^= s_random_state << 5;
+	return (float) (s_random_state >> 8) / (float) (1 << 24);
+}
+
+float sim_random_gauss(void)
+{
+	float u = sim_random_uniform();
+	float v = sim_random_uniform();
+	return sqrtf(-2.0f * logf(u + 1e-9f)) * cosf(2.0f * (float) M_PI * v);
+}
+
+static bool parse_time(const char *text, int64_t *out_us)
+{
+	char *end;
+	double value = strtod(text, &end);
+	if (end == text || value < 0)
+	{
+		return false;
+	}
+	double scale = 1;
+	switch (*end)
+	{
+		case '\0':
+		case 's':
+			break;
+		case 'm':
+			scale = 60;
+			break;
+		case 'h':
+			scale = 3600;
+			break;
+		case 'd':
+			scale = 86400;
+			break;
+		default:
+			return false;
+	}
+	*out_us = (int64_t) (value * scale * SIM_US_PER_S);
+	return true;
+}
+
+static bool parse_hex(const char *text, event_t *event)
+{
+	size_t len = strlen(text);
+	if (len % 2 || len / 2 > SCENARIO_MAX_WRITE)
+	{
+		return false;
+	}
+	event->size = (uint16_t) (len / 2);
+	event->data = malloc(event->size ? event->size : 1);
+	for (size_t i = 0; i < event->size; i++)
+	{
+		unsigned int byte;
+		if (!isxdigit((unsigned char) text[2 * i]) || !isxdigit((unsigned char) text[2 * i + 1]) ||
+			sscanf(text + 2 * i, "%2x", &byte) != 1)
+		{
+			return false;
+		}
+		event->data[i] = (uint8_t) byte;
+	}
+	return true;
+}
+
+static bool parse_line(char *line, event_t *event, int64_t *end_us, bool *is_end)
+{
+	char *argv[SCENARIO_MAX_ARGS] = {0};
+	int argc = 0;
+	for (char *tok = strtok(line, " \t\r\n"); tok && argc < SCENARIO_MAX_ARGS; tok = strtok(NULL, " \t\r\n"))
+	{
+		argv[argc++] = tok;
+	}
+	if (argc < 2 || !parse_time(argv[0], &event->t_us))
+	{
+		return false;
+	}
+	const char *cmd = argv[1];
+	*is_end = false;
+	if (!strcmp(cmd, "end"))
+	{
+		*end_us = event->t_us;
+		*is_end = true;
+		return true;
+	}
+	if (!strcmp(cmd, "leave"))
+	{
+		event->type = EVENT_LEAVE;
+		return true;
+	}
+	if (argc < 3)
+	{
+		return false;
+	}
+	float value = strtof(argv[2], NULL);
+	event->value = value;
+	if (!strcmp(cmd, "distance"))
+	{
+		event->type = EVENT_DISTANCE;
+	} else if (!strcmp(cmd, "ramp"))
+	{
+		event->type = EVENT_RAMP;
+		return argc >= 4 && parse_time(argv[3], &event->duration_us);
+	} else if (!strcmp(cmd, "temperature"))
+	{
+		event->type = EVENT_TEMPERATURE;
+	} else if (!strcmp(cmd, "noise"))
+	{
+		event->type = EVENT_NOISE;
+	} else if (!strcmp(cmd, "dropout"))
+	{
+		event->type = EVENT_DROPOUT;
+	} else if (!strcmp(cmd, "spurious"))
+	{
+		event->type = EVENT_SPURIOUS;
+		event->arg = argc >= 4 ? strtof(argv[3], NULL) : 30.0f;
+	} else if (!strcmp(cmd, "coordinator"))
+	{
+		event->type = EVENT_COORDINATOR;
+		event->value = !strcmp(argv[2], "up");
+	} else if (!strcmp(cmd, "write"))
+	{
+		event->type = EVENT_WRITE;
+		event->cluster = (uint16_t) strtoul(argv[2], NULL, 0);
+		event->attr = argc >= 4 ? (uint16_t) strtoul(argv[3], NULL, 0) : 0;
+		return argc >= 5 && parse_hex(argv[4], event);
+	} else if (!strcmp(cmd, "console"))
+	{
+		event->type = EVENT_CONSOLE;
+		size_t len = 0;
+		for (int i = 2; i < argc; i++)
+		{
+			len += strlen(argv[i]) + 1;
+		}
+		event->command = calloc(1, len);
+		for (int i = 2; i < argc; i++)
+		{
+			strcat(event->command, argv[i]);
+			strcat(event->command, i < argc - 1 ? " " : "");
+		}
+	} else if (!strcmp(cmd, "alarm") && argc >= 3)
+	{
+		event->type = EVENT_COMMAND;
+		event->cluster = ESP_ZB_ZCL_CLUSTER_ID_ALARMS;
+		if (!strcmp(argv[2], "reset") && argc >= 5)
+		{
+			uint16_t cluster = (uint16_t) strtoul(argv[4], NULL, 0);
+			event->cmd_id = 0x00;
+			event->size = 3;
+			event->data = malloc(event->size);
+			event->data[0] = (uint8_t) strtoul(argv[3], NULL, 0);
+			event->data[1] = (uint8_t) cluster;
+			event->data[2] = (uint8_t) (cluster >> 8);
+		} else if (!strcmp(argv[2], "reset_all"))
+		{
+			event->cmd_id = 0x01;
+		} else if (!strcmp(argv[2], "get"))
+		{
+			event->cmd_id = 0x02;
+		} else if (!strcmp(argv[2], "reset_log"))
+		{
+			event->cmd_id = 0x03;
+		} else
+		{
+			return false;
+		}
+	} else if (!strcmp(cmd, "scene"))
+	{
+		event->type = EVENT_SCENE;
+		if (argc < 4)
+		{
+			return false;
+		}
+		event->group_id = (uint16_t) strtoul(argv[3], NULL, 0);
+		if (!strcmp(argv[2], "remove_all"))
+		{
+			event->scene_op = SIM_SCENE_REMOVE_ALL;
+			return true;
+		}
+		if (argc < 5)
+		{
+			return false;
+		}
+		event->scene_id = (uint8_t) strtoul(argv[4], NULL, 0);
+		if (!strcmp(argv[2], "store"))
+		{
+			event->scene_op = SIM_SCENE_STORE;
+		} else if (!strcmp(argv[2], "recall"))
+		{
+			event->scene_op = SIM_SCENE_RECALL;
+		} else if (!strcmp(argv[2], "remove"))
+		{
+			event->scene_op = SIM_SCENE_REMOVE;
+		} else if (!strcmp(argv[2], "add") && argc >= 9)
+		{
+			event->scene_op = SIM_SCENE_ADD;
+			event->scene_fields.on_off = strtoul(argv[5], NULL, 0) != 0;
+			event->scene_fields.level = (uint8_t) strtoul(argv[6], NULL, 0);
+			event->scene_fields.color_x = (uint16_t) strtoul(argv[7], NULL, 0);
+			event->scene_fields.color_y = (uint16_t) strtoul(argv[8], NULL, 0);
+			if (argc >= 12)
+			{
+				event->scene_fields.enhanced_hue = (uint16_t) strtoul(argv[9], NULL, 0);
+				event->scene_fields.saturation = (uint8_t) strtoul(argv[10], NULL, 0);
+				event->scene_fields.color_temperature = (uint16_t) strtoul(argv[11], NULL, 0);
+			}
+		} else
+		{
+			return false;
+		}
+	} else
+	{
+		return false;
+	}
+	return true;
+}
+
+static bool parse_expect(char *line, sim_expect_t *expect)
+{
+	static const char *const ops[] = {
+			[SIM_EXPECT_LT] = "<",
+			[SIM_EXPECT_LE] = "<=",
+			[SIM_EXPECT_EQ] = "==",
+			[SIM_EXPECT_NE] = "!=",
+			[SIM_EXPECT_GE] = ">=",
+			[SIM_EXPECT_GT] = ">",
+	};
+	char *argv[5] = {0};
+	int argc = 0;
+	for (char *tok = strtok(line, " \t\r\n"); tok && argc < 5; tok = strtok(NULL, " \t\r\n"))
+	{
+		argv[argc++] = tok;
+	}
+	if (argc != 4 || strcmp(argv[0], "expect") != 0)
+	{
+		return false;
+	}
+	char *end;
+	expect->value = strtod(argv[3], &end);
+	if (end == argv[3] || *end)
+	{
+		return false;
+	}
+	for (size_t op = 0; op < sizeof(ops) / sizeof(ops[0]); op++)
+	{
+		if (!strcmp(argv[2], ops[op]))
+		{
+			expect->op = (sim_expect_op_t) op;
+			expect->metric = strdup(argv[1]);
+			snprintf(expect->text, sizeof(expect->text), "%s %s %s", argv[1], argv[2], argv[3]);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool sim_scenario_expect(int index, sim_expect_t *expect)
+{
+	if (index >= s_expect_count)
+	{
+		return false;
+	}
+	*expect = s_expects[index];
+	return true;
+}
+
+esp_err_t sim_scenario_load(const char *path, int64_t *end_us)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return ESP_ERR_NOT_FOUND;
+	}
+	char line[1024];
+	int line_no = 0;
+	bool uses_console = false;
+	*end_us = SIM_US_PER_HOUR * 24;
+	while (fgets(line, sizeof(line), file))
+	{
+		line_no++;
+		char *comment = strchr(line, '#');
+		if (comment)
+		{
+			*comment = '\0';
+		}
+		if (strspn(line, " \t\r\n") == strlen(line))
+		{
+			continue;
+		}
+		char *start = line + strspn(line, " \t");
+		if (!strncmp(start, "expect", 6) && isspace((unsigned char) start[6]))
+		{
+			if (s_expect_count == SCENARIO_MAX_EXPECTS || !parse_expect(start, &s_expects[s_expect_count]))
+			{
+				fprintf(stderr, "%s:%d: cannot parse expectation\n", path, line_no);
+				fclose(file);
+				return ESP_ERR_INVALID_ARG;
+			}
+			s_expects[s_expect_count++].line = line_no;
+			continue;
+		}
+		if (s_event_count == SCENARIO_MAX_EVENTS)
+		{
+			fprintf(stderr, "%s:%d: too many events\n", path, line_no);
+			fclose(file);
+			return ESP_ERR_NO_MEM;
+		}
+		event_t *event = &s_events[s_event_count];
+		bool is_end;
+		if (!parse_line(line, event, end_us, &is_end))
+		{
+			fprintf(stderr, "%s:%d: cannot parse event\n", path, line_no);
+			fclose(file);
+			return ESP_ERR_INVALID_ARG;
+		}
+		if (is_end)
+		{
+			continue;
+		}
+		if (s_event_count && event->t_us < s_events[s_event_count - 1].t_us)
+		{
+			fprintf(stderr, "%s:%d: events must be in time order\n", path, line_no);
+			fclose(file);
+			return ESP_ERR_INVALID_ARG;
+		}
+		uses_console |= event->type == EVENT_CONSOLE;
+		s_event_count++;
+	}
+	fclose(file);
+#if !CONFIG_DEPTH_SENSOR_CONSOLE
+	if (uses_console)
+	{
+		printf("scenario         %s skipped, the console is not in this build\n", path);
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+#endif
+	/* events at time zero describe the initial tank, apply them before boot */
+	while (s_next_event < s_event_count && s_events[s_next_event].t_us == 0 &&
+		   s_events[s_next_event].type != EVENT_WRITE && s_events[s_next_event].type != EVENT_SCENE &&
+		   s_events[s_next_event].type != EVENT_CONSOLE && s_events[s_next_event].type != EVENT_LEAVE)
+	{
+		const event_t *event = &s_events[s_next_event++];
+		switch (event->type)
+		{
+			case EVENT_DISTANCE:
+				s_ramp_d0 = s_ramp_d1 = event->value;
+				break;
+			case EVENT_TEMPERATURE:
+				s_world.temperature_c = event->value;
+				break;
+			case EVENT_NOISE:
+				s_world.noise_cm = event->value;
+				break;
+			case EVENT_DROPOUT:
+				s_world.dropout = event->value;
+				break;
+			case EVENT_SPURIOUS:
+				s_world.spurious = event->value;
+				s_world.spurious_cm = event->arg;
+				break;
+			case EVENT_COORDINATOR:
+				s_world.coordinator_up = event->value != 0;
+				break;
+			default:
+				/* a ramp from boot is applied by the scenario task */
+				s_next_event--;
+				return ESP_OK;
+		}
+	}
+	return ESP_OK;
+}
+
+static float ramp_at(int64_t t_us)
+{
+	if (t_us >= s_ramp_t1 || s_ramp_t1 == s_ramp_t0)
+	{
+		return s_ramp_d1;
+	}
+	if (t_us <= s_ramp_t0)
+	{
+		return s_ramp_d0;
+	}
+	return s_ramp_d0 + (s_ramp_d1 - s_ramp_d0) * (float) (t_us - s_ramp_t0) / (float) (s_ramp_t1 - s_ramp_t0);
+}
+
+void sim_world_at(int64_t t_us, sim_world_t *world)
+{
+	*world = s_world;
+	world->distance_cm = ramp_at(t_us);
+}
+
+static void apply_event(const event_t *event)
+{
+	float current = ramp_at(event->t_us);
+	switch (event->type)
+	{
+		case EVENT_DISTANCE:
+			if (fabsf(event->value - current) >= SCENARIO_STEP_CM)
+			{
+				sim_metrics_step(event->t_us, current, event->value);
+			}
+			s_ramp_d0 = s_ramp_d1 = event->value;
+			s_ramp_t0 = s_ramp_t1 = event->t_us;
+			break;
+		case EVENT_RAMP:
+			s_ramp_d0 = current;
+			s_ramp_d1 = event->value;
+			s_ramp_t0 = event->t_us;
+			s_ramp_t1 = event->t_us + event->duration_us;
+			break;
+		case EVENT_TEMPERATURE:
+			s_world.temperature_c = event->value;
+			break;
+		case EVENT_NOISE:
+			s_world.noise_cm = event->value;
+			break;
+		case EVENT_DROPOUT:
+			s_world.dropout = event->value;
+			break;
+		case EVENT_SPURIOUS:
+			s_world.spurious = event->value;
+			s_world.spurious_cm = event->arg;
+			break;
+		case EVENT_COORDINATOR:
+			s_world.coordinator_up = event->value != 0;
+			break;
+		case EVENT_WRITE:
+			sim_zigbee_remote_write(event->cluster, event->attr, event->data, event->size);
+			break;
+		case EVENT_SCENE:
+			sim_zigbee_scene(event->scene_op, event->group_id, event->scene_id, &event->scene_fields);
+			break;
+		case EVENT_COMMAND:
+			sim_zigbee_command(event->cluster, event->cmd_id, event->data, event->size);
+			break;
+		case EVENT_LEAVE:
+			sim_zigbee_leave();
+			break;
+		case EVENT_CONSOLE:
+		{
+			int ret;
+			esp_console_run(event->command, &ret);
+			break;
+		}
+	}
+}
+
+/* Applies events on time, so remote writes reach the stack when the script says */
+void sim_scenario_task(void *arg)
+{
+	while (s_next_event < s_event_count)
+	{
+		const event_t *event = &s_events[s_next_event];
+		int64_t now = sim_now_us();
+		if (event->t_us > now)
+		{
+			int64_t tick_us = SIM_US_PER_S / configTICK_RATE_HZ;
+			vTaskDelay((TickType_t) ((event->t_us - now + tick_us - 1) / tick_us));
+			continue;
+		}
+		apply_event(event);
+		s_next_event++;
+	}
+	vTaskDelete(NULL);
+}
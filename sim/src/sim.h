@@ -0,0 +1,184 @@
+/* Host simulation internals shared by the stubs, the world model and the runner */
+#ifndef SIM_SIM_H
+#define SIM_SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "esp_err.h"
+#include "esp_zigbee_zcl.h"
+
+#define SIM_US_PER_S                1000000LL
+#define SIM_US_PER_HOUR             (3600 * SIM_US_PER_S)
+#define SIM_TIMER_READ_COST_US      1       /* esp_timer_get_time() on the C6, rounded up */
+#define SIM_MAX_REPORTED_ATTRS      16
+#define SIM_TASK_PREFIX             "sim_"
+
+/* Virtual clock, only moves when a task sleeps or busy-waits */
+int64_t sim_now_us(void);
+void sim_busy_us(uint32_t us);
+
+/* Scheduler, tasks named "sim_*" belong to the harness and stay out of the metrics */
+void sim_scheduler_start(void (*main_fn)(void *), int64_t end_us);
+bool sim_in_task(void);
+
+/* Stubs call this where the real SDK takes memory from the heap, so the zero-heap build's
+ * allocation hook sees the same calls as on the target */
+void sim_heap_alloc(size_t size);
+
+/* Peak stack use of a task since it was created, false past the last task */
+typedef struct
+{
+	const char *name;
+	uint32_t stack_size;        /* as configured for the target */
+	uint32_t peak;              /* host bytes touched */
+	bool is_static;
+} sim_task_stack_t;
+
+bool sim_task_stack(int index, sim_task_stack_t *stack);
+
+/* Scripted world, see scenario.c */
+typedef struct
+{
+	float distance_cm;          /* true distance from the sensor to the surface */
+	float temperature_c;
+	float noise_cm;             /* gaussian sigma added to every echo */
+	float dropout;              /* probability of no echo at all */
+	float spurious;             /* probability of an early echo from spurious_cm */
+	float spurious_cm;
+	bool coordinator_up;
+} sim_world_t;
+
+/* Expectation on a metric at the end of the run, see scenario.c */
+typedef enum
+{
+	SIM_EXPECT_LT,
+	SIM_EXPECT_LE,
+	SIM_EXPECT_EQ,
+	SIM_EXPECT_NE,
+	SIM_EXPECT_GE,
+	SIM_EXPECT_GT,
+} sim_expect_op_t;
+
+typedef struct
+{
+	const char *metric;
+	sim_expect_op_t op;
+	double value;
+	int line;
+	char text[64];              /* as written, for the report */
+} sim_expect_t;
+
+/* ESP_ERR_NOT_SUPPORTED when the scenario needs something this build leaves out */
+esp_err_t sim_scenario_load(const char *path, int64_t *end_us);
+bool sim_scenario_expect(int index, sim_expect_t *expect);
+void sim_world_at(int64_t t_us, sim_world_t *world);
+void sim_scenario_task(void *arg);
+float sim_random_gauss(void);
+float sim_random_uniform(void);
+void sim_random_seed(uint32_t seed);
+
+/* End of the last echo pulse */
+int64_t sim_hw_last_echo_us(void);
+
+/* Pixel as last sent to the LED strip */
+void sim_hw_led_rgb(uint8_t rgb[3]);
+
+/* Zigbee stack */
+void sim_zigbee_remote_write(uint16_t cluster, uint16_t attr, const void *value, uint16_t size);
+void sim_zigbee_leave(void);
+bool sim_zigbee_reported_float(uint16_t cluster, uint16_t attr, float *value);
+void sim_zigbee_level(int64_t t_us, float distance_cm);
+
+typedef enum
+{
+	SIM_SCENE_ADD,              /* Add Scene with explicit field sets */
+	SIM_SCENE_STORE,            /* Store Scene from the current attributes */
+	SIM_SCENE_RECALL,
+	SIM_SCENE_REMOVE,
+	SIM_SCENE_REMOVE_ALL,       /* every scene of the group */
+} sim_scene_op_t;
+
+#define SIM_SCENE_COLOR_FIELD_SIZE  13
+
+typedef struct
+{
+	bool on_off;
+	uint8_t level;
+	uint16_t color_x;
+	uint16_t color_y;
+	uint16_t enhanced_hue;
+	uint8_t saturation;
+	uint16_t color_temperature;
+} sim_scene_fields_t;
+
+void sim_zigbee_scene(sim_scene_op_t op, uint16_t group_id, uint8_t scene_id, const sim_scene_fields_t *fields);
+
+/* Client to server command the stack leaves to the application's raw handler, ZCL payload bytes */
+void sim_zigbee_command(uint16_t cluster, uint8_t cmd_id, const uint8_t *payload, uint16_t size);
+
+/* Collected while the firmware runs, printed by main.c */
+typedef struct
+{
+	uint16_t cluster;
+	uint16_t attr;
+	uint32_t writes;
+	uint32_t reports;
+	uint32_t dropped;
+} sim_attr_metrics_t;
+
+typedef struct
+{
+	int64_t busy_us;            /* virtual time spent busy-waiting */
+	uint64_t task_switches;     /* firmware task resumes */
+	uint32_t pings;
+	uint32_t nvs_writes;
+	uint32_t nvs_bytes;
+	uint32_t led_refreshes;
+	uint32_t scene_recalls;
+	uint32_t steering_attempts;
+	uint32_t channels_scanned;
+	int64_t joined_us;          /* first successful steering, -1 when never joined */
+	/* joins after a scripted leave and how long they took */
+	uint32_t rejoins;
+	int64_t rejoin_sum_us;
+	int64_t rejoin_max_us;
+	/* On/Off commands to bound devices and their time from the true level crossing the pump mark,
+	 * for the commands within 10 minutes of a crossing */
+	uint32_t on_off_commands;
+	uint32_t on_off_dropped;
+	uint32_t on_off_timed;
+	int64_t on_off_latency_sum_us;
+	int64_t on_off_latency_min_us;
+	int64_t on_off_latency_max_us;
+	/* Alarms cluster alarms by code, with the time of the first one */
+	uint32_t alarms[4];
+	int64_t alarm_first_us[4];
+	/* Get Alarm responses, entries by code and empty logs */
+	uint32_t alarm_log[4];
+	uint32_t alarm_log_empty;
+	/* published distance against the true level */
+	uint32_t lag_samples;
+	double lag_abs_sum;
+	float lag_abs_max;
+	uint32_t lag_histogram[1000];   /* 0.1 cm bins */
+	/* level steps and how long the published value took to follow */
+	uint32_t steps;
+	uint32_t steps_settled;
+	int64_t settle_sum_us;
+	int64_t settle_max_us;
+	sim_attr_metrics_t attrs[SIM_MAX_REPORTED_ATTRS];
+	int attr_count;
+	FILE *trace;
+	/* USB-Serial-JTAG output of the diagnostics stream */
+	uint64_t stream_bytes;
+	FILE *stream;
+} sim_metrics_t;
+
+extern sim_metrics_t sim_metrics;
+
+sim_attr_metrics_t *sim_metrics_attr(uint16_t cluster, uint16_t attr);
+void sim_metrics_step(int64_t t_us, float from_cm, float to_cm);
+
+#endif
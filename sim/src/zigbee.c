@@ -0,0 +1,1405 @@
+/*
+ * Recording Zigbee stack
+ *
+ * Keeps the registered attributes, runs the commissioning state machine against
+ * the scripted coordinator and turns attribute changes into counted reports. The
+ * coordinator side only remembers the last reported value of each attribute.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ha/esp_zigbee_ha_standard.h"
+#include "esp_zigbee_core.h"
+#include "sim.h"
+
+#define ZB_MAX_ATTRS            192
+#define ZB_MAX_LIST_ATTRS       32
+#define ZB_MAX_CLUSTERS         24
+#define ZB_MAX_ENDPOINTS        4
+#define ZB_MAX_EVENTS           32
+#define ZB_MAX_SCENES           16
+#define ZB_ATTR_VALUE_SIZE      256
+#define ZB_INIT_DELAY_US        (100 * 1000)
+#define ZB_SCAN_CHANNEL_US      (138 * 1000)    /* beacon request and scan duration 3 per channel */
+#define ZB_JOIN_US              (500 * 1000)
+#define ZB_NETWORK_CHANNEL      15
+#define ZB_CHANNEL_MASK_ALL     ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK
+/* Pump mode and marks of the firmware's tank cluster, read back to time the On/Off commands */
+#define ZB_TANK_CLUSTER_ID      0xfc00
+#define ZB_PUMP_MODE_ID         0x0004
+#define ZB_PUMP_HIGH_MARK_ID    0x0005
+#define ZB_PUMP_LOW_MARK_ID     0x0006
+#define ZB_PUMP_MODE_DRAIN      1
+#define ZB_PUMP_PAIR_US         (10 * 60 * SIM_US_PER_S)    /* a command this far from the crossing is not timed */
+
+typedef struct
+{
+	esp_zb_zcl_attr_t desc;
+	uint8_t endpoint;
+	uint16_t cluster;
+	uint8_t role;
+	uint8_t value[ZB_ATTR_VALUE_SIZE];
+	size_t capacity;                        /* strings keep the size they were created with */
+	uint8_t reported[ZB_ATTR_VALUE_SIZE];  /* what the coordinator last received */
+	bool reported_valid;
+	bool reporting;
+	bool report_pending;
+	uint16_t min_interval;
+	uint16_t max_interval;
+	double delta;                           /* reportable change of numeric attributes */
+	int64_t last_report_us;
+	sim_attr_metrics_t *metrics;
+} zb_attr_t;
+
+struct esp_zb_attribute_list_s
+{
+	uint16_t cluster_id;
+	uint8_t role;
+	zb_attr_t *attrs[ZB_MAX_LIST_ATTRS];
+	int attr_count;
+	/* a cluster list is an attribute list of attribute lists */
+	esp_zb_attribute_list_t *clusters[ZB_MAX_CLUSTERS];
+	int cluster_count;
+};
+
+struct esp_zb_ep_list_s
+{
+	esp_zb_endpoint_config_t config[ZB_MAX_ENDPOINTS];
+	esp_zb_cluster_list_t *clusters[ZB_MAX_ENDPOINTS];
+	int count;
+};
+
+typedef enum
+{
+	ZB_EVENT_SIGNAL,
+	ZB_EVENT_ALARM,
+	ZB_EVENT_WRITE,
+	ZB_EVENT_STEERING_DONE,
+	ZB_EVENT_SCENE,
+	ZB_EVENT_COMMAND,
+} zb_event_type_t;
+
+typedef struct
+{
+	bool used;
+	zb_event_type_t type;
+	int64_t at_us;
+	uint32_t signal;
+	esp_err_t status;
+	esp_zb_callback_t cb;
+	uint8_t param;
+	uint16_t cluster;
+	uint16_t attr;
+	uint8_t data[ZB_ATTR_VALUE_SIZE];
+	uint16_t size;
+	sim_scene_op_t scene_op;
+	uint16_t group_id;
+	uint8_t scene_id;
+	sim_scene_fields_t scene_fields;
+} zb_event_t;
+
+/* The stack's own scene table, it holds the extension field sets handed over on recall */
+typedef struct
+{
+	bool used;
+	uint16_t group_id;
+	uint8_t scene_id;
+	sim_scene_fields_t fields;
+} zb_scene_t;
+
+static zb_attr_t s_attrs[ZB_MAX_ATTRS];
+static int s_attr_count;
+static esp_zb_ep_list_t *s_ep_list;
+static esp_zb_core_action_callback_t s_action_handler;
+static zb_event_t s_events[ZB_MAX_EVENTS];
+static zb_scene_t s_scenes[ZB_MAX_SCENES];
+static esp_zb_zcl_raw_command_callback_t s_raw_handler;
+static zb_zcl_parsed_hdr_t s_raw_header;
+static uint8_t s_raw_payload[64];
+static zb_uint_t s_raw_length;
+static TaskHandle_t s_zb_task;
+static bool s_started;
+static bool s_joined;
+static bool s_commissioned;
+static uint32_t s_primary_mask = ZB_CHANNEL_MASK_ALL;
+static uint32_t s_secondary_mask;
+static esp_zb_ieee_addr_t s_use_extended_pan_id;     /* network steering may join, all zeros for any */
+static const esp_zb_ieee_addr_t s_network_extended_pan_id = {0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd};
+static int64_t s_left_us = -1;
+/* True level at the last probe. Per pump mark, the crossing still waiting for its command and
+ * the command that came before the crossing, -1 when there is none */
+static int64_t s_level_us = -1;
+static float s_level_cm;
+static int64_t s_crossed_us[2] = {-1, -1};
+static int64_t s_commanded_us[2] = {-1, -1};
+
+static size_t type_size(uint8_t type, const uint8_t *value)
+{
+	switch (type)
+	{
+		case ESP_ZB_ZCL_ATTR_TYPE_BOOL:
+		case ESP_ZB_ZCL_ATTR_TYPE_8BITMAP:
+		case ESP_ZB_ZCL_ATTR_TYPE_U8:
+		case ESP_ZB_ZCL_ATTR_TYPE_S8:
+		case ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM:
+			return 1;
+		case ESP_ZB_ZCL_ATTR_TYPE_16BITMAP:
+		case ESP_ZB_ZCL_ATTR_TYPE_U16:
+		case ESP_ZB_ZCL_ATTR_TYPE_S16:
+		case ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM:
+			return 2;
+		case ESP_ZB_ZCL_ATTR_TYPE_U32:
+		case ESP_ZB_ZCL_ATTR_TYPE_S32:
+		case ESP_ZB_ZCL_ATTR_TYPE_SINGLE:
+			return 4;
+		case ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING:
+		case ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING:
+			return value ? 1 + (size_t) value[0] : 1;
+		default:
+			return 0;
+	}
+}
+
+static double numeric_value(uint8_t type, const uint8_t *value)
+{
+	switch (type)
+	{
+		case ESP_ZB_ZCL_ATTR_TYPE_S8:
+			return *(const int8_t *) value;
+		case ESP_ZB_ZCL_ATTR_TYPE_U16:
+		case ESP_ZB_ZCL_ATTR_TYPE_16BITMAP:
+		case ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM:
+			return *(const uint16_t *) value;
+		case ESP_ZB_ZCL_ATTR_TYPE_S16:
+			return *(const int16_t *) value;
+		case ESP_ZB_ZCL_ATTR_TYPE_U32:
+			return *(const uint32_t *) value;
+		case ESP_ZB_ZCL_ATTR_TYPE_S32:
+			return *(const int32_t *) value;
+		case ESP_ZB_ZCL_ATTR_TYPE_SINGLE:
+			return *(const float *) value;
+		default:
+			return value[0];
+	}
+}
+
+esp_zb_attribute_list_t *esp_zb_zcl_attr_list_create(uint16_t cluster_id)
+{
+	esp_zb_attribute_list_t *list = calloc(1, sizeof(*list));
+	if (list)
+	{
+		list->cluster_id = cluster_id;
+	}
+	return list;
+}
+
+esp_zb_cluster_list_t *esp_zb_zcl_cluster_list_create(void)
+{
+	return esp_zb_zcl_attr_list_create(0xffff);
+}
+
+esp_zb_ep_list_t *esp_zb_ep_list_create(void)
+{
+	return calloc(1, sizeof(esp_zb_ep_list_t));
+}
+
+esp_err_t esp_zb_ep_list_add_ep(esp_zb_ep_list_t *ep_list, esp_zb_cluster_list_t *cluster_list,
+								esp_zb_endpoint_config_t endpoint_config)
+{
+	if (!ep_list || !cluster_list || ep_list->count == ZB_MAX_ENDPOINTS)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	ep_list->config[ep_list->count] = endpoint_config;
+	ep_list->clusters[ep_list->count++] = cluster_list;
+	return ESP_OK;
+}
+
+static esp_err_t list_add_attr(esp_zb_attribute_list_t *list, uint16_t attr_id, uint8_t type, uint8_t access,
+							   uint16_t manuf_code, const void *value)
+{
+	if (!list || !value || list->attr_count == ZB_MAX_LIST_ATTRS || s_attr_count == ZB_MAX_ATTRS)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	for (int i = 0; i < list->attr_count; i++)
+	{
+		if (list->attrs[i]->desc.id == attr_id && list->attrs[i]->desc.manuf_code == manuf_code)
+		{
+			return ESP_ERR_INVALID_STATE;
+		}
+	}
+	size_t size = type_size(type, value);
+	if (!size || size > ZB_ATTR_VALUE_SIZE)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	zb_attr_t *attr = &s_attrs[s_attr_count++];
+	attr->desc.id = attr_id;
+	attr->desc.type = type;
+	attr->desc.access = access;
+	attr->desc.manuf_code = manuf_code;
+	attr->desc.data_p = attr->value;
+	attr->cluster = list->cluster_id;
+	attr->capacity = size;
+	memcpy(attr->value, value, size);
+	list->attrs[list->attr_count++] = attr;
+	return ESP_OK;
+}
+
+#define ADD_ATTR(list, id, type, access, value)                                         \
+	list_add_attr(list, id, type, access, ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC, value)
+
+esp_zb_attribute_list_t *esp_zb_basic_cluster_create(esp_zb_basic_cluster_cfg_t *basic_cfg)
+{
+	esp_zb_attribute_list_t *list = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_BASIC);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_BASIC_ZCL_VERSION_ID, ESP_ZB_ZCL_ATTR_TYPE_U8,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &basic_cfg->zcl_version);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_BASIC_POWER_SOURCE_ID, ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &basic_cfg->power_source);
+	return list;
+}
+
+esp_zb_attribute_list_t *esp_zb_identify_cluster_create(esp_zb_identify_cluster_cfg_t *identify_cfg)
+{
+	esp_zb_attribute_list_t *list = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID, ESP_ZB_ZCL_ATTR_TYPE_U16,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &identify_cfg->identify_time);
+	return list;
+}
+
+esp_zb_attribute_list_t *esp_zb_groups_cluster_create(esp_zb_groups_cluster_cfg_t *groups_cfg)
+{
+	esp_zb_attribute_list_t *list = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_GROUPS);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_GROUPS_NAME_SUPPORT_ID, ESP_ZB_ZCL_ATTR_TYPE_8BITMAP,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &groups_cfg->groups_name_support_id);
+	return list;
+}
+
+esp_zb_attribute_list_t *esp_zb_scenes_cluster_create(esp_zb_scenes_cluster_cfg_t *scene_cfg)
+{
+	esp_zb_attribute_list_t *list = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_SCENES);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_SCENES_SCENE_COUNT_ID, ESP_ZB_ZCL_ATTR_TYPE_U8,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &scene_cfg->scenes_count);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_SCENES_CURRENT_SCENE_ID, ESP_ZB_ZCL_ATTR_TYPE_U8,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &scene_cfg->current_scene);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_SCENES_CURRENT_GROUP_ID, ESP_ZB_ZCL_ATTR_TYPE_U16,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &scene_cfg->current_group);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_SCENES_SCENE_VALID_ID, ESP_ZB_ZCL_ATTR_TYPE_BOOL,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &scene_cfg->scene_valid);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_SCENES_NAME_SUPPORT_ID, ESP_ZB_ZCL_ATTR_TYPE_8BITMAP,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &scene_cfg->name_support);
+	return list;
+}
+
+esp_zb_attribute_list_t *esp_zb_on_off_cluster_create(esp_zb_on_off_cluster_cfg_t *on_off_cfg)
+{
+	esp_zb_attribute_list_t *list = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID, ESP_ZB_ZCL_ATTR_TYPE_BOOL,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &on_off_cfg->on_off);
+	return list;
+}
+
+esp_zb_attribute_list_t *esp_zb_level_cluster_create(esp_zb_level_cluster_cfg_t *level_cfg)
+{
+	esp_zb_attribute_list_t *list = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID, ESP_ZB_ZCL_ATTR_TYPE_U8,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &level_cfg->current_level);
+	return list;
+}
+
+esp_zb_attribute_list_t *esp_zb_color_control_cluster_create(esp_zb_color_cluster_cfg_t *color_cfg)
+{
+	esp_zb_attribute_list_t *list = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID, ESP_ZB_ZCL_ATTR_TYPE_U16,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &color_cfg->current_x);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID, ESP_ZB_ZCL_ATTR_TYPE_U16,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &color_cfg->current_y);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_MODE_ID, ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &color_cfg->color_mode);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_OPTIONS_ID, ESP_ZB_ZCL_ATTR_TYPE_8BITMAP,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &color_cfg->options);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_COLOR_MODE_ID, ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &color_cfg->enhanced_color_mode);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_CAPABILITIES_ID, ESP_ZB_ZCL_ATTR_TYPE_16BITMAP,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &color_cfg->color_capabilities);
+	return list;
+}
+
+esp_zb_attribute_list_t *esp_zb_analog_output_cluster_create(esp_zb_analog_output_cluster_cfg_t *analog_output_cfg)
+{
+	esp_zb_attribute_list_t *list = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_ANALOG_OUTPUT);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_ANALOG_OUTPUT_OUT_OF_SERVICE_ID, ESP_ZB_ZCL_ATTR_TYPE_BOOL,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &analog_output_cfg->out_of_service);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_ANALOG_OUTPUT_PRESENT_VALUE_ID, ESP_ZB_ZCL_ATTR_TYPE_SINGLE,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &analog_output_cfg->present_value);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_ANALOG_OUTPUT_STATUS_FLAGS_ID, ESP_ZB_ZCL_ATTR_TYPE_8BITMAP,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &analog_output_cfg->status_flags);
+	return list;
+}
+
+esp_zb_attribute_list_t *esp_zb_temperature_meas_cluster_create(esp_zb_temperature_meas_cluster_cfg_t *temperature_cfg)
+{
+	esp_zb_attribute_list_t *list = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID, ESP_ZB_ZCL_ATTR_TYPE_S16,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &temperature_cfg->measured_value);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_MIN_VALUE_ID, ESP_ZB_ZCL_ATTR_TYPE_S16,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &temperature_cfg->min_value);
+	ADD_ATTR(list, ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_MAX_VALUE_ID, ESP_ZB_ZCL_ATTR_TYPE_S16,
+			 ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &temperature_cfg->max_value);
+	return list;
+}
+
+esp_err_t esp_zb_basic_cluster_add_attr(esp_zb_attribute_list_t *attr_list, uint16_t attr_id, void *value_p)
+{
+	switch (attr_id)
+	{
+		case ESP_ZB_ZCL_ATTR_BASIC_MANUFACTURER_NAME_ID:
+		case ESP_ZB_ZCL_ATTR_BASIC_MODEL_IDENTIFIER_ID:
+			return ADD_ATTR(attr_list, attr_id, ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY,
+							value_p);
+		default:
+			return ESP_ERR_NOT_SUPPORTED;
+	}
+}
+
+esp_err_t esp_zb_color_control_cluster_add_attr(esp_zb_attribute_list_t *attr_list, uint16_t attr_id, void *value_p)
+{
+	uint8_t type;
+	uint8_t access = ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING;
+	switch (attr_id)
+	{
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_HUE_ID:
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID:
+			type = ESP_ZB_ZCL_ATTR_TYPE_U8;
+			break;
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMPERATURE_ID:
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_CURRENT_HUE_ID:
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMP_PHYSICAL_MIN_MIREDS_ID:
+		case ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMP_PHYSICAL_MAX_MIREDS_ID:
+			type = ESP_ZB_ZCL_ATTR_TYPE_U16;
+			break;
+		default:
+			return ESP_ERR_NOT_SUPPORTED;
+	}
+	return ADD_ATTR(attr_list, attr_id, type, access, value_p);
+}
+
+esp_err_t esp_zb_custom_cluster_add_custom_attr(esp_zb_attribute_list_t *attr_list, uint16_t attr_id, uint8_t attr_type,
+												uint8_t attr_access, void *value_p)
+{
+	return ADD_ATTR(attr_list, attr_id, attr_type, attr_access, value_p);
+}
+
+esp_err_t esp_zb_cluster_add_manufacturer_attr(esp_zb_attribute_list_t *attr_list, uint16_t cluster_id,
+											   uint16_t attr_id, uint16_t manuf_code, uint8_t attr_type,
+											   uint8_t attr_access, void *value_p)
+{
+	if (!attr_list || attr_list->cluster_id != cluster_id)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	return list_add_attr(attr_list, attr_id, attr_type, attr_access | ESP_ZB_ZCL_ATTR_MANUF_SPEC, manuf_code,
+						 value_p);
+}
+
+static esp_err_t cluster_list_add(esp_zb_cluster_list_t *cluster_list, esp_zb_attribute_list_t *attr_list,
+								  uint8_t role_mask)
+{
+	if (!cluster_list || !attr_list || cluster_list->cluster_count == ZB_MAX_CLUSTERS)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	for (int i = 0; i < cluster_list->cluster_count; i++)
+	{
+		const esp_zb_attribute_list_t *other = cluster_list->clusters[i];
+		if (other->cluster_id == attr_list->cluster_id && other->role == role_mask)
+		{
+			return ESP_ERR_INVALID_STATE;
+		}
+	}
+	attr_list->role = role_mask;
+	cluster_list->clusters[cluster_list->cluster_count++] = attr_list;
+	return ESP_OK;
+}
+
+#define CLUSTER_LIST_ADD(name)                                                                          \
+esp_err_t esp_zb_cluster_list_add_##name##_cluster(esp_zb_cluster_list_t *cluster_list,                 \
+												   esp_zb_attribute_list_t *attr_list, uint8_t role_mask) \
+{                                                                                                       \
+	return cluster_list_add(cluster_list, attr_list, role_mask);                                        \
+}
+
+CLUSTER_LIST_ADD(basic)
+CLUSTER_LIST_ADD(identify)
+CLUSTER_LIST_ADD(groups)
+CLUSTER_LIST_ADD(scenes)
+CLUSTER_LIST_ADD(on_off)
+CLUSTER_LIST_ADD(level)
+CLUSTER_LIST_ADD(color_control)
+CLUSTER_LIST_ADD(analog_output)
+CLUSTER_LIST_ADD(temperature_meas)
+CLUSTER_LIST_ADD(custom)
+
+static zb_attr_t *find_attr(uint8_t endpoint, uint16_t cluster, uint8_t role, uint16_t attr_id)
+{
+	for (int i = 0; i < s_attr_count; i++)
+	{
+		zb_attr_t *attr = &s_attrs[i];
+		if (attr->endpoint == endpoint && attr->cluster == cluster && attr->role == role && attr->desc.id == attr_id)
+		{
+			return attr;
+		}
+	}
+	return NULL;
+}
+
+static void zb_wake(void)
+{
+	if (s_zb_task && xTaskGetCurrentTaskHandle() != s_zb_task)
+	{
+		xTaskNotifyGive(s_zb_task);
+	}
+}
+
+static zb_event_t *event_add(zb_event_type_t type, int64_t delay_us)
+{
+	for (int i = 0; i < ZB_MAX_EVENTS; i++)
+	{
+		if (!s_events[i].used)
+		{
+			memset(&s_events[i], 0, sizeof(s_events[i]));
+			s_events[i].used = true;
+			s_events[i].type = type;
+			s_events[i].at_us = sim_now_us() + delay_us;
+			zb_wake();
+			return &s_events[i];
+		}
+	}
+	fprintf(stderr, "sim: Zigbee event queue full\n");
+	abort();
+}
+
+static void signal_add(uint32_t signal, esp_err_t status, int64_t delay_us)
+{
+	zb_event_t *event = event_add(ZB_EVENT_SIGNAL, delay_us);
+	event->signal = signal;
+	event->status = status;
+}
+
+esp_err_t esp_zb_platform_config(esp_zb_platform_config_t *config)
+{
+	return ESP_OK;
+}
+
+void esp_zb_init(esp_zb_cfg_t *nwk_cfg)
+{
+	s_zb_task = xTaskGetCurrentTaskHandle();
+}
+
+esp_err_t esp_zb_device_register(esp_zb_ep_list_t *ep_list)
+{
+	for (int e = 0; e < ep_list->count; e++)
+	{
+		esp_zb_cluster_list_t *cluster_list = ep_list->clusters[e];
+		for (int c = 0; c < cluster_list->cluster_count; c++)
+		{
+			esp_zb_attribute_list_t *attr_list = cluster_list->clusters[c];
+			for (int a = 0; a < attr_list->attr_count; a++)
+			{
+				attr_list->attrs[a]->endpoint = ep_list->config[e].endpoint;
+				attr_list->attrs[a]->role = attr_list->role;
+			}
+		}
+	}
+	s_ep_list = ep_list;
+	return ESP_OK;
+}
+
+void esp_zb_core_action_handler_register(esp_zb_core_action_callback_t cb)
+{
+	s_action_handler = cb;
+}
+
+void esp_zb_raw_command_handler_register(esp_zb_zcl_raw_command_callback_t cb)
+{
+	s_raw_handler = cb;
+}
+
+void *zb_buf_get_param(zb_bufid_t buf)
+{
+	return &s_raw_header;
+}
+
+void *zb_buf_begin(zb_bufid_t buf)
+{
+	return s_raw_payload;
+}
+
+zb_uint_t zb_buf_len(zb_bufid_t buf)
+{
+	return s_raw_length;
+}
+
+esp_err_t esp_zb_set_primary_network_channel_set(uint32_t channel_mask)
+{
+	s_primary_mask = channel_mask;
+	return ESP_OK;
+}
+
+esp_err_t esp_zb_set_secondary_network_channel_set(uint32_t channel_mask)
+{
+	s_secondary_mask = channel_mask;
+	return ESP_OK;
+}
+
+esp_err_t esp_zb_start(bool autostart)
+{
+	if (!s_ep_list)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	s_started = true;
+	signal_add(autostart ? ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START : ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP, ESP_OK, 0);
+	return ESP_OK;
+}
+
+bool esp_zb_is_started(void)
+{
+	return s_started;
+}
+
+/* Active scan over a mask, the network is found on ZB_NETWORK_CHANNEL when the coordinator is up
+ * and steering is not limited to another extended PAN ID */
+static bool scan(uint32_t mask, int64_t *duration_us)
+{
+	static const esp_zb_ieee_addr_t any = {0};
+	int channels = __builtin_popcount(mask & ZB_CHANNEL_MASK_ALL);
+	sim_metrics.channels_scanned += (uint32_t) channels;
+	*duration_us += channels * ZB_SCAN_CHANNEL_US;
+	sim_world_t world;
+	sim_world_at(sim_now_us(), &world);
+	bool wanted = !memcmp(s_use_extended_pan_id, any, sizeof(any)) ||
+				  !memcmp(s_use_extended_pan_id, s_network_extended_pan_id, sizeof(s_network_extended_pan_id));
+	return world.coordinator_up && wanted && (mask & (1U << ZB_NETWORK_CHANNEL));
+}
+
+esp_err_t esp_zb_bdb_start_top_level_commissioning(uint8_t mode_mask)
+{
+	if (mode_mask == ESP_ZB_BDB_MODE_INITIALIZATION)
+	{
+		signal_add(s_commissioned ? ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT : ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START, ESP_OK,
+				   ZB_INIT_DELAY_US);
+		return ESP_OK;
+	}
+	if (mode_mask == ESP_ZB_BDB_MODE_NETWORK_STEERING)
+	{
+		sim_metrics.steering_attempts++;
+		int64_t duration_us = 0;
+		bool found = scan(s_primary_mask, &duration_us);
+		if (!found && s_secondary_mask)
+		{
+			found = scan(s_secondary_mask, &duration_us);
+		}
+		zb_event_t *event = event_add(ZB_EVENT_STEERING_DONE, duration_us + (found ? ZB_JOIN_US : 0));
+		event->status = found ? ESP_OK : ESP_FAIL;
+		return ESP_OK;
+	}
+	return ESP_ERR_NOT_SUPPORTED;
+}
+
+bool esp_zb_bdb_dev_joined(void)
+{
+	return s_joined;
+}
+
+bool esp_zb_bdb_is_factory_new(void)
+{
+	return !s_commissioned;
+}
+
+esp_err_t esp_zb_nvram_erase_at_start(bool erase)
+{
+	if (erase)
+	{
+		s_commissioned = false;
+		s_joined = false;
+	}
+	return ESP_OK;
+}
+
+void esp_zb_get_extended_pan_id(esp_zb_ieee_addr_t ext_pan_id)
+{
+	memcpy(ext_pan_id, s_network_extended_pan_id, sizeof(s_network_extended_pan_id));
+}
+
+void esp_zb_set_extended_pan_id(const esp_zb_ieee_addr_t ext_pan_id)
+{
+	memcpy(s_use_extended_pan_id, ext_pan_id, sizeof(s_use_extended_pan_id));
+}
+
+uint16_t esp_zb_get_pan_id(void)
+{
+	return s_joined ? 0x1a62 : 0xffff;
+}
+
+uint8_t esp_zb_get_current_channel(void)
+{
+	return s_joined ? ZB_NETWORK_CHANNEL : 0;
+}
+
+uint16_t esp_zb_get_short_address(void)
+{
+	return s_joined ? 0x4c2e : 0xfffe;
+}
+
+const char *esp_zb_zdo_signal_to_string(esp_zb_app_signal_type_t signal)
+{
+	switch (signal)
+	{
+		case ESP_ZB_ZDO_SIGNAL_DEFAULT_START:
+			return "ZDO_SIGNAL_DEFAULT_START";
+		case ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP:
+			return "ZDO_SIGNAL_SKIP_STARTUP";
+		case ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE:
+			return "ZDO_SIGNAL_DEVICE_ANNCE";
+		case ESP_ZB_ZDO_SIGNAL_LEAVE:
+			return "ZDO_SIGNAL_LEAVE";
+		case ESP_ZB_ZDO_SIGNAL_ERROR:
+			return "ZDO_SIGNAL_ERROR";
+		case ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START:
+			return "BDB_SIGNAL_DEVICE_FIRST_START";
+		case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT:
+			return "BDB_SIGNAL_DEVICE_REBOOT";
+		case ESP_ZB_BDB_SIGNAL_STEERING:
+			return "BDB_SIGNAL_STEERING";
+		case ESP_ZB_BDB_SIGNAL_FORMATION:
+			return "BDB_SIGNAL_FORMATION";
+		default:
+			return "UNKNOWN";
+	}
+}
+
+void esp_zb_scheduler_alarm(esp_zb_callback_t cb, uint8_t param, uint32_t time)
+{
+	zb_event_t *event = event_add(ZB_EVENT_ALARM, (int64_t) time * 1000);
+	event->cb = cb;
+	event->param = param;
+}
+
+void esp_zb_scheduler_alarm_cancel(esp_zb_callback_t cb, uint8_t param)
+{
+	for (int i = 0; i < ZB_MAX_EVENTS; i++)
+	{
+		if (s_events[i].used && s_events[i].type == ZB_EVENT_ALARM && s_events[i].cb == cb &&
+			s_events[i].param == param)
+		{
+			s_events[i].used = false;
+		}
+	}
+}
+
+bool esp_zb_lock_acquire(TickType_t block_ticks)
+{
+	return true;
+}
+
+void esp_zb_lock_release(void)
+{
+}
+
+/* Numeric attributes report once they moved by the delta from the last report, others on any change */
+static bool report_change_reached(const zb_attr_t *attr)
+{
+	uint8_t type = attr->desc.type;
+	if (!attr->reported_valid || attr->delta <= 0 || type == ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING ||
+		type == ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING)
+	{
+		return true;
+	}
+	return fabs(numeric_value(type, attr->value) - numeric_value(type, attr->reported)) >= attr->delta;
+}
+
+static double report_delta(uint8_t type, const esp_zb_zcl_attr_var_t *delta)
+{
+	switch (type)
+	{
+		case ESP_ZB_ZCL_ATTR_TYPE_U8:
+			return delta->u8;
+		case ESP_ZB_ZCL_ATTR_TYPE_S8:
+			return delta->s8;
+		case ESP_ZB_ZCL_ATTR_TYPE_U16:
+			return delta->u16;
+		case ESP_ZB_ZCL_ATTR_TYPE_S16:
+			return delta->s16;
+		case ESP_ZB_ZCL_ATTR_TYPE_U32:
+			return delta->u32;
+		case ESP_ZB_ZCL_ATTR_TYPE_S32:
+			return delta->s32;
+		case ESP_ZB_ZCL_ATTR_TYPE_SINGLE:
+		{
+			float value;
+			memcpy(&value, delta->data_buf, sizeof(value));
+			return value;
+		}
+		default:
+			/* discrete types report every change */
+			return 0;
+	}
+}
+
+esp_zb_zcl_status_t esp_zb_zcl_set_attribute_val(uint8_t endpoint, uint16_t cluster_id, uint8_t cluster_role,
+												 uint16_t attr_id, void *value_p, bool check)
+{
+	zb_attr_t *attr = find_attr(endpoint, cluster_id, cluster_role, attr_id);
+	if (!attr)
+	{
+		return ESP_ZB_ZCL_STATUS_UNSUP_ATTRIB;
+	}
+	/* the stack copies the value through a ZBOSS buffer */
+	sim_heap_alloc(sizeof(zb_attr_t));
+	size_t size = type_size(attr->desc.type, value_p);
+	if (!value_p || size > attr->capacity)
+	{
+		return ESP_ZB_ZCL_STATUS_INVALID_VALUE;
+	}
+	if (attr->metrics)
+	{
+		attr->metrics->writes++;
+	}
+	if (memcmp(attr->value, value_p, size) != 0)
+	{
+		memcpy(attr->value, value_p, size);
+		if (attr->reporting && report_change_reached(attr))
+		{
+			attr->report_pending = true;
+			zb_wake();
+		}
+	}
+	return ESP_ZB_ZCL_STATUS_SUCCESS;
+}
+
+esp_zb_zcl_attr_t *esp_zb_zcl_get_attribute(uint8_t endpoint, uint16_t cluster_id, uint8_t cluster_role,
+											uint16_t attr_id)
+{
+	zb_attr_t *attr = find_attr(endpoint, cluster_id, cluster_role, attr_id);
+	return attr ? &attr->desc : NULL;
+}
+
+esp_err_t esp_zb_zcl_update_reporting_info(esp_zb_zcl_reporting_info_t *report_info)
+{
+	zb_attr_t *attr = find_attr(report_info->ep, report_info->cluster_id, report_info->cluster_role,
+								report_info->attr_id);
+	if (!attr || !(attr->desc.access & ESP_ZB_ZCL_ATTR_ACCESS_REPORTING))
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+	attr->reporting = true;
+	attr->report_pending = true;
+	attr->min_interval = report_info->u.send_info.min_interval;
+	attr->max_interval = report_info->u.send_info.max_interval;
+	attr->delta = report_delta(attr->desc.type, &report_info->u.send_info.delta);
+	attr->last_report_us = -(int64_t) attr->min_interval * SIM_US_PER_S;
+	attr->metrics = sim_metrics_attr(attr->cluster, attr->desc.id);
+	return ESP_OK;
+}
+
+/* Marks as the firmware holds them, false before the pump cluster exists */
+static bool pump_marks(uint8_t *mode, float *high_cm, float *low_cm)
+{
+	zb_attr_t *mode_attr = find_attr(1, ZB_TANK_CLUSTER_ID, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ZB_PUMP_MODE_ID);
+	zb_attr_t *high = find_attr(1, ZB_TANK_CLUSTER_ID, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ZB_PUMP_HIGH_MARK_ID);
+	zb_attr_t *low = find_attr(1, ZB_TANK_CLUSTER_ID, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ZB_PUMP_LOW_MARK_ID);
+	if (!mode_attr || !high || !low)
+	{
+		return false;
+	}
+	*mode = mode_attr->value[0];
+	*high_cm = (float) numeric_value(high->desc.type, high->value) / 10.0f;
+	*low_cm = (float) numeric_value(low->desc.type, low->value) / 10.0f;
+	return true;
+}
+
+/* Time the level passed the mark between two probes, the world is linear in between */
+static int64_t crossing_us(int64_t t0_us, float d0_cm, int64_t t1_us, float d1_cm, float mark_cm)
+{
+	return t0_us + (int64_t) ((double) (t1_us - t0_us) * (mark_cm - d0_cm) / (d1_cm - d0_cm));
+}
+
+/* Negative when the command went out before the true level got there, the firmware compares
+ * the rounded filtered distance */
+static void on_off_latency(int64_t latency_us)
+{
+	if (latency_us > ZB_PUMP_PAIR_US || latency_us < -ZB_PUMP_PAIR_US)
+	{
+		return;
+	}
+	if (!sim_metrics.on_off_timed || latency_us < sim_metrics.on_off_latency_min_us)
+	{
+		sim_metrics.on_off_latency_min_us = latency_us;
+	}
+	if (!sim_metrics.on_off_timed || latency_us > sim_metrics.on_off_latency_max_us)
+	{
+		sim_metrics.on_off_latency_max_us = latency_us;
+	}
+	sim_metrics.on_off_timed++;
+	sim_metrics.on_off_latency_sum_us += latency_us;
+}
+
+/* Pairs a crossing of mark 0 (high) or 1 (low) with an earlier command, or keeps it for the next */
+static void mark_crossed(int mark, int64_t t_us)
+{
+	if (s_commanded_us[mark] >= 0)
+	{
+		on_off_latency(s_commanded_us[mark] - t_us);
+		s_commanded_us[mark] = -1;
+	} else
+	{
+		s_crossed_us[mark] = t_us;
+	}
+}
+
+void sim_zigbee_level(int64_t t_us, float distance_cm)
+{
+	uint8_t mode;
+	float high_cm;
+	float low_cm;
+	if (s_level_us >= 0 && pump_marks(&mode, &high_cm, &low_cm))
+	{
+		if (s_level_cm > high_cm && distance_cm <= high_cm)
+		{
+			mark_crossed(0, crossing_us(s_level_us, s_level_cm, t_us, distance_cm, high_cm));
+		} else if (s_level_cm <= high_cm && distance_cm > high_cm)
+		{
+			/* back out before the command, nothing to time */
+			s_crossed_us[0] = -1;
+		}
+		if (s_level_cm < low_cm && distance_cm >= low_cm)
+		{
+			mark_crossed(1, crossing_us(s_level_us, s_level_cm, t_us, distance_cm, low_cm));
+		} else if (s_level_cm >= low_cm && distance_cm < low_cm)
+		{
+			s_crossed_us[1] = -1;
+		}
+	}
+	s_level_us = t_us;
+	s_level_cm = distance_cm;
+}
+
+/* Bound relays are not modelled, only whether the command could leave the device and how far
+ * from the true level crossing the mark it did */
+uint8_t esp_zb_zcl_on_off_cmd_req(esp_zb_zcl_on_off_cmd_t *cmd_req)
+{
+	static uint8_t tsn;
+	sim_heap_alloc(sizeof(*cmd_req));
+	if (!s_joined)
+	{
+		sim_metrics.on_off_dropped++;
+		return tsn++;
+	}
+	sim_metrics.on_off_commands++;
+	uint8_t mode;
+	float high_cm;
+	float low_cm;
+	if (!pump_marks(&mode, &high_cm, &low_cm))
+	{
+		return tsn++;
+	}
+	/* drain switches on past the high mark and off past the low one, fill the other way round */
+	bool on = cmd_req->on_off_cmd_id == ESP_ZB_ZCL_CMD_ON_OFF_ON_ID;
+	int mark = (mode == ZB_PUMP_MODE_DRAIN) == on ? 0 : 1;
+	int64_t now = sim_now_us();
+	if (s_crossed_us[mark] >= 0)
+	{
+		on_off_latency(now - s_crossed_us[mark]);
+		s_crossed_us[mark] = -1;
+	} else
+	{
+		s_commanded_us[mark] = now;
+	}
+	return tsn++;
+}
+
+/* Only the Alarm command and the Get Alarm response of the Alarms cluster are understood, both
+ * to the coordinator, which is bound to the cluster. Lost while it is down */
+uint8_t esp_zb_zcl_custom_cluster_cmd_req(esp_zb_zcl_custom_cluster_cmd_t *cmd_req)
+{
+	static uint8_t tsn;
+	sim_heap_alloc(sizeof(*cmd_req) + cmd_req->data.size);
+	const uint8_t *payload = cmd_req->data.value;
+	bool alarm = cmd_req->custom_cmd_id == 0x00 && cmd_req->data.size >= 3 &&
+				 cmd_req->address_mode == ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
+	bool get_alarm_response = cmd_req->custom_cmd_id == 0x01 && cmd_req->data.size >= 1 &&
+							  cmd_req->address_mode == ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT &&
+							  cmd_req->zcl_basic_cmd.dst_addr_u.addr_short == 0x0000;
+	if (cmd_req->cluster_id != ESP_ZB_ZCL_CLUSTER_ID_ALARMS ||
+		cmd_req->direction != ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI || (!alarm && !get_alarm_response))
+	{
+		fprintf(stderr, "sim: custom command 0x%02x to 0x%04x not modelled\n", cmd_req->custom_cmd_id,
+				cmd_req->cluster_id);
+		return tsn++;
+	}
+	sim_world_t world;
+	sim_world_at(sim_now_us(), &world);
+	if (!s_joined || !world.coordinator_up)
+	{
+		return tsn++;
+	}
+	if (get_alarm_response)
+	{
+		if (payload[0] == ESP_ZB_ZCL_STATUS_SUCCESS && cmd_req->data.size >= 8)
+		{
+			sim_metrics.alarm_log[payload[1] < 4 ? payload[1] : 0]++;
+		} else
+		{
+			sim_metrics.alarm_log_empty++;
+		}
+		return tsn++;
+	}
+	uint8_t code = payload[0] < 4 ? payload[0] : 0;
+	if (!sim_metrics.alarms[code])
+	{
+		sim_metrics.alarm_first_us[code] = sim_now_us();
+	}
+	sim_metrics.alarms[code]++;
+	return tsn++;
+}
+
+bool sim_zigbee_reported_float(uint16_t cluster, uint16_t attr_id, float *value)
+{
+	for (int i = 0; i < s_attr_count; i++)
+	{
+		zb_attr_t *attr = &s_attrs[i];
+		if (attr->cluster == cluster && attr->desc.id == attr_id && attr->reported_valid)
+		{
+			*value = (float) numeric_value(attr->desc.type, attr->reported);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* The coordinator asked the device to leave, the app erases the network and steers again */
+void sim_zigbee_leave(void)
+{
+	if (!s_joined)
+	{
+		return;
+	}
+	s_joined = false;
+	s_left_us = sim_now_us();
+	signal_add(ESP_ZB_ZDO_SIGNAL_LEAVE, ESP_OK, 0);
+}
+
+void sim_zigbee_command(uint16_t cluster, uint8_t cmd_id, const uint8_t *payload, uint16_t size)
+{
+	if (size > ZB_ATTR_VALUE_SIZE || size > sizeof(s_raw_payload))
+	{
+		return;
+	}
+	zb_event_t *event = event_add(ZB_EVENT_COMMAND, 0);
+	event->cluster = cluster;
+	event->param = cmd_id;
+	if (size)
+	{
+		memcpy(event->data, payload, size);
+	}
+	event->size = size;
+}
+
+void sim_zigbee_remote_write(uint16_t cluster, uint16_t attr_id, const void *value, uint16_t size)
+{
+	if (size > ZB_ATTR_VALUE_SIZE)
+	{
+		return;
+	}
+	zb_event_t *event = event_add(ZB_EVENT_WRITE, 0);
+	event->cluster = cluster;
+	event->attr = attr_id;
+	memcpy(event->data, value, size);
+	event->size = size;
+}
+
+static void remote_write(const zb_event_t *event)
+{
+	zb_attr_t *attr = NULL;
+	for (int i = 0; i < s_attr_count && !attr; i++)
+	{
+		if (s_attrs[i].cluster == event->cluster && s_attrs[i].role == ESP_ZB_ZCL_CLUSTER_SERVER_ROLE &&
+			s_attrs[i].desc.id == event->attr)
+		{
+			attr = &s_attrs[i];
+		}
+	}
+	if (!attr || type_size(attr->desc.type, event->data) != event->size || event->size > attr->capacity)
+	{
+		fprintf(stderr, "sim: remote write to 0x%04x/0x%04x rejected\n", event->cluster, event->attr);
+		return;
+	}
+	memcpy(attr->value, event->data, event->size);
+	if (attr->reporting && report_change_reached(attr))
+	{
+		attr->report_pending = true;
+	}
+	esp_zb_zcl_set_attr_value_message_t message = {
+			.info = {
+					.status = ESP_ZB_ZCL_STATUS_SUCCESS,
+					.dst_endpoint = attr->endpoint,
+					.cluster = attr->cluster,
+			},
+			.attribute = {
+					.id = attr->desc.id,
+					.data = {
+							.type = attr->desc.type,
+							.size = event->size,
+							.value = attr->value,
+					},
+			},
+	};
+	if (s_action_handler)
+	{
+		s_action_handler(ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID, &message);
+	}
+}
+
+void sim_zigbee_scene(sim_scene_op_t op, uint16_t group_id, uint8_t scene_id, const sim_scene_fields_t *fields)
+{
+	zb_event_t *event = event_add(ZB_EVENT_SCENE, 0);
+	event->scene_op = op;
+	event->group_id = group_id;
+	event->scene_id = scene_id;
+	event->scene_fields = *fields;
+}
+
+static zb_scene_t *scene_slot(uint16_t group_id, uint8_t scene_id, bool create)
+{
+	zb_scene_t *free_slot = NULL;
+	for (int i = 0; i < ZB_MAX_SCENES; i++)
+	{
+		zb_scene_t *scene = &s_scenes[i];
+		if (scene->used && scene->group_id == group_id && scene->scene_id == scene_id)
+		{
+			return scene;
+		}
+		if (!scene->used && !free_slot)
+		{
+			free_slot = scene;
+		}
+	}
+	if (create && free_slot)
+	{
+		free_slot->used = true;
+		free_slot->group_id = group_id;
+		free_slot->scene_id = scene_id;
+	}
+	return create ? free_slot : NULL;
+}
+
+static void *light_value(uint16_t cluster, uint16_t attr_id)
+{
+	zb_attr_t *attr = find_attr(1, cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, attr_id);
+	return attr ? attr->value : NULL;
+}
+
+/* The stack keeps SceneCount in line with its own table */
+static void scene_count_update(void)
+{
+	uint8_t count = 0;
+	for (int i = 0; i < ZB_MAX_SCENES; i++)
+	{
+		count += s_scenes[i].used;
+	}
+	esp_zb_zcl_set_attribute_val(1, ESP_ZB_ZCL_CLUSTER_ID_SCENES, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+								 ESP_ZB_ZCL_ATTR_SCENES_SCENE_COUNT_ID, &count, false);
+}
+
+/* Color Control extension field set, the color loop left inactive */
+static void scene_color_field(const sim_scene_fields_t *fields, uint8_t color[SIM_SCENE_COLOR_FIELD_SIZE])
+{
+	const uint8_t value[SIM_SCENE_COLOR_FIELD_SIZE] = {
+			(uint8_t) fields->color_x, (uint8_t) (fields->color_x >> 8),
+			(uint8_t) fields->color_y, (uint8_t) (fields->color_y >> 8),
+			(uint8_t) fields->enhanced_hue, (uint8_t) (fields->enhanced_hue >> 8),
+			fields->saturation, 0, 0, 0, 0,
+			(uint8_t) fields->color_temperature, (uint8_t) (fields->color_temperature >> 8),
+	};
+	memcpy(color, value, sizeof(value));
+}
+
+/* Offered to the raw handler first like the stack does, true when the application took it over */
+static bool scene_raw_command(const zb_event_t *event)
+{
+	uint8_t *payload = s_raw_payload;
+	*payload++ = (uint8_t) event->group_id;
+	*payload++ = (uint8_t) (event->group_id >> 8);
+	uint8_t cmd_id = ESP_ZB_ZCL_CMD_SCENES_REMOVE_ALL_SCENES;
+	if (event->scene_op != SIM_SCENE_REMOVE_ALL)
+	{
+		cmd_id = event->scene_op == SIM_SCENE_ADD ? ESP_ZB_ZCL_CMD_SCENES_ADD_SCENE
+												  : ESP_ZB_ZCL_CMD_SCENES_REMOVE_SCENE;
+		*payload++ = event->scene_id;
+	}
+	if (event->scene_op == SIM_SCENE_ADD)
+	{
+		/* transition time, empty name, then the on/off, level and color field sets */
+		const uint8_t header[] = {0, 0, 0, 0x06, 0x00, 1, event->scene_fields.on_off, 0x08, 0x00, 1,
+								  event->scene_fields.level, 0x00, 0x03, SIM_SCENE_COLOR_FIELD_SIZE};
+		memcpy(payload, header, sizeof(header));
+		payload += sizeof(header);
+		scene_color_field(&event->scene_fields, payload);
+		payload += SIM_SCENE_COLOR_FIELD_SIZE;
+	}
+	s_raw_length = (zb_uint_t) (payload - s_raw_payload);
+	s_raw_header = (zb_zcl_parsed_hdr_t) {
+			.addr_data.common_data = {.source = 0x0000, .dst_addr = esp_zb_get_short_address(), .src_endpoint = 1, .dst_endpoint = 1},
+			.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_SCENES,
+			.profile_id = ESP_ZB_AF_HA_PROFILE_ID,
+			.cmd_id = cmd_id,
+			.cmd_direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV,
+	};
+	return s_raw_handler && s_raw_handler(0);
+}
+
+/* Only what the application handles itself, the stack's clusters are not modelled */
+static void cluster_command(const zb_event_t *event)
+{
+	memcpy(s_raw_payload, event->data, event->size);
+	s_raw_length = event->size;
+	s_raw_header = (zb_zcl_parsed_hdr_t) {
+			.addr_data.common_data = {.source = 0x0000, .dst_addr = esp_zb_get_short_address(), .src_endpoint = 1, .dst_endpoint = 1},
+			.cluster_id = event->cluster,
+			.profile_id = ESP_ZB_AF_HA_PROFILE_ID,
+			.cmd_id = event->param,
+			.cmd_direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV,
+	};
+	if (!s_raw_handler || !s_raw_handler(0))
+	{
+		fprintf(stderr, "sim: command 0x%02x to 0x%04x not modelled\n", event->param, event->cluster);
+	}
+}
+
+static void scene_command(const zb_event_t *event)
+{
+	if (event->scene_op != SIM_SCENE_STORE && event->scene_op != SIM_SCENE_RECALL && scene_raw_command(event))
+	{
+		return;
+	}
+	if (event->scene_op == SIM_SCENE_REMOVE || event->scene_op == SIM_SCENE_REMOVE_ALL)
+	{
+		for (int i = 0; i < ZB_MAX_SCENES; i++)
+		{
+			zb_scene_t *scene = &s_scenes[i];
+			if (scene->used && scene->group_id == event->group_id &&
+				(event->scene_op == SIM_SCENE_REMOVE_ALL || scene->scene_id == event->scene_id))
+			{
+				scene->used = false;
+			}
+		}
+		scene_count_update();
+		return;
+	}
+	zb_scene_t *scene = scene_slot(event->group_id, event->scene_id, event->scene_op != SIM_SCENE_RECALL);
+	if (!scene)
+	{
+		fprintf(stderr, "sim: scene %d of group 0x%04x %s\n", event->scene_id, event->group_id,
+				event->scene_op == SIM_SCENE_RECALL ? "not found" : "table full");
+		return;
+	}
+	esp_zb_device_cb_common_info_t info = {
+			.status = ESP_ZB_ZCL_STATUS_SUCCESS,
+			.dst_endpoint = 1,
+			.cluster = ESP_ZB_ZCL_CLUSTER_ID_SCENES,
+	};
+	if (event->scene_op == SIM_SCENE_ADD)
+	{
+		scene->fields = event->scene_fields;
+		scene_count_update();
+	} else if (event->scene_op == SIM_SCENE_STORE)
+	{
+		const bool *on_off = light_value(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID);
+		const uint8_t *level = light_value(ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+										   ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID);
+		const uint16_t *x = light_value(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_X_ID);
+		const uint16_t *y = light_value(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_Y_ID);
+		const uint16_t *hue = light_value(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+										  ESP_ZB_ZCL_ATTR_COLOR_CONTROL_ENHANCED_CURRENT_HUE_ID);
+		const uint8_t *sat = light_value(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+										 ESP_ZB_ZCL_ATTR_COLOR_CONTROL_CURRENT_SATURATION_ID);
+		const uint16_t *mireds = light_value(ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL,
+											 ESP_ZB_ZCL_ATTR_COLOR_CONTROL_COLOR_TEMPERATURE_ID);
+		scene->fields = (sim_scene_fields_t) {
+				.on_off = on_off && *on_off,
+				.level = level ? *level : 0,
+				.color_x = x ? *x : 0,
+				.color_y = y ? *y : 0,
+				.enhanced_hue = hue ? *hue : 0,
+				.saturation = sat ? *sat : 0,
+				.color_temperature = mireds ? *mireds : 0,
+		};
+		esp_zb_zcl_store_scene_message_t message = {
+				.info = info,
+				.group_id = event->group_id,
+				.scene_id = event->scene_id,
+		};
+		if (s_action_handler)
+		{
+			s_action_handler(ESP_ZB_CORE_SCENES_STORE_SCENE_CB_ID, &message);
+		}
+	} else
+	{
+		uint8_t on_off = scene->fields.on_off;
+		uint8_t level = scene->fields.level;
+		uint8_t color[SIM_SCENE_COLOR_FIELD_SIZE];
+		scene_color_field(&scene->fields, color);
+		esp_zb_zcl_scenes_extension_field_t color_field = {ESP_ZB_ZCL_CLUSTER_ID_COLOR_CONTROL, sizeof(color), color,
+														   NULL};
+		esp_zb_zcl_scenes_extension_field_t level_field = {ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, 1, &level,
+														   &color_field};
+		esp_zb_zcl_scenes_extension_field_t on_off_field = {ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, 1, &on_off, &level_field};
+		esp_zb_zcl_recall_scene_message_t message = {
+				.info = info,
+				.group_id = event->group_id,
+				.scene_id = event->scene_id,
+				.field_set = &on_off_field,
+		};
+		sim_metrics.scene_recalls++;
+		if (s_action_handler)
+		{
+			s_action_handler(ESP_ZB_CORE_SCENES_RECALL_SCENE_CB_ID, &message);
+		}
+	}
+}
+
+static void run_event(zb_event_t *event)
+{
+	esp_zb_app_signal_t signal = {0};
+	uint32_t signal_type;
+	switch (event->type)
+	{
+		case ZB_EVENT_STEERING_DONE:
+			if (event->status == ESP_OK)
+			{
+				s_joined = true;
+				s_commissioned = true;
+				if (sim_metrics.joined_us < 0)
+				{
+					sim_metrics.joined_us = sim_now_us();
+				}
+				if (s_left_us >= 0)
+				{
+					int64_t rejoin_us = sim_now_us() - s_left_us;
+					sim_metrics.rejoins++;
+					sim_metrics.rejoin_sum_us += rejoin_us;
+					sim_metrics.rejoin_max_us = rejoin_us > sim_metrics.rejoin_max_us ? rejoin_us
+																					  : sim_metrics.rejoin_max_us;
+					s_left_us = -1;
+				}
+			}
+			event->signal = ESP_ZB_BDB_SIGNAL_STEERING;
+			/* fall through */
+		case ZB_EVENT_SIGNAL:
+			signal_type = event->signal;
+			signal.p_app_signal = &signal_type;
+			signal.esp_err_status = event->status;
+			esp_zb_app_signal_handler(&signal);
+			break;
+		case ZB_EVENT_ALARM:
+			event->cb(event->param);
+			break;
+		case ZB_EVENT_WRITE:
+			remote_write(event);
+			break;
+		case ZB_EVENT_SCENE:
+			scene_command(event);
+			break;
+		case ZB_EVENT_COMMAND:
+			cluster_command(event);
+			break;
+	}
+}
+
+static void send_report(zb_attr_t *attr, int64_t now)
+{
+	sim_world_t world;
+	sim_world_at(now, &world);
+	attr->report_pending = false;
+	attr->last_report_us = now;
+	if (!world.coordinator_up)
+	{
+		attr->metrics->dropped++;
+		return;
+	}
+	attr->metrics->reports++;
+	memcpy(attr->reported, attr->value, type_size(attr->desc.type, attr->value));
+	attr->reported_valid = true;
+}
+
+/* Sends due reports and returns when the next one is due */
+static int64_t run_reports(int64_t now)
+{
+	int64_t next = INT64_MAX;
+	for (int i = 0; i < s_attr_count; i++)
+	{
+		zb_attr_t *attr = &s_attrs[i];
+		if (!attr->reporting)
+		{
+			continue;
+		}
+		int64_t due = INT64_MAX;
+		if (attr->report_pending)
+		{
+			due = attr->last_report_us + (int64_t) attr->min_interval * SIM_US_PER_S;
+		}
+		if (attr->max_interval)
+		{
+			int64_t periodic = attr->last_report_us + (int64_t) attr->max_interval * SIM_US_PER_S;
+			due = periodic < due ? periodic : due;
+		}
+		if (due <= now && s_joined)
+		{
+			send_report(attr, now);
+			due = attr->max_interval ? now + (int64_t) attr->max_interval * SIM_US_PER_S : INT64_MAX;
+		}
+		next = due < next ? due : next;
+	}
+	return s_joined ? next : INT64_MAX;
+}
+
+void esp_zb_stack_main_loop(void)
+{
+	const int64_t tick_us = SIM_US_PER_S / configTICK_RATE_HZ;
+	while (true)
+	{
+		int64_t now = sim_now_us();
+		int64_t next = INT64_MAX;
+		for (int i = 0; i < ZB_MAX_EVENTS; i++)
+		{
+			zb_event_t *event = &s_events[i];
+			if (!event->used)
+			{
+				continue;
+			}
+			if (event->at_us <= now)
+			{
+				/* copy out, the handler may queue new events into this slot */
+				zb_event_t due = *event;
+				event->used = false;
+				run_event(&due);
+				next = now;
+			} else if (event->at_us < next)
+			{
+				next = event->at_us;
+			}
+		}
+		int64_t report = run_reports(now);
+		next = report < next ? report : next;
+		if (next <= now)
+		{
+			continue;
+		}
+		ulTaskNotifyTake(pdTRUE, next == INT64_MAX ? portMAX_DELAY : (TickType_t) ((next - now + tick_us - 1) / tick_us));
+	}
+}
+
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""Decode the diagnostics console sample stream to CSV.
+
+Start the stream with "stream on" on the device console, then read the port
+(pyserial needed) or a capture of it:
+
+    diag_stream.py /dev/ttyACM0 > samples.csv
+    diag_stream.py capture.bin -o samples.csv
+
+Frames are found by their sync bytes and checked by CRC, so console text and log
+lines on the same port are skipped. Gaps in the sequence are frames the device
+dropped and are counted on stderr. The frame layout is documented in
+main/diag_stream.h.
+"""
+
+import argparse
+import csv
+import os
+import stat
+import struct
+import sys
+
+SYNC = b'\xa5\x5a'
+PAYLOAD = struct.Struct('<HIBHHHHH')
+STATUS = ('sample', 'window_miss', 'target_lost', 'ping_error', 'echo_timeout', 'echo_early', 'error')
+NO_DISTANCE = 0xffff
+COLUMNS = ('seq', 'time_ms', 'status', 'echo_us', 'raw_cm', 'filtered_cm', 'window_min_us', 'window_max_us')
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xff if crc & 0x80 else (crc << 1) & 0xff
+    return crc
+
+
+class Decoder:
+    """Splits a byte stream into frames, keeping partial frames for the next chunk."""
+
+    def __init__(self):
+        self.buffer = b''
+        self.last_seq = None
+        self.decoded = 0
+        self.dropped = 0
+
+    def feed(self, chunk):
+        self.buffer += chunk
+        frames = []
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                self.buffer = self.buffer[-1:] if self.buffer.endswith(SYNC[:1]) else b''
+                break
+            self.buffer = self.buffer[start:]
+            if len(self.buffer) < 3:
+                break
+            end = 3 + self.buffer[2] + 1
+            if self.buffer[2] != PAYLOAD.size:
+                self.buffer = self.buffer[1:]
+                continue
+            if len(self.buffer) < end:
+                break
+            if crc8(self.buffer[2:end - 1]) != self.buffer[end - 1]:
+                self.buffer = self.buffer[1:]
+                continue
+            frame = PAYLOAD.unpack_from(self.buffer, 3)
+            self.buffer = self.buffer[end:]
+            if self.last_seq is not None:
+                self.dropped += (frame[0] - self.last_seq - 1) & 0xffff
+            self.last_seq = frame[0]
+            self.decoded += 1
+            frames.append(frame)
+        return frames
+
+
+def csv_row(frame):
+    seq, time_ms, status, echo_us, raw, filtered, window_min, window_max = frame
+    return (seq, time_ms, STATUS[status] if status < len(STATUS) else status, echo_us or '',
+            '' if raw == NO_DISTANCE else raw / 10, '' if filtered == NO_DISTANCE else filtered / 10,
+            window_min, window_max)
+
+
+def open_source(path, baudrate):
+    """Source and its read function, which returns b'' only at the end of a file."""
+    if path == '-':
+        return sys.stdin.buffer.raw, lambda source: source.read(4096)
+    if not stat.S_ISCHR(os.stat(path).st_mode):
+        return open(path, 'rb'), lambda source: source.read(4096)
+    import serial
+    port = serial.Serial(path, baudrate)
+    return port, lambda source: source.read(source.in_waiting or 1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('source', help='serial port, capture file or - for stdin')
+    parser.add_argument('-o', '--output', help='CSV file, stdout by default')
+    parser.add_argument('--baudrate', type=int, default=115200, help='for a UART console, ignored on USB')
+    args = parser.parse_args()
+
+    source, read = open_source(args.source, args.baudrate)
+    output = open(args.output, 'w', newline='') if args.output else sys.stdout
+    writer = csv.writer(output)
+    writer.writerow(COLUMNS)
+    decoder = Decoder()
+    try:
+        while True:
+            chunk = read(source)
+            if not chunk:
+                break
+            writer.writerows(csv_row(frame) for frame in decoder.feed(chunk))
+    except KeyboardInterrupt:
+        pass
+    finally:
+        source.close()
+        if args.output:
+            output.close()
+    print('{} frames, {} dropped on the device'.format(decoder.decoded, decoder.dropped), file=sys.stderr)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Static RAM report per subsystem, parsed from the GNU ld map file.
+
+Every input section placed into a RAM output section (DRAM data/bss, IRAM code,
+no-init and RTC memory) is attributed to the object it came from. Objects of the
+main component are reported one per source file, everything else per library.
+
+    mem_budget.py build/depth_sensor.map --limit app=16384 --limit warm_start=512
+
+Limits name a subsystem (source file stem or library name without the lib prefix),
+"app" for the whole main component or "total" for the whole image. The script
+exits with status 1 when any of them is exceeded.
+"""
+
+import argparse
+import collections
+import re
+import sys
+
+RAM_OUTPUT_SECTIONS = ('.dram0', '.iram0', '.noinit', '.rtc', '.data', '.bss', '.sdata', '.sbss')
+APP_LIBRARY = 'libmain.a'
+
+OUTPUT_SECTION_RE = re.compile(r'^(\.[\w.]+)(\s+0x[0-9a-f]+\s+0x[0-9a-f]+)?\s*$')
+INPUT_SECTION_RE = re.compile(r'^ (?:[\w.*]+|COMMON)?\s*0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+)\s*$')
+PENDING_NAME_RE = re.compile(r'^ ([\w.]+|COMMON)\s*$')
+OBJECT_RE = re.compile(r'(?:.*/)?(lib[\w\-+]+\.a)\((.+?)(?:\.c|\.cpp|\.S)?\.obj\)$')
+
+
+def subsystem_of(obj):
+    match = OBJECT_RE.match(obj)
+    if not match:
+        return None, obj.rsplit('/', 1)[-1]
+    library, source = match.groups()
+    if library == APP_LIBRARY:
+        return True, source
+    return False, library[3:-2]
+
+
+def parse(map_path):
+    sizes = collections.Counter()
+    app_subsystems = set()
+    in_memory_map = False
+    in_ram = False
+    with open(map_path, encoding='utf-8', errors='replace') as map_file:
+        for line in map_file:
+            line = line.rstrip('\n')
+            if not in_memory_map:
+                in_memory_map = line.startswith('Linker script and memory map')
+                continue
+            output = OUTPUT_SECTION_RE.match(line)
+            if output:
+                in_ram = output.group(1).startswith(RAM_OUTPUT_SECTIONS)
+                continue
+            if not in_ram:
+                continue
+            if PENDING_NAME_RE.match(line):
+                # long input section names put address and size on the next line
+                continue
+            section = INPUT_SECTION_RE.match(line)
+            if not section:
+                continue
+            address, size, obj = int(section.group(1), 16), int(section.group(2), 16), section.group(3)
+            if address == 0 or size == 0:
+                continue
+            is_app, name = subsystem_of(obj)
+            sizes[name] += size
+            if is_app:
+                app_subsystems.add(name)
+    return sizes, app_subsystems
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('map', help='linker map file')
+    parser.add_argument('--limit', action='append', default=[], metavar='NAME=BYTES',
+                        help='fail when NAME uses more than BYTES of static RAM')
+    parser.add_argument('--top', type=int, default=10, help='number of other libraries to list')
+    args = parser.parse_args()
+
+    sizes, app_subsystems = parse(args.map)
+    app_total = sum(sizes[name] for name in app_subsystems)
+    totals = dict(sizes, app=app_total, total=sum(sizes.values()))
+
+    print('Static RAM per subsystem')
+    for name in sorted(app_subsystems, key=lambda n: -sizes[n]):
+        print('  {:<24} {:>8} B'.format(name, sizes[name]))
+    print('  {:<24} {:>8} B'.format('app', app_total))
+    others = [name for name in sizes if name not in app_subsystems]
+    for name in sorted(others, key=lambda n: -sizes[n])[:args.top]:
+        print('  {:<24} {:>8} B'.format(name, sizes[name]))
+    print('  {:<24} {:>8} B'.format('total', totals['total']))
+
+    failed = False
+    for limit in args.limit:
+        name, _, value = limit.partition('=')
+        budget = int(value, 0)
+        if budget <= 0:
+            continue
+        used = totals.get(name, 0)
+        if used > budget:
+            print('error: {} uses {} B of static RAM, budget is {} B'.format(name, used, budget), file=sys.stderr)
+            failed = True
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,22 +1,274 @@
-const {identify, numeric, temperature, light} = require('zigbee-herdsman-converters/lib/modernExtend');
+const {Zcl} = require('zigbee-herdsman');
+const {identify, numeric, enumLookup, temperature, light, deviceAddCustomCluster} = require('zigbee-herdsman-converters/lib/modernExtend');
+const exposes = require('zigbee-herdsman-converters/lib/exposes');
+
+const e = exposes.presets;
+const ea = exposes.access;
+
+const TANK_PROFILE_MAX_POINTS = 32;
+const TANK_PROFILE_POINT_SIZE = 6;
+
+/* Tank profile as JSON [[distance_cm, volume_l], ...], distances increasing.
+ * Encoded as u8 count + that many points of u16 distance (mm) and u32 volume (dl). */
+const tzTankProfile = {
+    key: ['tank_profile'],
+    convertSet: async (entity, key, value, meta) => {
+        const points = typeof value === 'string' ? JSON.parse(value) : value;
+        if (!Array.isArray(points) || points.length === 1 || points.length > TANK_PROFILE_MAX_POINTS) {
+            throw new Error(`tank_profile needs 0 or 2..${TANK_PROFILE_MAX_POINTS} points`);
+        }
+        const buffer = Buffer.alloc(1 + points.length * TANK_PROFILE_POINT_SIZE);
+        buffer.writeUInt8(points.length, 0);
+        points.forEach(([distance, volume], i) => {
+            buffer.writeUInt16LE(Math.round(distance * 10), 1 + i * TANK_PROFILE_POINT_SIZE);
+            buffer.writeUInt32LE(Math.round(volume * 10), 3 + i * TANK_PROFILE_POINT_SIZE);
+        });
+        await entity.write('acTank', {tankProfile: buffer});
+        return {state: {tank_profile: JSON.stringify(points)}};
+    },
+};
+
+const LED_RULES_MAX = 8;
+const LED_RULES_RULE_SIZE = 11;
+const LED_RULE_SOURCES = ['distance', 'temperature'];
+const LED_RULE_OPS = ['above', 'below'];
+
+/* LED rules as JSON [{source, op, threshold, hysteresis, color: [r, g, b], level, blink_ms}, ...],
+ * the first active rule drives the light. Encoded as u8 count + fixed 8 rules, see led_rules.h. */
+const tzLedRules = {
+    key: ['led_rules'],
+    convertSet: async (entity, key, value, meta) => {
+        const rules = typeof value === 'string' ? JSON.parse(value) : value;
+        if (!Array.isArray(rules) || rules.length > LED_RULES_MAX) {
+            throw new Error(`led_rules needs at most ${LED_RULES_MAX} rules`);
+        }
+        const buffer = Buffer.alloc(1 + LED_RULES_MAX * LED_RULES_RULE_SIZE);
+        buffer.writeUInt8(rules.length, 0);
+        rules.forEach((rule, i) => {
+            const offset = 1 + i * LED_RULES_RULE_SIZE;
+            const source = LED_RULE_SOURCES.indexOf(rule.source);
+            const op = LED_RULE_OPS.indexOf(rule.op);
+            if (source < 0 || op < 0) {
+                throw new Error(`led_rules source is one of ${LED_RULE_SOURCES}, op one of ${LED_RULE_OPS}`);
+            }
+            const [red, green, blue] = rule.color ?? [255, 255, 255];
+            buffer.writeUInt8(source, offset);
+            buffer.writeUInt8(op, offset + 1);
+            buffer.writeInt16LE(Math.round(rule.threshold * 10), offset + 2);
+            buffer.writeUInt16LE(Math.round((rule.hysteresis ?? 0) * 10), offset + 4);
+            buffer.writeUInt8(red, offset + 6);
+            buffer.writeUInt8(green, offset + 7);
+            buffer.writeUInt8(blue, offset + 8);
+            buffer.writeUInt8(rule.level ?? 255, offset + 9);
+            buffer.writeUInt8(Math.round((rule.blink_ms ?? 0) / 100), offset + 10);
+        });
+        await entity.write('acTank', {ledRules: buffer});
+        return {state: {led_rules: JSON.stringify(rules)}};
+    },
+};
+
+const TRACE_MODULES = ['sensor', 'zigbee', 'light'];
+const TRACE_LEVELS = ['none', 'error', 'warn', 'info', 'debug', 'verbose'];
+
+/* Trace levels as JSON {sensor, zigbee, light}, modules left out keep their level.
+ * Encoded as one esp_log_level_t byte per module, not stored across reboots. */
+const tzTraceLevels = {
+    key: ['trace_levels'],
+    convertSet: async (entity, key, value, meta) => {
+        const levels = typeof value === 'string' ? JSON.parse(value) : value;
+        const current = meta.state.trace_levels ? JSON.parse(meta.state.trace_levels) : {};
+        const buffer = Buffer.alloc(TRACE_MODULES.length);
+        const result = {};
+        TRACE_MODULES.forEach((module, i) => {
+            const name = levels[module] ?? current[module] ?? 'info';
+            const level = TRACE_LEVELS.indexOf(name);
+            if (level < 0) {
+                throw new Error(`trace_levels level is one of ${TRACE_LEVELS}`);
+            }
+            buffer.writeUInt8(level, i);
+            result[module] = name;
+        });
+        await entity.write('acTank', {traceLevels: buffer});
+        return {state: {trace_levels: JSON.stringify(result)}};
+    },
+};
+
+const TANK_ALARM_CODES = {1: 'leak', 2: 'rapid_drain', 3: 'overflow'};
+
+/* Alarm command of the Alarms cluster, sent with the tank cluster ID when an alarm is raised */
+const fzTankAlarm = {
+    cluster: 'genAlarms',
+    type: ['commandAlarm'],
+    convert: (model, msg, publish, options, meta) => {
+        if (msg.data.clusterid !== 0xfc00) return;
+        return {alarm: TANK_ALARM_CODES[msg.data.alarmcode] ?? `unknown_${msg.data.alarmcode}`};
+    },
+};
+
+/* Active alarms bitmap, bit n is alarm code n + 1 */
+const fzTankAlarmState = {
+    cluster: 'acTank',
+    type: ['attributeReport', 'readResponse'],
+    convert: (model, msg, publish, options, meta) => {
+        if (msg.data.alarms === undefined) return;
+        const result = {};
+        for (const [code, name] of Object.entries(TANK_ALARM_CODES)) {
+            result[name] = (msg.data.alarms & (1 << (code - 1))) !== 0;
+        }
+        return result;
+    },
+};
+
+/* Reset All Alarms, the alarms still active are raised again by the next measurements */
+const tzResetAlarms = {
+    key: ['reset_alarms'],
+    convertSet: async (entity, key, value, meta) => {
+        await entity.command('genAlarms', 'resetAll', {});
+    },
+};
 
 const definition = {
     zigbeeModel: ['Depth.Sensor'],
     model: 'Depth.Sensor',
     vendor: 'Acheta',
     description: 'Automatically generated definition',
-    extend: [identify(), light({"color": true, "effect": false, "powerOnBehavior": false}), temperature(), numeric({
-        name: 'depth',
-        cluster: 'genAnalogOutput',
-        attribute: 'presentValue',
-        reporting: {min: '10_SECONDS', max: '1_HOUR', change: 1},
-        description: 'Measure distance from sensor',
-        unit: 'cm',
-        valueMin: 20,
-        valueMax: 600,
-        access: 'STATE_GET',
-    })],
+    extend: [
+        deviceAddCustomCluster('acTank', {
+            ID: 0xfc00,
+            manufacturerCode: 0x131b,
+            attributes: {
+                volume: {ID: 0x0000, type: Zcl.DataType.SINGLE_PREC},
+                percentFull: {ID: 0x0001, type: Zcl.DataType.UINT8},
+                tankProfile: {ID: 0x0002, type: Zcl.DataType.OCTET_STR},
+                ledRules: {ID: 0x0003, type: Zcl.DataType.OCTET_STR},
+                pumpMode: {ID: 0x0004, type: Zcl.DataType.ENUM8},
+                pumpHighMark: {ID: 0x0005, type: Zcl.DataType.UINT16},
+                pumpLowMark: {ID: 0x0006, type: Zcl.DataType.UINT16},
+                leakRate: {ID: 0x0007, type: Zcl.DataType.UINT16},
+                drainRate: {ID: 0x0008, type: Zcl.DataType.UINT16},
+                overflowMark: {ID: 0x0009, type: Zcl.DataType.UINT16},
+                alarms: {ID: 0x000a, type: Zcl.DataType.BITMAP8},
+                traceLevels: {ID: 0x000b, type: Zcl.DataType.OCTET_STR},
+            },
+            commands: {},
+            commandsResponse: {},
+        }),
+        identify(), light({
+            "color": {"modes": ["xy", "hs"], "enhancedHue": true},
+            "colorTemp": {"range": [153, 500]},
+            "effect": false,
+            "powerOnBehavior": false,
+        }), temperature(), numeric({
+            name: 'depth',
+            cluster: 'genAnalogOutput',
+            attribute: 'presentValue',
+            reporting: {min: '10_SECONDS', max: '1_HOUR', change: 1},
+            description: 'Measure distance from sensor',
+            unit: 'cm',
+            valueMin: 20,
+            valueMax: 600,
+            access: 'STATE_GET',
+        }), numeric({
+            name: 'volume',
+            cluster: 'acTank',
+            attribute: 'volume',
+            reporting: {min: '10_SECONDS', max: '1_HOUR', change: 1},
+            description: 'Volume at the current level, needs a tank profile',
+            unit: 'L',
+            access: 'STATE_GET',
+        }), numeric({
+            name: 'percent_full',
+            cluster: 'acTank',
+            attribute: 'percentFull',
+            reporting: {min: '10_SECONDS', max: '1_HOUR', change: 1},
+            description: 'Volume relative to the full tank, needs a tank profile',
+            unit: '%',
+            valueMin: 0,
+            valueMax: 100,
+            access: 'STATE_GET',
+        }), enumLookup({
+            name: 'pump_mode',
+            cluster: 'acTank',
+            attribute: 'pumpMode',
+            lookup: {disabled: 0, drain: 1, fill: 2},
+            description: 'On/Off commands to bound pump relays: drain switches on at the high mark, fill at the low one',
+            access: 'ALL',
+        }), numeric({
+            name: 'pump_high_mark',
+            cluster: 'acTank',
+            attribute: 'pumpHighMark',
+            description: 'Distance from the sensor of the high water mark, set it below the low mark',
+            unit: 'cm',
+            scale: 10,
+            valueMin: 0,
+            valueMax: 600,
+            valueStep: 0.1,
+            access: 'ALL',
+        }), numeric({
+            name: 'pump_low_mark',
+            cluster: 'acTank',
+            attribute: 'pumpLowMark',
+            description: 'Distance from the sensor of the low water mark',
+            unit: 'cm',
+            scale: 10,
+            valueMin: 0,
+            valueMax: 600,
+            valueStep: 0.1,
+            access: 'ALL',
+        }), numeric({
+            name: 'leak_rate',
+            cluster: 'acTank',
+            attribute: 'leakRate',
+            description: 'Smallest steady fall raising the leak alarm, falls 4 times faster count as draws, 0 disables it',
+            unit: 'mm/h',
+            scale: 10,
+            valueMin: 0,
+            valueMax: 100,
+            valueStep: 0.1,
+            access: 'ALL',
+        }), numeric({
+            name: 'drain_rate',
+            cluster: 'acTank',
+            attribute: 'drainRate',
+            description: 'Fall raising the rapid drain alarm, 0 disables it',
+            unit: 'mm/min',
+            valueMin: 0,
+            valueMax: 1000,
+            access: 'ALL',
+        }), numeric({
+            name: 'overflow_mark',
+            cluster: 'acTank',
+            attribute: 'overflowMark',
+            description: 'Distance from the sensor where the tank overflows, 0 disables the overflow alarm',
+            unit: 'cm',
+            scale: 10,
+            valueMin: 0,
+            valueMax: 600,
+            valueStep: 0.1,
+            access: 'ALL',
+        })],
+    fromZigbee: [fzTankAlarm, fzTankAlarmState],
+    toZigbee: [tzTankProfile, tzLedRules, tzTraceLevels, tzResetAlarms],
+    configure: async (device, coordinatorEndpoint) => {
+        /* the Alarm commands go through the binding table */
+        await device.getEndpoint(1).bind('genAlarms', coordinatorEndpoint);
+    },
+    exposes: [
+        e.text('tank_profile', ea.SET)
+            .withDescription('Distance to volume table as JSON [[distance_cm, volume_l], ...], distances increasing'),
+        e.text('led_rules', ea.SET)
+            .withDescription('Light rules as JSON [{source: distance|temperature, op: above|below, threshold, ' +
+                'hysteresis, color: [r, g, b], level, blink_ms}, ...], the first active rule drives the light'),
+        e.text('trace_levels', ea.SET)
+            .withDescription('Log levels as JSON {sensor, zigbee, light}, each none|error|warn|info|debug|verbose, ' +
+                'reset on reboot'),
+        e.enum('reset_alarms', ea.SET, ['reset']).withDescription('Clear the alarms, active ones are raised again'),
+        e.enum('alarm', ea.STATE, Object.values(TANK_ALARM_CODES)).withDescription('Last alarm raised by the tank'),
+        e.binary('leak', ea.STATE, true, false).withDescription('Level keeps falling by at least the leak rate'),
+        e.binary('rapid_drain', ea.STATE, true, false).withDescription('Level falls faster than the drain rate'),
+        e.binary('overflow', ea.STATE, true, false).withDescription('Level reaches the overflow mark within 10 minutes'),
+    ],
     meta: {},
 };
 
-module.exports = definition;
\ No newline at end of file
+module.exports = definition;